@@ -186,6 +186,43 @@ void AsmHelper32::SaveRetValAndSignalEvent(
     _assembler.call( asmjit::host::eax );
 }
 
+/// <summary>
+/// Save return value and last status, then raise completion flag
+/// </summary>
+/// <param name="ResultPtr">Result value memory location</param>
+/// <param name="flagPtr">Completion flag memory location</param>
+/// <param name="errPtr">Error code memory location</param>
+/// <param name="rtype">Return type</param>
+void AsmHelper32::SaveRetValAndSetFlag(
+    uintptr_t ResultPtr,
+    uintptr_t flagPtr,
+    uintptr_t errPtr,
+    eReturnType rtype /*= rt_int32*/
+    )
+{
+    _assembler.mov( asmjit::host::ecx, ResultPtr );
+
+    // Return 64bit value in edx:eax
+    if (rtype == rt_int64)
+    {
+        _assembler.mov( asmjit::host::dword_ptr( asmjit::host::ecx ), asmjit::host::eax );
+        _assembler.mov( asmjit::host::dword_ptr( asmjit::host::ecx, 4 ), asmjit::host::edx );
+    }
+    else if (rtype == rt_int32)
+        _assembler.mov( asmjit::host::dword_ptr( asmjit::host::ecx ), asmjit::host::eax );
+
+    // Save last NT status
+    SetTebPtr();
+    _assembler.add( asmjit::host::edx, LAST_STATUS_OFS );
+    _assembler.mov( asmjit::host::edx, asmjit::host::dword_ptr( asmjit::host::edx ) );
+    _assembler.mov( asmjit::host::eax, errPtr );
+    _assembler.mov( asmjit::host::dword_ptr( asmjit::host::eax ), asmjit::host::edx );
+
+    // Flag is raised last, so result is visible once it is set
+    _assembler.mov( asmjit::host::eax, flagPtr );
+    _assembler.mov( asmjit::host::dword_ptr( asmjit::host::eax ), 1 );
+}
+
 /// <summary>
 /// Push function argument
 /// </summary>
@@ -58,6 +58,20 @@ public:
         eReturnType rtype = rt_int32
         );
 
+    /// <summary>
+    /// Save return value and last status, then raise completion flag
+    /// </summary>
+    /// <param name="ResultPtr">Result value memory location</param>
+    /// <param name="flagPtr">Completion flag memory location</param>
+    /// <param name="errPtr">Error code memory location</param>
+    /// <param name="rtype">Return type</param>
+    virtual void SaveRetValAndSetFlag( 
+        uintptr_t ResultPtr,
+        uintptr_t flagPtr,
+        uintptr_t errPtr,
+        eReturnType rtype = rt_int32
+        );
+
     /// <summary>
     /// Does nothing under x86
     /// </summary>
@@ -159,6 +159,38 @@ void AsmHelper64::SaveRetValAndSignalEvent(
     _assembler.call( asmjit::host::rax );
 }
 
+/// <summary>
+/// Save return value and last status, then raise completion flag
+/// </summary>
+/// <param name="ResultPtr">Result value memory location</param>
+/// <param name="flagPtr">Completion flag memory location</param>
+/// <param name="lastStatusPtr">Error code memory location</param>
+/// <param name="rtype">Return type</param>
+void AsmHelper64::SaveRetValAndSetFlag(
+    uintptr_t ResultPtr,
+    uintptr_t flagPtr,
+    uintptr_t lastStatusPtr,
+    eReturnType rtype /*= rt_int32*/
+    )
+{
+    _assembler.mov( asmjit::host::rcx, ResultPtr );
+
+    // FPU value has been already saved
+    if (rtype == rt_int64 || rtype == rt_int32)
+        _assembler.mov( asmjit::host::qword_ptr( asmjit::host::rcx ), asmjit::host::rax );
+
+    // Save last NT status
+    SetTebPtr();
+    _assembler.add( asmjit::host::rdx, LAST_STATUS_OFS );
+    _assembler.mov( asmjit::host::edx, asmjit::host::dword_ptr( asmjit::host::rdx ) );
+    _assembler.mov( asmjit::host::rax, lastStatusPtr );
+    _assembler.mov( asmjit::host::dword_ptr( asmjit::host::rax ), asmjit::host::edx );
+
+    // Flag is raised last, so result is visible once it is set
+    _assembler.mov( asmjit::host::rax, flagPtr );
+    _assembler.mov( asmjit::host::dword_ptr( asmjit::host::rax ), 1 );
+}
+
 
 /// <summary>
 /// Set stack reservation policy on call generation
@@ -18,6 +18,7 @@ namespace blackbone
         friend class AsmHelper32;
         friend class AsmHelper64;
         friend class RemoteExec;
+        friend class RemoteAgent;
 
         template<typename... Args>
         friend class FuncArguments;
@@ -33,4 +33,9 @@
     #error "Unknown or unsupported platform"
 #endif
 
+// Host OS, selects available memory backends
+#if defined(__linux__)
+    #define OS_LINUX
+#endif
+
 
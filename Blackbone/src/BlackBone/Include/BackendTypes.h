@@ -0,0 +1,129 @@
+#pragma once
+
+//
+// Types used by memory backends. On Windows they come from system headers,
+// elsewhere the subset backends need is defined here, so backend layer builds without Winheaders.h
+//
+
+#include "../Config.h"
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef OS_LINUX
+
+typedef int32_t NTSTATUS;      // 32 bit, like on Windows, so NT_SUCCESS sign check works
+typedef uint32_t DWORD;
+
+#define NT_SUCCESS(Status) (((NTSTATUS)(Status)) >= 0)
+
+typedef struct _MEMORY_BASIC_INFORMATION64
+{
+    uint64_t BaseAddress;
+    uint64_t AllocationBase;
+    DWORD    AllocationProtect;
+    DWORD    __alignment1;
+    uint64_t RegionSize;
+    DWORD    State;
+    DWORD    Protect;
+    DWORD    Type;
+    DWORD    __alignment2;
+} MEMORY_BASIC_INFORMATION64, *PMEMORY_BASIC_INFORMATION64;
+
+// Memory protection
+#define PAGE_NOACCESS           0x01
+#define PAGE_READONLY           0x02
+#define PAGE_READWRITE          0x04
+#define PAGE_WRITECOPY          0x08
+#define PAGE_EXECUTE            0x10
+#define PAGE_EXECUTE_READ       0x20
+#define PAGE_EXECUTE_READWRITE  0x40
+#define PAGE_EXECUTE_WRITECOPY  0x80
+#define PAGE_GUARD              0x100
+
+// Region state, type and allocation/free flags
+#define MEM_COMMIT              0x1000
+#define MEM_RESERVE             0x2000
+#define MEM_DECOMMIT            0x4000
+#define MEM_RELEASE             0x8000
+#define MEM_FREE                0x10000
+#define MEM_PRIVATE             0x20000
+#define MEM_MAPPED              0x40000
+#define MEM_TOP_DOWN            0x100000
+#define MEM_IMAGE               0x1000000
+
+// Status codes
+#define STATUS_SUCCESS                  ((NTSTATUS)0x00000000L)
+#define STATUS_PENDING                  ((NTSTATUS)0x00000103L)
+#define STATUS_PARTIAL_COPY             ((NTSTATUS)0x8000000DL)
+#define STATUS_UNSUCCESSFUL             ((NTSTATUS)0xC0000001L)
+#define STATUS_ACCESS_VIOLATION         ((NTSTATUS)0xC0000005L)
+#define STATUS_INVALID_CID              ((NTSTATUS)0xC000000BL)
+#define STATUS_INVALID_PARAMETER        ((NTSTATUS)0xC000000DL)
+#define STATUS_NO_MEMORY                ((NTSTATUS)0xC0000017L)
+#define STATUS_CONFLICTING_ADDRESSES    ((NTSTATUS)0xC0000018L)
+#define STATUS_ACCESS_DENIED            ((NTSTATUS)0xC0000022L)
+#define STATUS_NOT_COMMITTED            ((NTSTATUS)0xC000002DL)
+#define STATUS_FREE_VM_NOT_AT_BASE      ((NTSTATUS)0xC000009FL)
+#define STATUS_MEMORY_NOT_ALLOCATED     ((NTSTATUS)0xC00000A0L)
+#define STATUS_NOT_SUPPORTED            ((NTSTATUS)0xC00000BBL)
+#define STATUS_INVALID_ADDRESS          ((NTSTATUS)0xC0000141L)
+#define STATUS_NOT_FOUND                ((NTSTATUS)0xC0000225L)
+
+/// <summary>
+/// Last status storage, stands in for TEB LastStatus field
+/// </summary>
+/// <returns>Status of calling thread</returns>
+inline NTSTATUS& LastNtStatusRef()
+{
+    static thread_local NTSTATUS status = STATUS_SUCCESS;
+    return status;
+}
+
+/// <summary>
+/// Get last NT status
+/// </summary>
+/// <returns></returns>
+inline NTSTATUS LastNtStatus()
+{
+    return LastNtStatusRef();
+}
+
+/// <summary>
+/// Set last NT status
+/// </summary>
+/// <param name="status">The status.</param>
+/// <returns></returns>
+inline NTSTATUS LastNtStatus( NTSTATUS status )
+{
+    return LastNtStatusRef() = status;
+}
+
+#else
+
+#include "Winheaders.h"
+#include "Macro.h"
+
+#endif
+
+namespace blackbone
+{
+
+typedef uint64_t ptr_t;     // Generic pointer in remote process
+
+/// <summary>
+/// Single range of a batched read
+/// </summary>
+struct ReadRequest
+{
+    ptr_t address = 0;                  // Memory address
+    size_t size = 0;                    // Number of bytes to read
+    void* buffer = nullptr;             // Output buffer
+    NTSTATUS status = STATUS_SUCCESS;   // Request status, set by read
+
+    ReadRequest() = default;
+    ReadRequest( ptr_t address_, size_t size_, void* buffer_ )
+        : address( address_ ), size( size_ ), buffer( buffer_ ) { }
+};
+
+}
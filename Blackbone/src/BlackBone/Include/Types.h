@@ -1,15 +1,16 @@
 #pragma once
 
+#include "BackendTypes.h"
 #include "NativeStructures.h"
 #include "FunctionTypes.h"
 
 #include <stdint.h>
 #include <string>
+#include <memory>
 
 namespace blackbone
 {
 
-typedef uint64_t ptr_t;     // Generic pointer in remote process
 typedef ptr_t    module_t;  // Module base pointer
 
 // PEB helper
@@ -53,6 +54,9 @@ enum eModSeachType
     PEHeaders,      // Scan for PE headers in memory
 };
 
+// Indexed export directory, see ProcessModules
+struct ExportIndex;
+
 // Module info
 struct ModuleData
 {
@@ -62,6 +66,9 @@ struct ModuleData
     size_t size;            // Size of image
     eModType type;          // Module type
     bool manual;            // Image is manually mapped
+    ptr_t ldrEntry = 0;     // Loader entry address, 0 if module wasn't found in loader list
+
+    mutable std::shared_ptr<ExportIndex> exports;  // Export lookup cache, built on first GetExport
 
     bool operator ==(const ModuleData& other) const
     {
@@ -336,11 +336,25 @@ const ModuleData* MMap::FindOrMapModule(
     if (!(flags & NoSxS))
         CreateActx( pImage->peImage.manifestFile(), pImage->peImage.manifestID(), !pImage->peImage.noPhysFile() );
 
-    // Core image mapping operations
-    if (!CopyImage( pImage.get() ) || !RelocateImage( pImage.get() ))
+    // Core image mapping operations. Image is staged locally and written at once
     {
-        pImage->peImage.Release();
-        return nullptr;
+        MemoryTransaction imageWrites( pImage->imgMem );
+
+        if (!CopyImage( pImage.get() ) || !RelocateImage( pImage.get() ))
+        {
+            pImage->peImage.Release();
+            return nullptr;
+        }
+
+        status = imageWrites.Commit();
+        if (!NT_SUCCESS( status ))
+        {
+            BLACKBONE_TRACE( L"ManualMap: Failed to write image. Status = 0x%x", status );
+            pImage->peImage.Release();
+            return nullptr;
+        }
+
+        BLACKBONE_TRACE( L"ManualMap: Image written in %zu native writes", imageWrites.stats().spans );
     }
 
     auto mt = pImage->peImage.mType();
@@ -354,9 +368,13 @@ const ModuleData* MMap::FindOrMapModule(
         return nullptr;
     }
 
-    // Apply proper memory protection for sections
-    if (!(flags & HideVAD))
-        ProtectImageMemory( pImage.get() );
+    // Apply proper memory protection for header and sections
+    if (!(flags & HideVAD) && !ProtectImageMemory( pImage.get() ))
+    {
+        pImage->peImage.Release();
+        _process.modules().RemoveManualModule( pImage->FileName, mt );
+        return nullptr;
+    }
 
     // Make exception handling possible (C and C++)
     if (!(flags & NoExceptions))
@@ -493,13 +511,6 @@ bool MMap::CopyImage( ImageContext* pImage )
         return false;
     }
 
-    // Set header protection
-    if (!(pImage->flags & HideVAD) && pImage->imgMem.Protect( PAGE_READONLY, 0, dwHeaderSize ) != STATUS_SUCCESS)
-    {
-        BLACKBONE_TRACE( L"ManualMap: Failed to set header memory protection. Status = 0x%x", LastNtStatus() );
-        return false;
-    }
-
     auto& sections = pImage->peImage.sections();
 
     // Copy sections
@@ -541,12 +552,21 @@ bool MMap::CopyImage( ImageContext* pImage )
 }
 
 /// <summary>
-/// Adjust image memory protection
+/// Adjust image memory protection. Every section is processed even if header or some section fails
 /// </summary>
 /// <param name="pImage">image data</param>
 /// <returns>true on success</returns>
 bool MMap::ProtectImageMemory( ImageContext* pImage )
 {
+    bool success = true;
+
+    // Set header protection
+    if (pImage->imgMem.Protect( PAGE_READONLY, 0, pImage->peImage.headersSize() ) != STATUS_SUCCESS)
+    {
+        BLACKBONE_TRACE( L"ManualMap: Failed to set header memory protection. Status = 0x%x", LastNtStatus() );
+        success = false;
+    }
+
     // Set section memory protection
     for (auto& section : pImage->peImage.sections())
     {
@@ -560,7 +580,7 @@ bool MMap::ProtectImageMemory( ImageContext* pImage )
                     section.VirtualAddress, LastNtStatus()
                     );
 
-                return false;
+                success = false;
             }
         }
         // Decommit pages with NO_ACCESS protection
@@ -570,7 +590,7 @@ bool MMap::ProtectImageMemory( ImageContext* pImage )
         }
     }
 
-    return true;
+    return success;
 }
 
 /// <summary>
@@ -722,6 +742,12 @@ bool MMap::ResolveImport( ImageContext* pImage, bool useDelayed /*= false */ )
     if (imports.empty())
         return true;
 
+    // Dependency headers and export directories are read many times
+    MemoryCacheScope cache( _process.memory() );
+
+    // IAT slots are adjacent, write them at once
+    MemoryTransaction iatWrites( pImage->imgMem );
+
     // Traverse entries
     for (auto& importMod : imports)
     {
@@ -736,14 +762,24 @@ bool MMap::ResolveImport( ImageContext* pImage, bool useDelayed /*= false */ )
             return false;
         }
 
+        // Resolve whole module import in one pass
+        std::vector<const char*> names;
+        names.reserve( importMod.second.size() );
+
         for (auto& importFn : importMod.second)
         {
-            exportData expData;
-
             if (importFn.importByOrd)
-                expData = _process.modules().GetExport( hMod, reinterpret_cast<const char*>(importFn.importOrdinal) );
+                names.emplace_back( reinterpret_cast<const char*>(importFn.importOrdinal) );
             else
-                expData = _process.modules().GetExport( hMod, importFn.importName.c_str() );
+                names.emplace_back( importFn.importName.c_str() );
+        }
+
+        auto exports = _process.modules().GetExports( hMod, names );
+
+        for (size_t i = 0; i < importMod.second.size(); i++)
+        {
+            auto& importFn = importMod.second[i];
+            exportData& expData = exports[i];
 
             // Still forwarded, load missing modules
             while (expData.procAddress && expData.isForwarded)
@@ -799,6 +835,13 @@ bool MMap::ResolveImport( ImageContext* pImage, bool useDelayed /*= false */ )
         }
     }
 
+    auto status = iatWrites.Commit();
+    if (!NT_SUCCESS( status ))
+    {
+        BLACKBONE_TRACE( L"ManualMap: Failed to write import address table. Status = 0x%x", status );
+        return false;
+    }
+
     return true;
 }
 
@@ -1131,10 +1174,10 @@ bool MMap::CreateActx( const std::wstring& path, int id /*= 2 */, bool asImage /
         //a->mov( asmjit::host::dword_ptr( asmjit::host::edx ), asmjit::host::eax );
         a->dw( '\x01\x02' );
 
-        auto pTermThd = _process.modules().GetExport( _process.modules().GetModule( L"ntdll.dll" ), "NtTerminateThread" );
+        auto pTermThd = _process.remote().helpers().NtTerminateThread;
         a->push( a->zax );
         a->push( uint32_t( 0 ) );
-        a->mov( asmjit::host::eax, static_cast<uint32_t>(pTermThd.procAddress) );
+        a->mov( asmjit::host::eax, static_cast<uint32_t>(pTermThd) );
         a->call( a->zax );
         a->ret( 4 );
         
@@ -303,7 +303,7 @@ private:
     bool CopyImage( ImageContext* pImage );
 
     /// <summary>
-    /// Adjust image memory protection
+    /// Adjust image memory protection. Every section is processed even if header or some section fails
     /// </summary>
     /// <param name="pImage">image data</param>
     /// <returns>true on success</returns>
@@ -1,6 +1,6 @@
 #include "NtLoader.h"
 #include "../../Process/Process.h"
-#include "../../Patterns/PatternSearch.h"
+#include "../../Patterns/PatternSet.h"
 #include "../../Misc/Utils.h"
 #include "../../Include/Macro.h"
 #include "../../Misc/DynImport.h"
@@ -125,7 +125,7 @@ T* NtLdr::SetNode( T* ptr, void* pModule )
 
         m_memory.ExecInWorkerThread(a->make(), a->getCodeSize(), (size_t&)ptr);*/
 
-        auto rgn = _process.memory().Allocate( sizeof(T), PAGE_READWRITE );
+        auto rgn = _process.memory().heap().Allocate( sizeof(T), PAGE_READWRITE );
         if (rgn.valid())
         {
             rgn.Release();
@@ -348,7 +348,7 @@ _LDR_DATA_TABLE_ENTRY_W8* NtLdr::InitW8Node(
     }
     else
     {
-        auto block = _process.memory().Allocate( sizeof( _LDR_DATA_TABLE_ENTRY_W8 ), PAGE_READWRITE );
+        auto block = _process.memory().heap().Allocate( sizeof( _LDR_DATA_TABLE_ENTRY_W8 ), PAGE_READWRITE );
         pEntry = block.ptr<_LDR_DATA_TABLE_ENTRY_W8*>();
         block.Release();
     }
@@ -374,7 +374,7 @@ _LDR_DATA_TABLE_ENTRY_W8* NtLdr::InitW8Node(
         }
         else
         {
-            auto block = _process.memory().Allocate( sizeof( _LDR_DATA_TABLE_ENTRY_W8 ), PAGE_READWRITE );
+            auto block = _process.memory().heap().Allocate( sizeof( _LDR_DATA_TABLE_ENTRY_W8 ), PAGE_READWRITE );
             pDdagNode = block.ptr<_LDR_DDAG_NODE*>();
             block.Release();
         }  
@@ -463,7 +463,7 @@ _LDR_DATA_TABLE_ENTRY_W7* NtLdr::InitW7Node(
     AsmJitHelper a;
 
     // Allocate space for Unicode string
-    auto StringBuf = _process.memory().Allocate( MAX_PATH, PAGE_READWRITE );
+    auto StringBuf = _process.memory().heap().Allocate( MAX_PATH, PAGE_READWRITE );
     StringBuf.Release();
 
     if (_LdrHeapBase)
@@ -489,7 +489,7 @@ _LDR_DATA_TABLE_ENTRY_W7* NtLdr::InitW7Node(
     }
     else
     {
-        auto block = _process.memory().Allocate( sizeof( _LDR_DATA_TABLE_ENTRY_W8 ), PAGE_READWRITE );
+        auto block = _process.memory().heap().Allocate( sizeof( _LDR_DATA_TABLE_ENTRY_W8 ), PAGE_READWRITE );
         pEntry = block.ptr<_LDR_DATA_TABLE_ENTRY_W7*>();
         block.Release();
     }
@@ -807,7 +807,6 @@ bool NtLdr::FindLdrpModuleIndexBase( )
 /// <returns>true on success</returns>
 bool NtLdr::ScanPatterns( )
 {
-    std::vector<ptr_t> foundData;
     pe::PEImage ntdll;
     void* pStart  = nullptr;
     size_t scanSize = 0;
@@ -831,83 +830,83 @@ bool NtLdr::ScanPatterns( )
     if(pStart == nullptr)
         return false;
 
+    PatternSet patterns;
+    std::vector<PatternMatch> found;
+    ptr_t match = 0;
+
+    // First match of pattern, 0 if not found
+    auto first = [&found]( size_t id ) -> ptr_t
+    {
+        for (auto& item : found)
+            if (item.id == id)
+                return item.address;
+
+        return 0;
+    };
+
     // Win 8.1 and later
     if (IsWindows8Point1OrGreater())
     {
     #ifdef USE64
         // LdrpHandleTlsData
         // 44 8D 43 09 4C 8D 4C 24 38
-        PatternSearch ps( "\x44\x8d\x43\x09\x4c\x8d\x4c\x24\x38" );
-        ps.Search( pStart, scanSize, foundData );
-
-        if (!foundData.empty())
-        {
-            _LdrpHandleTlsData = static_cast<uintptr_t>(foundData.front() - 0x43);
-            foundData.clear();
-        }
+        size_t tlsData = patterns.Add( "\x44\x8d\x43\x09\x4c\x8d\x4c\x24\x38" );
 
         // RtlInsertInvertedFunctionTable
         // 8B C3 2B D3 48 8D 48 01
-        PatternSearch ps2( "\x8B\xC3\x2B\xD3\x48\x8D\x48\x01" );
-        ps2.Search( pStart, scanSize, foundData );
+        size_t insertTable = patterns.Add( "\x8B\xC3\x2B\xD3\x48\x8D\x48\x01" );
+
+        patterns.Search( pStart, scanSize, found );
 
-        if (!foundData.empty())
+        if ((match = first( tlsData )) != 0)
+            _LdrpHandleTlsData = static_cast<uintptr_t>(match - 0x43);
+
+        if ((match = first( insertTable )) != 0)
         {
-            _RtlInsertInvertedFunctionTable = static_cast<uintptr_t>(foundData.front() - 0x84);
+            _RtlInsertInvertedFunctionTable = static_cast<uintptr_t>(match - 0x84);
             if (IsWindows10OrGreater())
-                _LdrpInvertedFunctionTable = *reinterpret_cast<int32_t*>(foundData.front() - 0x27 + 3) + (foundData.front() - 0x27 + 7);
+                _LdrpInvertedFunctionTable = *reinterpret_cast<int32_t*>(match - 0x27 + 3) + (match - 0x27 + 7);
         }
     #else
         // RtlInsertInvertedFunctionTable
         // 53 56 57 8B DA 8B F9 50 
-        PatternSearch ps1( "\x53\x56\x57\x8b\xda\x8b\xf9\x50" );
-        ps1.Search( pStart, scanSize, foundData );
+        size_t insertTable = patterns.Add( "\x53\x56\x57\x8b\xda\x8b\xf9\x50" );
+
+        // RtlInsertInvertedFunctionTable, old pattern
+        // 8D 45 F4 89 55 F8 50 8D 55 FC
+        size_t insertTableOld = patterns.Add( "\x8d\x45\xf4\x89\x55\xf8\x50\x8d\x55\xfc" );
 
-        if (!foundData.empty())
+        // LdrpHandleTlsData
+        // 8D 45 ?? 50 6A 09 6A 01 8B C1
+        size_t tlsData = patterns.Add( 0xCC, "\x8d\x45\xcc\x50\x6a\x09\x6a\x01\x8b\xc1" );
+
+        // LdrProtectMrdata
+        // 83 7D 08 00 8B 35    
+        size_t protectMrdata = patterns.Add( "\x83\x7d\x08\x00\x8b\x35", 6 );
+
+        patterns.Search( pStart, scanSize, found );
+
+        if ((match = first( insertTable )) != 0)
         {
-            _RtlInsertInvertedFunctionTable = static_cast<size_t>(foundData.front() - 0xB);
+            _RtlInsertInvertedFunctionTable = static_cast<size_t>(match - 0xB);
 
             if (IsWindows10OrGreater())
-                _LdrpInvertedFunctionTable = *reinterpret_cast<uintptr_t*>(foundData.front() + 0x22);
+                _LdrpInvertedFunctionTable = *reinterpret_cast<uintptr_t*>(match + 0x22);
             else
-                _LdrpInvertedFunctionTable = *reinterpret_cast<uintptr_t*>(foundData.front() + 0x23);
-
-            foundData.clear();
+                _LdrpInvertedFunctionTable = *reinterpret_cast<uintptr_t*>(match + 0x23);
         }
-        // Rescan using old pattern
-        else
+        // Fall back to old pattern
+        else if ((match = first( insertTableOld )) != 0)
         {
-            // RtlInsertInvertedFunctionTable
-            // 8D 45 F4 89 55 F8 50 8D 55 FC
-            PatternSearch ps12( "\x8d\x45\xf4\x89\x55\xf8\x50\x8d\x55\xfc" );
-            ps12.Search( pStart, scanSize, foundData );
-
-            if (!foundData.empty())
-            {
-                _RtlInsertInvertedFunctionTable = static_cast<uintptr_t>(foundData.front() - 0xB);
-                _LdrpInvertedFunctionTable = *reinterpret_cast<uintptr_t*>(foundData.front() + 0x1D);
-                foundData.clear();
-            }
+            _RtlInsertInvertedFunctionTable = static_cast<uintptr_t>(match - 0xB);
+            _LdrpInvertedFunctionTable = *reinterpret_cast<uintptr_t*>(match + 0x1D);
         }
 
-        // LdrpHandleTlsData
-        // 8D 45 ?? 50 6A 09 6A 01 8B C1
-        PatternSearch ps2( "\x8d\x45\xcc\x50\x6a\x09\x6a\x01\x8b\xc1" );
-        ps2.Search( 0xCC, pStart, scanSize, foundData );
+        if ((match = first( tlsData )) != 0)
+            _LdrpHandleTlsData = static_cast<uintptr_t>(match - 0x18);
 
-        if (!foundData.empty())
-        {
-            _LdrpHandleTlsData = static_cast<uintptr_t>(foundData.front() - 0x18);
-            foundData.clear();
-        }
-
-        // LdrProtectMrdata
-        // 83 7D 08 00 8B 35    
-        PatternSearch ps3( "\x83\x7d\x08\x00\x8b\x35", 6 );
-        ps3.Search( pStart, scanSize, foundData );
-
-        if (!foundData.empty())
-            _LdrProtectMrdata = static_cast<uintptr_t>(foundData.front() - 0x12);
+        if ((match = first( protectMrdata )) != 0)
+            _LdrProtectMrdata = static_cast<uintptr_t>(match - 0x12);
     #endif
     }
     // Win 8
@@ -916,31 +915,31 @@ bool NtLdr::ScanPatterns( )
     #ifdef USE64
         // LdrpHandleTlsData
         // 48 8B 79 30 45 8D 66 01
-        PatternSearch ps( "\x48\x8b\x79\x30\x45\x8d\x66\x01" );
-        ps.Search( pStart, scanSize, foundData );
+        size_t tlsData = patterns.Add( "\x48\x8b\x79\x30\x45\x8d\x66\x01" );
+
+        patterns.Search( pStart, scanSize, found );
 
-        if (!foundData.empty())
-            _LdrpHandleTlsData = static_cast<uintptr_t>(foundData.front() - 0x49);
+        if ((match = first( tlsData )) != 0)
+            _LdrpHandleTlsData = static_cast<uintptr_t>(match - 0x49);
     #else
         // RtlInsertInvertedFunctionTable
         // 8B FF 55 8B EC 51 51 53 57 8B 7D 08 8D
-        PatternSearch ps1( "\x8b\xff\x55\x8b\xec\x51\x51\x53\x57\x8b\x7d\x08\x8d" );
-        ps1.Search( pStart, scanSize, foundData );
+        size_t insertTable = patterns.Add( "\x8b\xff\x55\x8b\xec\x51\x51\x53\x57\x8b\x7d\x08\x8d" );
 
-        if(!foundData.empty())
+        // LdrpHandleTlsData
+        // 8B 45 08 89 45 A0
+        size_t tlsData = patterns.Add( "\x8b\x45\x08\x89\x45\xa0" );
+
+        patterns.Search( pStart, scanSize, found );
+
+        if ((match = first( insertTable )) != 0)
         {
-            _RtlInsertInvertedFunctionTable = static_cast<uintptr_t>(foundData.front());
+            _RtlInsertInvertedFunctionTable = static_cast<uintptr_t>(match);
             _LdrpInvertedFunctionTable = *reinterpret_cast<uintptr_t*>(_RtlInsertInvertedFunctionTable + 0x26);
-            foundData.clear();
         }
 
-        // LdrpHandleTlsData
-        // 8B 45 08 89 45 A0
-        PatternSearch ps2( "\x8b\x45\x08\x89\x45\xa0" );
-        ps2.Search( pStart, scanSize, foundData );
-
-        if (!foundData.empty())
-            _LdrpHandleTlsData = static_cast<uintptr_t>(foundData.front() - 0xC);
+        if ((match = first( tlsData )) != 0)
+            _LdrpHandleTlsData = static_cast<uintptr_t>(match - 0xC);
     #endif
     }
     // Win 7
@@ -949,67 +948,49 @@ bool NtLdr::ScanPatterns( )
     #ifdef USE64
         // LdrpHandleTlsData
         // 41 B8 09 00 00 00 48 8D 44 24 38
-        PatternSearch ps1( "\x41\xb8\x09\x00\x00\x00\x48\x8d\x44\x24\x38", 11 );
-        ps1.Search( pStart, scanSize, foundData );
-
-        if (!foundData.empty())
-        {
-            _LdrpHandleTlsData = static_cast<uintptr_t>(foundData.front() - 0x27);
-            foundData.clear();            
-        }
+        size_t tlsData = patterns.Add( "\x41\xb8\x09\x00\x00\x00\x48\x8d\x44\x24\x38", 11 );
 
         // LdrpFindOrMapDll patch address
         // 48 8D 8C 24 98 00 00 00 41 b0 01
-        PatternSearch ps2( "\x48\x8D\x8C\x24\x98\x00\x00\x00\x41\xb0\x01", 11 );
-        ps2.Search( pStart, scanSize, foundData );
-
-        if (!foundData.empty())
-        {
-            _LdrKernel32PatchAddress = static_cast<uintptr_t>(foundData.front() + 0x12);
-            foundData.clear();            
-        }
+        size_t kernel32Patch = patterns.Add( "\x48\x8D\x8C\x24\x98\x00\x00\x00\x41\xb0\x01", 11 );
 
         // KiUserApcDispatcher patch address
         // 48 8B 4C 24 18 48 8B C1 4C
-        PatternSearch ps3( "\x48\x8b\x4c\x24\x18\x48\x8b\xc1\x4c");
-        ps3.Search( pStart, scanSize, foundData );
+        size_t apcPatch = patterns.Add( "\x48\x8b\x4c\x24\x18\x48\x8b\xc1\x4c" );
 
-        if (!foundData.empty())
-        {
-            _APC64PatchAddress = static_cast<uintptr_t>(foundData.front());
-            foundData.clear();            
-        }
+        patterns.Search( pStart, scanSize, found );
+
+        if ((match = first( tlsData )) != 0)
+            _LdrpHandleTlsData = static_cast<uintptr_t>(match - 0x27);
+
+        if ((match = first( kernel32Patch )) != 0)
+            _LdrKernel32PatchAddress = static_cast<uintptr_t>(match + 0x12);
+
+        if ((match = first( apcPatch )) != 0)
+            _APC64PatchAddress = static_cast<uintptr_t>(match);
     #else
         // RtlInsertInvertedFunctionTable
         // 8B FF 55 8B EC 56 68
-        PatternSearch ps1( "\x8b\xff\x55\x8b\xec\x56\x68" );
-        ps1.Search( pStart, scanSize, foundData);
-
-        if(!foundData.empty())
-        {
-            _RtlInsertInvertedFunctionTable = static_cast<size_t>(foundData.front( ));
-            foundData.clear();
-        }
+        size_t insertTable = patterns.Add( "\x8b\xff\x55\x8b\xec\x56\x68" );
 
         // RtlLookupFunctionTable + 0x11
         // 89 5D E0 38
-        PatternSearch ps2( "\x89\x5D\xE0\x38" );
-        ps2.Search( pStart, scanSize, foundData );
-                
-        if(!foundData.empty())
-        {
-            _LdrpInvertedFunctionTable = *reinterpret_cast<uintptr_t*>(foundData.front() + 0x1B);
-            foundData.clear();
-        }
+        size_t lookupTable = patterns.Add( "\x89\x5D\xE0\x38" );
 
         // LdrpHandleTlsData
         // 74 20 8D 45 D4 50 6A 09 
-        PatternSearch ps3( "\x74\x20\x8d\x45\xd4\x50\x6a\x09" );
-        ps3.Search( pStart, scanSize, foundData );
+        size_t tlsData = patterns.Add( "\x74\x20\x8d\x45\xd4\x50\x6a\x09" );
+
+        patterns.Search( pStart, scanSize, found );
+
+        if ((match = first( insertTable )) != 0)
+            _RtlInsertInvertedFunctionTable = static_cast<size_t>(match);
 
-        if(!foundData.empty())
-            _LdrpHandleTlsData = static_cast<uintptr_t>(foundData.front() - 0x14);
+        if ((match = first( lookupTable )) != 0)
+            _LdrpInvertedFunctionTable = *reinterpret_cast<uintptr_t*>(match + 0x1B);
 
+        if ((match = first( tlsData )) != 0)
+            _LdrpHandleTlsData = static_cast<uintptr_t>(match - 0x14);
     #endif
     }
 
@@ -0,0 +1,77 @@
+#include "CpuFeatures.h"
+
+#ifdef COMPILER_MSVC
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+namespace blackbone
+{
+
+/// <summary>
+/// Execute cpuid
+/// </summary>
+/// <param name="leaf">Leaf</param>
+/// <param name="subleaf">Sub-leaf</param>
+/// <param name="regs">EAX, EBX, ECX, EDX</param>
+static void CpuId( uint32_t leaf, uint32_t subleaf, uint32_t regs[4] )
+{
+#ifdef COMPILER_MSVC
+    __cpuidex( reinterpret_cast<int*>(regs), leaf, subleaf );
+#else
+    __cpuid_count( leaf, subleaf, regs[0], regs[1], regs[2], regs[3] );
+#endif
+}
+
+/// <summary>
+/// Read extended control register 0
+/// </summary>
+/// <returns>XCR0</returns>
+static uint64_t ReadXcr0()
+{
+#ifdef COMPILER_MSVC
+    return _xgetbv( 0 );
+#else
+    uint32_t eax = 0, edx = 0;
+    __asm__ __volatile__( "xgetbv" : "=a"(eax), "=d"(edx) : "c"(0) );
+    return (static_cast<uint64_t>(edx) << 32) | eax;
+#endif
+}
+
+/// <summary>
+/// Get host features. Detected once
+/// </summary>
+/// <returns>Supported features</returns>
+const CpuFeatures& CpuFeatures::Get()
+{
+    static const CpuFeatures features = []()
+    {
+        CpuFeatures result;
+        uint32_t regs[4] = { 0 };
+
+        CpuId( 0, 0, regs );
+        uint32_t maxLeaf = regs[0];
+        if (maxLeaf < 1)
+            return result;
+
+        CpuId( 1, 0, regs );
+        result.sse2 = (regs[3] & (1 << 26)) != 0;
+        result.sse41 = (regs[2] & (1 << 19)) != 0;
+
+        // AVX and OSXSAVE, YMM state must be enabled by OS
+        bool osAvx = (regs[2] & (1 << 27)) != 0 && (regs[2] & (1 << 28)) != 0 && (ReadXcr0() & 6) == 6;
+
+        if (osAvx && maxLeaf >= 7)
+        {
+            CpuId( 7, 0, regs );
+            result.avx2 = (regs[1] & (1 << 5)) != 0;
+        }
+
+        return result;
+    }();
+
+    return features;
+}
+
+}
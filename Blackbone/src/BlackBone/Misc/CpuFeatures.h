@@ -0,0 +1,53 @@
+#pragma once
+
+#include "../Config.h"
+
+#include <cstdint>
+
+#ifdef COMPILER_MSVC
+#include <intrin.h>
+#endif
+
+// Functions using AVX2 intrinsics. MSVC allows them anywhere, GCC needs per-function target
+#ifdef COMPILER_MSVC
+    #define TARGET_AVX2
+#else
+    #define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+
+namespace blackbone
+{
+
+/// <summary>
+/// SIMD extensions supported by host CPU and OS
+/// </summary>
+struct CpuFeatures
+{
+    bool sse2 = false;      // SSE2
+    bool sse41 = false;     // SSE4.1
+    bool avx2 = false;      // AVX2, OS saves YMM state
+
+    /// <summary>
+    /// Get host features. Detected once
+    /// </summary>
+    /// <returns>Supported features</returns>
+    BLACKBONE_API static const CpuFeatures& Get();
+};
+
+/// <summary>
+/// Index of lowest set bit
+/// </summary>
+/// <param name="mask">Non-zero mask</param>
+/// <returns>Bit index</returns>
+inline uint32_t LowestBit( uint32_t mask )
+{
+#ifdef COMPILER_MSVC
+    unsigned long index = 0;
+    _BitScanForward( &index, mask );
+    return index;
+#else
+    return static_cast<uint32_t>(__builtin_ctz( mask ));
+#endif
+}
+
+}
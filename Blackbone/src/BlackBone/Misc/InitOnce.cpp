@@ -87,6 +87,8 @@ private:
         LOAD_IMPORT( "NtDuplicateObject",                        hNtdll );
         LOAD_IMPORT( "NtQueryObject",                            hNtdll );
         LOAD_IMPORT( "NtQuerySection",                           hNtdll );
+        LOAD_IMPORT( "NtMapViewOfSection",                       hNtdll );
+        LOAD_IMPORT( "NtUnmapViewOfSection",                     hNtdll );
         LOAD_IMPORT( "RtlCreateActivationContext",               hNtdll );
         LOAD_IMPORT( "NtQueryVirtualMemory",                     hNtdll );
         LOAD_IMPORT( "NtCreateThreadEx",                         hNtdll );
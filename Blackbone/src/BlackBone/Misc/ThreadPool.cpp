@@ -0,0 +1,166 @@
+#include "ThreadPool.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+ThreadPool::ThreadPool( size_t threads /*= 0*/ )
+{
+    if (threads == 0)
+    {
+        SYSTEM_INFO info = { 0 };
+        GetSystemInfo( &info );
+        threads = info.dwNumberOfProcessors;
+    }
+
+    threads = std::min<size_t>( std::max<size_t>( threads, 1 ), POOL_MAX_THREADS );
+    for (size_t i = 0; i < threads; i++)
+    {
+        _workers.emplace_back( new Worker() );
+        _workers.back()->pool = this;
+        _workers.back()->index = i;
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+}
+
+/// <summary>
+/// Run items [0, count) and wait for completion. Not reentrant
+/// </summary>
+/// <param name="count">Number of items</param>
+/// <param name="work">Item handler, called concurrently by different workers</param>
+/// <param name="cancel">Optional cancellation token, items not started yet are skipped once it is set</param>
+void ThreadPool::Run( size_t count, const fnWork& work, const CancellationToken* cancel /*= nullptr*/ )
+{
+    if (count == 0)
+        return;
+
+    _work = &work;
+    _cancel = cancel;
+
+    // Nearly equal initial ranges, extra workers would only steal
+    size_t active = std::min( count, _workers.size() );
+    for (size_t i = 0; i < _workers.size(); i++)
+    {
+        _workers[i]->begin = i < active ? count * i / active : 0;
+        _workers[i]->end = i < active ? count * (i + 1) / active : 0;
+    }
+
+    // Range of a worker that failed to start is stolen by the rest
+    std::vector<HANDLE> threads;
+    for (size_t i = 1; i < active; i++)
+    {
+        HANDLE hThread = CreateThread( NULL, 0, &ThreadPool::WorkerThreadWrap, _workers[i].get(), 0, NULL );
+        if (hThread != NULL)
+            threads.emplace_back( hThread );
+    }
+
+    WorkerThread( 0 );
+
+    for (auto hThread : threads)
+    {
+        WaitForSingleObject( hThread, INFINITE );
+        CloseHandle( hThread );
+    }
+
+    _work = nullptr;
+    _cancel = nullptr;
+}
+
+/// <summary>
+/// Worker thread wrapper
+/// </summary>
+/// <param name="lpParam">Worker</param>
+/// <returns>0</returns>
+DWORD CALLBACK ThreadPool::WorkerThreadWrap( LPVOID lpParam )
+{
+    auto pWorker = reinterpret_cast<Worker*>(lpParam);
+    pWorker->pool->WorkerThread( pWorker->index );
+    return 0;
+}
+
+/// <summary>
+/// Process own items, then steal from other workers until all ranges are empty
+/// </summary>
+/// <param name="index">Worker number</param>
+void ThreadPool::WorkerThread( size_t index )
+{
+    for (size_t item = 0; _cancel == nullptr || !_cancel->cancelled();)
+    {
+        // Stolen range may be stolen back before the first item is taken, so take is retried
+        if (Take( index, item ))
+            (*_work)( item, index );
+        else if (!Steal( index ))
+            break;
+    }
+}
+
+/// <summary>
+/// Take next item from own range
+/// </summary>
+/// <param name="index">Worker number</param>
+/// <param name="item">Taken item</param>
+/// <returns>false if range is empty</returns>
+bool ThreadPool::Take( size_t index, size_t& item )
+{
+    auto& worker = *_workers[index];
+    CSLock lck( worker.lock );
+
+    if (worker.begin == worker.end)
+        return false;
+
+    item = worker.begin++;
+    return true;
+}
+
+/// <summary>
+/// Move upper half of the largest remaining range into own range
+/// </summary>
+/// <param name="index">Worker number</param>
+/// <returns>false if there is nothing left to steal</returns>
+bool ThreadPool::Steal( size_t index )
+{
+    size_t begin = 0, end = 0;
+
+    // Only one lock is held at a time, victim may be drained before it's locked again
+    while (begin == end)
+    {
+        size_t victim = 0, largest = 0;
+        for (size_t i = 0; i < _workers.size(); i++)
+        {
+            if (i == index)
+                continue;
+
+            CSLock lck( _workers[i]->lock );
+            if (_workers[i]->end - _workers[i]->begin > largest)
+            {
+                largest = _workers[i]->end - _workers[i]->begin;
+                victim = i;
+            }
+        }
+
+        if (largest == 0)
+            return false;
+
+        auto& target = *_workers[victim];
+        CSLock lck( target.lock );
+
+        // Last item is taken whole
+        begin = target.begin + (target.end - target.begin) / 2;
+        end = target.end;
+        target.end = begin;
+    }
+
+    auto& worker = *_workers[index];
+    CSLock lck( worker.lock );
+
+    worker.begin = begin;
+    worker.end = end;
+
+    return true;
+}
+
+}
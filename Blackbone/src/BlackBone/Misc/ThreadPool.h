@@ -0,0 +1,107 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "Utils.h"
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <functional>
+
+namespace blackbone
+{
+
+#define POOL_MAX_THREADS    64      // Upper limit of worker threads
+
+/// <summary>
+/// Cancellation flag shared by caller and running work
+/// </summary>
+class CancellationToken
+{
+public:
+    BLACKBONE_API inline void Cancel() { _cancelled = true; }
+    BLACKBONE_API inline void Reset() { _cancelled = false; }
+    BLACKBONE_API inline bool cancelled() const { return _cancelled; }
+
+private:
+    std::atomic<bool> _cancelled{ false };
+};
+
+/// <summary>
+/// Fork-join pool with work stealing.
+/// Batch of items is split into contiguous ranges, one per worker. Worker takes items from the front
+/// of its own range, once it runs dry it steals upper half of the largest remaining range.
+/// Calling thread acts as worker 0, so per-worker state can be indexed by worker number
+/// </summary>
+class ThreadPool
+{
+public:
+    typedef std::function<void( size_t item, size_t worker )> fnWork;
+
+    BLACKBONE_API ThreadPool( size_t threads = 0 );
+    BLACKBONE_API ~ThreadPool();
+
+    /// <summary>
+    /// Run items [0, count) and wait for completion. Not reentrant
+    /// </summary>
+    /// <param name="count">Number of items</param>
+    /// <param name="work">Item handler, called concurrently by different workers</param>
+    /// <param name="cancel">Optional cancellation token, items not started yet are skipped once it is set</param>
+    BLACKBONE_API void Run( size_t count, const fnWork& work, const CancellationToken* cancel = nullptr );
+
+    /// <summary>
+    /// Number of workers, calling thread included
+    /// </summary>
+    BLACKBONE_API inline size_t threads() const { return _workers.size(); }
+
+private:
+    /// <summary>
+    /// Worker state
+    /// </summary>
+    struct Worker
+    {
+        ThreadPool* pool = nullptr; // Owner
+        size_t index = 0;           // Worker number
+        CriticalSection lock;       // Range guard
+        size_t begin = 0;           // First item not taken yet
+        size_t end = 0;             // End of range
+    };
+
+    /// <summary>
+    /// Worker thread wrapper
+    /// </summary>
+    /// <param name="lpParam">Worker</param>
+    /// <returns>0</returns>
+    static DWORD CALLBACK WorkerThreadWrap( LPVOID lpParam );
+
+    /// <summary>
+    /// Process own items, then steal from other workers until all ranges are empty
+    /// </summary>
+    /// <param name="index">Worker number</param>
+    void WorkerThread( size_t index );
+
+    /// <summary>
+    /// Take next item from own range
+    /// </summary>
+    /// <param name="index">Worker number</param>
+    /// <param name="item">Taken item</param>
+    /// <returns>false if range is empty</returns>
+    bool Take( size_t index, size_t& item );
+
+    /// <summary>
+    /// Move upper half of the largest remaining range into own range
+    /// </summary>
+    /// <param name="index">Worker number</param>
+    /// <returns>false if there is nothing left to steal</returns>
+    bool Steal( size_t index );
+
+    ThreadPool( const ThreadPool& ) = delete;
+    ThreadPool& operator =( const ThreadPool& ) = delete;
+
+private:
+    std::vector<std::unique_ptr<Worker>> _workers;  // Workers, calling thread is the first one
+    const fnWork* _work = nullptr;                  // Current item handler
+    const CancellationToken* _cancel = nullptr;     // Current cancellation token
+};
+
+}
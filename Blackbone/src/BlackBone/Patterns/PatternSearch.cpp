@@ -2,95 +2,349 @@
 #include "../Include/Macro.h"
 #include "../Include/Winheaders.h"
 #include "../Process/Process.h"
+#include "../Process/RegionStream.h"
+#include "../Misc/CpuFeatures.h"
+#include "../Misc/ThreadPool.h"
 
+#include <immintrin.h>
 #include <algorithm>
+#include <climits>
 #include <memory>
 
 namespace blackbone
 {
 
-PatternSearch::PatternSearch( const std::vector<uint8_t>& pattern )
-    : _pattern( pattern )
+/// <summary>
+/// Pattern prepared for scanning
+/// </summary>
+struct ScanPattern
+{
+    std::vector<uint8_t> value;     // Pattern bytes, wildcards are zeroed
+    std::vector<uint8_t> mask;      // 0xFF for fixed byte, 0 for wildcard
+    size_t anchor = 0;              // Offset of the rarest fixed byte
+    size_t anchor2 = 0;             // Offset of the second rarest fixed byte, equals anchor if there is only one
+    size_t step = 1;                // Distance to the next candidate after a match
+    bool fixed = false;             // Pattern has at least one fixed byte
+};
+
+/// <summary>
+/// Receiver of verified matches
+/// </summary>
+struct ScanSink
+{
+    std::vector<ptr_t>* out = nullptr;                  // Collected results
+    const PatternSearch::fnVisitor* visitor = nullptr;  // Match callback
+    ptr_t first = 0;                                    // First match, kept if neither results nor callback are set
+    size_t count = 0;                                   // Number of reported matches
+};
+
+typedef void( *fnScan )(const uint8_t* data, size_t size, const ScanPattern& pattern, ScanSink& sink, ptr_t base);
+
+/// <summary>
+/// Report match
+/// </summary>
+/// <param name="sink">Match receiver</param>
+/// <param name="address">Match address</param>
+/// <returns>false if scan must stop</returns>
+static inline bool Emit( ScanSink& sink, ptr_t address )
 {
+    sink.count++;
+
+    if (sink.out != nullptr)
+    {
+        sink.out->emplace_back( address );
+        return true;
+    }
+
+    if (sink.visitor != nullptr)
+        return (*sink.visitor)( address );
+
+    sink.first = address;
+    return false;
 }
 
-PatternSearch::PatternSearch( const std::initializer_list<uint8_t>&& pattern )
-    : _pattern( pattern )
+/// <summary>
+/// Build mask from pattern with single wildcard value
+/// </summary>
+/// <param name="pattern">Pattern bytes</param>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <returns>Pattern mask, 0 marks wildcard</returns>
+static std::vector<uint8_t> WildcardMask( const std::vector<uint8_t>& pattern, uint8_t wildcard )
 {
+    std::vector<uint8_t> mask( pattern.size() );
+    for (size_t i = 0; i < pattern.size(); i++)
+        mask[i] = pattern[i] != wildcard ? 0xFF : 0;
+
+    return mask;
 }
 
-PatternSearch::PatternSearch( const std::string& pattern )
-    : _pattern( pattern.begin(), pattern.end() )
+/// <summary>
+/// Rough byte frequency in process memory, lower is rarer
+/// </summary>
+static int Commonness( uint8_t value )
 {
+    switch (value)
+    {
+        case 0x00: case 0xFF:
+            return 3;
+
+        // Frequent x86 opcodes, prefixes and ModRM bytes
+        case 0x01: case 0x0F: case 0x20: case 0x24: case 0x44: case 0x48: case 0x4C: case 0x74:
+        case 0x83: case 0x85: case 0x89: case 0x8B: case 0x8D: case 0x90: case 0xC3: case 0xCC: case 0xE8:
+            return 2;
+
+        // Small integers and ASCII text
+        default:
+            return (value < 0x10 || (value >= 0x20 && value < 0x7F)) ? 1 : 0;
+    }
 }
 
-PatternSearch::PatternSearch( const char* pattern, size_t len /*= 0*/ )
-    : _pattern( pattern, pattern + (len ? len : strlen( pattern )) )
+/// <summary>
+/// Build value/mask pair and select anchor bytes
+/// </summary>
+/// <param name="pattern">Pattern bytes</param>
+/// <param name="mask">Pattern mask, 0 marks wildcard. nullptr if every byte is fixed</param>
+/// <param name="overlapping">Report overlapping matches</param>
+/// <param name="result">Prepared pattern</param>
+static void Prepare( const std::vector<uint8_t>& pattern, const uint8_t* mask, bool overlapping, ScanPattern& result )
 {
+    result.value.assign( pattern.size(), 0 );
+    result.mask.assign( pattern.size(), 0 );
+    result.step = overlapping ? 1 : pattern.size();
+    result.fixed = false;
+
+    int best = INT_MAX, best2 = INT_MAX;
+    for (size_t i = 0; i < pattern.size(); i++)
+    {
+        if (mask != nullptr && mask[i] == 0)
+            continue;
+
+        result.value[i] = pattern[i];
+        result.mask[i] = 0xFF;
+        result.fixed = true;
+
+        int score = Commonness( pattern[i] );
+        if (score < best)
+        {
+            result.anchor = i;
+            best = score;
+        }
+    }
+
+    // Second anchor filters most false candidates, prefer byte that differs from the first one
+    result.anchor2 = result.anchor;
+    for (size_t i = 0; i < pattern.size(); i++)
+    {
+        if (result.mask[i] == 0 || i == result.anchor)
+            continue;
+
+        int score = Commonness( pattern[i] ) + (pattern[i] == pattern[result.anchor] ? 4 : 0);
+        if (score < best2)
+        {
+            result.anchor2 = i;
+            best2 = score;
+        }
+    }
 }
 
-PatternSearch::PatternSearch( const uint8_t* pattern, size_t len /*= 0*/ )
-    : _pattern( pattern, pattern + (len ? len : strlen( (const char*)pattern )) )
-{ 
+/// <summary>
+/// Check pattern at candidate position
+/// </summary>
+static inline bool Verify( const uint8_t* data, const ScanPattern& pattern )
+{
+    const uint8_t* value = pattern.value.data();
+    const uint8_t* mask = pattern.mask.data();
+    size_t size = pattern.value.size();
+    size_t i = 0;
+
+    for (; i + sizeof( uint64_t ) <= size; i += sizeof( uint64_t ))
+    {
+        uint64_t qd = 0, qv = 0, qm = 0;
+        memcpy( &qd, data + i, sizeof( qd ) );
+        memcpy( &qv, value + i, sizeof( qv ) );
+        memcpy( &qm, mask + i, sizeof( qm ) );
+
+        if ((qd & qm) != qv)
+            return false;
+    }
+
+    for (; i < size; i++)
+        if ((data[i] & mask[i]) != value[i])
+            return false;
+
+    return true;
 }
 
-PatternSearch::~PatternSearch()
+/// <summary>
+/// Verify candidates from compare mask
+/// </summary>
+/// <param name="mask">Candidate bits</param>
+/// <param name="data">Scanned data</param>
+/// <param name="pos">Position of the first mask bit</param>
+/// <param name="pattern">Pattern</param>
+/// <param name="next">First position not covered by previous match</param>
+/// <param name="sink">Match receiver</param>
+/// <param name="base">Address of data[0]</param>
+/// <returns>false if scan must stop</returns>
+static inline bool CheckCandidates( uint32_t mask, const uint8_t* data, size_t pos, const ScanPattern& pattern, size_t& next, ScanSink& sink, ptr_t base )
 {
+    for (; mask != 0; mask &= mask - 1)
+    {
+        size_t cand = pos + LowestBit( mask );
+        if (cand >= next && Verify( data + cand, pattern ))
+        {
+            if (!Emit( sink, base + cand ))
+                return false;
+
+            next = cand + pattern.step;
+        }
+    }
+
+    return true;
 }
 
 /// <summary>
-/// Default pattern matching with wildcards.
-/// std::search is approximately 2x faster than naive approach.
+/// Scalar scan starting at candidate position. Anchor byte is located with memchr
 /// </summary>
-/// <param name="wildcard">Pattern wildcard</param>
-/// <param name="scanStart">Starting address</param>
-/// <param name="scanSize">Size of region to scan</param>
-/// <param name="out">Found results</param>
-/// <param name="value_offset">Value that will be added to resulting addresses</param>
-/// <returns>Number of found addresses</returns>
-size_t PatternSearch::Search( uint8_t wildcard, void* scanStart, size_t scanSize, std::vector<ptr_t>& out, ptr_t value_offset /*= 0*/ )
+static void ScanTail( const uint8_t* data, size_t size, const ScanPattern& pattern, size_t pos, size_t next, ScanSink& sink, ptr_t base )
 {
-    const uint8_t* cstart = (const uint8_t*)scanStart;
-    const uint8_t* cend   = cstart + scanSize;
+    size_t count = size - pattern.value.size() + 1;
+    uint8_t anchor = pattern.value[pattern.anchor];
 
-    for (;;)
+    for (pos = std::max( pos, next ); pos < count;)
     {
-        const uint8_t* res = std::search( cstart, cend, _pattern.begin(), _pattern.end(),
-                                          [&wildcard]( uint8_t val1, uint8_t val2 ){ return (val1 == val2 || val2 == wildcard); } );
-
-        if (res >= cend)
+        auto found = reinterpret_cast<const uint8_t*>(memchr( data + pos + pattern.anchor, anchor, count - pos ));
+        if (found == nullptr)
             break;
 
-        if (value_offset != 0)
-            out.emplace_back( REBASE( res, scanStart, value_offset ) );
+        pos = static_cast<size_t>(found - data) - pattern.anchor;
+        if (Verify( data + pos, pattern ))
+        {
+            if (!Emit( sink, base + pos ))
+                return;
+
+            pos += pattern.step;
+        }
         else
-            out.emplace_back( reinterpret_cast<ptr_t>(res) );
+            pos++;
+    }
+}
+
+/// <summary>
+/// Scalar scan
+/// </summary>
+static void ScanScalar( const uint8_t* data, size_t size, const ScanPattern& pattern, ScanSink& sink, ptr_t base )
+{
+    ScanTail( data, size, pattern, 0, 0, sink, base );
+}
+
+/// <summary>
+/// Anchor pair compare, 32 candidates per iteration
+/// </summary>
+static void ScanSSE2( const uint8_t* data, size_t size, const ScanPattern& pattern, ScanSink& sink, ptr_t base )
+{
+    const __m128i first = _mm_set1_epi8( static_cast<char>(pattern.value[pattern.anchor]) );
+    const __m128i second = _mm_set1_epi8( static_cast<char>(pattern.value[pattern.anchor2]) );
+    const uint8_t* p1 = data + pattern.anchor;
+    const uint8_t* p2 = data + pattern.anchor2;
+
+    size_t count = size - pattern.value.size() + 1;
+    size_t pos = 0, next = 0;
 
-        cstart = res + _pattern.size();
+    for (; pos + 32 <= count; pos += 32)
+    {
+        __m128i lo = _mm_and_si128( _mm_cmpeq_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>(p1 + pos) ), first ),
+                                    _mm_cmpeq_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>(p2 + pos) ), second ) );
+        __m128i hi = _mm_and_si128( _mm_cmpeq_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>(p1 + pos + 16) ), first ),
+                                    _mm_cmpeq_epi8( _mm_loadu_si128( reinterpret_cast<const __m128i*>(p2 + pos + 16) ), second ) );
+
+        uint32_t mask = static_cast<uint32_t>(_mm_movemask_epi8( lo )) | (static_cast<uint32_t>(_mm_movemask_epi8( hi )) << 16);
+        if (mask != 0 && !CheckCandidates( mask, data, pos, pattern, next, sink, base ))
+            return;
     }
 
-    return out.size();
+    ScanTail( data, size, pattern, pos, next, sink, base );
 }
 
 /// <summary>
-/// Full pattern match, no wildcards.
-/// Uses BoyerMooreHorspool algorithm.
+/// Anchor pair compare, 64 candidates per iteration
 /// </summary>
-/// <param name="scanStart">Starting address</param>
-/// <param name="scanSize">Size of region to scan</param>
-/// <param name="out">Found results</param>
-/// <param name="value_offset">Value that will be added to resulting addresses</param>
-/// <returns>Number of found addresses</returns>
-size_t PatternSearch::Search( void* scanStart, size_t scanSize, std::vector<ptr_t>& out, ptr_t value_offset /*= 0*/ )
+TARGET_AVX2 static void ScanAVX2( const uint8_t* data, size_t size, const ScanPattern& pattern, ScanSink& sink, ptr_t base )
+{
+    const __m256i first = _mm256_set1_epi8( static_cast<char>(pattern.value[pattern.anchor]) );
+    const __m256i second = _mm256_set1_epi8( static_cast<char>(pattern.value[pattern.anchor2]) );
+    const uint8_t* p1 = data + pattern.anchor;
+    const uint8_t* p2 = data + pattern.anchor2;
+
+    size_t count = size - pattern.value.size() + 1;
+    size_t pos = 0, next = 0;
+
+    for (; pos + 64 <= count; pos += 64)
+    {
+        __m256i lo = _mm256_and_si256( _mm256_cmpeq_epi8( _mm256_loadu_si256( reinterpret_cast<const __m256i*>(p1 + pos) ), first ),
+                                       _mm256_cmpeq_epi8( _mm256_loadu_si256( reinterpret_cast<const __m256i*>(p2 + pos) ), second ) );
+        __m256i hi = _mm256_and_si256( _mm256_cmpeq_epi8( _mm256_loadu_si256( reinterpret_cast<const __m256i*>(p1 + pos + 32) ), first ),
+                                       _mm256_cmpeq_epi8( _mm256_loadu_si256( reinterpret_cast<const __m256i*>(p2 + pos + 32) ), second ) );
+
+        if (_mm256_testz_si256( _mm256_or_si256( lo, hi ), _mm256_or_si256( lo, hi ) ))
+            continue;
+
+        if (!CheckCandidates( static_cast<uint32_t>(_mm256_movemask_epi8( lo )), data, pos, pattern, next, sink, base ) ||
+            !CheckCandidates( static_cast<uint32_t>(_mm256_movemask_epi8( hi )), data, pos + 32, pattern, next, sink, base ))
+            return;
+    }
+
+    ScanTail( data, size, pattern, pos, next, sink, base );
+}
+
+/// <summary>
+/// Scan buffer with the best kernel supported by CPU
+/// </summary>
+/// <param name="data">Data to scan</param>
+/// <param name="size">Data size</param>
+/// <param name="pattern">Prepared pattern</param>
+/// <param name="sink">Match receiver</param>
+/// <param name="base">Address of data[0]</param>
+static void Scan( const uint8_t* data, size_t size, const ScanPattern& pattern, ScanSink& sink, ptr_t base )
+{
+    static const fnScan scan = CpuFeatures::Get().avx2 ? &ScanAVX2 : (CpuFeatures::Get().sse2 ? &ScanSSE2 : &ScanScalar);
+
+    if (pattern.value.empty() || size < pattern.value.size())
+        return;
+
+    // Every position matches
+    if (!pattern.fixed)
+    {
+        for (size_t pos = 0; pos + pattern.value.size() <= size; pos += pattern.step)
+            if (!Emit( sink, base + pos ))
+                break;
+
+        return;
+    }
+
+    scan( data, size, pattern, sink, base );
+}
+
+/// <summary>
+/// Boyer-Moore-Horspool full match, used if CPU lacks SSE2
+/// </summary>
+/// <param name="data">Data to scan</param>
+/// <param name="size">Data size</param>
+/// <param name="needle">Pattern</param>
+/// <param name="sink">Match receiver</param>
+/// <param name="base">Address of data[0]</param>
+static void ScanBMH( const uint8_t* data, size_t size, const std::vector<uint8_t>& needle, ScanSink& sink, ptr_t base )
 {
     size_t bad_char_skip[UCHAR_MAX + 1];
 
-    const uint8_t* haystack = reinterpret_cast<const uint8_t*>(scanStart);
-    const uint8_t* needle   = &_pattern[0];
-    uintptr_t       nlen     = _pattern.size();
+    const uint8_t* haystack = data;
+    uintptr_t       nlen     = needle.size();
     uintptr_t       scan     = 0;
     uintptr_t       last     = nlen - 1;
 
+    if (nlen == 0)
+        return;
+
     //
     // Preprocess
     //
@@ -103,26 +357,206 @@ size_t PatternSearch::Search( void* scanStart, size_t scanSize, std::vector<ptr_
     //
     // Search
     //
-    while (scanSize >= static_cast<size_t>(nlen))
+    while (size >= static_cast<size_t>(nlen))
     {
         for (scan = last; haystack[scan] == needle[scan]; --scan)
         {
             if (scan == 0)
             {
-                if (value_offset != 0)
-                    out.emplace_back( REBASE( haystack, scanStart, value_offset ) );
-                else
-                    out.emplace_back( reinterpret_cast<ptr_t>(haystack) );
+                if (!Emit( sink, base + (haystack - data) ))
+                    return;
+
+                break;
             }
         }
 
-        scanSize -= bad_char_skip[haystack[last]];
+        size -= bad_char_skip[haystack[last]];
         haystack += bad_char_skip[haystack[last]];
     }
+}
+
+PatternSearch::PatternSearch( const std::vector<uint8_t>& pattern )
+    : _pattern( pattern )
+{
+}
+
+PatternSearch::PatternSearch( const std::initializer_list<uint8_t>&& pattern )
+    : _pattern( pattern )
+{
+}
+
+PatternSearch::PatternSearch( const std::string& pattern )
+    : _pattern( pattern.begin(), pattern.end() )
+{
+}
+
+PatternSearch::PatternSearch( const char* pattern, size_t len /*= 0*/ )
+    : _pattern( pattern, pattern + (len ? len : strlen( pattern )) )
+{
+}
+
+PatternSearch::PatternSearch( const uint8_t* pattern, size_t len /*= 0*/ )
+    : _pattern( pattern, pattern + (len ? len : strlen( (const char*)pattern )) )
+{ 
+}
+
+PatternSearch::~PatternSearch()
+{
+}
+
+/// <summary>
+/// Pattern matching with wildcards.
+/// Candidates are found by comparing two rarest fixed bytes 32 or 64 positions at a time (SSE2/AVX2),
+/// then checked against the whole pattern
+/// </summary>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="out">Found results</param>
+/// <param name="value_offset">Value that will be added to resulting addresses</param>
+/// <returns>Number of found addresses</returns>
+size_t PatternSearch::Search( uint8_t wildcard, void* scanStart, size_t scanSize, std::vector<ptr_t>& out, ptr_t value_offset /*= 0*/ )
+{
+    return Search( WildcardMask( _pattern, wildcard ), scanStart, scanSize, out, value_offset );
+}
+
+/// <summary>
+/// Pattern matching with mask. Pattern bytes with zero mask are wildcards,
+/// so unlike single wildcard value any byte can be matched
+/// </summary>
+/// <param name="mask">Pattern mask, same size as pattern. Non-zero byte means exact match</param>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="out">Found results</param>
+/// <param name="value_offset">Value that will be added to resulting addresses</param>
+/// <returns>Number of found addresses</returns>
+size_t PatternSearch::Search( const std::vector<uint8_t>& mask, void* scanStart, size_t scanSize, std::vector<ptr_t>& out, ptr_t value_offset /*= 0*/ )
+{
+    if (mask.size() != _pattern.size())
+        return out.size();
+
+    ScanSink sink;
+    sink.out = &out;
+    ScanBuffer( mask.data(), scanStart, scanSize, sink, value_offset );
 
     return out.size();
 }
 
+/// <summary>
+/// Full pattern match, no wildcards.
+/// Uses SIMD anchor scan, BoyerMooreHorspool algorithm if CPU lacks SSE2.
+/// </summary>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="out">Found results</param>
+/// <param name="value_offset">Value that will be added to resulting addresses</param>
+/// <returns>Number of found addresses</returns>
+size_t PatternSearch::Search( void* scanStart, size_t scanSize, std::vector<ptr_t>& out, ptr_t value_offset /*= 0*/ )
+{
+    ScanSink sink;
+    sink.out = &out;
+    ScanBuffer( nullptr, scanStart, scanSize, sink, value_offset );
+
+    return out.size();
+}
+
+/// <summary>
+/// Pattern matching with wildcards, every match is passed to callback
+/// </summary>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="visitor">Match callback, returns false to stop search</param>
+/// <param name="value_offset">Value that will be added to resulting addresses</param>
+/// <returns>Number of visited matches</returns>
+size_t PatternSearch::Search( uint8_t wildcard, void* scanStart, size_t scanSize, const fnVisitor& visitor, ptr_t value_offset /*= 0*/ )
+{
+    return Search( WildcardMask( _pattern, wildcard ), scanStart, scanSize, visitor, value_offset );
+}
+
+/// <summary>
+/// Pattern matching with mask, every match is passed to callback
+/// </summary>
+/// <param name="mask">Pattern mask, same size as pattern. Non-zero byte means exact match</param>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="visitor">Match callback, returns false to stop search</param>
+/// <param name="value_offset">Value that will be added to resulting addresses</param>
+/// <returns>Number of visited matches</returns>
+size_t PatternSearch::Search( const std::vector<uint8_t>& mask, void* scanStart, size_t scanSize, const fnVisitor& visitor, ptr_t value_offset /*= 0*/ )
+{
+    if (mask.size() != _pattern.size())
+        return 0;
+
+    ScanSink sink;
+    sink.visitor = &visitor;
+
+    return ScanBuffer( mask.data(), scanStart, scanSize, sink, value_offset );
+}
+
+/// <summary>
+/// Full pattern match, every match is passed to callback
+/// </summary>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="visitor">Match callback, returns false to stop search</param>
+/// <param name="value_offset">Value that will be added to resulting addresses</param>
+/// <returns>Number of visited matches</returns>
+size_t PatternSearch::Search( void* scanStart, size_t scanSize, const fnVisitor& visitor, ptr_t value_offset /*= 0*/ )
+{
+    ScanSink sink;
+    sink.visitor = &visitor;
+
+    return ScanBuffer( nullptr, scanStart, scanSize, sink, value_offset );
+}
+
+/// <summary>
+/// Find first match of pattern with wildcards. Scan stops at the first verified match
+/// </summary>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="value_offset">Value that will be added to resulting address</param>
+/// <returns>Found address, 0 if not found</returns>
+ptr_t PatternSearch::SearchFirst( uint8_t wildcard, void* scanStart, size_t scanSize, ptr_t value_offset /*= 0*/ )
+{
+    return SearchFirst( WildcardMask( _pattern, wildcard ), scanStart, scanSize, value_offset );
+}
+
+/// <summary>
+/// Find first match of pattern with mask. Scan stops at the first verified match
+/// </summary>
+/// <param name="mask">Pattern mask, same size as pattern. Non-zero byte means exact match</param>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="value_offset">Value that will be added to resulting address</param>
+/// <returns>Found address, 0 if not found</returns>
+ptr_t PatternSearch::SearchFirst( const std::vector<uint8_t>& mask, void* scanStart, size_t scanSize, ptr_t value_offset /*= 0*/ )
+{
+    if (mask.size() != _pattern.size())
+        return 0;
+
+    ScanSink sink;
+    ScanBuffer( mask.data(), scanStart, scanSize, sink, value_offset );
+
+    return sink.first;
+}
+
+/// <summary>
+/// Find first full match. Scan stops at the first verified match
+/// </summary>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="value_offset">Value that will be added to resulting address</param>
+/// <returns>Found address, 0 if not found</returns>
+ptr_t PatternSearch::SearchFirst( void* scanStart, size_t scanSize, ptr_t value_offset /*= 0*/ )
+{
+    ScanSink sink;
+    ScanBuffer( nullptr, scanStart, scanSize, sink, value_offset );
+
+    return sink.first;
+}
+
 /// <summary>
 /// Search pattern in remote process
 /// </summary>
@@ -134,13 +568,9 @@ size_t PatternSearch::Search( void* scanStart, size_t scanSize, std::vector<ptr_
 /// <returns>Number of found addresses</returns>
 size_t PatternSearch::SearchRemote( Process& remote, uint8_t wildcard, ptr_t scanStart, size_t scanSize, std::vector<ptr_t>& out )
 {
-    uint8_t *pBuffer = reinterpret_cast<uint8_t*>(VirtualAlloc( NULL, scanSize, MEM_COMMIT, PAGE_READWRITE ));
-
-    if (pBuffer && remote.memory().Read( scanStart, scanSize, pBuffer ) == STATUS_SUCCESS)
-        Search( wildcard, pBuffer, scanSize, out, scanStart );
-
-    if (pBuffer)
-        VirtualFree( pBuffer, 0, MEM_RELEASE );
+    ScanSink sink;
+    sink.out = &out;
+    ScanRemote( remote, WildcardMask( _pattern, wildcard ).data(), scanStart, scanSize, sink );
 
     return out.size();
 }
@@ -155,15 +585,77 @@ size_t PatternSearch::SearchRemote( Process& remote, uint8_t wildcard, ptr_t sca
 /// <returns>Number of found addresses</returns>
 size_t PatternSearch::SearchRemote( Process& remote, ptr_t scanStart, size_t scanSize, std::vector<ptr_t>& out )
 {
-    uint8_t *pBuffer = reinterpret_cast<uint8_t*>(VirtualAlloc( NULL, scanSize, MEM_COMMIT, PAGE_READWRITE ));
+    ScanSink sink;
+    sink.out = &out;
+    ScanRemote( remote, nullptr, scanStart, scanSize, sink );
 
-    if (pBuffer && remote.memory().Read( scanStart, scanSize, pBuffer ) == STATUS_SUCCESS)
-        Search( pBuffer, scanSize, out, scanStart );
+    return out.size();
+}
 
-    if (pBuffer)
-        VirtualFree( pBuffer, 0, MEM_RELEASE );
+/// <summary>
+/// Search pattern in remote process, every match is passed to callback
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="visitor">Match callback, returns false to stop search</param>
+/// <returns>Number of visited matches</returns>
+size_t PatternSearch::SearchRemote( Process& remote, uint8_t wildcard, ptr_t scanStart, size_t scanSize, const fnVisitor& visitor )
+{
+    ScanSink sink;
+    sink.visitor = &visitor;
 
-    return out.size();
+    return ScanRemote( remote, WildcardMask( _pattern, wildcard ).data(), scanStart, scanSize, sink );
+}
+
+/// <summary>
+/// Search pattern in remote process, every match is passed to callback
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="visitor">Match callback, returns false to stop search</param>
+/// <returns>Number of visited matches</returns>
+size_t PatternSearch::SearchRemote( Process& remote, ptr_t scanStart, size_t scanSize, const fnVisitor& visitor )
+{
+    ScanSink sink;
+    sink.visitor = &visitor;
+
+    return ScanRemote( remote, nullptr, scanStart, scanSize, sink );
+}
+
+/// <summary>
+/// Find first match of pattern with wildcards in remote process.
+/// Region is read in chunks, reading stops at the first verified match
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <returns>Found address, 0 if not found</returns>
+ptr_t PatternSearch::SearchFirstRemote( Process& remote, uint8_t wildcard, ptr_t scanStart, size_t scanSize )
+{
+    ScanSink sink;
+    ScanRemote( remote, WildcardMask( _pattern, wildcard ).data(), scanStart, scanSize, sink );
+
+    return sink.first;
+}
+
+/// <summary>
+/// Find first full match in remote process.
+/// Region is read in chunks, reading stops at the first verified match
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <returns>Found address, 0 if not found</returns>
+ptr_t PatternSearch::SearchFirstRemote( Process& remote, ptr_t scanStart, size_t scanSize )
+{
+    ScanSink sink;
+    ScanRemote( remote, nullptr, scanStart, scanSize, sink );
+
+    return sink.first;
 }
 
 /// <summary>
@@ -176,48 +668,253 @@ size_t PatternSearch::SearchRemote( Process& remote, ptr_t scanStart, size_t sca
 /// <returns>Number of found addresses</returns>
 size_t PatternSearch::SearchRemoteWhole( Process& remote, bool useWildcard, uint8_t wildcard, std::vector<ptr_t>& out )
 {
-    MEMORY_BASIC_INFORMATION64 mbi = { 0 };
-    size_t  bufsize = 1 * 1024 * 1024;  // 1 MB
-    uint8_t *buf = reinterpret_cast<uint8_t*>(VirtualAlloc( 0, bufsize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE ));
+    out.clear();
+
+    if (_pattern.empty())
+        return 0;
+
+    // Pattern size - 1 bytes are carried between chunks, so matches crossing chunk border are found only once
+    RegionStream stream( remote.memory(), STREAM_CHUNK_SIZE, _pattern.size() - 1 );
+    auto& backend = remote.memory().backend();
+
+    if (!NT_SUCCESS( stream.Start( backend.minAddr(), backend.maxAddr() ) ))
+        return 0;
+
+    for (StreamChunk chunk; stream.Next( chunk );)
+    {
+        auto data = const_cast<uint8_t*>(chunk.data);
 
+        if (useWildcard)
+            Search( wildcard, data, chunk.size, out, chunk.address );
+        else
+            Search( data, chunk.size, out, chunk.address );
+    }
+
+    return out.size();
+}
+
+/// <summary>
+/// Search pattern in whole address space of remote process using several threads.
+/// Readable memory is split into work items scanned on a work-stealing pool,
+/// every worker collects matches into its own buffer, buffers are merged in address order.
+/// With maxResults set the lowest maxResults matches in address space are returned, regardless of thread timing
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="useWildcard">True if pattern contains wildcards</param>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <param name="options">Thread count, result limit and cancellation token</param>
+/// <param name="out">Found results, sorted by address</param>
+/// <returns>Number of found addresses</returns>
+size_t PatternSearch::SearchRemoteWhole( Process& remote, bool useWildcard, uint8_t wildcard, const ScanOptions& options, std::vector<ptr_t>& out )
+{
     out.clear();
 
-    auto native = remote.core().native();
+    if (_pattern.empty())
+        return 0;
 
-    for (ptr_t memptr = native->minAddr(); memptr < native->maxAddr(); memptr = mbi.BaseAddress + mbi.RegionSize)
+    //
+    // Work item is a chunk of contiguous readable memory. It's read together with pattern size - 1
+    // following bytes, so matches crossing item border are found, and only by the item they start in
+    //
+    struct WorkItem
+    {
+        ptr_t address = 0;      // Item start
+        size_t size = 0;        // Item size
+        size_t extra = 0;       // Bytes read past item end
+        size_t worker = 0;      // Worker that scanned item
+        size_t first = 0;       // Start of item matches in worker buffer
+        size_t count = 0;       // Number of item matches
+    };
+
+    auto& backend = remote.memory().backend();
+    size_t chunkSize = options.chunkSize != 0 ? options.chunkSize : STREAM_CHUNK_SIZE;
+    size_t overlap = _pattern.size() - 1;
+
+    vecRegions ranges;
+    std::vector<WorkItem> items;
+    RegionStream::Readable( remote.memory(), backend.minAddr(), backend.maxAddr(), ranges );
+
+    for (size_t i = 0; i < ranges.size();)
     {
-        auto status = remote.core().native()->VirtualQueryExT( memptr, &mbi );
+        // Adjacent regions form one span
+        ptr_t start = ranges[i].BaseAddress;
+        ptr_t end = start + ranges[i].RegionSize;
+        for (i++; i < ranges.size() && ranges[i].BaseAddress == end; i++)
+            end += ranges[i].RegionSize;
 
-        if (status == STATUS_INVALID_PARAMETER || status == STATUS_ACCESS_DENIED)
-            break;
-        else if (status != STATUS_SUCCESS)
-            continue;
+        for (ptr_t ptr = start; ptr < end; ptr += chunkSize)
+        {
+            WorkItem item;
+            item.address = ptr;
+            item.size = static_cast<size_t>(std::min<ptr_t>( end - ptr, chunkSize ));
+            item.extra = static_cast<size_t>(std::min<ptr_t>( end - ptr - item.size, overlap ));
+            items.emplace_back( item );
+        }
+    }
 
-        // Filter regions
-        if (mbi.State != MEM_COMMIT || mbi.Protect == PAGE_NOACCESS/*|| !(mbi.Protect & PAGE_READWRITE)*/)
-            continue;
+    ThreadPool pool( options.threads );
+    CancellationToken stop;
+    CriticalSection countLock;
+    std::vector<uint8_t> scanned( items.size(), 0 );
+
+    // Items past cutoff can't hold any of the lowest maxResults matches and are skipped,
+    // items below it are always scanned, so result doesn't depend on order items complete in
+    std::atomic<size_t> cutoff{ items.size() };
+    std::vector<std::vector<uint8_t>> buffers( pool.threads() );
+    std::vector<std::vector<ptr_t>> results( pool.threads() );
 
-        // Reallocate buffer
-        if (mbi.RegionSize > bufsize)
+    // Workers read through backend directly, whole chunks would only evict useful pages from ProcessMemory read cache.
+    // These reads aren't counted in ProcessMemory statistics
+    pool.Run( items.size(), [&]( size_t index, size_t worker )
+    {
+        if (options.cancel != nullptr && options.cancel->cancelled())
         {
-            bufsize = static_cast<size_t>(mbi.RegionSize);
-            VirtualFree( buf, 0, MEM_RELEASE );
-            buf = reinterpret_cast<uint8_t*>(VirtualAlloc( 0, bufsize, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE ));
+            stop.Cancel();
+            return;
         }
 
-        if (remote.memory().Read( memptr, static_cast<size_t>(mbi.RegionSize), buf ) != STATUS_SUCCESS)
-            continue;
+        if (index > cutoff)
+            return;
 
-        if (useWildcard)
-            Search( wildcard, buf, static_cast<size_t>(mbi.RegionSize), out, memptr );
-        else
-            Search( buf, static_cast<size_t>(mbi.RegionSize), out, memptr );
-    }
+        auto& item = items[index];
+        auto& buf = buffers[worker];
+        auto& res = results[worker];
+        size_t size = item.size + item.extra;
+
+        if (buf.size() < size)
+            buf.resize( chunkSize + overlap );
+
+        // Memory past item end could have been released already, item itself is still worth scanning
+        bool readable = NT_SUCCESS( backend.Read( item.address, buf.data(), size ) );
+        if (!readable && item.extra != 0)
+        {
+            size = item.size;
+            readable = NT_SUCCESS( backend.Read( item.address, buf.data(), size ) );
+        }
+
+        // Unreadable item still counts as scanned, with no matches
+        if (readable)
+        {
+            item.worker = worker;
+            item.first = res.size();
 
-    VirtualFree( buf, 0, MEM_RELEASE );
+            if (useWildcard)
+                Search( wildcard, buf.data(), size, res, item.address );
+            else
+                Search( buf.data(), size, res, item.address );
+
+            item.count = res.size() - item.first;
+        }
+
+        // Scanned items up to the first one where enough matches are collected already hold the lowest matches
+        if (options.maxResults != 0)
+        {
+            CSLock lck( countLock );
+
+            scanned[index] = 1;
+            for (size_t i = 0, sum = 0; i < cutoff; i++)
+            {
+                sum += scanned[i] ? items[i].count : 0;
+                if (sum >= options.maxResults)
+                {
+                    cutoff = i;
+                    break;
+                }
+            }
+        }
+    }, &stop );
+
+    // Items are ordered by address, so concatenation in item order is sorted.
+    // Every item up to cutoff was scanned and together they hold at least maxResults matches
+    size_t total = 0;
+    for (auto& item : items)
+        total += item.count;
+
+    out.reserve( options.maxResults != 0 ? std::min( total, options.maxResults ) : total );
+
+    for (auto& item : items)
+    {
+        auto& res = results[item.worker];
+        out.insert( out.end(), res.begin() + item.first, res.begin() + item.first + item.count );
+
+        if (options.maxResults != 0 && out.size() >= options.maxResults)
+        {
+            out.resize( options.maxResults );
+            break;
+        }
+    }
 
     return out.size();
 }
 
+/// <summary>
+/// Scan local buffer
+/// </summary>
+/// <param name="mask">Pattern mask, 0 marks wildcard. nullptr for full match</param>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="sink">Match receiver</param>
+/// <param name="value_offset">Value that will be added to resulting addresses</param>
+/// <returns>Number of reported matches</returns>
+size_t PatternSearch::ScanBuffer( const uint8_t* mask, void* scanStart, size_t scanSize, ScanSink& sink, ptr_t value_offset )
+{
+    auto data = reinterpret_cast<const uint8_t*>(scanStart);
+    ptr_t base = value_offset != 0 ? value_offset : reinterpret_cast<ptr_t>(scanStart);
+
+    // Masked search reports non-overlapping matches, full match reports all of them
+    if (mask != nullptr || CpuFeatures::Get().sse2)
+    {
+        ScanPattern pattern;
+        Prepare( _pattern, mask, mask == nullptr, pattern );
+        Scan( data, scanSize, pattern, sink, base );
+    }
+    else
+        ScanBMH( data, scanSize, _pattern, sink, base );
+
+    return sink.count;
+}
+
+/// <summary>
+/// Scan memory of remote process.
+/// In first match mode region is read in chunks, so the rest of it isn't read once match is found
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="mask">Pattern mask, 0 marks wildcard. nullptr for full match</param>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="sink">Match receiver</param>
+/// <returns>Number of reported matches</returns>
+size_t PatternSearch::ScanRemote( Process& remote, const uint8_t* mask, ptr_t scanStart, size_t scanSize, ScanSink& sink )
+{
+    if (_pattern.empty() || scanSize == 0)
+        return sink.count;
+
+    // Chunk is read together with pattern size - 1 following bytes, so matches crossing chunk border are found
+    bool first = sink.out == nullptr && sink.visitor == nullptr;
+    size_t chunkSize = first ? std::min<size_t>( scanSize, STREAM_CHUNK_SIZE ) : scanSize;
+    size_t overlap = std::min( _pattern.size() - 1, scanSize - chunkSize );
+
+    uint8_t *pBuffer = reinterpret_cast<uint8_t*>(VirtualAlloc( NULL, chunkSize + overlap, MEM_COMMIT, PAGE_READWRITE ));
+    if (pBuffer == nullptr)
+        return sink.count;
+
+    for (size_t offset = 0; offset < scanSize; offset += chunkSize)
+    {
+        size_t size = std::min( chunkSize, scanSize - offset );
+        size_t extra = std::min( overlap, scanSize - offset - size );
+
+        if (remote.memory().Read( scanStart + offset, size + extra, pBuffer ) != STATUS_SUCCESS)
+            break;
+
+        size_t found = sink.count;
+        ScanBuffer( mask, pBuffer, size + extra, sink, scanStart + offset );
+
+        if (first && sink.count != found)
+            break;
+    }
+
+    VirtualFree( pBuffer, 0, MEM_RELEASE );
+    return sink.count;
+}
 
 }
\ No newline at end of file
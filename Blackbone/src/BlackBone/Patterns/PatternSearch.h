@@ -4,13 +4,32 @@
 
 #include <string>
 #include <vector>
+#include <functional>
 #include <initializer_list>
 
 namespace blackbone
 {
 
+class CancellationToken;
+struct ScanSink;
+
+/// <summary>
+/// Options of parallel whole address space search
+/// </summary>
+struct ScanOptions
+{
+    size_t threads = 0;                         // Worker threads, 0 - one per logical CPU
+    size_t maxResults = 0;                      // Stop once this many matches are found, 0 - no limit
+    size_t chunkSize = 0;                       // Work item size, 0 - STREAM_CHUNK_SIZE
+    const CancellationToken* cancel = nullptr;  // Search is stopped once token is set
+};
+
 class PatternSearch
 {
+public:
+    // Match callback. Return false to stop search
+    typedef std::function<bool( ptr_t address )> fnVisitor;
+
 public:
     BLACKBONE_API PatternSearch( const std::vector<uint8_t>& pattern );
     BLACKBONE_API PatternSearch( const std::initializer_list<uint8_t>&& pattern );
@@ -21,8 +40,9 @@ public:
     BLACKBONE_API ~PatternSearch();
 
     /// <summary>
-    /// Default pattern matching with wildcards.
-    /// std::search is approximately 2x faster than naive approach.
+    /// Pattern matching with wildcards.
+    /// Candidates are found by comparing two rarest fixed bytes 32 or 64 positions at a time (SSE2/AVX2),
+    /// then checked against the whole pattern
     /// </summary>
     /// <param name="wildcard">Pattern wildcard</param>
     /// <param name="scanStart">Starting address</param>
@@ -32,9 +52,21 @@ public:
     /// <returns>Number of found addresses</returns>
     BLACKBONE_API size_t Search( uint8_t wildcard, void* scanStart, size_t scanSize, std::vector<ptr_t>& out, ptr_t value_offset = 0 );
 
+    /// <summary>
+    /// Pattern matching with mask. Pattern bytes with zero mask are wildcards,
+    /// so unlike single wildcard value any byte can be matched
+    /// </summary>
+    /// <param name="mask">Pattern mask, same size as pattern. Non-zero byte means exact match</param>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="out">Found results</param>
+    /// <param name="value_offset">Value that will be added to resulting addresses</param>
+    /// <returns>Number of found addresses</returns>
+    BLACKBONE_API size_t Search( const std::vector<uint8_t>& mask, void* scanStart, size_t scanSize, std::vector<ptr_t>& out, ptr_t value_offset = 0 );
+
     /// <summary>
     /// Full pattern match, no wildcards.
-    /// Uses BoyerMooreHorspool algorithm.
+    /// Uses SIMD anchor scan, BoyerMooreHorspool algorithm if CPU lacks SSE2.
     /// </summary>
     /// <param name="scanStart">Starting address</param>
     /// <param name="scanSize">Size of region to scan</param>
@@ -43,6 +75,67 @@ public:
     /// <returns>Number of found addresses</returns>
     BLACKBONE_API size_t Search( void* scanStart, size_t scanSize, std::vector<ptr_t>& out, ptr_t value_offset = 0 );
 
+    /// <summary>
+    /// Pattern matching with wildcards, every match is passed to callback
+    /// </summary>
+    /// <param name="wildcard">Pattern wildcard</param>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="visitor">Match callback, returns false to stop search</param>
+    /// <param name="value_offset">Value that will be added to resulting addresses</param>
+    /// <returns>Number of visited matches</returns>
+    BLACKBONE_API size_t Search( uint8_t wildcard, void* scanStart, size_t scanSize, const fnVisitor& visitor, ptr_t value_offset = 0 );
+
+    /// <summary>
+    /// Pattern matching with mask, every match is passed to callback
+    /// </summary>
+    /// <param name="mask">Pattern mask, same size as pattern. Non-zero byte means exact match</param>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="visitor">Match callback, returns false to stop search</param>
+    /// <param name="value_offset">Value that will be added to resulting addresses</param>
+    /// <returns>Number of visited matches</returns>
+    BLACKBONE_API size_t Search( const std::vector<uint8_t>& mask, void* scanStart, size_t scanSize, const fnVisitor& visitor, ptr_t value_offset = 0 );
+
+    /// <summary>
+    /// Full pattern match, every match is passed to callback
+    /// </summary>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="visitor">Match callback, returns false to stop search</param>
+    /// <param name="value_offset">Value that will be added to resulting addresses</param>
+    /// <returns>Number of visited matches</returns>
+    BLACKBONE_API size_t Search( void* scanStart, size_t scanSize, const fnVisitor& visitor, ptr_t value_offset = 0 );
+
+    /// <summary>
+    /// Find first match of pattern with wildcards. Scan stops at the first verified match
+    /// </summary>
+    /// <param name="wildcard">Pattern wildcard</param>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="value_offset">Value that will be added to resulting address</param>
+    /// <returns>Found address, 0 if not found</returns>
+    BLACKBONE_API ptr_t SearchFirst( uint8_t wildcard, void* scanStart, size_t scanSize, ptr_t value_offset = 0 );
+
+    /// <summary>
+    /// Find first match of pattern with mask. Scan stops at the first verified match
+    /// </summary>
+    /// <param name="mask">Pattern mask, same size as pattern. Non-zero byte means exact match</param>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="value_offset">Value that will be added to resulting address</param>
+    /// <returns>Found address, 0 if not found</returns>
+    BLACKBONE_API ptr_t SearchFirst( const std::vector<uint8_t>& mask, void* scanStart, size_t scanSize, ptr_t value_offset = 0 );
+
+    /// <summary>
+    /// Find first full match. Scan stops at the first verified match
+    /// </summary>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="value_offset">Value that will be added to resulting address</param>
+    /// <returns>Found address, 0 if not found</returns>
+    BLACKBONE_API ptr_t SearchFirst( void* scanStart, size_t scanSize, ptr_t value_offset = 0 );
+
     /// <summary>
     /// Search pattern in remote process
     /// </summary>
@@ -64,6 +157,48 @@ public:
     /// <returns>Number of found addresses</returns>
     BLACKBONE_API size_t SearchRemote( class Process& remote, ptr_t scanStart, size_t scanSize, std::vector<ptr_t>& out );
 
+    /// <summary>
+    /// Search pattern in remote process, every match is passed to callback
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="wildcard">Pattern wildcard</param>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="visitor">Match callback, returns false to stop search</param>
+    /// <returns>Number of visited matches</returns>
+    BLACKBONE_API size_t SearchRemote( class Process& remote, uint8_t wildcard, ptr_t scanStart, size_t scanSize, const fnVisitor& visitor );
+
+    /// <summary>
+    /// Search pattern in remote process, every match is passed to callback
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="visitor">Match callback, returns false to stop search</param>
+    /// <returns>Number of visited matches</returns>
+    BLACKBONE_API size_t SearchRemote( class Process& remote, ptr_t scanStart, size_t scanSize, const fnVisitor& visitor );
+
+    /// <summary>
+    /// Find first match of pattern with wildcards in remote process.
+    /// Region is read in chunks, reading stops at the first verified match
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="wildcard">Pattern wildcard</param>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <returns>Found address, 0 if not found</returns>
+    BLACKBONE_API ptr_t SearchFirstRemote( class Process& remote, uint8_t wildcard, ptr_t scanStart, size_t scanSize );
+
+    /// <summary>
+    /// Find first full match in remote process.
+    /// Region is read in chunks, reading stops at the first verified match
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <returns>Found address, 0 if not found</returns>
+    BLACKBONE_API ptr_t SearchFirstRemote( class Process& remote, ptr_t scanStart, size_t scanSize );
+
     /// <summary>
     /// Search pattern in whole address space of remote process
     /// </summary>
@@ -74,6 +209,45 @@ public:
     /// <returns>Number of found addresses</returns>
     BLACKBONE_API size_t SearchRemoteWhole( class Process& remote, bool useWildcard, uint8_t wildcard, std::vector<ptr_t>& out );
 
+    /// <summary>
+    /// Search pattern in whole address space of remote process using several threads.
+    /// Readable memory is split into work items scanned on a work-stealing pool,
+    /// every worker collects matches into its own buffer, buffers are merged in address order.
+    /// With maxResults set the lowest of the found addresses are returned,
+    /// they aren't necessarily the first matches in address space
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="useWildcard">True if pattern contains wildcards</param>
+    /// <param name="wildcard">Pattern wildcard</param>
+    /// <param name="options">Thread count, result limit and cancellation token</param>
+    /// <param name="out">Found results, sorted by address</param>
+    /// <returns>Number of found addresses</returns>
+    BLACKBONE_API size_t SearchRemoteWhole( class Process& remote, bool useWildcard, uint8_t wildcard, const ScanOptions& options, std::vector<ptr_t>& out );
+
+private:
+    /// <summary>
+    /// Scan local buffer
+    /// </summary>
+    /// <param name="mask">Pattern mask, 0 marks wildcard. nullptr for full match</param>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="sink">Match receiver</param>
+    /// <param name="value_offset">Value that will be added to resulting addresses</param>
+    /// <returns>Number of reported matches</returns>
+    size_t ScanBuffer( const uint8_t* mask, void* scanStart, size_t scanSize, ScanSink& sink, ptr_t value_offset );
+
+    /// <summary>
+    /// Scan memory of remote process.
+    /// In first match mode region is read in chunks, so the rest of it isn't read once match is found
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="mask">Pattern mask, 0 marks wildcard. nullptr for full match</param>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="sink">Match receiver</param>
+    /// <returns>Number of reported matches</returns>
+    size_t ScanRemote( class Process& remote, const uint8_t* mask, ptr_t scanStart, size_t scanSize, ScanSink& sink );
+
 private:
     std::vector<uint8_t> _pattern;      // Pattern to search
 };
@@ -0,0 +1,339 @@
+#include "PatternSet.h"
+#include "Signature.h"
+#include "../Include/Winheaders.h"
+#include "../Process/Process.h"
+#include "../Process/RegionStream.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+PatternSet::PatternSet()
+{
+}
+
+PatternSet::~PatternSet()
+{
+}
+
+/// <summary>
+/// Add pattern without wildcards
+/// </summary>
+/// <param name="pattern">Pattern bytes</param>
+/// <returns>Pattern id</returns>
+size_t PatternSet::Add( const std::vector<uint8_t>& pattern )
+{
+    return Add( pattern.data(), nullptr, pattern.size() );
+}
+
+/// <summary>
+/// Add pattern with wildcards
+/// </summary>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <param name="pattern">Pattern bytes</param>
+/// <returns>Pattern id</returns>
+size_t PatternSet::Add( uint8_t wildcard, const std::vector<uint8_t>& pattern )
+{
+    return AddWildcard( pattern.data(), pattern.size(), wildcard );
+}
+
+/// <summary>
+/// Add pattern without wildcards
+/// </summary>
+/// <param name="pattern">Pattern bytes</param>
+/// <param name="len">Pattern length, 0 if pattern is null-terminated</param>
+/// <returns>Pattern id</returns>
+size_t PatternSet::Add( const char* pattern, size_t len /*= 0*/ )
+{
+    return Add( reinterpret_cast<const uint8_t*>(pattern), nullptr, len ? len : strlen( pattern ) );
+}
+
+/// <summary>
+/// Add pattern with wildcards
+/// </summary>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <param name="pattern">Pattern bytes</param>
+/// <param name="len">Pattern length, 0 if pattern is null-terminated</param>
+/// <returns>Pattern id</returns>
+size_t PatternSet::Add( uint8_t wildcard, const char* pattern, size_t len /*= 0*/ )
+{
+    return AddWildcard( reinterpret_cast<const uint8_t*>(pattern), len ? len : strlen( pattern ), wildcard );
+}
+
+/// <summary>
+/// Add compiled signature. Captures can be resolved with Signature::Resolve
+/// </summary>
+/// <param name="signature">Signature</param>
+/// <returns>Pattern id</returns>
+size_t PatternSet::Add( const Signature& signature )
+{
+    return Add( signature.value().data(), signature.mask().data(), signature.size() );
+}
+
+/// <summary>
+/// Add pattern with wildcards
+/// </summary>
+/// <param name="pattern">Pattern bytes</param>
+/// <param name="size">Pattern size</param>
+/// <param name="wildcard">Pattern wildcard</param>
+/// <returns>Pattern id</returns>
+size_t PatternSet::AddWildcard( const uint8_t* pattern, size_t size, uint8_t wildcard )
+{
+    std::vector<uint8_t> mask( size );
+    for (size_t i = 0; i < size; i++)
+        mask[i] = pattern[i] != wildcard ? 0xFF : 0;
+
+    return Add( pattern, mask.data(), size );
+}
+
+/// <summary>
+/// Add pattern
+/// </summary>
+/// <param name="pattern">Pattern bytes</param>
+/// <param name="mask">Pattern mask, 0 marks wildcard. nullptr if every byte is fixed</param>
+/// <param name="size">Pattern size</param>
+/// <returns>Pattern id</returns>
+size_t PatternSet::Add( const uint8_t* pattern, const uint8_t* mask, size_t size )
+{
+    Entry entry;
+    entry.value.assign( size, 0 );
+    entry.mask.assign( size, 0 );
+
+    for (size_t i = 0, run = 0; i < size; i++)
+    {
+        if (mask != nullptr && mask[i] == 0)
+        {
+            run = 0;
+            continue;
+        }
+
+        entry.value[i] = pattern[i];
+        entry.mask[i] = 0xFF;
+
+        // Longest run of fixed bytes becomes automaton key
+        if (++run > entry.keyEnd - entry.keyStart)
+        {
+            entry.keyStart = i + 1 - run;
+            entry.keyEnd = i + 1;
+        }
+    }
+
+    _patterns.emplace_back( std::move( entry ) );
+    _maxSize = std::max( _maxSize, size );
+    _compiled = false;
+
+    return _patterns.size() - 1;
+}
+
+/// <summary>
+/// Build automaton from keys of all patterns
+/// </summary>
+void PatternSet::Compile()
+{
+    std::vector<std::vector<uint32_t>> output( 1 );
+    uint32_t states = 1;
+
+    _next.assign( 256, 0 );
+    _anyIds.clear();
+
+    // Trie of keys, 0 marks missing transition
+    for (size_t id = 0; id < _patterns.size(); id++)
+    {
+        auto& entry = _patterns[id];
+        if (entry.keyEnd == entry.keyStart)
+        {
+            // Empty pattern never matches
+            if (!entry.value.empty())
+                _anyIds.emplace_back( id );
+
+            continue;
+        }
+
+        uint32_t state = 0;
+        for (size_t i = entry.keyStart; i < entry.keyEnd; i++)
+        {
+            size_t idx = state * 256 + entry.value[i];
+            if (_next[idx] == 0)
+            {
+                _next[idx] = states++;
+                _next.resize( states * 256, 0 );
+                output.emplace_back();
+            }
+
+            state = _next[idx];
+        }
+
+        output[state].emplace_back( static_cast<uint32_t>(id) );
+    }
+
+    // Failure links in breadth-first order, missing transitions are taken from failure state
+    std::vector<uint32_t> fail( states, 0 ), queue;
+    queue.reserve( states );
+
+    for (uint32_t c = 0; c < 256; c++)
+        if (_next[c] != 0)
+            queue.emplace_back( _next[c] );
+
+    for (size_t head = 0; head < queue.size(); head++)
+    {
+        uint32_t state = queue[head];
+        auto& inherited = output[fail[state]];
+        output[state].insert( output[state].end(), inherited.begin(), inherited.end() );
+
+        for (uint32_t c = 0; c < 256; c++)
+        {
+            uint32_t& target = _next[state * 256 + c];
+            if (target != 0)
+            {
+                fail[target] = _next[fail[state] * 256 + c];
+                queue.emplace_back( target );
+            }
+            else
+                target = _next[fail[state] * 256 + c];
+        }
+    }
+
+    // Flatten outputs
+    _outFirst.assign( states + 1, 0 );
+    _outIds.clear();
+
+    for (uint32_t state = 0; state < states; state++)
+    {
+        _outFirst[state] = static_cast<uint32_t>(_outIds.size());
+        _outIds.insert( _outIds.end(), output[state].begin(), output[state].end() );
+    }
+
+    _outFirst[states] = static_cast<uint32_t>(_outIds.size());
+
+    // Transition yields row offset directly, low bit marks state with output
+    for (auto& target : _next)
+        target = target * 256 | (_outFirst[target] != _outFirst[target + 1] ? 1 : 0);
+
+    _compiled = true;
+}
+
+/// <summary>
+/// Single pass over buffer
+/// </summary>
+/// <param name="data">Data to scan</param>
+/// <param name="size">Data size</param>
+/// <param name="skip">Matches ending at or before this offset are ignored</param>
+/// <param name="out">Found results</param>
+/// <param name="base">Address of data[0]</param>
+void PatternSet::Scan( const uint8_t* data, size_t size, size_t skip, std::vector<PatternMatch>& out, ptr_t base )
+{
+    if (!_compiled)
+        Compile();
+
+    size_t first = out.size();
+    const uint32_t* next = _next.data();
+    uint32_t row = 0;
+
+    for (size_t i = 0; i < size; i++)
+    {
+        uint32_t target = next[row + data[i]];
+        row = target & ~0xFFu;
+
+        if ((target & 1) == 0)
+            continue;
+
+        uint32_t state = row / 256;
+        for (uint32_t k = _outFirst[state]; k < _outFirst[state + 1]; k++)
+        {
+            uint32_t id = _outIds[k];
+            auto& entry = _patterns[id];
+
+            // Key hit, check whole pattern around it
+            if (i + 1 < entry.keyEnd)
+                continue;
+
+            size_t start = i + 1 - entry.keyEnd;
+            size_t end = start + entry.value.size();
+            if (end > size || end <= skip)
+                continue;
+
+            bool match = true;
+            for (size_t j = 0; j < entry.value.size() && match; j++)
+                match = (data[start + j] & entry.mask[j]) == entry.value[j];
+
+            if (match)
+                out.emplace_back( id, base + start );
+        }
+    }
+
+    for (auto id : _anyIds)
+    {
+        size_t len = _patterns[id].value.size();
+        for (size_t start = skip >= len ? skip - len + 1 : 0; start + len <= size; start++)
+            out.emplace_back( id, base + start );
+    }
+
+    std::sort( out.begin() + first, out.end(), []( const PatternMatch& a, const PatternMatch& b )
+    {
+        return a.address < b.address || (a.address == b.address && a.id < b.id);
+    } );
+}
+
+/// <summary>
+/// Search all patterns in a single pass
+/// </summary>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="out">Found results, sorted by address</param>
+/// <param name="value_offset">Value that will be added to resulting addresses</param>
+/// <returns>Number of found matches</returns>
+size_t PatternSet::Search( void* scanStart, size_t scanSize, std::vector<PatternMatch>& out, ptr_t value_offset /*= 0*/ )
+{
+    Scan( reinterpret_cast<const uint8_t*>(scanStart), scanSize, 0, out, value_offset != 0 ? value_offset : reinterpret_cast<ptr_t>(scanStart) );
+    return out.size();
+}
+
+/// <summary>
+/// Search all patterns in remote process
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="out">Found results, sorted by address</param>
+/// <returns>Number of found matches</returns>
+size_t PatternSet::SearchRemote( Process& remote, ptr_t scanStart, size_t scanSize, std::vector<PatternMatch>& out )
+{
+    uint8_t *pBuffer = reinterpret_cast<uint8_t*>(VirtualAlloc( NULL, scanSize, MEM_COMMIT, PAGE_READWRITE ));
+
+    if (pBuffer && remote.memory().Read( scanStart, scanSize, pBuffer ) == STATUS_SUCCESS)
+        Search( pBuffer, scanSize, out, scanStart );
+
+    if (pBuffer)
+        VirtualFree( pBuffer, 0, MEM_RELEASE );
+
+    return out.size();
+}
+
+/// <summary>
+/// Search all patterns in whole address space of remote process
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="out">Found results, sorted by address</param>
+/// <returns>Number of found matches</returns>
+size_t PatternSet::SearchRemoteWhole( Process& remote, std::vector<PatternMatch>& out )
+{
+    out.clear();
+
+    if (_maxSize == 0)
+        return 0;
+
+    // Longest pattern size - 1 bytes are carried between chunks, matches inside carried bytes were reported already
+    RegionStream stream( remote.memory(), STREAM_CHUNK_SIZE, _maxSize - 1 );
+    auto& backend = remote.memory().backend();
+
+    if (!NT_SUCCESS( stream.Start( backend.minAddr(), backend.maxAddr() ) ))
+        return 0;
+
+    for (StreamChunk chunk; stream.Next( chunk );)
+        Scan( chunk.data, chunk.size, chunk.overlap, out, chunk.address );
+
+    return out.size();
+}
+
+}
@@ -0,0 +1,160 @@
+#pragma once
+
+#include "../Include/Types.h"
+
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Pattern found by PatternSet
+/// </summary>
+struct PatternMatch
+{
+    size_t id;          // Pattern id returned by PatternSet::Add
+    ptr_t address;      // Match address
+
+    PatternMatch( size_t id_, ptr_t address_ )
+        : id( id_ ), address( address_ ) { }
+};
+
+/// <summary>
+/// Set of patterns searched in a single pass.
+/// Longest run of fixed bytes of every pattern is added to Aho-Corasick automaton,
+/// each hit is then checked against the whole pattern
+/// </summary>
+class PatternSet
+{
+public:
+    BLACKBONE_API PatternSet();
+    BLACKBONE_API ~PatternSet();
+
+    /// <summary>
+    /// Add pattern without wildcards
+    /// </summary>
+    /// <param name="pattern">Pattern bytes</param>
+    /// <returns>Pattern id</returns>
+    BLACKBONE_API size_t Add( const std::vector<uint8_t>& pattern );
+
+    /// <summary>
+    /// Add pattern with wildcards
+    /// </summary>
+    /// <param name="wildcard">Pattern wildcard</param>
+    /// <param name="pattern">Pattern bytes</param>
+    /// <returns>Pattern id</returns>
+    BLACKBONE_API size_t Add( uint8_t wildcard, const std::vector<uint8_t>& pattern );
+
+    /// <summary>
+    /// Add pattern without wildcards
+    /// </summary>
+    /// <param name="pattern">Pattern bytes</param>
+    /// <param name="len">Pattern length, 0 if pattern is null-terminated</param>
+    /// <returns>Pattern id</returns>
+    BLACKBONE_API size_t Add( const char* pattern, size_t len = 0 );
+
+    /// <summary>
+    /// Add pattern with wildcards
+    /// </summary>
+    /// <param name="wildcard">Pattern wildcard</param>
+    /// <param name="pattern">Pattern bytes</param>
+    /// <param name="len">Pattern length, 0 if pattern is null-terminated</param>
+    /// <returns>Pattern id</returns>
+    BLACKBONE_API size_t Add( uint8_t wildcard, const char* pattern, size_t len = 0 );
+
+    /// <summary>
+    /// Add compiled signature. Captures can be resolved with Signature::Resolve
+    /// </summary>
+    /// <param name="signature">Signature</param>
+    /// <returns>Pattern id</returns>
+    BLACKBONE_API size_t Add( const class Signature& signature );
+
+    /// <summary>
+    /// Search all patterns in a single pass
+    /// </summary>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="out">Found results, sorted by address</param>
+    /// <param name="value_offset">Value that will be added to resulting addresses</param>
+    /// <returns>Number of found matches</returns>
+    BLACKBONE_API size_t Search( void* scanStart, size_t scanSize, std::vector<PatternMatch>& out, ptr_t value_offset = 0 );
+
+    /// <summary>
+    /// Search all patterns in remote process
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="out">Found results, sorted by address</param>
+    /// <returns>Number of found matches</returns>
+    BLACKBONE_API size_t SearchRemote( class Process& remote, ptr_t scanStart, size_t scanSize, std::vector<PatternMatch>& out );
+
+    /// <summary>
+    /// Search all patterns in whole address space of remote process
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="out">Found results, sorted by address</param>
+    /// <returns>Number of found matches</returns>
+    BLACKBONE_API size_t SearchRemoteWhole( class Process& remote, std::vector<PatternMatch>& out );
+
+    BLACKBONE_API inline size_t size() const { return _patterns.size(); }
+
+private:
+    /// <summary>
+    /// Compiled pattern
+    /// </summary>
+    struct Entry
+    {
+        std::vector<uint8_t> value;     // Pattern bytes, wildcards are zeroed
+        std::vector<uint8_t> mask;      // 0xFF for fixed byte, 0 for wildcard
+        size_t keyStart = 0;            // Start of the longest run of fixed bytes
+        size_t keyEnd = 0;              // End of the longest run of fixed bytes
+    };
+
+    /// <summary>
+    /// Add pattern
+    /// </summary>
+    /// <param name="pattern">Pattern bytes</param>
+    /// <param name="mask">Pattern mask, 0 marks wildcard. nullptr if every byte is fixed</param>
+    /// <param name="size">Pattern size</param>
+    /// <returns>Pattern id</returns>
+    size_t Add( const uint8_t* pattern, const uint8_t* mask, size_t size );
+
+    /// <summary>
+    /// Add pattern with wildcards
+    /// </summary>
+    /// <param name="pattern">Pattern bytes</param>
+    /// <param name="size">Pattern size</param>
+    /// <param name="wildcard">Pattern wildcard</param>
+    /// <returns>Pattern id</returns>
+    size_t AddWildcard( const uint8_t* pattern, size_t size, uint8_t wildcard );
+
+    /// <summary>
+    /// Build automaton from keys of all patterns
+    /// </summary>
+    void Compile();
+
+    /// <summary>
+    /// Single pass over buffer
+    /// </summary>
+    /// <param name="data">Data to scan</param>
+    /// <param name="size">Data size</param>
+    /// <param name="skip">Matches ending at or before this offset are ignored</param>
+    /// <param name="out">Found results</param>
+    /// <param name="base">Address of data[0]</param>
+    void Scan( const uint8_t* data, size_t size, size_t skip, std::vector<PatternMatch>& out, ptr_t base );
+
+    PatternSet( const PatternSet& ) = delete;
+    PatternSet& operator =( const PatternSet& ) = delete;
+
+private:
+    std::vector<Entry> _patterns;       // Added patterns, index is pattern id
+    std::vector<uint32_t> _next;        // Automaton transitions, 256 per state. Values are state * 256 | has output
+    std::vector<uint32_t> _outFirst;    // Start of state output in _outIds, one extra entry at the end
+    std::vector<uint32_t> _outIds;      // Ids of patterns whose key ends in state
+    std::vector<size_t> _anyIds;        // Patterns without fixed bytes, they match everywhere
+    size_t _maxSize = 0;                // Longest pattern size
+    bool _compiled = false;             // Automaton is up to date
+};
+
+}
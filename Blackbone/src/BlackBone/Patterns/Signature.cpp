@@ -0,0 +1,231 @@
+#include "Signature.h"
+#include "PatternSearch.h"
+#include "../Include/Winheaders.h"
+#include "../Process/Process.h"
+#include "../Process/RegionStream.h"
+
+namespace blackbone
+{
+
+/// <summary>
+/// Parse signature text at runtime, e.g. "48 8B ?? ?? 4C"
+/// </summary>
+/// <param name="text">Signature text</param>
+Signature::Signature( const std::string& text )
+{
+    using namespace signature_detail;
+
+    const char* str = text.c_str();
+    for (size_t pos = Skip( str, 0 ); str[pos] != 0; pos = Skip( str, TokenEnd( str, pos ) ))
+    {
+        // Malformed text produces invalid signature
+        if (!IsValidToken( str + pos ))
+        {
+            _value.clear();
+            _mask.clear();
+            break;
+        }
+
+        _value.emplace_back( Value( str + pos ) );
+        _mask.emplace_back( Mask( str + pos ) );
+    }
+}
+
+/// <summary>
+/// Build signature from value/mask pair
+/// </summary>
+/// <param name="value">Pattern bytes</param>
+/// <param name="mask">Pattern mask, 0 marks wildcard</param>
+/// <param name="size">Pattern size</param>
+Signature::Signature( const uint8_t* value, const uint8_t* mask, size_t size )
+    : _value( value, value + size )
+    , _mask( size )
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        _mask[i] = mask[i] != 0 ? 0xFF : 0;
+        _value[i] &= _mask[i];
+    }
+}
+
+Signature::~Signature()
+{
+}
+
+/// <summary>
+/// Add named capture point
+/// </summary>
+/// <param name="name">Capture name</param>
+/// <param name="type">Capture type</param>
+/// <param name="offset">Offset of capture point from match start, may lie outside of signature</param>
+/// <param name="adjust">Value added to resolved displacement target</param>
+/// <returns>Capture index in SignatureMatch::captures</returns>
+size_t Signature::Capture( const std::string& name, eCaptureType type, int32_t offset, int32_t adjust /*= 0*/ )
+{
+    SignatureCapture capture;
+    capture.name = name;
+    capture.type = type;
+    capture.offset = offset;
+    capture.adjust = adjust;
+
+    _captures.emplace_back( capture );
+    return _captures.size() - 1;
+}
+
+/// <summary>
+/// Get capture index by name
+/// </summary>
+/// <param name="name">Capture name</param>
+/// <returns>Capture index, -1 if not found</returns>
+size_t Signature::Find( const std::string& name ) const
+{
+    for (size_t i = 0; i < _captures.size(); i++)
+        if (_captures[i].name == name)
+            return i;
+
+    return static_cast<size_t>(-1);
+}
+
+/// <summary>
+/// Search signature in buffer
+/// </summary>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="out">Found matches</param>
+/// <param name="value_offset">Value that will be added to resulting addresses</param>
+/// <returns>Number of found matches</returns>
+size_t Signature::Search( void* scanStart, size_t scanSize, std::vector<SignatureMatch>& out, ptr_t value_offset /*= 0*/ )
+{
+    Scan( reinterpret_cast<const uint8_t*>(scanStart), scanSize, value_offset != 0 ? value_offset : reinterpret_cast<ptr_t>(scanStart), nullptr, out );
+    return out.size();
+}
+
+/// <summary>
+/// Search signature in remote process
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="scanStart">Starting address</param>
+/// <param name="scanSize">Size of region to scan</param>
+/// <param name="out">Found matches</param>
+/// <returns>Number of found matches</returns>
+size_t Signature::SearchRemote( Process& remote, ptr_t scanStart, size_t scanSize, std::vector<SignatureMatch>& out )
+{
+    uint8_t *pBuffer = reinterpret_cast<uint8_t*>(VirtualAlloc( NULL, scanSize, MEM_COMMIT, PAGE_READWRITE ));
+
+    if (pBuffer && remote.memory().Read( scanStart, scanSize, pBuffer ) == STATUS_SUCCESS)
+        Scan( pBuffer, scanSize, scanStart, &remote, out );
+
+    if (pBuffer)
+        VirtualFree( pBuffer, 0, MEM_RELEASE );
+
+    return out.size();
+}
+
+/// <summary>
+/// Search signature in whole address space of remote process
+/// </summary>
+/// <param name="remote">Remote process</param>
+/// <param name="out">Found matches</param>
+/// <returns>Number of found matches</returns>
+size_t Signature::SearchRemoteWhole( Process& remote, std::vector<SignatureMatch>& out )
+{
+    out.clear();
+
+    if (!valid())
+        return 0;
+
+    // Signature size - 1 bytes are carried between chunks, so matches crossing chunk border are found only once
+    RegionStream stream( remote.memory(), STREAM_CHUNK_SIZE, _value.size() - 1 );
+    auto& backend = remote.memory().backend();
+
+    if (!NT_SUCCESS( stream.Start( backend.minAddr(), backend.maxAddr() ) ))
+        return 0;
+
+    for (StreamChunk chunk; stream.Next( chunk );)
+        Scan( chunk.data, chunk.size, chunk.address, &remote, out );
+
+    return out.size();
+}
+
+/// <summary>
+/// Resolve captures of match found in buffer.
+/// Capture points outside of buffer are read from remote process, if any
+/// </summary>
+/// <param name="address">Match address</param>
+/// <param name="data">Scanned data</param>
+/// <param name="size">Data size</param>
+/// <param name="base">Address of data[0]</param>
+/// <param name="remote">Remote process, nullptr for local buffer</param>
+/// <param name="match">Resulting match</param>
+void Signature::Resolve( ptr_t address, const uint8_t* data, size_t size, ptr_t base, Process* remote, SignatureMatch& match ) const
+{
+    match.address = address;
+    match.captures.assign( _captures.size(), 0 );
+
+    for (size_t i = 0; i < _captures.size(); i++)
+    {
+        auto& capture = _captures[i];
+        ptr_t point = address + capture.offset;
+
+        if (capture.type == cap_offset)
+        {
+            match.captures[i] = point;
+            continue;
+        }
+
+        size_t fieldSize = capture.type == cap_rel8 ? sizeof( int8_t ) : (capture.type == cap_abs64 ? sizeof( uint64_t ) : sizeof( uint32_t ));
+        uint64_t field = 0;
+
+        // Field is usually inside scanned data, remote read is needed only for distant points
+        if (point >= base && point + fieldSize <= base + size)
+            memcpy( &field, data + (point - base), fieldSize );
+        else if (remote == nullptr || !NT_SUCCESS( remote->memory().Read( point, fieldSize, &field ) ))
+            continue;
+
+        switch (capture.type)
+        {
+            case cap_rel8:
+                match.captures[i] = point + fieldSize + static_cast<int8_t>(field) + capture.adjust;
+                break;
+
+            case cap_rel32:
+                match.captures[i] = point + fieldSize + static_cast<int32_t>(field) + capture.adjust;
+                break;
+
+            case cap_abs32:
+            case cap_imm32:
+                match.captures[i] = static_cast<uint32_t>(field);
+                break;
+
+            default:
+                match.captures[i] = field;
+                break;
+        }
+    }
+}
+
+/// <summary>
+/// Search signature in buffer and resolve captures
+/// </summary>
+/// <param name="data">Data to scan</param>
+/// <param name="size">Data size</param>
+/// <param name="base">Address of data[0]</param>
+/// <param name="remote">Remote process, nullptr for local buffer</param>
+/// <param name="out">Found matches</param>
+void Signature::Scan( const uint8_t* data, size_t size, ptr_t base, Process* remote, std::vector<SignatureMatch>& out )
+{
+    if (!valid())
+        return;
+
+    std::vector<ptr_t> found;
+    PatternSearch( _value ).Search( _mask, const_cast<uint8_t*>(data), size, found, base );
+
+    for (auto address : found)
+    {
+        SignatureMatch match;
+        Resolve( address, data, size, base, remote, match );
+        out.emplace_back( std::move( match ) );
+    }
+}
+
+}
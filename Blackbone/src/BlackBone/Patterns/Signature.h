@@ -0,0 +1,234 @@
+#pragma once
+
+#include "../Include/Types.h"
+
+#include <array>
+#include <string>
+#include <vector>
+#include <utility>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Signature text parsing. Functions are C++11 constexpr, so literals are parsed at compile time.
+/// Text is a list of whitespace separated tokens: two hex digits for a fixed byte, '?' or '??' for any byte
+/// </summary>
+namespace signature_detail
+{
+    constexpr bool IsSpace( char c ) { return c == ' ' || c == '\t' || c == '\r' || c == '\n'; }
+    constexpr bool IsEnd( char c ) { return c == 0 || IsSpace( c ); }
+
+    constexpr int HexDigit( char c )
+    {
+        return (c >= '0' && c <= '9') ? c - '0' :
+               (c >= 'a' && c <= 'f') ? c - 'a' + 10 :
+               (c >= 'A' && c <= 'F') ? c - 'A' + 10 : -1;
+    }
+
+    // Start of the first token at or after pos
+    constexpr size_t Skip( const char* text, size_t pos ) { return IsSpace( text[pos] ) ? Skip( text, pos + 1 ) : pos; }
+
+    // End of token starting at pos
+    constexpr size_t TokenEnd( const char* text, size_t pos ) { return IsEnd( text[pos] ) ? pos : TokenEnd( text, pos + 1 ); }
+
+    // Start of token with given index
+    constexpr size_t Token( const char* text, size_t index, size_t pos = 0 )
+    {
+        return index == 0 ? Skip( text, pos ) : Token( text, index - 1, TokenEnd( text, Skip( text, pos ) ) );
+    }
+
+    // Number of tokens at or after pos
+    constexpr size_t Count( const char* text, size_t pos = 0 )
+    {
+        return text[Skip( text, pos )] == 0 ? 0 : 1 + Count( text, TokenEnd( text, Skip( text, pos ) ) );
+    }
+
+    constexpr bool IsWildcard( const char* token ) { return token[0] == '?'; }
+
+    constexpr bool IsValidToken( const char* token )
+    {
+        return IsWildcard( token ) ? (IsEnd( token[1] ) || (token[1] == '?' && IsEnd( token[2] ))) :
+               (HexDigit( token[0] ) >= 0 && HexDigit( token[1] ) >= 0 && IsEnd( token[2] ));
+    }
+
+    constexpr bool IsValid( const char* text, size_t pos = 0 )
+    {
+        return text[Skip( text, pos )] == 0 || (IsValidToken( text + Skip( text, pos ) ) && IsValid( text, TokenEnd( text, Skip( text, pos ) ) ));
+    }
+
+    constexpr uint8_t Value( const char* token )
+    {
+        return IsWildcard( token ) ? 0 : static_cast<uint8_t>(HexDigit( token[0] ) * 16 + HexDigit( token[1] ));
+    }
+
+    constexpr uint8_t Mask( const char* token ) { return IsWildcard( token ) ? 0 : 0xFF; }
+}
+
+/// <summary>
+/// Value/mask pair of signature parsed at compile time, see BLACKBONE_SIGNATURE
+/// </summary>
+template<size_t N>
+struct SignatureBytes
+{
+    std::array<uint8_t, N> value;   // Pattern bytes, wildcards are zeroed
+    std::array<uint8_t, N> mask;    // 0xFF for fixed byte, 0 for wildcard
+};
+
+namespace signature_detail
+{
+    template<bool Valid, size_t... I>
+    constexpr SignatureBytes<sizeof...(I)> Make( const char* text, std::index_sequence<I...> )
+    {
+        static_assert(Valid && sizeof...(I) > 0, "Malformed signature text");
+        return SignatureBytes<sizeof...(I)>{ { { Value( text + Token( text, I ) )... } }, { { Mask( text + Token( text, I ) )... } } };
+    }
+}
+
+// Parse signature literal at compile time, e.g. BLACKBONE_SIGNATURE( "48 8B 05 ?? ?? ?? ?? 48 85 C0" )
+#define BLACKBONE_SIGNATURE( text ) \
+    blackbone::signature_detail::Make<blackbone::signature_detail::IsValid( text )>( text, std::make_index_sequence<blackbone::signature_detail::Count( text )>() )
+
+// Capture type
+enum eCaptureType
+{
+    cap_offset = 0,     // Address of capture point itself
+    cap_rel8,           // Target of 8-bit displacement: field + 1 + disp8
+    cap_rel32,          // Target of 32-bit displacement: field + 4 + disp32, e.g. call, jmp or rip-relative operand
+    cap_abs32,          // 32-bit absolute address stored at capture point
+    cap_abs64,          // 64-bit absolute address stored at capture point
+    cap_imm32,          // Raw 32-bit value stored at capture point, e.g. structure offset
+};
+
+/// <summary>
+/// Named point of signature resolved for every match
+/// </summary>
+struct SignatureCapture
+{
+    std::string name;       // Capture name
+    eCaptureType type;      // Capture type
+    int32_t offset;         // Offset of capture point from match start
+    int32_t adjust;         // Value added to resolved displacement target, e.g. size of immediate following displacement
+};
+
+/// <summary>
+/// Signature match with resolved captures
+/// </summary>
+struct SignatureMatch
+{
+    ptr_t address = 0;              // Match address
+    std::vector<ptr_t> captures;    // Resolved captures in order they were added, 0 if capture point couldn't be read
+};
+
+/// <summary>
+/// Compiled signature: value/mask pair plus named capture points.
+/// Any byte value can be matched, wildcards are taken from mask only
+/// </summary>
+class Signature
+{
+public:
+    /// <summary>
+    /// Parse signature text at runtime, e.g. "48 8B ?? ?? 4C"
+    /// </summary>
+    /// <param name="text">Signature text</param>
+    BLACKBONE_API Signature( const std::string& text );
+
+    /// <summary>
+    /// Build signature from value/mask pair
+    /// </summary>
+    /// <param name="value">Pattern bytes</param>
+    /// <param name="mask">Pattern mask, 0 marks wildcard</param>
+    /// <param name="size">Pattern size</param>
+    BLACKBONE_API Signature( const uint8_t* value, const uint8_t* mask, size_t size );
+
+    /// <summary>
+    /// Use signature parsed at compile time
+    /// </summary>
+    /// <param name="bytes">Result of BLACKBONE_SIGNATURE</param>
+    template<size_t N>
+    Signature( const SignatureBytes<N>& bytes )
+        : Signature( bytes.value.data(), bytes.mask.data(), N ) { }
+
+    BLACKBONE_API ~Signature();
+
+    /// <summary>
+    /// Add named capture point
+    /// </summary>
+    /// <param name="name">Capture name</param>
+    /// <param name="type">Capture type</param>
+    /// <param name="offset">Offset of capture point from match start, may lie outside of signature</param>
+    /// <param name="adjust">Value added to resolved displacement target</param>
+    /// <returns>Capture index in SignatureMatch::captures</returns>
+    BLACKBONE_API size_t Capture( const std::string& name, eCaptureType type, int32_t offset, int32_t adjust = 0 );
+
+    /// <summary>
+    /// Get capture index by name
+    /// </summary>
+    /// <param name="name">Capture name</param>
+    /// <returns>Capture index, -1 if not found</returns>
+    BLACKBONE_API size_t Find( const std::string& name ) const;
+
+    /// <summary>
+    /// Search signature in buffer
+    /// </summary>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="out">Found matches</param>
+    /// <param name="value_offset">Value that will be added to resulting addresses</param>
+    /// <returns>Number of found matches</returns>
+    BLACKBONE_API size_t Search( void* scanStart, size_t scanSize, std::vector<SignatureMatch>& out, ptr_t value_offset = 0 );
+
+    /// <summary>
+    /// Search signature in remote process
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="scanStart">Starting address</param>
+    /// <param name="scanSize">Size of region to scan</param>
+    /// <param name="out">Found matches</param>
+    /// <returns>Number of found matches</returns>
+    BLACKBONE_API size_t SearchRemote( class Process& remote, ptr_t scanStart, size_t scanSize, std::vector<SignatureMatch>& out );
+
+    /// <summary>
+    /// Search signature in whole address space of remote process
+    /// </summary>
+    /// <param name="remote">Remote process</param>
+    /// <param name="out">Found matches</param>
+    /// <returns>Number of found matches</returns>
+    BLACKBONE_API size_t SearchRemoteWhole( class Process& remote, std::vector<SignatureMatch>& out );
+
+    /// <summary>
+    /// Resolve captures of match found in buffer.
+    /// Capture points outside of buffer are read from remote process, if any
+    /// </summary>
+    /// <param name="address">Match address</param>
+    /// <param name="data">Scanned data</param>
+    /// <param name="size">Data size</param>
+    /// <param name="base">Address of data[0]</param>
+    /// <param name="remote">Remote process, nullptr for local buffer</param>
+    /// <param name="match">Resulting match</param>
+    BLACKBONE_API void Resolve( ptr_t address, const uint8_t* data, size_t size, ptr_t base, class Process* remote, SignatureMatch& match ) const;
+
+    BLACKBONE_API inline const std::vector<uint8_t>& value() const { return _value; }
+    BLACKBONE_API inline const std::vector<uint8_t>& mask() const { return _mask; }
+    BLACKBONE_API inline const std::vector<SignatureCapture>& captures() const { return _captures; }
+    BLACKBONE_API inline size_t size() const { return _value.size(); }
+    BLACKBONE_API inline bool valid() const { return !_value.empty(); }
+
+private:
+    /// <summary>
+    /// Search signature in buffer and resolve captures
+    /// </summary>
+    /// <param name="data">Data to scan</param>
+    /// <param name="size">Data size</param>
+    /// <param name="base">Address of data[0]</param>
+    /// <param name="remote">Remote process, nullptr for local buffer</param>
+    /// <param name="out">Found matches</param>
+    void Scan( const uint8_t* data, size_t size, ptr_t base, class Process* remote, std::vector<SignatureMatch>& out );
+
+private:
+    std::vector<uint8_t> _value;                // Pattern bytes, wildcards are zeroed
+    std::vector<uint8_t> _mask;                 // 0xFF for fixed byte, 0 for wildcard
+    std::vector<SignatureCapture> _captures;    // Capture points
+};
+
+}
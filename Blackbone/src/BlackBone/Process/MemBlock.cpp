@@ -1,5 +1,7 @@
 #include "MemBlock.h"
 #include "ProcessMemory.h"
+#include "RemoteHeap.h"
+#include "MemoryTransaction.h"
 #include "ProcessCore.h"
 #include "../Subsystem/NativeSubsystem.h"
 
@@ -19,13 +21,16 @@ MemBlock::MemBlock()
 /// <param name="size">Block size</param>
 /// <param name="prot">Memory protection</param>
 /// <param name="own">false if caller will be responsible for block deallocation</param>
-MemBlock::MemBlock( ProcessMemory* mem, ptr_t ptr, size_t size, DWORD prot, bool own /*= true*/, bool physical /*= false*/ )
+/// <param name="physical">Memory allocated as direct physical</param>
+/// <param name="heap">Remote heap block was taken from, nullptr for native allocation</param>
+MemBlock::MemBlock( ProcessMemory* mem, ptr_t ptr, size_t size, DWORD prot, bool own /*= true*/, bool physical /*= false*/, RemoteHeap* heap /*= nullptr*/ )
     : _ptr( ptr )
     , _size( size )
     , _protection( prot )
     , _own( own )
     , _physical( physical )
     , _memory( mem )
+    , _heap( heap )
 {
 }
 
@@ -67,15 +72,18 @@ MemBlock MemBlock::Allocate( ProcessMemory& process, size_t size, ptr_t desired
     ptr_t desired64 = desired;
     DWORD newProt = CastProtection( protection, process.core().DEP() );
     
-    if (process.core().native()->VirtualAllocExT( desired64, size, MEM_COMMIT, newProt ) != STATUS_SUCCESS)
+    if (process.backend().Allocate( desired64, size, MEM_COMMIT, newProt ) != STATUS_SUCCESS)
     {
         desired64 = 0;
-        if (process.core().native()->VirtualAllocExT( desired64, size, MEM_COMMIT, newProt ) == STATUS_SUCCESS)
+        if (process.backend().Allocate( desired64, size, MEM_COMMIT, newProt ) == STATUS_SUCCESS)
             LastNtStatus( STATUS_IMAGE_NOT_AT_BASE );
         else
             desired64 = 0;
     }
 
+    if (desired64 != 0)
+        process.regions().Update( desired64, size );
+
     return MemBlock( &process, desired64, size, protection, own );
 }
 
@@ -89,12 +97,12 @@ MemBlock MemBlock::Allocate( ProcessMemory& process, size_t size, ptr_t desired
 ptr_t MemBlock::Realloc( size_t size, ptr_t desired /*= 0*/, DWORD protection /*= PAGE_EXECUTE_READWRITE*/ )
 {
     ptr_t desired64 = desired;
-    _memory->core().native()->VirtualAllocExT( desired64, size, MEM_COMMIT, protection );
+    _memory->backend().Allocate( desired64, size, MEM_COMMIT, protection );
 
     if (!desired64)
     {
         desired64 = 0;
-        _memory->core( ).native( )->VirtualAllocExT( desired64, size, MEM_COMMIT, protection );
+        _memory->backend().Allocate( desired64, size, MEM_COMMIT, protection );
 
         if (desired64)
             LastNtStatus( STATUS_IMAGE_NOT_AT_BASE );
@@ -103,8 +111,10 @@ ptr_t MemBlock::Realloc( size_t size, ptr_t desired /*= 0*/, DWORD protection /*
     // Replace current instance
     if (desired64)
     {
+        _memory->regions().Update( desired64, size );
         Free();
 
+        _heap = nullptr;
         _ptr = desired64;
         _size = size;
         _protection = protection;
@@ -114,7 +124,7 @@ ptr_t MemBlock::Realloc( size_t size, ptr_t desired /*= 0*/, DWORD protection /*
 }
 
 /// <summary>
-/// Change memory protection
+/// Change memory protection. Not supported for remote heap blocks
 /// </summary>
 /// <param name="protection">New protection flags</param>
 /// <param name="offset">Memory offset in block</param>
@@ -123,6 +133,10 @@ ptr_t MemBlock::Realloc( size_t size, ptr_t desired /*= 0*/, DWORD protection /*
 /// <returns>Status</returns>
 NTSTATUS MemBlock::Protect( DWORD protection, uintptr_t offset /*= 0*/, size_t size /*= 0*/, DWORD* pOld /*= nullptr */ )
 {
+    // Page is shared with other blocks
+    if (_heap != nullptr)
+        return LastNtStatus( STATUS_NOT_SUPPORTED );
+
     auto prot = CastProtection( protection, _memory->core().DEP() );
 
     if (size == 0)
@@ -133,11 +147,26 @@ NTSTATUS MemBlock::Protect( DWORD protection, uintptr_t offset /*= 0*/, size_t s
 }
 
 /// <summary>
-/// Free memory
+/// Free memory. Remote heap blocks are returned into heap
 /// </summary>
 /// <param name="size">Size of memory chunk to free. If 0 - whole block is freed</param>
 NTSTATUS MemBlock::Free( size_t size /*= 0*/ )
 {
+    if (_ptr != 0 && _heap != nullptr)
+    {
+        if (size != 0 && size < _size)
+            return LastNtStatus( STATUS_NOT_SUPPORTED );
+
+        NTSTATUS status = _heap->Release( _ptr );
+
+        _ptr = 0;
+        _size = 0;
+        _protection = 0;
+        _heap = nullptr;
+
+        return status;
+    }
+
     if (_ptr != 0)
     {
         size = Align( size, 0x1000 );
@@ -177,6 +206,9 @@ NTSTATUS MemBlock::Free( size_t size /*= 0*/ )
 /// <returns>Status</returns>
 NTSTATUS MemBlock::Read( uintptr_t offset, size_t size, PVOID pResult, bool handleHoles /*= false*/ )
 {
+    if (_tx != nullptr)
+        return _tx->Read( _ptr + offset, size, pResult, handleHoles );
+
     return _memory->Read( _ptr + offset, size, pResult, handleHoles );
 }
 
@@ -190,6 +222,9 @@ NTSTATUS MemBlock::Read( uintptr_t offset, size_t size, PVOID pResult, bool hand
 /// <returns>Status</returns>
 NTSTATUS MemBlock::Write( uintptr_t offset, size_t size, const void* pData )
 {
+    if (_tx != nullptr)
+        return _tx->Write( _ptr + offset, size, pData );
+
     return _memory->Write( _ptr + offset, size, pData );
 }
 
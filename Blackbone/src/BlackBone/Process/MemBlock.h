@@ -58,13 +58,16 @@ public:
     /// <param name="size">Block size</param>
     /// <param name="prot">Memory protection</param>
     /// <param name="own">true if caller will be responsible for block deallocation</param>
+    /// <param name="physical">Memory allocated as direct physical</param>
+    /// <param name="heap">Remote heap block was taken from, nullptr for native allocation</param>
     BLACKBONE_API MemBlock( 
         class ProcessMemory* mem, 
         ptr_t ptr, 
         size_t size, 
         DWORD prot,
         bool own = true, 
-        bool physical = false 
+        bool physical = false,
+        class RemoteHeap* heap = nullptr
         );
 
     BLACKBONE_API ~MemBlock();
@@ -96,7 +99,7 @@ public:
     BLACKBONE_API ptr_t Realloc( size_t size, ptr_t desired = 0, DWORD protection = PAGE_EXECUTE_READWRITE );
 
     /// <summary>
-    /// Change memory protection
+    /// Change memory protection. Not supported for remote heap blocks
     /// </summary>
     /// <param name="protection">New protection flags</param>
     /// <param name="offset">Memory offset in block</param>
@@ -106,7 +109,7 @@ public:
     BLACKBONE_API NTSTATUS Protect( DWORD protection, uintptr_t offset = 0, size_t size = 0, DWORD* pOld = nullptr );
 
     /// <summary>
-    /// Free memory
+    /// Free memory. Remote heap blocks are returned into heap
     /// </summary>
     /// <param name="size">Size of memory chunk to free. If 0 - whole block is freed</param>
     BLACKBONE_API NTSTATUS Free( size_t size = 0 );
@@ -205,6 +208,30 @@ public:
     /// <returns>true if memory pointer isn't 0</returns>
     BLACKBONE_API inline bool valid() const { return (_memory != nullptr && _ptr != 0); }
 
+    /// <summary>
+    /// Check if block was taken from remote heap
+    /// </summary>
+    /// <returns>true if block belongs to remote heap</returns>
+    BLACKBONE_API inline bool pooled() const { return _heap != nullptr; }
+
+    /// <summary>
+    /// Route block reads and writes through write transaction
+    /// </summary>
+    /// <param name="tx">Transaction, nullptr to access memory directly</param>
+    BLACKBONE_API inline void Attach( class MemoryTransaction* tx ) { _tx = tx; }
+
+    /// <summary>
+    /// Get attached write transaction
+    /// </summary>
+    /// <returns>Transaction, nullptr if none</returns>
+    BLACKBONE_API inline class MemoryTransaction* transaction() const { return _tx; }
+
+    /// <summary>
+    /// Get process memory routines
+    /// </summary>
+    /// <returns>Process memory</returns>
+    BLACKBONE_API inline class ProcessMemory* memory() const { return _memory; }
+
     /// <summary>
     /// Get memory pointer
     /// </summary>
@@ -217,6 +244,8 @@ public:
         _ptr = other._ptr;
         _size = other._size;
         _protection = other._protection;
+        _heap = other._heap;
+        _tx = nullptr;
         _own = true;
 
         // Transfer memory ownership
@@ -232,6 +261,8 @@ private:
     bool   _own = true;             // Memory will be freed in destructor
     bool   _physical = false;       // Memory allocated as direct physical
     class ProcessMemory* _memory;   // Target process routines
+    class RemoteHeap* _heap = nullptr;  // Remote heap block belongs to
+    class MemoryTransaction* _tx = nullptr; // Write transaction block access is routed through
 };
 
 }
\ No newline at end of file
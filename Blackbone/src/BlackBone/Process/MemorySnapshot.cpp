@@ -0,0 +1,401 @@
+#include "MemorySnapshot.h"
+#include "ProcessMemory.h"
+#include "../Misc/CpuFeatures.h"
+
+#include <immintrin.h>
+#include <algorithm>
+
+namespace blackbone
+{
+
+typedef size_t( *fnCompare )(const uint8_t* a, const uint8_t* b, size_t size);
+
+/// <summary>
+/// Length of equal prefix
+/// </summary>
+static size_t MismatchScalar( const uint8_t* a, const uint8_t* b, size_t size )
+{
+    size_t i = 0;
+    for (; i + sizeof( uint64_t ) <= size; i += sizeof( uint64_t ))
+    {
+        uint64_t qa = 0, qb = 0;
+        memcpy( &qa, a + i, sizeof( qa ) );
+        memcpy( &qb, b + i, sizeof( qb ) );
+
+        if (qa != qb)
+            break;
+    }
+
+    while (i < size && a[i] == b[i])
+        i++;
+
+    return i;
+}
+
+/// <summary>
+/// Length of different prefix
+/// </summary>
+static size_t MatchScalar( const uint8_t* a, const uint8_t* b, size_t size )
+{
+    size_t i = 0;
+    while (i < size && a[i] != b[i])
+        i++;
+
+    return i;
+}
+
+/// <summary>
+/// Length of equal prefix, 64 bytes per iteration
+/// </summary>
+TARGET_AVX2 static size_t MismatchAVX2( const uint8_t* a, const uint8_t* b, size_t size )
+{
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64)
+    {
+        __m256i eq0 = _mm256_cmpeq_epi8( _mm256_loadu_si256( reinterpret_cast<const __m256i*>(a + i) ),
+                                         _mm256_loadu_si256( reinterpret_cast<const __m256i*>(b + i) ) );
+        __m256i eq1 = _mm256_cmpeq_epi8( _mm256_loadu_si256( reinterpret_cast<const __m256i*>(a + i + 32) ),
+                                         _mm256_loadu_si256( reinterpret_cast<const __m256i*>(b + i + 32) ) );
+
+        if (static_cast<uint32_t>(_mm256_movemask_epi8( _mm256_and_si256( eq0, eq1 ) )) == 0xFFFFFFFF)
+            continue;
+
+        uint32_t mask = ~static_cast<uint32_t>(_mm256_movemask_epi8( eq0 ));
+        if (mask != 0)
+            return i + LowestBit( mask );
+
+        return i + 32 + LowestBit( ~static_cast<uint32_t>(_mm256_movemask_epi8( eq1 )) );
+    }
+
+    return i + MismatchScalar( a + i, b + i, size - i );
+}
+
+/// <summary>
+/// Length of different prefix, 32 bytes per iteration
+/// </summary>
+TARGET_AVX2 static size_t MatchAVX2( const uint8_t* a, const uint8_t* b, size_t size )
+{
+    size_t i = 0;
+    for (; i + 32 <= size; i += 32)
+    {
+        __m256i eq = _mm256_cmpeq_epi8( _mm256_loadu_si256( reinterpret_cast<const __m256i*>(a + i) ),
+                                        _mm256_loadu_si256( reinterpret_cast<const __m256i*>(b + i) ) );
+
+        uint32_t mask = static_cast<uint32_t>(_mm256_movemask_epi8( eq ));
+        if (mask != 0)
+            return i + LowestBit( mask );
+    }
+
+    return i + MatchScalar( a + i, b + i, size - i );
+}
+
+/// <summary>
+/// Report changed ranges of two buffers
+/// </summary>
+static void CompareRange(
+    const uint8_t* a, const uint8_t* b, size_t size, ptr_t address, size_t gap,
+    fnCompare mismatch, fnCompare match, std::vector<SnapshotChange>& changes
+    )
+{
+    size_t pos = mismatch( a, b, size );
+    while (pos < size)
+    {
+        size_t start = pos;
+        size_t end = pos + match( a + pos, b + pos, size - pos );
+        pos = end + mismatch( a + end, b + end, size - end );
+
+        // Join changes separated by short equal runs
+        while (pos < size && pos - end <= gap)
+        {
+            end = pos + match( a + pos, b + pos, size - pos );
+            pos = end + mismatch( a + end, b + end, size - end );
+        }
+
+        changes.emplace_back( address + start, end - start, ct_changed );
+    }
+}
+
+/// <summary>
+/// Report ranges of one snapshot not covered by another
+/// </summary>
+static void Uncovered( const MemorySnapshot& src, const MemorySnapshot& other, eChangeType type, std::vector<SnapshotChange>& changes )
+{
+    auto regions = other.regions();
+    size_t first = 0;
+
+    for (size_t i = 0; i < src.count(); i++)
+    {
+        ptr_t cur = src.regions()[i].base;
+        ptr_t end = cur + src.regions()[i].size;
+
+        while (first < other.count() && regions[first].base + regions[first].size <= cur)
+            first++;
+
+        for (size_t k = first; k < other.count() && regions[k].base < end; k++)
+        {
+            if (regions[k].base > cur)
+                changes.emplace_back( cur, static_cast<size_t>(regions[k].base - cur), type );
+
+            cur = std::max<ptr_t>( cur, regions[k].base + regions[k].size );
+        }
+
+        if (cur < end)
+            changes.emplace_back( cur, static_cast<size_t>(end - cur), type );
+    }
+}
+
+MemorySnapshot::MemorySnapshot()
+{
+}
+
+MemorySnapshot::~MemorySnapshot()
+{
+    Close();
+}
+
+/// <summary>
+/// Capture committed readable regions into new snapshot file. Snapshot stays opened
+/// </summary>
+/// <param name="memory">Target process memory</param>
+/// <param name="path">Snapshot file path, overwritten if exists</param>
+/// <returns>Status code</returns>
+NTSTATUS MemorySnapshot::Capture( ProcessMemory& memory, const std::wstring& path )
+{
+    Close();
+
+    std::list<MEMORY_BASIC_INFORMATION64> found;
+    std::vector<SnapshotRegion> table;
+    uint64_t dataSize = 0;
+
+    memory.EnumRegions( found );
+
+    for (auto& mbi : found)
+    {
+        if (mbi.State != MEM_COMMIT || mbi.Protect == 0 || (mbi.Protect & (PAGE_NOACCESS | PAGE_GUARD)) != 0)
+            continue;
+
+        SnapshotRegion region = { 0 };
+        region.base = mbi.BaseAddress;
+        region.size = mbi.RegionSize;
+        region.offset = dataSize;
+        region.protect = mbi.Protect;
+        region.type = mbi.Type;
+
+        table.emplace_back( region );
+        dataSize += mbi.RegionSize;
+    }
+
+    uint64_t dataStart = Align( sizeof( SnapshotHeader ) + table.size() * sizeof( SnapshotRegion ), SNAPSHOT_ALIGN );
+    for (auto& region : table)
+        region.offset += dataStart;
+
+    _hFile = CreateFileW( path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ, NULL, CREATE_ALWAYS, 0, NULL );
+    if (_hFile == INVALID_HANDLE_VALUE)
+        return LastNtStatus();
+
+    NTSTATUS status = Map( dataStart + dataSize );
+    if (!NT_SUCCESS( status ))
+    {
+        Close();
+        return status;
+    }
+
+    // Region data goes straight into file view
+    for (auto& region : table)
+    {
+        if (!NT_SUCCESS( memory.Read( region.base, static_cast<size_t>(region.size), _view + region.offset ) ))
+            region.flags |= SNAPSHOT_PARTIAL;
+    }
+
+    SnapshotHeader header = { 0 };
+    header.magic = SNAPSHOT_MAGIC;
+    header.version = SNAPSHOT_VERSION;
+    header.pageSize = memory.backend().pageSize();
+    header.count = static_cast<uint32_t>(table.size());
+    header.dataSize = dataSize;
+
+    memcpy( _view, &header, sizeof( header ) );
+    if (!table.empty())
+        memcpy( _view + sizeof( header ), table.data(), table.size() * sizeof( SnapshotRegion ) );
+
+    return LastNtStatus( STATUS_SUCCESS );
+}
+
+/// <summary>
+/// Open existing snapshot file
+/// </summary>
+/// <param name="path">Snapshot file path</param>
+/// <returns>Status code</returns>
+NTSTATUS MemorySnapshot::Open( const std::wstring& path )
+{
+    Close();
+
+    _hFile = CreateFileW( path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, 0, NULL );
+    if (_hFile == INVALID_HANDLE_VALUE)
+        return LastNtStatus();
+
+    NTSTATUS status = Map( 0 );
+
+    // Validate header and region table
+    if (NT_SUCCESS( status ))
+    {
+        if (_fileSize < sizeof( SnapshotHeader ) || _header->magic != SNAPSHOT_MAGIC || _header->version != SNAPSHOT_VERSION ||
+            (_fileSize - sizeof( SnapshotHeader )) / sizeof( SnapshotRegion ) < _header->count)
+        {
+            status = STATUS_FILE_CORRUPT_ERROR;
+        }
+
+        for (uint32_t i = 0; NT_SUCCESS( status ) && i < _header->count; i++)
+        {
+            auto& region = _regions[i];
+            if (region.offset > _fileSize || region.size > _fileSize - region.offset || (i > 0 && region.base < _regions[i - 1].base + _regions[i - 1].size))
+                status = STATUS_FILE_CORRUPT_ERROR;
+        }
+    }
+
+    if (!NT_SUCCESS( status ))
+        Close();
+
+    return LastNtStatus( status );
+}
+
+/// <summary>
+/// Unmap and close snapshot file
+/// </summary>
+void MemorySnapshot::Close()
+{
+    if (_view != nullptr)
+        UnmapViewOfFile( _view );
+
+    if (_hMapping != NULL)
+        CloseHandle( _hMapping );
+
+    if (_hFile != INVALID_HANDLE_VALUE)
+        CloseHandle( _hFile );
+
+    _hFile = INVALID_HANDLE_VALUE;
+    _hMapping = NULL;
+    _view = nullptr;
+    _fileSize = 0;
+    _header = nullptr;
+    _regions = nullptr;
+}
+
+/// <summary>
+/// Read captured data
+/// </summary>
+/// <param name="address">Address to read from</param>
+/// <param name="size">Size of data to read</param>
+/// <param name="result">Output buffer</param>
+/// <returns>Status code, STATUS_INVALID_ADDRESS if range doesn't belong to single captured region</returns>
+NTSTATUS MemorySnapshot::Read( ptr_t address, size_t size, void* result ) const
+{
+    auto region = Find( address );
+    if (region == nullptr || address + size > region->base + region->size)
+        return LastNtStatus( STATUS_INVALID_ADDRESS );
+
+    memcpy( result, data( *region ) + (address - region->base), size );
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Find captured region containing address
+/// </summary>
+/// <param name="address">Address</param>
+/// <returns>Region, nullptr if not found</returns>
+const SnapshotRegion* MemorySnapshot::Find( ptr_t address ) const
+{
+    auto end = _regions + count();
+    auto iter = std::upper_bound( _regions, end, address, []( ptr_t addr, const SnapshotRegion& region ) { return addr < region.base; } );
+    if (iter == _regions)
+        return nullptr;
+
+    --iter;
+    return address < iter->base + iter->size ? iter : nullptr;
+}
+
+/// <summary>
+/// Map whole file
+/// </summary>
+/// <param name="size">File size, 0 to map existing file read-only</param>
+/// <returns>Status code</returns>
+NTSTATUS MemorySnapshot::Map( uint64_t size )
+{
+    bool write = size != 0;
+
+    if (!write)
+    {
+        LARGE_INTEGER fileSize = { 0 };
+        if (!GetFileSizeEx( _hFile, &fileSize ) || fileSize.QuadPart == 0)
+            return LastNtStatus( STATUS_FILE_CORRUPT_ERROR );
+
+        size = static_cast<uint64_t>(fileSize.QuadPart);
+    }
+
+    _hMapping = CreateFileMappingW( _hFile, NULL, write ? PAGE_READWRITE : PAGE_READONLY, HIDWORD( size ), LODWORD( size ), NULL );
+    if (_hMapping == NULL)
+        return LastNtStatus();
+
+    _view = reinterpret_cast<uint8_t*>(MapViewOfFile( _hMapping, write ? FILE_MAP_WRITE : FILE_MAP_READ, 0, 0, 0 ));
+    if (_view == nullptr)
+        return LastNtStatus();
+
+    _fileSize = size;
+    _header = reinterpret_cast<const SnapshotHeader*>(_view);
+    _regions = reinterpret_cast<const SnapshotRegion*>(_view + sizeof( SnapshotHeader ));
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Compare two snapshots of the same process.
+/// Uses AVX2 if supported by CPU, scalar comparison otherwise
+/// </summary>
+/// <param name="before">Earlier snapshot</param>
+/// <param name="after">Later snapshot</param>
+/// <param name="changes">Changed ranges sorted by address</param>
+/// <param name="gap">Changes separated by no more than gap equal bytes are joined</param>
+/// <returns>Number of changed ranges</returns>
+size_t MemorySnapshot::Diff( const MemorySnapshot& before, const MemorySnapshot& after, std::vector<SnapshotChange>& changes, size_t gap /*= 0*/ )
+{
+    bool avx2 = CpuFeatures::Get().avx2;
+    fnCompare mismatch = avx2 ? &MismatchAVX2 : &MismatchScalar;
+    fnCompare match = avx2 ? &MatchAVX2 : &MatchScalar;
+
+    changes.clear();
+
+    Uncovered( after, before, ct_added, changes );
+    Uncovered( before, after, ct_removed, changes );
+
+    // Walk overlapping parts of both region tables
+    auto regionsA = before.regions();
+    auto regionsB = after.regions();
+
+    for (size_t i = 0, j = 0; i < before.count() && j < after.count();)
+    {
+        auto& ra = regionsA[i];
+        auto& rb = regionsB[j];
+
+        ptr_t start = std::max<ptr_t>( ra.base, rb.base );
+        ptr_t end = std::min<ptr_t>( ra.base + ra.size, rb.base + rb.size );
+
+        // Unreliable data can't be compared
+        if (start < end && ((ra.flags | rb.flags) & SNAPSHOT_PARTIAL) == 0)
+        {
+            CompareRange(
+                before.data( ra ) + (start - ra.base), after.data( rb ) + (start - rb.base),
+                static_cast<size_t>(end - start), start, gap, mismatch, match, changes
+                );
+        }
+
+        if (ra.base + ra.size <= rb.base + rb.size)
+            i++;
+        else
+            j++;
+    }
+
+    std::sort( changes.begin(), changes.end(), []( const SnapshotChange& l, const SnapshotChange& r ) { return l.address < r.address; } );
+    return changes.size();
+}
+
+}
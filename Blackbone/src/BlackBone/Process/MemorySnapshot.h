@@ -0,0 +1,153 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+
+#include <string>
+#include <vector>
+
+namespace blackbone
+{
+
+#define SNAPSHOT_MAGIC      0x4E534242  // 'BBSN'
+#define SNAPSHOT_VERSION    1
+#define SNAPSHOT_ALIGN      0x1000      // Alignment of region data in file
+
+#define SNAPSHOT_PARTIAL    0x1         // Region couldn't be read completely, data is not reliable
+
+/// <summary>
+/// Snapshot file header
+/// </summary>
+struct SnapshotHeader
+{
+    uint32_t magic;         // SNAPSHOT_MAGIC
+    uint32_t version;       // SNAPSHOT_VERSION
+    uint32_t pageSize;      // Target page size
+    uint32_t count;         // Number of regions
+    uint64_t dataSize;      // Total size of region data
+};
+
+/// <summary>
+/// Region table entry
+/// </summary>
+struct SnapshotRegion
+{
+    ptr_t base;             // Region address
+    uint64_t size;          // Region size
+    uint64_t offset;        // Data offset in file
+    uint32_t protect;       // Memory protection
+    uint32_t type;          // Region type
+    uint32_t flags;         // SNAPSHOT_* flags
+    uint32_t reserved;
+};
+
+// Snapshot difference type
+enum eChangeType
+{
+    ct_changed = 0,     // Bytes differ
+    ct_added,           // Range is present only in later snapshot
+    ct_removed,         // Range is present only in earlier snapshot
+};
+
+/// <summary>
+/// Changed address range
+/// </summary>
+struct SnapshotChange
+{
+    ptr_t address;
+    size_t size;
+    eChangeType type;
+
+    SnapshotChange( ptr_t address_, size_t size_, eChangeType type_ )
+        : address( address_ ), size( size_ ), type( type_ ) { }
+};
+
+/// <summary>
+/// Memory-mapped address space snapshot.
+/// File holds header, region table and raw data of every committed readable region
+/// </summary>
+class MemorySnapshot
+{
+public:
+    BLACKBONE_API MemorySnapshot();
+    BLACKBONE_API ~MemorySnapshot();
+
+    /// <summary>
+    /// Capture committed readable regions into new snapshot file. Snapshot stays opened
+    /// </summary>
+    /// <param name="memory">Target process memory</param>
+    /// <param name="path">Snapshot file path, overwritten if exists</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Capture( class ProcessMemory& memory, const std::wstring& path );
+
+    /// <summary>
+    /// Open existing snapshot file
+    /// </summary>
+    /// <param name="path">Snapshot file path</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Open( const std::wstring& path );
+
+    /// <summary>
+    /// Unmap and close snapshot file
+    /// </summary>
+    BLACKBONE_API void Close();
+
+    /// <summary>
+    /// Read captured data
+    /// </summary>
+    /// <param name="address">Address to read from</param>
+    /// <param name="size">Size of data to read</param>
+    /// <param name="result">Output buffer</param>
+    /// <returns>Status code, STATUS_INVALID_ADDRESS if range doesn't belong to single captured region</returns>
+    BLACKBONE_API NTSTATUS Read( ptr_t address, size_t size, void* result ) const;
+
+    /// <summary>
+    /// Find captured region containing address
+    /// </summary>
+    /// <param name="address">Address</param>
+    /// <returns>Region, nullptr if not found</returns>
+    BLACKBONE_API const SnapshotRegion* Find( ptr_t address ) const;
+
+    /// <summary>
+    /// Compare two snapshots of the same process.
+    /// Uses AVX2 if supported by CPU, scalar comparison otherwise
+    /// </summary>
+    /// <param name="before">Earlier snapshot</param>
+    /// <param name="after">Later snapshot</param>
+    /// <param name="changes">Changed ranges sorted by address</param>
+    /// <param name="gap">Changes separated by no more than gap equal bytes are joined</param>
+    /// <returns>Number of changed ranges</returns>
+    BLACKBONE_API static size_t Diff( const MemorySnapshot& before, const MemorySnapshot& after, std::vector<SnapshotChange>& changes, size_t gap = 0 );
+
+    /// <summary>
+    /// Get region data
+    /// </summary>
+    /// <param name="region">Region table entry</param>
+    /// <returns>Region data</returns>
+    BLACKBONE_API inline const uint8_t* data( const SnapshotRegion& region ) const { return _view + region.offset; }
+
+    BLACKBONE_API inline const SnapshotRegion* regions() const { return _regions; }
+    BLACKBONE_API inline size_t count() const { return _header != nullptr ? _header->count : 0; }
+    BLACKBONE_API inline bool valid() const { return _view != nullptr; }
+
+private:
+    /// <summary>
+    /// Map whole file
+    /// </summary>
+    /// <param name="size">File size, 0 to map existing file read-only</param>
+    /// <returns>Status code</returns>
+    NTSTATUS Map( uint64_t size );
+
+    MemorySnapshot( const MemorySnapshot& ) = delete;
+    MemorySnapshot& operator =( const MemorySnapshot& ) = delete;
+
+private:
+    HANDLE _hFile = INVALID_HANDLE_VALUE;           // Snapshot file
+    HANDLE _hMapping = NULL;                        // File mapping
+    uint8_t* _view = nullptr;                       // Mapped file
+    uint64_t _fileSize = 0;                         // File size
+    const SnapshotHeader* _header = nullptr;        // File header
+    const SnapshotRegion* _regions = nullptr;       // Region table, sorted by address
+};
+
+}
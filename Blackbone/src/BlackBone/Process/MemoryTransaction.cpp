@@ -0,0 +1,250 @@
+#include "MemoryTransaction.h"
+#include "ProcessMemory.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Transaction over whole process memory
+/// </summary>
+/// <param name="memory">Process memory</param>
+MemoryTransaction::MemoryTransaction( ProcessMemory& memory )
+    : _memory( memory )
+{
+}
+
+/// <summary>
+/// Transaction over memory block. Block reads and writes are routed through transaction until it is destroyed
+/// </summary>
+/// <param name="block">Memory block</param>
+MemoryTransaction::MemoryTransaction( MemBlock& block )
+    : _memory( *block.memory() )
+    , _block( &block )
+{
+    _block->Attach( this );
+}
+
+MemoryTransaction::~MemoryTransaction()
+{
+    if (_block != nullptr && _block->transaction() == this)
+        _block->Attach( nullptr );
+}
+
+/// <summary>
+/// Stage data write
+/// </summary>
+/// <param name="address">Memory address to write to</param>
+/// <param name="size">Size of data to write</param>
+/// <param name="data">Buffer to write</param>
+/// <returns>Status</returns>
+NTSTATUS MemoryTransaction::Write( ptr_t address, size_t size, const void* data )
+{
+    if (address == 0)
+        return LastNtStatus( STATUS_INVALID_ADDRESS );
+
+    _staged++;
+    if (size == 0)
+        return STATUS_SUCCESS;
+
+    auto src = reinterpret_cast<const uint8_t*>(data);
+    ptr_t end = address + size;
+
+    // First span touching the range
+    auto first = _spans.upper_bound( address );
+    if (first != _spans.begin())
+    {
+        auto prev = std::prev( first );
+        if (prev->first + prev->second.size() >= address)
+            first = prev;
+    }
+
+    // Spans touching the range
+    auto last = first;
+    ptr_t newEnd = end;
+    for (; last != _spans.end() && last->first <= end; ++last)
+        newEnd = std::max<ptr_t>( newEnd, last->first + last->second.size() );
+
+    // New span
+    if (first == last)
+    {
+        _spans.emplace( address, std::vector<uint8_t>( src, src + size ) );
+        return STATUS_SUCCESS;
+    }
+
+    // Grow first span in place. Covers overwrites and appends
+    if (first->first <= address)
+    {
+        auto& span = first->second;
+        span.resize( static_cast<size_t>(newEnd - first->first) );
+
+        for (auto iter = std::next( first ); iter != last; ++iter)
+            std::copy( iter->second.begin(), iter->second.end(), span.begin() + static_cast<size_t>(iter->first - first->first) );
+
+        std::copy( src, src + size, span.begin() + static_cast<size_t>(address - first->first) );
+        _spans.erase( std::next( first ), last );
+        return STATUS_SUCCESS;
+    }
+
+    // Range starts before all touched spans
+    std::vector<uint8_t> merged( static_cast<size_t>(newEnd - address) );
+    for (auto iter = first; iter != last; ++iter)
+        std::copy( iter->second.begin(), iter->second.end(), merged.begin() + static_cast<size_t>(iter->first - address) );
+
+    std::copy( src, src + size, merged.begin() );
+
+    _spans.erase( first, last );
+    _spans.emplace( address, std::move( merged ) );
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Read data. Staged writes are applied on top of target memory
+/// </summary>
+/// <param name="address">Memory address to read from</param>
+/// <param name="size">Size of data to read</param>
+/// <param name="result">Output buffer</param>
+/// <param name="handleHoles">Read only committed pages of target memory</param>
+/// <returns>Status</returns>
+NTSTATUS MemoryTransaction::Read( ptr_t address, size_t size, void* result, bool handleHoles /*= false*/ )
+{
+    auto out = reinterpret_cast<uint8_t*>(result);
+    ptr_t end = address + size;
+
+    auto iter = _spans.upper_bound( address );
+    if (iter != _spans.begin())
+        --iter;
+
+    // Range is completely staged
+    if (iter != _spans.end() && iter->first <= address && iter->first + iter->second.size() >= end)
+    {
+        auto start = iter->second.begin() + static_cast<size_t>(address - iter->first);
+        std::copy( start, start + size, out );
+        return STATUS_SUCCESS;
+    }
+
+    NTSTATUS status = _memory.Read( address, size, result, handleHoles );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    // Overlay staged spans
+    for (; iter != _spans.end() && iter->first < end; ++iter)
+    {
+        ptr_t spanEnd = iter->first + iter->second.size();
+        if (spanEnd <= address)
+            continue;
+
+        ptr_t from = std::max<ptr_t>( iter->first, address );
+        ptr_t to = std::min<ptr_t>( spanEnd, end );
+
+        auto start = iter->second.begin() + static_cast<size_t>(from - iter->first);
+        std::copy( start, start + static_cast<size_t>(to - from), out + static_cast<size_t>(from - address) );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Write staged data into target process
+/// </summary>
+/// <param name="gap">Spans closer than gap bytes are joined into one write. Gap contents are read from target</param>
+/// <returns>Status. On failure spans that weren't written are kept staged</returns>
+NTSTATUS MemoryTransaction::Commit( size_t gap /*= 0*/ )
+{
+    _stats = TransactionStats();
+    _stats.writes = _staged;
+    _staged = 0;
+
+    if (gap != 0 && _spans.size() > 1)
+        JoinSpans( gap );
+
+    for (auto iter = _spans.begin(); iter != _spans.end(); iter = _spans.erase( iter ))
+    {
+        NTSTATUS status = _memory.Write( iter->first, iter->second.size(), iter->second.data() );
+        if (!NT_SUCCESS( status ))
+            return LastNtStatus( status );
+
+        _stats.spans++;
+        _stats.bytes += iter->second.size();
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Discard staged writes
+/// </summary>
+void MemoryTransaction::Rollback()
+{
+    _spans.clear();
+    _staged = 0;
+}
+
+/// <summary>
+/// Get number of staged bytes
+/// </summary>
+/// <returns>Staged bytes</returns>
+size_t MemoryTransaction::pending() const
+{
+    size_t total = 0;
+    for (auto& span : _spans)
+        total += span.second.size();
+
+    return total;
+}
+
+/// <summary>
+/// Join spans separated by no more than gap bytes
+/// </summary>
+/// <param name="gap">Max gap size</param>
+void MemoryTransaction::JoinSpans( size_t gap )
+{
+    std::vector<ReadRequest> holes;
+    std::vector<std::vector<uint8_t>> holeData;
+
+    holes.reserve( _spans.size() );
+    holeData.reserve( _spans.size() );
+
+    for (auto iter = _spans.begin(), next = std::next( iter ); next != _spans.end(); iter = next++)
+    {
+        ptr_t spanEnd = iter->first + iter->second.size();
+        if (next->first - spanEnd <= gap)
+        {
+            holeData.emplace_back( static_cast<size_t>(next->first - spanEnd) );
+            holes.emplace_back( spanEnd, holeData.back().size(), holeData.back().data() );
+        }
+    }
+
+    if (holes.empty())
+        return;
+
+    // Fetch all gaps at once
+    _memory.ReadBatch( holes );
+
+    size_t idx = 0;
+    for (auto iter = _spans.begin(); iter != _spans.end(); ++iter)
+    {
+        for (auto next = std::next( iter ); next != _spans.end() && idx < holes.size(); next = std::next( iter ))
+        {
+            auto& span = iter->second;
+            if (holes[idx].address != iter->first + span.size())
+                break;
+
+            // Unreadable gap, spans stay separate
+            auto& hole = holeData[idx];
+            if (!NT_SUCCESS( holes[idx++].status ))
+                break;
+
+            span.insert( span.end(), hole.begin(), hole.end() );
+            span.insert( span.end(), next->second.begin(), next->second.end() );
+            _stats.gapBytes += hole.size();
+
+            _spans.erase( next );
+        }
+    }
+}
+
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+
+#include <vector>
+#include <map>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Transaction commit statistics
+/// </summary>
+struct TransactionStats
+{
+    size_t writes = 0;      // Staged writes
+    size_t spans = 0;       // Native writes issued
+    size_t bytes = 0;       // Bytes written
+    size_t gapBytes = 0;    // Unchanged bytes written to join nearby spans
+};
+
+/// <summary>
+/// Write transaction. Writes are staged in local shadow buffer,
+/// adjacent and overlapping writes are merged and flushed with the fewest native writes on Commit.
+/// Reads through transaction see staged data. Uncommitted writes are discarded on destruction
+/// </summary>
+class MemoryTransaction
+{
+public:
+    /// <summary>
+    /// Transaction over whole process memory
+    /// </summary>
+    /// <param name="memory">Process memory</param>
+    BLACKBONE_API MemoryTransaction( class ProcessMemory& memory );
+
+    /// <summary>
+    /// Transaction over memory block. Block reads and writes are routed through transaction until it is destroyed
+    /// </summary>
+    /// <param name="block">Memory block</param>
+    BLACKBONE_API MemoryTransaction( class MemBlock& block );
+
+    BLACKBONE_API ~MemoryTransaction();
+
+    /// <summary>
+    /// Stage data write
+    /// </summary>
+    /// <param name="address">Memory address to write to</param>
+    /// <param name="size">Size of data to write</param>
+    /// <param name="data">Buffer to write</param>
+    /// <returns>Status</returns>
+    BLACKBONE_API NTSTATUS Write( ptr_t address, size_t size, const void* data );
+
+    /// <summary>
+    /// Stage data write
+    /// </summary>
+    /// <param name="address">Memory address to write to</param>
+    /// <param name="data">Data to write</param>
+    /// <returns>Status</returns>
+    template<class T>
+    inline NTSTATUS Write( ptr_t address, const T& data )
+    {
+        return Write( address, sizeof( T ), &data );
+    }
+
+    /// <summary>
+    /// Read data. Staged writes are applied on top of target memory
+    /// </summary>
+    /// <param name="address">Memory address to read from</param>
+    /// <param name="size">Size of data to read</param>
+    /// <param name="result">Output buffer</param>
+    /// <param name="handleHoles">Read only committed pages of target memory</param>
+    /// <returns>Status</returns>
+    BLACKBONE_API NTSTATUS Read( ptr_t address, size_t size, void* result, bool handleHoles = false );
+
+    /// <summary>
+    /// Write staged data into target process
+    /// </summary>
+    /// <param name="gap">Spans closer than gap bytes are joined into one write. Gap contents are read from target</param>
+    /// <returns>Status. On failure spans that weren't written are kept staged</returns>
+    BLACKBONE_API NTSTATUS Commit( size_t gap = 0 );
+
+    /// <summary>
+    /// Discard staged writes
+    /// </summary>
+    BLACKBONE_API void Rollback();
+
+    /// <summary>
+    /// Get number of staged bytes
+    /// </summary>
+    /// <returns>Staged bytes</returns>
+    BLACKBONE_API size_t pending() const;
+
+    /// <summary>
+    /// Get last commit statistics
+    /// </summary>
+    /// <returns>Commit statistics</returns>
+    BLACKBONE_API inline const TransactionStats& stats() const { return _stats; }
+
+private:
+    /// <summary>
+    /// Join spans separated by no more than gap bytes
+    /// </summary>
+    /// <param name="gap">Max gap size</param>
+    void JoinSpans( size_t gap );
+
+    MemoryTransaction( const MemoryTransaction& ) = delete;
+    MemoryTransaction& operator =( const MemoryTransaction& ) = delete;
+
+private:
+    class ProcessMemory& _memory;                   // Target process memory
+    class MemBlock* _block = nullptr;               // Attached memory block
+    std::map<ptr_t, std::vector<uint8_t>> _spans;   // Staged data, non-adjacent spans sorted by address
+    size_t _staged = 0;                             // Writes staged since last commit
+    TransactionStats _stats;                        // Last commit statistics
+};
+
+}
@@ -0,0 +1,219 @@
+#include "PointerPaths.h"
+#include "ProcessMemory.h"
+
+namespace blackbone
+{
+
+PointerPaths::PointerPaths( ProcessMemory& memory )
+    : _memory( memory )
+{
+}
+
+PointerPaths::~PointerPaths()
+{
+}
+
+/// <summary>
+/// Add pointer path
+/// </summary>
+/// <param name="adrList">Base address + list of offsets</param>
+/// <returns>Path index</returns>
+size_t PointerPaths::Add( const std::vector<ptr_t>& adrList )
+{
+    Path path = { npos, 0 };
+
+    // Single address, nothing to dereference
+    if (adrList.size() < 2)
+    {
+        path.offset = adrList.empty() ? 0 : adrList.front();
+        _paths.emplace_back( path );
+        return _paths.size() - 1;
+    }
+
+    // Every element except the last one is dereferenced
+    for (size_t i = 0; i < adrList.size() - 1; i++)
+    {
+        auto key = std::make_pair( path.leaf, adrList[i] );
+        auto iter = _lookup.find( key );
+        if (iter != _lookup.end())
+        {
+            path.leaf = iter->second;
+            continue;
+        }
+
+        Node node;
+        node.parent = path.leaf;
+        node.offset = adrList[i];
+
+        _nodes.emplace_back( node );
+        path.leaf = _nodes.size() - 1;
+        _lookup.emplace( key, path.leaf );
+
+        if (_levels.size() <= i)
+            _levels.resize( i + 1 );
+
+        _levels[i].emplace_back( path.leaf );
+    }
+
+    path.offset = adrList.back();
+    _paths.emplace_back( path );
+
+    return _paths.size() - 1;
+}
+
+/// <summary>
+/// Resolve all paths
+/// </summary>
+/// <returns>STATUS_SUCCESS if all paths were resolved, STATUS_PARTIAL_COPY if only some of them</returns>
+NTSTATUS PointerPaths::Resolve()
+{
+    std::vector<ReadRequest> requests;
+    std::vector<size_t> pending;
+
+    size_t ptrSize = _memory.backend().ptrSize();
+    uint32_t epoch = _memory.epoch();
+    DWORD now = GetTickCount();
+
+    _stats = PointerStats();
+
+    for (size_t depth = 0; depth < _levels.size(); depth++)
+    {
+        requests.clear();
+        pending.clear();
+
+        for (auto idx : _levels[depth])
+        {
+            auto& node = _nodes[idx];
+            ptr_t base = 0;
+
+            if (node.parent != npos)
+            {
+                auto& parent = _nodes[node.parent];
+                if (!parent.valid || parent.value == 0)
+                {
+                    node.valid = false;
+                    _stats.failed++;
+                    continue;
+                }
+
+                base = parent.value;
+            }
+
+            // Cached pointer is still good
+            if (depth < _cacheDepth && node.valid && !node.stale && node.epoch == epoch &&
+                node.parentValue == base && now - node.stamp <= _cacheAge)
+            {
+                _stats.cached++;
+                continue;
+            }
+
+            node.value = 0;
+            node.parentValue = base;
+            requests.emplace_back( base + node.offset, ptrSize, &node.value );
+            pending.emplace_back( idx );
+        }
+
+        if (requests.empty())
+            continue;
+
+        // Whole level at once
+        _memory.ReadBatch( requests );
+        _stats.levels++;
+
+        for (size_t i = 0; i < requests.size(); i++)
+        {
+            auto& node = _nodes[pending[i]];
+
+            node.valid = NT_SUCCESS( requests[i].status );
+            node.stale = false;
+            node.stamp = now;
+            node.epoch = epoch;
+
+            if (node.valid)
+            {
+                _stats.fetched++;
+                continue;
+            }
+
+            // Cached prefix may be outdated
+            _stats.failed++;
+            for (size_t parent = node.parent; parent != npos; parent = _nodes[parent].parent)
+                _nodes[parent].stale = true;
+        }
+    }
+
+    if (_stats.failed == 0)
+        return STATUS_SUCCESS;
+
+    return _stats.failed < _nodes.size() ? STATUS_PARTIAL_COPY : STATUS_UNSUCCESSFUL;
+}
+
+/// <summary>
+/// Resolve all paths and read values they point to
+/// </summary>
+/// <param name="size">Size of every value</param>
+/// <param name="results">Output buffer, size * count() bytes</param>
+/// <returns>STATUS_SUCCESS if all values were read, STATUS_PARTIAL_COPY if only some of them</returns>
+NTSTATUS PointerPaths::Read( size_t size, void* results )
+{
+    std::vector<ReadRequest> requests;
+    auto out = reinterpret_cast<uint8_t*>(results);
+
+    Resolve();
+
+    for (size_t i = 0; i < _paths.size(); i++)
+    {
+        ptr_t ptr = address( i );
+        if (ptr != 0)
+            requests.emplace_back( ptr, size, out + i * size );
+    }
+
+    if (requests.empty())
+        return LastNtStatus( STATUS_UNSUCCESSFUL );
+
+    NTSTATUS status = _memory.ReadBatch( requests );
+    if (status == STATUS_SUCCESS && requests.size() != _paths.size())
+        status = STATUS_PARTIAL_COPY;
+
+    return status;
+}
+
+/// <summary>
+/// Cache intermediate pointers
+/// </summary>
+/// <param name="depth">Number of leading levels to cache, 0 to disable caching</param>
+/// <param name="maxAge">Max age of cached pointer in milliseconds</param>
+void PointerPaths::SetCache( uint32_t depth, uint32_t maxAge /*= 1000*/ )
+{
+    _cacheDepth = depth;
+    _cacheAge = maxAge;
+}
+
+/// <summary>
+/// Drop cached pointers
+/// </summary>
+void PointerPaths::Invalidate()
+{
+    for (auto& node : _nodes)
+        node.stale = true;
+}
+
+/// <summary>
+/// Get resolved path address
+/// </summary>
+/// <param name="path">Path index</param>
+/// <returns>Final address, 0 if path couldn't be resolved</returns>
+ptr_t PointerPaths::address( size_t path ) const
+{
+    if (path >= _paths.size())
+        return 0;
+
+    auto& compiled = _paths[path];
+    if (compiled.leaf == npos)
+        return compiled.offset;
+
+    auto& leaf = _nodes[compiled.leaf];
+    return (leaf.valid && leaf.value != 0) ? leaf.value + compiled.offset : 0;
+}
+
+}
@@ -0,0 +1,147 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+
+#include <vector>
+#include <map>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Last resolve statistics
+/// </summary>
+struct PointerStats
+{
+    size_t fetched = 0;     // Pointers read from target
+    size_t cached = 0;      // Pointers taken from cache
+    size_t failed = 0;      // Pointers that couldn't be read
+    size_t levels = 0;      // Batched reads issued, one per trie level
+};
+
+/// <summary>
+/// Compiled set of multi-level pointer paths.
+/// Paths have the same format as in ProcessMemory::Read( std::vector<ptr_t>&& ... ): base address followed by offsets.
+/// Shared prefixes are resolved once, every level of all paths is read with a single batched read.
+/// Intermediate pointers can be cached, cached pointer is re-read if it's older than cache age,
+/// if its parent pointer has changed, if process memory was invalidated or if one of its children failed to read
+/// </summary>
+class PointerPaths
+{
+public:
+    BLACKBONE_API PointerPaths( class ProcessMemory& memory );
+    BLACKBONE_API ~PointerPaths();
+
+    /// <summary>
+    /// Add pointer path
+    /// </summary>
+    /// <param name="adrList">Base address + list of offsets</param>
+    /// <returns>Path index</returns>
+    BLACKBONE_API size_t Add( const std::vector<ptr_t>& adrList );
+
+    /// <summary>
+    /// Resolve all paths
+    /// </summary>
+    /// <returns>STATUS_SUCCESS if all paths were resolved, STATUS_PARTIAL_COPY if only some of them</returns>
+    BLACKBONE_API NTSTATUS Resolve();
+
+    /// <summary>
+    /// Resolve all paths and read values they point to
+    /// </summary>
+    /// <param name="size">Size of every value</param>
+    /// <param name="results">Output buffer, size * count() bytes</param>
+    /// <returns>STATUS_SUCCESS if all values were read, STATUS_PARTIAL_COPY if only some of them</returns>
+    BLACKBONE_API NTSTATUS Read( size_t size, void* results );
+
+    /// <summary>
+    /// Resolve all paths and read values they point to
+    /// </summary>
+    /// <param name="results">Read values. Values of unresolved paths are left default-initialized</param>
+    /// <returns>STATUS_SUCCESS if all values were read, STATUS_PARTIAL_COPY if only some of them</returns>
+    template<typename T>
+    inline NTSTATUS Read( std::vector<T>& results )
+    {
+        results.assign( _paths.size(), T() );
+        return results.empty() ? STATUS_SUCCESS : Read( sizeof( T ), results.data() );
+    }
+
+    /// <summary>
+    /// Cache intermediate pointers
+    /// </summary>
+    /// <param name="depth">Number of leading levels to cache, 0 to disable caching</param>
+    /// <param name="maxAge">Max age of cached pointer in milliseconds</param>
+    BLACKBONE_API void SetCache( uint32_t depth, uint32_t maxAge = 1000 );
+
+    /// <summary>
+    /// Drop cached pointers
+    /// </summary>
+    BLACKBONE_API void Invalidate();
+
+    /// <summary>
+    /// Get resolved path address
+    /// </summary>
+    /// <param name="path">Path index</param>
+    /// <returns>Final address, 0 if path couldn't be resolved</returns>
+    BLACKBONE_API ptr_t address( size_t path ) const;
+
+    /// <summary>
+    /// Get number of paths
+    /// </summary>
+    /// <returns>Path count</returns>
+    BLACKBONE_API inline size_t count() const { return _paths.size(); }
+
+    /// <summary>
+    /// Get number of unique pointers dereferenced per resolve
+    /// </summary>
+    /// <returns>Trie node count</returns>
+    BLACKBONE_API inline size_t nodes() const { return _nodes.size(); }
+
+    /// <summary>
+    /// Get last resolve statistics
+    /// </summary>
+    /// <returns>Statistics</returns>
+    BLACKBONE_API inline const PointerStats& stats() const { return _stats; }
+
+private:
+    /// <summary>
+    /// Single dereference, shared by all paths with the same prefix
+    /// </summary>
+    struct Node
+    {
+        size_t parent;              // Parent node, npos for base address
+        ptr_t offset;               // Offset from parent value, or base address
+        ptr_t value = 0;            // Read pointer
+        ptr_t parentValue = 0;      // Parent value the pointer was read with
+        DWORD stamp = 0;            // Read time
+        uint32_t epoch = 0;         // Process memory cache epoch at read time
+        bool valid = false;         // Pointer was read successfully
+        bool stale = true;          // Pointer must be re-read
+    };
+
+    /// <summary>
+    /// Compiled path
+    /// </summary>
+    struct Path
+    {
+        size_t leaf;                // Last dereference node, npos if path has no dereferences
+        ptr_t offset;               // Offset added to leaf value
+    };
+
+    static const size_t npos = static_cast<size_t>(-1);
+
+    PointerPaths( const PointerPaths& ) = delete;
+    PointerPaths& operator =( const PointerPaths& ) = delete;
+
+private:
+    class ProcessMemory& _memory;                       // Target process memory
+    std::vector<Node> _nodes;                           // Dereference trie
+    std::vector<std::vector<size_t>> _levels;           // Nodes by depth
+    std::map<std::pair<size_t, ptr_t>, size_t> _lookup; // Parent and offset -> node
+    std::vector<Path> _paths;                           // Compiled paths
+    uint32_t _cacheDepth = 0;                           // Number of cached levels
+    uint32_t _cacheAge = 1000;                          // Max cached pointer age, ms
+    PointerStats _stats;                                // Last resolve statistics
+};
+
+}
@@ -8,6 +8,9 @@ ProcessMemory::ProcessMemory( Process* process )
     : RemoteMemory( process )
     , _process( process )
     , _core( process->core() )  
+    , _backend( new NativeBackend( process->core() ) )
+    , _regions( *this )
+    , _heap( *this )
 {
 }
 
@@ -37,7 +40,25 @@ MemBlock ProcessMemory::Allocate( size_t size, DWORD protection /*= PAGE_EXECUTE
 /// <returns>Status</returns>
 NTSTATUS ProcessMemory::Free( ptr_t pAddr, size_t size /*= 0*/, DWORD freeType /*= MEM_RELEASE*/ )
 {
-    return _core.native()->VirtualFreeExT( pAddr, size, freeType );
+    // Released region size is unknown
+    if (size == 0)
+        Invalidate();
+    else
+        Invalidate( pAddr, size );
+
+    // Whole allocation is released
+    size_t changed = size != 0 ? size : _regions.AllocationSize( pAddr );
+
+    NTSTATUS status = _backend->Free( pAddr, size, freeType );
+    if (NT_SUCCESS( status ))
+    {
+        if (changed != 0)
+            _regions.Update( pAddr, changed );
+        else
+            _regions.Invalidate();
+    }
+
+    return status;
 }
 
 /// <summary>
@@ -48,7 +69,8 @@ NTSTATUS ProcessMemory::Free( ptr_t pAddr, size_t size /*= 0*/, DWORD freeType /
 /// <returns>Status</returns>
 NTSTATUS ProcessMemory::Query( ptr_t pAddr, PMEMORY_BASIC_INFORMATION64 pInfo )
 {
-    return _core.native()->VirtualQueryExT( pAddr, pInfo );
+    _stats.queries++;
+    return _backend->Query( pAddr, pInfo );
 }
 
 /// <summary>
@@ -65,7 +87,14 @@ NTSTATUS ProcessMemory::Protect( ptr_t pAddr, size_t size, DWORD flProtect, DWOR
     if (pOld == nullptr)
         pOld = &junk;
 
-    return _core.native()->VirtualProtectExT( pAddr, size, CastProtection( flProtect, _core.DEP() ), pOld );
+    Invalidate( pAddr, size );
+    _stats.protects++;
+
+    NTSTATUS status = _backend->Protect( pAddr, size, CastProtection( flProtect, _core.DEP() ), pOld );
+    if (NT_SUCCESS( status ))
+        _regions.Update( pAddr, size );
+
+    return status;
 }
 
 /// <summary>
@@ -81,8 +110,6 @@ NTSTATUS ProcessMemory::Protect( ptr_t pAddr, size_t size, DWORD flProtect, DWOR
 /// <returns>Status</returns>
 NTSTATUS ProcessMemory::Read( ptr_t dwAddress, size_t dwSize, PVOID pResult, bool handleHoles /*= false*/ )
 {
-    DWORD64 dwRead = 0;
-
     if (dwAddress == 0)
         return LastNtStatus( STATUS_INVALID_ADDRESS );
 
@@ -91,32 +118,55 @@ NTSTATUS ProcessMemory::Read( ptr_t dwAddress, size_t dwSize, PVOID pResult, boo
     // Simple read
     if (!handleHoles)
     {
-        return _core.native()->ReadProcessMemoryT( dwAddress, pResult, dwSize, &dwRead );
+        if (_cacheBudget != 0)
+            return ReadCached( dwAddress, dwSize, pResult );
+
+        _stats.reads++;
+        return _backend->Read( dwAddress, pResult, dwSize );
     }
     // Read all committed memory regions
     else
     {
-        MEMORY_BASIC_INFORMATION64 mbi = { 0 };
-
-        for (ptr_t memptr = dwAddress; memptr < dwAddress + dwSize; memptr = mbi.BaseAddress + mbi.RegionSize)
+        // Target may have changed pages in range since map was built, range is re-queried once
+        NTSTATUS status = ReadCommitted( dwAddress, dwSize, pResult );
+        if (status != STATUS_SUCCESS && _regions.valid())
         {
-            if (_core.native()->VirtualQueryExT( memptr, &mbi ) != STATUS_SUCCESS)
-                continue;
+            _regions.Update( dwAddress, dwSize );
+            status = ReadCommitted( dwAddress, dwSize, pResult );
+        }
 
-            // Filter empty regions
-            if (mbi.State != MEM_COMMIT || mbi.Protect == PAGE_NOACCESS)
-                continue;
+        return status;
+    }
+}
 
-            uint64_t region_ptr = memptr - dwAddress;
+/// <summary>
+/// Read committed pages of memory range, as seen by region map
+/// </summary>
+/// <param name="dwAddress">Memory address to read from</param>
+/// <param name="dwSize">Size of data to read</param>
+/// <param name="pResult">Output buffer</param>
+/// <returns>Status</returns>
+NTSTATUS ProcessMemory::ReadCommitted( ptr_t dwAddress, size_t dwSize, PVOID pResult )
+{
+    vecRegions regions;
+    ptr_t end = dwAddress + dwSize;
 
-            if (_core.native()->ReadProcessMemoryT( mbi.BaseAddress,
-                reinterpret_cast<uint8_t*>(pResult) + region_ptr,
-                static_cast<size_t>(mbi.RegionSize),
-                &dwRead ) != STATUS_SUCCESS)
-            {
-                return LastNtStatus();
-            }
-        }
+    _regions.Get( dwAddress, end, regions );
+
+    for (auto& mbi : regions)
+    {
+        // Filter empty regions
+        if (mbi.State != MEM_COMMIT || mbi.Protect == PAGE_NOACCESS)
+            continue;
+
+        ptr_t memptr = std::max<ptr_t>( mbi.BaseAddress, dwAddress );
+        size_t size = static_cast<size_t>(std::min<ptr_t>( mbi.BaseAddress + mbi.RegionSize, end ) - memptr);
+        _stats.reads++;
+
+        if (_backend->Read( memptr,
+            reinterpret_cast<uint8_t*>(pResult) + (memptr - dwAddress),
+            size ) != STATUS_SUCCESS)
+            return LastNtStatus();
     }
 
     return STATUS_SUCCESS;
@@ -140,7 +190,7 @@ NTSTATUS ProcessMemory::Read( std::vector<ptr_t>&& adrList, size_t dwSize, PVOID
     if(adrList.size() == 1)
         return Read( adrList.front(), dwSize, pResult, handleHoles );
 
-    bool wow64 = _core.native()->GetWow64Barrier().targetWow64;
+    bool wow64 = _backend->ptrSize() == sizeof( uint32_t );
     ptr_t ptr = wow64 ? Read<uint32_t>( adrList[0] ) : Read<ptr_t>( adrList[0] );
 
     for (size_t i = 1; i < adrList.size() - 1; i++)
@@ -149,6 +199,22 @@ NTSTATUS ProcessMemory::Read( std::vector<ptr_t>&& adrList, size_t dwSize, PVOID
     return Read( ptr + adrList.back(), dwSize, pResult, handleHoles );
 }
 
+/// <summary>
+/// Read several memory ranges with minimal number of native reads.
+/// Ranges closer than gap bytes are merged, results are scattered back into request buffers
+/// </summary>
+/// <param name="requests">Ranges to read. Status of every request is updated</param>
+/// <param name="gap">Max distance between ranges that are still merged</param>
+/// <returns>STATUS_SUCCESS if all ranges were read, STATUS_PARTIAL_COPY if only some of them</returns>
+NTSTATUS ProcessMemory::ReadBatch( std::vector<ReadRequest>& requests, size_t gap /*= 0x1000*/ )
+{
+    size_t calls = 0;
+    NTSTATUS status = _backend->ReadBatch( requests, gap, &calls );
+
+    _stats.reads += calls;
+    return status;
+}
+
 /// <summary>
 /// Write data
 /// </summary>
@@ -158,7 +224,10 @@ NTSTATUS ProcessMemory::Read( std::vector<ptr_t>&& adrList, size_t dwSize, PVOID
 /// <returns>Status</returns>
 NTSTATUS ProcessMemory::Write( ptr_t pAddress, size_t dwSize, const void* pData )
 {
-    return _core.native()->WriteProcessMemoryT( pAddress, pData, dwSize );
+    Invalidate( pAddress, dwSize );
+    _stats.writes++;
+
+    return _backend->Write( pAddress, pData, dwSize );
 }
 
 /// <summary>
@@ -175,7 +244,7 @@ NTSTATUS ProcessMemory::Write( std::vector<ptr_t>&& adrList, size_t dwSize, cons
     if (adrList.size() == 1)
         return Write( adrList.front(), dwSize, pData );
 
-    bool wow64 = _core.native()->GetWow64Barrier().targetWow64;
+    bool wow64 = _backend->ptrSize() == sizeof( uint32_t );
     ptr_t ptr = wow64 ? Read<uint32_t>( adrList[0] ) : Read<ptr_t>( adrList[0] );
 
     for (size_t i = 1; i < adrList.size() - 1; i++)
@@ -192,7 +261,303 @@ NTSTATUS ProcessMemory::Write( std::vector<ptr_t>&& adrList, size_t dwSize, cons
 /// <returns>Number of regions found</returns>
 size_t ProcessMemory::EnumRegions( std::list<MEMORY_BASIC_INFORMATION64>& results, bool includeFree /*= false*/ )
 {
-    return _core.native()->EnumRegions( results, includeFree );
+    vecRegions regions;
+    _regions.Get( _backend->minAddr(), _backend->maxAddr(), regions, includeFree );
+
+    results.assign( regions.begin(), regions.end() );
+    return results.size();
+}
+
+/// <summary>
+/// Unmap any mapped memory, restore hooks and drop cached data
+/// </summary>
+void ProcessMemory::reset()
+{
+    RemoteMemory::reset();
+
+    _heap.reset();
+    Invalidate();
+    _regions.Invalidate();
+}
+
+/// <summary>
+/// Replace address space backend. Remote heap, cached pages and region map are dropped
+/// </summary>
+/// <param name="backend">New backend, nullptr restores process subsystem backend</param>
+void ProcessMemory::SetBackend( ptrBackend backend )
+{
+    // Heap chunks belong to old address space
+    _heap.reset();
+
+    if (backend)
+        _backend = std::move( backend );
+    else
+        _backend.reset( new NativeBackend( _core ) );
+
+    Invalidate();
+    _regions.Invalidate();
+}
+
+/// <summary>
+/// Enable page-granular read cache.
+/// Cached pages are dropped by Write, Protect and Free through this object or by Invalidate.
+/// Changes made by the target itself are not tracked, so cache should only span short operations
+/// </summary>
+/// <param name="budget">Max number of cached pages</param>
+void ProcessMemory::EnableCache( size_t budget /*= 256*/ )
+{
+    CSLock lck( _cacheLock );
+
+    _cacheBudget = budget;
+
+    // Shrink to new budget
+    while (_cache.size() > _cacheBudget)
+    {
+        _cache.erase( _cacheLru.back() );
+        _cacheLru.pop_back();
+    }
+}
+
+/// <summary>
+/// Disable read cache and drop cached pages
+/// </summary>
+void ProcessMemory::DisableCache()
+{
+    EnableCache( 0 );
+    Invalidate();
+}
+
+/// <summary>
+/// Drop all cached pages and start new cache epoch
+/// </summary>
+/// <returns>New epoch</returns>
+uint32_t ProcessMemory::Invalidate()
+{
+    CSLock lck( _cacheLock );
+
+    _cache.clear();
+    _cacheLru.clear();
+
+    return ++_epoch;
+}
+
+/// <summary>
+/// Drop cached pages overlapping memory range
+/// </summary>
+/// <param name="address">Range start</param>
+/// <param name="size">Range size</param>
+void ProcessMemory::Invalidate( ptr_t address, size_t size )
+{
+    CSLock lck( _cacheLock );
+
+    if (!_cache.empty())
+        DropPages( address, size );
+}
+
+/// <summary>
+/// Get native call statistics
+/// </summary>
+/// <returns>Statistics snapshot</returns>
+MemoryStats ProcessMemory::stats() const
+{
+    MemoryStats snapshot;
+
+    snapshot.reads = _stats.reads;
+    snapshot.writes = _stats.writes;
+    snapshot.queries = _stats.queries;
+    snapshot.protects = _stats.protects;
+    snapshot.cacheHits = _stats.cacheHits;
+    snapshot.cacheMisses = _stats.cacheMisses;
+
+    return snapshot;
+}
+
+/// <summary>
+/// Reset native call statistics
+/// </summary>
+void ProcessMemory::ResetStats()
+{
+    _stats.reads = 0;
+    _stats.writes = 0;
+    _stats.queries = 0;
+    _stats.protects = 0;
+    _stats.cacheHits = 0;
+    _stats.cacheMisses = 0;
+}
+
+/// <summary>
+/// Drop cached pages overlapping memory range. Cache lock must be held
+/// </summary>
+/// <param name="address">Range start</param>
+/// <param name="size">Range size</param>
+void ProcessMemory::DropPages( ptr_t address, size_t size )
+{
+    ptr_t pageSize = _backend->pageSize();
+    ptr_t first = address & ~(pageSize - 1);
+    ptr_t last = (address + (size != 0 ? size : 1) - 1) & ~(pageSize - 1);
+
+    // Huge range, faster to walk the cache
+    if ((last - first) / pageSize > _cache.size())
+    {
+        for (auto iter = _cache.begin(); iter != _cache.end();)
+        {
+            if (iter->first >= first && iter->first <= last)
+            {
+                _cacheLru.erase( iter->second.second );
+                iter = _cache.erase( iter );
+            }
+            else
+                ++iter;
+        }
+
+        return;
+    }
+
+    for (ptr_t page = first; page <= last; page += pageSize)
+    {
+        auto iter = _cache.find( page );
+        if (iter != _cache.end())
+        {
+            _cacheLru.erase( iter->second.second );
+            _cache.erase( iter );
+        }
+    }
+}
+
+/// <summary>
+/// Read data through page cache
+/// </summary>
+/// <param name="dwAddress">Memory address to read from</param>
+/// <param name="dwSize">Size of data to read</param>
+/// <param name="pResult">Output buffer</param>
+/// <returns>Status</returns>
+NTSTATUS ProcessMemory::ReadCached( ptr_t dwAddress, size_t dwSize, PVOID pResult )
+{
+    CSLock lck( _cacheLock );
+
+    ptr_t pageSize = _backend->pageSize();
+    ptr_t first = dwAddress & ~(pageSize - 1);
+    ptr_t last = (dwAddress + (dwSize != 0 ? dwSize : 1) - 1) & ~(pageSize - 1);
+
+    // Range doesn't fit into cache
+    if ((last - first) / pageSize + 1 > _cacheBudget)
+    {
+        _stats.reads++;
+        return _backend->Read( dwAddress, pResult, dwSize );
+    }
+
+    // Fetch missing pages, one read per run of adjacent missing pages
+    for (ptr_t page = first; page <= last;)
+    {
+        if (_cache.count( page ))
+        {
+            _stats.cacheHits++;
+            page += pageSize;
+            continue;
+        }
+
+        ptr_t runEnd = page;
+        while (runEnd + pageSize <= last && !_cache.count( runEnd + pageSize ))
+            runEnd += pageSize;
+
+        std::vector<uint8_t> buf( static_cast<size_t>(runEnd - page + pageSize) );
+
+        _stats.reads++;
+        if (!NT_SUCCESS( _backend->Read( page, buf.data(), buf.size() ) ))
+        {
+            // Part of the range isn't readable, leave it to direct read
+            _stats.reads++;
+            return _backend->Read( dwAddress, pResult, dwSize );
+        }
+
+        for (ptr_t ofs = 0; ofs < buf.size(); ofs += pageSize)
+        {
+            _cacheLru.push_front( page + ofs );
+            auto start = buf.begin() + static_cast<size_t>(ofs);
+            _cache.emplace( page + ofs, CachedPage( std::vector<uint8_t>( start, start + static_cast<size_t>(pageSize) ), _cacheLru.begin() ) );
+            _stats.cacheMisses++;
+        }
+
+        page = runEnd + pageSize;
+    }
+
+    // Copy out
+    uint8_t* out = reinterpret_cast<uint8_t*>(pResult);
+    for (ptr_t addr = dwAddress, end = dwAddress + dwSize; addr < end;)
+    {
+        ptr_t page = addr & ~(pageSize - 1);
+        auto& cached = _cache[page];
+
+        size_t offset = static_cast<size_t>(addr - page);
+        size_t chunk = static_cast<size_t>(std::min<ptr_t>( end - addr, pageSize - offset ));
+        memcpy( out, cached.first.data() + offset, chunk );
+
+        // Move to LRU head
+        _cacheLru.splice( _cacheLru.begin(), _cacheLru, cached.second );
+
+        out += chunk;
+        addr += chunk;
+    }
+
+    // Evict least recently used pages
+    while (_cache.size() > _cacheBudget)
+    {
+        _cache.erase( _cacheLru.back() );
+        _cacheLru.pop_back();
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Enable read cache for the lifetime of the object
+/// </summary>
+/// <param name="memory">Process memory</param>
+/// <param name="budget">Max number of cached pages</param>
+MemoryCacheScope::MemoryCacheScope( ProcessMemory& memory, size_t budget /*= 256*/ )
+    : _memory( memory )
+    , _prevBudget( 0 )
+    , _start( memory.stats() )
+{
+    CSLock lck( _memory._cacheLock );
+    _memory._cacheScopes++;
+
+    // Budget is read under lock, so scopes on other threads can't change it in between
+    _prevBudget = _memory._cacheBudget;
+
+    // Nested scope never shrinks outer cache
+    if (budget > _prevBudget)
+        _memory.EnableCache( budget );
+}
+
+MemoryCacheScope::~MemoryCacheScope()
+{
+    CSLock lck( _memory._cacheLock );
+
+    // Pages cached by nested scope still belong to the outer one
+    if (--_memory._cacheScopes == 0)
+        _memory.Invalidate();
+
+    _memory.EnableCache( _prevBudget );
+}
+
+/// <summary>
+/// Native call statistics collected since scope start
+/// </summary>
+/// <returns>Statistics</returns>
+MemoryStats MemoryCacheScope::stats() const
+{
+    MemoryStats now = _memory.stats();
+    MemoryStats delta;
+
+    delta.reads = now.reads - _start.reads;
+    delta.writes = now.writes - _start.writes;
+    delta.queries = now.queries - _start.queries;
+    delta.protects = now.protects - _start.protects;
+    delta.cacheHits = now.cacheHits - _start.cacheHits;
+    delta.cacheMisses = now.cacheMisses - _start.cacheMisses;
+
+    return delta;
 }
 
 }
\ No newline at end of file
@@ -1,17 +1,62 @@
 #pragma once
 
 #include "../Include/Winheaders.h"
+#include "../Subsystem/NativeSubsystem.h"
+#include "../Subsystem/NativeBackend.h"
 #include "RPC/RemoteMemory.h"
 #include "MemBlock.h"
+#include "RegionMap.h"
+#include "RemoteHeap.h"
+#include "MemoryTransaction.h"
+#include "PointerPaths.h"
+#include "../Misc/Utils.h"
 
 #include <vector>
 #include <list>
+#include <unordered_map>
+#include <memory>
+#include <atomic>
 
 namespace blackbone
 {
 
+/// <summary>
+/// Native calls issued through ProcessMemory
+/// </summary>
+struct MemoryStats
+{
+    uint64_t reads = 0;         // Memory reads
+    uint64_t writes = 0;        // Memory writes
+    uint64_t queries = 0;       // Region queries
+    uint64_t protects = 0;      // Protection changes
+    uint64_t cacheHits = 0;     // Pages served from read cache
+    uint64_t cacheMisses = 0;   // Pages fetched into read cache
+
+    /// <summary>
+    /// Total number of native calls
+    /// </summary>
+    /// <returns>Call count</returns>
+    inline uint64_t syscalls() const { return reads + writes + queries + protects; }
+};
+
+/// <summary>
+/// Live counters behind MemoryStats. Updated from any thread that uses ProcessMemory, e.g. RegionStream reader
+/// </summary>
+struct MemoryCounters
+{
+    std::atomic<uint64_t> reads{ 0 };
+    std::atomic<uint64_t> writes{ 0 };
+    std::atomic<uint64_t> queries{ 0 };
+    std::atomic<uint64_t> protects{ 0 };
+    std::atomic<uint64_t> cacheHits{ 0 };
+    std::atomic<uint64_t> cacheMisses{ 0 };
+};
+
 class ProcessMemory : public RemoteMemory
 {
+public:
+    typedef std::unique_ptr<MemoryBackend> ptrBackend;
+
 public:
     BLACKBONE_API ProcessMemory( class Process* process );
     BLACKBONE_API ~ProcessMemory();
@@ -79,6 +124,15 @@ public:
     /// <returns>Status</returns>
     BLACKBONE_API NTSTATUS Read( std::vector<ptr_t>&& adrList, size_t dwSize, PVOID pResult, bool handleHoles = false );
 
+    /// <summary>
+    /// Read several memory ranges with minimal number of native reads.
+    /// Ranges closer than gap bytes are merged, results are scattered back into request buffers
+    /// </summary>
+    /// <param name="requests">Ranges to read. Status of every request is updated</param>
+    /// <param name="gap">Max distance between ranges that are still merged</param>
+    /// <returns>STATUS_SUCCESS if all ranges were read, STATUS_PARTIAL_COPY if only some of them</returns>
+    BLACKBONE_API NTSTATUS ReadBatch( std::vector<ReadRequest>& requests, size_t gap = 0x1000 );
+
     /// <summary>
     /// Write data
     /// </summary>
@@ -172,23 +226,167 @@ public:
     }
 
     /// <summary>
-    /// Enumerate valid memory regions
+    /// Enumerate valid memory regions. Region map is rebuilt first if it's older than max age
     /// </summary>
     /// <param name="results">Found regions</param>
     /// <param name="includeFree">If true - non-allocated regions will be included in list</param>
     /// <returns>Number of regions found</returns>
     BLACKBONE_API size_t EnumRegions( std::list<MEMORY_BASIC_INFORMATION64>& results, bool includeFree = false );
 
+    /// <summary>
+    /// Get address space region map
+    /// </summary>
+    /// <returns>Region map</returns>
+    BLACKBONE_API inline RegionMap& regions() { return _regions; }
+
+    /// <summary>
+    /// Replace address space backend. Remote heap, cached pages and region map are dropped
+    /// </summary>
+    /// <param name="backend">New backend, nullptr restores process subsystem backend</param>
+    BLACKBONE_API void SetBackend( ptrBackend backend );
+
+    /// <summary>
+    /// Get address space backend
+    /// </summary>
+    /// <returns>Backend</returns>
+    BLACKBONE_API inline MemoryBackend& backend() { return *_backend; }
+
+    /// <summary>
+    /// Get remote heap
+    /// </summary>
+    /// <returns>Remote heap</returns>
+    BLACKBONE_API inline RemoteHeap& heap() { return _heap; }
+
+    /// <summary>
+    /// Enable page-granular read cache.
+    /// Cached pages are dropped by Write, Protect and Free through this object or by Invalidate.
+    /// Changes made by the target itself are not tracked, so cache should only span short operations
+    /// </summary>
+    /// <param name="budget">Max number of cached pages</param>
+    BLACKBONE_API void EnableCache( size_t budget = 256 );
+
+    /// <summary>
+    /// Disable read cache and drop cached pages
+    /// </summary>
+    BLACKBONE_API void DisableCache();
+
+    /// <summary>
+    /// Drop all cached pages and start new cache epoch
+    /// </summary>
+    /// <returns>New epoch</returns>
+    BLACKBONE_API uint32_t Invalidate();
+
+    /// <summary>
+    /// Drop cached pages overlapping memory range
+    /// </summary>
+    /// <param name="address">Range start</param>
+    /// <param name="size">Range size</param>
+    BLACKBONE_API void Invalidate( ptr_t address, size_t size );
+
+    /// <summary>
+    /// Get read cache budget
+    /// </summary>
+    /// <returns>Max number of cached pages, 0 if cache is disabled</returns>
+    BLACKBONE_API inline size_t cacheBudget() const { return _cacheBudget; }
+
+    /// <summary>
+    /// Get current cache epoch
+    /// </summary>
+    /// <returns>Epoch</returns>
+    BLACKBONE_API inline uint32_t epoch() const { return _epoch; }
+
+    /// <summary>
+    /// Get native call statistics
+    /// </summary>
+    /// <returns>Statistics snapshot</returns>
+    BLACKBONE_API MemoryStats stats() const;
+
+    /// <summary>
+    /// Reset native call statistics
+    /// </summary>
+    BLACKBONE_API void ResetStats();
+
+    /// <summary>
+    /// Unmap any mapped memory, restore hooks and drop cached data
+    /// </summary>
+    BLACKBONE_API void reset();
+
     BLACKBONE_API inline class ProcessCore& core() { return _core; }
     BLACKBONE_API inline class Process* process()  { return _process; }
 
 private:
+    /// <summary>
+    /// Read data through page cache
+    /// </summary>
+    /// <param name="dwAddress">Memory address to read from</param>
+    /// <param name="dwSize">Size of data to read</param>
+    /// <param name="pResult">Output buffer</param>
+    /// <returns>Status</returns>
+    NTSTATUS ReadCached( ptr_t dwAddress, size_t dwSize, PVOID pResult );
+
+    /// <summary>
+    /// Read committed pages of memory range, as seen by region map
+    /// </summary>
+    /// <param name="dwAddress">Memory address to read from</param>
+    /// <param name="dwSize">Size of data to read</param>
+    /// <param name="pResult">Output buffer</param>
+    /// <returns>Status</returns>
+    NTSTATUS ReadCommitted( ptr_t dwAddress, size_t dwSize, PVOID pResult );
+
+    /// <summary>
+    /// Drop cached pages overlapping memory range. Cache lock must be held
+    /// </summary>
+    /// <param name="address">Range start</param>
+    /// <param name="size">Range size</param>
+    void DropPages( ptr_t address, size_t size );
+
     ProcessMemory( const ProcessMemory& ) = delete;
     ProcessMemory& operator =( const ProcessMemory& ) = delete;
 
+    friend class MemoryCacheScope;
+
 private:
+    typedef std::pair<std::vector<uint8_t>, std::list<ptr_t>::iterator> CachedPage;
+
     class Process* _process;    // Owning process object
     class ProcessCore& _core;   // Core routines
+    ptrBackend _backend;        // Address space access
+    RegionMap _regions;         // Address space regions
+    RemoteHeap _heap;           // Small block sub-allocator
+
+    std::unordered_map<ptr_t, CachedPage> _cache;   // Page base -> page data and LRU position
+    std::list<ptr_t> _cacheLru;                     // Cached pages, most recently used first
+    std::atomic<size_t> _cacheBudget{ 0 };          // Max cached pages, 0 if cache is disabled. Written under _cacheLock
+    uint32_t _epoch = 0;                            // Cache epoch
+    uint32_t _cacheScopes = 0;                      // Active MemoryCacheScope objects, guarded by _cacheLock
+    MemoryCounters _stats;                          // Native call statistics
+    CriticalSection _cacheLock;                     // Cache guard
+};
+
+/// <summary>
+/// Read cache scope. Enables cache on ProcessMemory for the lifetime of the object
+/// and drops cached pages on exit. Nested scopes share the cache, only the outermost one drops it
+/// </summary>
+class MemoryCacheScope
+{
+public:
+    BLACKBONE_API MemoryCacheScope( ProcessMemory& memory, size_t budget = 256 );
+    BLACKBONE_API ~MemoryCacheScope();
+
+    /// <summary>
+    /// Native call statistics collected since scope start
+    /// </summary>
+    /// <returns>Statistics</returns>
+    BLACKBONE_API MemoryStats stats() const;
+
+private:
+    MemoryCacheScope( const MemoryCacheScope& ) = delete;
+    MemoryCacheScope& operator =( const MemoryCacheScope& ) = delete;
+
+private:
+    ProcessMemory& _memory;     // Cached memory
+    size_t _prevBudget;         // Cache budget before scope
+    MemoryStats _start;         // Statistics at scope start
 };
 
 }
\ No newline at end of file
@@ -27,6 +27,7 @@ ProcessModules::ProcessModules( class Process& proc )
     , _memory( _proc.memory() )
     , _core( _proc.core() )
     , _ldrPatched( false )
+    , _generation( 0 )
 {
 }
 
@@ -76,16 +77,34 @@ const ModuleData* ProcessModules::GetModule(
     auto key = std::make_pair( name, type );
 
     // Fast lookup
-    if (_modules.count( key ) && (_modules[key].manual || ValidateModule( _modules[key].baseAddress )))
-        return &_modules[key];
+    auto iter = _modules.find( key );
+    if (iter != _modules.end())
+    {
+        // Loader entry that is still linked and unchanged means image is still there, no need to check headers
+        auto& mod = iter->second;
+        if (mod.manual || (mod.ldrEntry != 0 ? _core.native()->ValidateLdrEntry( mod ) : ValidateModule( mod.baseAddress )))
+            return &mod;
+
+        // Module was unloaded
+        UncacheModule( iter );
+        _generation++;
+    }
 
-    // Enum all process modules
-    Native::listModules modules;
-    _core.native()->EnumModules( modules, search, type );
-    
-    // Update local cache
-    for (auto& mod : modules)
-        _modules.emplace( std::make_pair( std::make_pair( mod.name, mod.type ), mod ) );
+    if (search == LdrList)
+    {
+        // Read only loader list changes
+        RefreshLdrModules( type );
+    }
+    else
+    {
+        // Enum all process modules
+        Native::listModules modules;
+        _core.native()->EnumModules( modules, search, type );
+
+        // Update local cache
+        for (auto& mod : modules)
+            CacheModule( mod );
+    }
 
     if (_modules.count( key ))
         return &_modules[key];
@@ -114,33 +133,63 @@ const ModuleData* ProcessModules::GetModule(
 
     CSLock lck( _modGuard );
 
-    auto compFn = [modBase, strict]( const mapModules::value_type& val )
-    { 
-        if (strict)
-            return (val.second.baseAddress == modBase);
-        else
-            return (modBase >= val.second.baseAddress && modBase < val.second.baseAddress + val.second.size);
-    };
+    auto pMod = FindCached( modBase, strict, type );
+    if (pMod != nullptr)
+        return pMod;
 
-    auto iter = std::find_if( _modules.begin( ), _modules.end( ), compFn );
+    if (search == LdrList)
+    {
+        // Read only loader list changes
+        RefreshLdrModules( type );
+    }
+    else
+    {
+        // Enum all process modules
+        Native::listModules modules;
+        _core.native()->EnumModules( modules, search, type );
 
-    if (iter != _modules.end())
-        return &iter->second;
+        // Update local cache
+        for (auto& mod : modules)
+            CacheModule( mod );
+    }
 
-    // Enum all process modules
-    Native::listModules modules;
-    _core.native()->EnumModules( modules, search, type );
+    return FindCached( modBase, strict, type );
+}
 
-    // Update local cache
-    for (auto& mod : modules)
-        _modules.emplace( std::make_pair( std::make_pair( mod.name, mod.type ), mod ) );
+/// <summary>
+/// Apply loader list changes to local cache
+/// </summary>
+/// <param name="type">Module type. 32 bit or 64 bit</param>
+void ProcessModules::RefreshLdrModules( eModType type )
+{
+    Native::listModules added, removed;
+    auto& state = _ldrState[type == mt_mod64 ? 1 : 0];
 
-    iter = std::find_if( _modules.begin(), _modules.end(), compFn );
+    if (!NT_SUCCESS( _core.native()->RefreshModules( state, added, removed, type ) ))
+        return;
 
-    if (iter != _modules.end())
-        return &iter->second;
-    else
-        return nullptr;
+    for (auto& mod : removed)
+    {
+        auto iter = _modules.find( std::make_pair( mod.name, mod.type ) );
+        if (iter != _modules.end() && !iter->second.manual && iter->second.baseAddress == mod.baseAddress)
+        {
+            UncacheModule( iter );
+            _generation++;
+        }
+    }
+
+    for (auto& mod : added)
+    {
+        // Replace stale entry left from a previous load
+        auto iter = _modules.find( std::make_pair( mod.name, mod.type ) );
+        if (iter != _modules.end() && !iter->second.manual && iter->second.baseAddress != mod.baseAddress)
+        {
+            UncacheModule( iter );
+            _generation++;
+        }
+
+        CacheModule( mod );
+    }
 }
 
 /// <summary>
@@ -182,17 +231,21 @@ const ProcessModules::mapModules& ProcessModules::GetAllModules( eModSeachType s
     CSLock lck( _modGuard );
 
     // Remove non-manual modules
+    mapModules previous;
     for (auto iter = _modules.begin(); iter != _modules.end();)
     {
-        if (!iter->second.manual) 
-            _modules.erase( iter++ );
+        if (!iter->second.manual)
+        {
+            previous.emplace( *iter );
+            iter = UncacheModule( iter );
+        }
         else 
             ++iter;
     }
 
     // Update local cache
     for (auto& mod : modules)
-        _modules.emplace( std::make_pair( std::make_pair( mod.name, mod.type ), mod ) );
+        CacheModule( mod );
 
     // Do additional search in case of loader lists
     // This, however won't search for 32 bit modules in native x64 process
@@ -202,9 +255,27 @@ const ProcessModules::mapModules& ProcessModules::GetAllModules( eModSeachType s
 
         // Update local cache
         for (auto& mod : modules2)
-            _modules.emplace( std::make_pair( std::make_pair( mod.name, mod.type ), mod ) );
+            CacheModule( mod );
+    }
+
+    // Bump generation only if some module was loaded, unloaded or moved
+    size_t count = 0;
+    bool changed = false;
+    for (auto& mod : _modules)
+    {
+        if (mod.second.manual)
+            continue;
+
+        auto iter = previous.find( mod.first );
+        if (iter == previous.end() || iter->second.baseAddress != mod.second.baseAddress)
+            changed = true;
+
+        count++;
     }
 
+    if (changed || count != previous.size())
+        _generation++;
+
     return _modules;
 }
 
@@ -238,120 +309,228 @@ exportData ProcessModules::GetExport( const ModuleData* hMod, const char* name_o
         LastNtStatus( STATUS_INVALID_PARAMETER_1 );
         return data;
     }
-    
-    std::unique_ptr<IMAGE_EXPORT_DIRECTORY, decltype(&free)> expData( nullptr, &free );
+
+    auto index = GetExportIndex( hMod );
+    if (!index)
+        return data;
+
+    data = LookupExport( *index, name_ord );
+    if (!data.isForwarded)
+        return data;
+
+    auto hChainMod = GetModule( data.forwardModule, LdrList, index->type, baseModule );
+    if (hChainMod == nullptr)
+        return data;
+
+    std::wstring wDll = data.forwardModule;
+
+    // Import by ordinal
+    if (data.forwardByOrd)
+        return GetExport( hChainMod, reinterpret_cast<const char*>(data.forwardOrdinal), wDll.c_str() );
+    // Import by name
+    else
+        return GetExport( hChainMod, data.forwardName.c_str(), wDll.c_str() );
+}
+
+/// <summary>
+/// Get addresses of several exports in one pass over module export directory.
+/// Forwarded exports are grouped by target module and resolved if forward module is present
+/// </summary>
+/// <param name="hMod">Module to search in</param>
+/// <param name="names">Function names or ordinals</param>
+/// <param name="baseModule">Import module name. Only used to resolve ApiSchema during manual map.</param>
+/// <returns>Export info for every name, in the same order. If failed procAddress field is 0</returns>
+std::vector<exportData> ProcessModules::GetExports(
+    const ModuleData* hMod,
+    const std::vector<const char*>& names,
+    const wchar_t* baseModule /*= L""*/
+    )
+{
+    std::vector<exportData> result( names.size() );
+
+    /// Invalid module
+    if (hMod == nullptr || hMod->baseAddress == 0)
+    {  
+        LastNtStatus( STATUS_INVALID_PARAMETER_1 );
+        return result;
+    }
+
+    auto index = GetExportIndex( hMod );
+    if (!index)
+        return result;
+
+    // Forward module -> indices of forwarded entries
+    std::map<std::wstring, std::vector<size_t>> forwards;
+
+    for (size_t i = 0; i < names.size(); i++)
+    {
+        result[i] = LookupExport( *index, names[i] );
+        if (result[i].isForwarded)
+            forwards[result[i].forwardModule].push_back( i );
+    }
+
+    // Resolve each forward module once
+    for (auto& fwd : forwards)
+    {
+        std::wstring wDll = fwd.first;
+        auto hChainMod = GetModule( wDll, LdrList, index->type, baseModule );
+        if (hChainMod == nullptr)
+            continue;
+
+        std::vector<const char*> chainNames;
+        for (auto i : fwd.second)
+        {
+            if (result[i].forwardByOrd)
+                chainNames.emplace_back( reinterpret_cast<const char*>(result[i].forwardOrdinal) );
+            else
+                chainNames.emplace_back( result[i].forwardName.c_str() );
+        }
+
+        auto chained = GetExports( hChainMod, chainNames, wDll.c_str() );
+        for (size_t k = 0; k < fwd.second.size(); k++)
+            result[fwd.second[k]] = std::move( chained[k] );
+    }
+
+    return result;
+}
+
+/// <summary>
+/// Find export in module index. Forwarded exports are not followed
+/// </summary>
+/// <param name="index">Module export index</param>
+/// <param name="name_ord">Function name or ordinal</param>
+/// <returns>Export info. If failed procAddress field is 0</returns>
+exportData ProcessModules::LookupExport( const ExportIndex& index, const char* name_ord )
+{
+    exportData data;
+
+    // Find by ordinal or by name
+    uint32_t rva = 0;
+    if (reinterpret_cast<uintptr_t>(name_ord) <= 0xFFFF)
+        rva = index.Find( static_cast<uint16_t>(reinterpret_cast<uintptr_t>(name_ord)) );
+    else
+        rva = index.Find( name_ord );
+
+    if (rva == 0)
+        return data;
+
+    data.procAddress = index.base + rva;
+
+    // Check forwarded export
+    if (index.forwarded( rva ))
+    {
+        std::string chainExp( index.str( rva - index.dirRva ) );
+
+        std::string strDll = chainExp.substr( 0, chainExp.find( "." ) ) + ".dll";
+        std::string strName = chainExp.substr( chainExp.find( "." ) + 1, strName.npos );
+
+        // Fill export data info
+        data.isForwarded = true;
+        data.forwardModule = Utils::AnsiToWstring( strDll );
+        data.forwardByOrd = (strName.find( "#" ) == 0);
+
+        if (data.forwardByOrd)
+            data.forwardOrdinal = static_cast<WORD>(atoi( strName.c_str() + 1 ));
+        else
+            data.forwardName = strName;
+    }
+
+    return data;
+}
+
+/// <summary>
+/// Get export index of a module. Index is built once and kept on module data
+/// </summary>
+/// <param name="hMod">Module</param>
+/// <returns>Export index, nullptr if module has no exports</returns>
+std::shared_ptr<ExportIndex> ProcessModules::GetExportIndex( const ModuleData* hMod )
+{
+    CSLock lck( _modGuard );
+
+    // Already indexed
+    if (hMod->exports && hMod->exports->base == hMod->baseAddress)
+        return hMod->exports;
 
     IMAGE_DOS_HEADER hdrDos = { 0 };
     uint8_t hdrNt32[sizeof(IMAGE_NT_HEADERS64)] = { 0 };
     auto phdrNt32 = reinterpret_cast<PIMAGE_NT_HEADERS32>(hdrNt32);
     auto phdrNt64 = reinterpret_cast<PIMAGE_NT_HEADERS64>(hdrNt32);
-    DWORD expSize = 0;
-    uintptr_t expBase = 0;
+    IMAGE_DATA_DIRECTORY expDir = { 0 };
 
     _memory.Read( hMod->baseAddress, sizeof(hdrDos), &hdrDos );
 
     if (hdrDos.e_magic != IMAGE_DOS_SIGNATURE)
-        return data;
+        return nullptr;
 
     _memory.Read( hMod->baseAddress + hdrDos.e_lfanew, sizeof(IMAGE_NT_HEADERS64), &hdrNt32 );
 
     if (phdrNt32->Signature != IMAGE_NT_SIGNATURE)
-        return data;
+        return nullptr;
 
     if (phdrNt32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
-        expBase = phdrNt32->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].VirtualAddress;
+        expDir = phdrNt32->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT];
     else
-        expBase = phdrNt64->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].VirtualAddress;
+        expDir = phdrNt64->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT];
 
-    // Exports are present
-    if (expBase)
-    {
-        if (phdrNt32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC)
-            expSize = phdrNt32->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].Size;
-        else
-            expSize = phdrNt64->OptionalHeader.DataDirectory[IMAGE_DIRECTORY_ENTRY_EXPORT].Size;
+    // No exports
+    if (expDir.VirtualAddress == 0 || expDir.Size < sizeof( IMAGE_EXPORT_DIRECTORY ))
+        return nullptr;
 
-        expData.reset( reinterpret_cast<IMAGE_EXPORT_DIRECTORY*>(malloc( expSize )) );
-        IMAGE_EXPORT_DIRECTORY* pExpData = expData.get();
+    auto index = std::make_shared<ExportIndex>();
+    index->base = hMod->baseAddress;
+    index->dirRva = expDir.VirtualAddress;
+    index->dirSize = expDir.Size;
+    index->type = (phdrNt32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC) ? mt_mod32 : mt_mod64;
 
-        _memory.Read( hMod->baseAddress + expBase, expSize, pExpData );
+    // Single read for the whole directory. Extra zero byte terminates last string
+    index->dir.resize( expDir.Size + 1, 0 );
+    if (_memory.Read( hMod->baseAddress + expDir.VirtualAddress, expDir.Size, index->dir.data() ) != STATUS_SUCCESS)
+        return nullptr;
 
-        WORD *pAddressOfOrds = reinterpret_cast<WORD*> (
-            pExpData->AddressOfNameOrdinals + reinterpret_cast<uintptr_t>(pExpData) - expBase);
+    auto pExpData = reinterpret_cast<const IMAGE_EXPORT_DIRECTORY*>(index->dir.data());
+    index->ordBase = pExpData->Base;
 
-        DWORD *pAddressOfNames = reinterpret_cast<DWORD*>(
-            pExpData->AddressOfNames + reinterpret_cast<uintptr_t>(pExpData) - expBase);
+    // Translate RVA into directory copy
+    auto inDir = [&expDir]( DWORD rva, size_t size ) 
+    {
+        return rva >= expDir.VirtualAddress && rva - expDir.VirtualAddress + size <= expDir.Size;
+    };
 
-        DWORD *pAddressOfFuncs = reinterpret_cast<DWORD*>(
-            pExpData->AddressOfFunctions + reinterpret_cast<uintptr_t>(pExpData) - expBase);
+    if (!inDir( pExpData->AddressOfFunctions, pExpData->NumberOfFunctions * sizeof( DWORD ) ) ||
+        !inDir( pExpData->AddressOfNames, pExpData->NumberOfNames * sizeof( DWORD ) ) ||
+        !inDir( pExpData->AddressOfNameOrdinals, pExpData->NumberOfNames * sizeof( WORD ) ))
+    {
+        return nullptr;
+    }
 
-        for (DWORD i = 0; i < pExpData->NumberOfFunctions; ++i)
-        {
-            WORD OrdIndex = 0xFFFF;
-            char *pName = nullptr;
+    auto pAddressOfFuncs = reinterpret_cast<const DWORD*>(index->dir.data() + pExpData->AddressOfFunctions - expDir.VirtualAddress);
+    auto pAddressOfNames = reinterpret_cast<const DWORD*>(index->dir.data() + pExpData->AddressOfNames - expDir.VirtualAddress);
+    auto pAddressOfOrds = reinterpret_cast<const WORD*>(index->dir.data() + pExpData->AddressOfNameOrdinals - expDir.VirtualAddress);
 
-            // Find by index
-            if (reinterpret_cast<uintptr_t>(name_ord) <= 0xFFFF)
-            {
-                OrdIndex = static_cast<WORD>(i);
-            }
-            // Find by name
-            else if (reinterpret_cast<uintptr_t>(name_ord) > 0xFFFF && i < pExpData->NumberOfNames)
-            {
-                pName = (char*)(pAddressOfNames[i] + reinterpret_cast<uintptr_t>(pExpData) - expBase);
-                OrdIndex = static_cast<WORD>(pAddressOfOrds[i]);
-            }
-            else
-                return data;
+    // Ordinal table
+    index->functions.assign( pAddressOfFuncs, pAddressOfFuncs + pExpData->NumberOfFunctions );
 
-            if ((reinterpret_cast<uintptr_t>(name_ord) <= 0xFFFF && (WORD)((uintptr_t)name_ord) == (OrdIndex + pExpData->Base)) ||
-                 (reinterpret_cast<uintptr_t>(name_ord) > 0xFFFF && strcmp( pName, name_ord ) == 0))
-            {
-                data.procAddress = pAddressOfFuncs[OrdIndex] + hMod->baseAddress;
-
-                // Check forwarded export
-                if (data.procAddress >= hMod->baseAddress + expBase && 
-                    data.procAddress <= hMod->baseAddress + expBase + expSize)
-                {
-                    char forwardStr[255] = { 0 };
-
-                    _memory.Read( data.procAddress, sizeof(forwardStr), forwardStr );
-
-                    std::string chainExp( forwardStr );
-
-                    std::string strDll = chainExp.substr( 0, chainExp.find( "." ) ) + ".dll";
-                    std::string strName = chainExp.substr( chainExp.find( "." ) + 1, strName.npos );
-                    std::wstring wDll( Utils::AnsiToWstring( strDll ) );
-
-                    // Fill export data info
-                    data.isForwarded = true;
-                    data.forwardModule = wDll;
-                    data.forwardByOrd = (strName.find( "#" ) == 0);
-
-                    if (data.forwardByOrd)
-                        data.forwardOrdinal = static_cast<WORD>(atoi( strName.c_str() + 1 ));
-                    else
-                        data.forwardName = strName;
-
-                    auto mt = (phdrNt32->OptionalHeader.Magic == IMAGE_NT_OPTIONAL_HDR32_MAGIC) ? mt_mod32 : mt_mod64;
-                    auto hChainMod = GetModule( wDll, LdrList, mt, baseModule );
-                    if (hChainMod == nullptr)
-                        return data;
-
-                    // Import by ordinal
-                    if (data.forwardByOrd)
-                        return GetExport( hChainMod, reinterpret_cast<const char*>(data.forwardOrdinal), wDll.c_str() );
-                    // Import by name
-                    else
-                        return GetExport( hChainMod, strName.c_str(), wDll.c_str() );
-                }
-
-                break;
-            }
-        }
+    // Name table
+    index->names.reserve( pExpData->NumberOfNames );
+    for (DWORD i = 0; i < pExpData->NumberOfNames; ++i)
+    {
+        if (!inDir( pAddressOfNames[i], 1 ))
+            continue;
+
+        index->names.emplace_back( pAddressOfNames[i] - expDir.VirtualAddress, pAddressOfOrds[i] );
     }
 
-    return data;
+    // Names are sorted by linker, but nothing forces it
+    auto nameLess = [&index]( const std::pair<uint32_t, uint16_t>& l, const std::pair<uint32_t, uint16_t>& r )
+    {
+        return strcmp( index->str( l.first ), index->str( r.first ) ) < 0;
+    };
+
+    if (!std::is_sorted( index->names.begin(), index->names.end(), nameLess ))
+        std::sort( index->names.begin(), index->names.end(), nameLess );
+
+    hMod->exports = index;
+    return index;
 }
 
 /// <summary>
@@ -382,9 +561,10 @@ const ModuleData* ProcessModules::Inject( const std::wstring& path, NTSTATUS* pS
         return mod;
     }
 
-    // Image path
+    // Image path, followed by module handle
     UNICODE_STRING ustr = { 0 };
-    auto modName = _memory.Allocate( 0x1000, PAGE_READWRITE );
+    size_t handleOfs = Align( sizeof( ustr ) + (path.size() + 1) * sizeof( wchar_t ), sizeof( uint64_t ) );
+    auto modName = _memory.heap().Allocate( handleOfs + sizeof( uint64_t ), PAGE_READWRITE );
 
     ustr.Buffer = reinterpret_cast<PWSTR>(modName.ptr<uintptr_t>() + sizeof( ustr ));
     ustr.Length = static_cast<USHORT>(path.size() * sizeof( wchar_t ));
@@ -428,7 +608,7 @@ const ModuleData* ProcessModules::Inject( const std::wstring& path, NTSTATUS* pS
         }
         #endif
 
-        a.GenCall( (uintptr_t)pLdrLoadDll, { 0, 0, modName.ptr<uintptr_t>(), modName.ptr<uintptr_t>() + 0x800 } );
+        a.GenCall( (uintptr_t)pLdrLoadDll, { 0, 0, modName.ptr<uintptr_t>(), modName.ptr<uintptr_t>() + handleOfs } );
         a->ret();
 
         status = _proc.remote().ExecInNewThread( a->make(), a->getCodeSize(), res );
@@ -480,7 +660,12 @@ bool ProcessModules::Unload( const ModuleData* hMod )
         _proc.remote().ExecDirect( pUnload.procAddress, hMod->baseAddress );
 
     // Remove module from cache
-    _modules.erase( std::make_pair( hMod->name, hMod->type ) );
+    CSLock lck( _modGuard );
+    auto iter = _modules.find( std::make_pair( hMod->name, hMod->type ) );
+    if (iter != _modules.end())
+        UncacheModule( iter );
+
+    _generation++;
 
     return true;
 }
@@ -534,10 +719,8 @@ const ModuleData* ProcessModules::AddManualModule( const std::wstring& FilePath,
     module.manual = true;
     module.type = mt;
 
-    auto key = std::make_pair( module.name, module.type );
-    _modules.emplace( std::make_pair( key, module ) );
-
-    return &_modules.find( key )->second;
+    CSLock lck( _modGuard );
+    return CacheModule( module );
 }
 
 /// <summary>
@@ -547,10 +730,77 @@ const ModuleData* ProcessModules::AddManualModule( const std::wstring& FilePath,
 /// <param name="mt">Module type. 32 bit or 64 bit</param>
 void ProcessModules::RemoveManualModule( const std::wstring& filename, eModType mt )
 {
-    auto key = std::make_pair( filename, mt );
+    CSLock lck( _modGuard );
 
-    if (_modules.count( key ))
-        _modules.erase( key );
+    auto iter = _modules.find( std::make_pair( filename, mt ) );
+    if (iter != _modules.end())
+    {
+        UncacheModule( iter );
+        _generation++;
+    }
+}
+
+/// <summary>
+/// Add module to local cache and address index
+/// </summary>
+/// <param name="mod">Module data</param>
+/// <returns>Cached module. Existing entry is kept if module is already present</returns>
+const ModuleData* ProcessModules::CacheModule( const ModuleData& mod )
+{
+    auto res = _modules.emplace( std::make_pair( std::make_pair( mod.name, mod.type ), mod ) );
+    if (res.second)
+        _ranges[std::make_pair( mod.baseAddress, mod.type )] = &res.first->second;
+
+    return &res.first->second;
+}
+
+/// <summary>
+/// Remove module from local cache and address index
+/// </summary>
+/// <param name="iter">Module to remove</param>
+/// <returns>Iterator to the next module</returns>
+ProcessModules::mapModules::iterator ProcessModules::UncacheModule( mapModules::iterator iter )
+{
+    // Map nodes are stable, so entry is owned by this module only if pointers match
+    auto range = _ranges.find( std::make_pair( iter->second.baseAddress, iter->second.type ) );
+    if (range != _ranges.end() && range->second == &iter->second)
+        _ranges.erase( range );
+
+    return _modules.erase( iter );
+}
+
+/// <summary>
+/// Find cached module containing address
+/// </summary>
+/// <param name="address">Address to look for</param>
+/// <param name="strict">If true address must exactly match module base address</param>
+/// <param name="type">Module type. Modules of unknown type match any type</param>
+/// <returns>Module data. nullptr if not found</returns>
+const ModuleData* ProcessModules::FindCached( ptr_t address, bool strict, eModType type ) const
+{
+    if (strict)
+    {
+        auto iter = _ranges.find( std::make_pair( address, type ) );
+        if (iter == _ranges.end())
+            iter = _ranges.find( std::make_pair( address, mt_unknown ) );
+
+        return iter != _ranges.end() ? iter->second : nullptr;
+    }
+
+    // Last module of this type with base <= address. WOW64 process has 32 and 64 bit modules at same bases
+    for (auto iter = _ranges.upper_bound( std::make_pair( address, mt_unknown ) ); iter != _ranges.begin();)
+    {
+        --iter;
+        if (iter->first.second != type && iter->first.second != mt_unknown)
+            continue;
+
+        if (address < iter->second->baseAddress + iter->second->size)
+            return iter->second;
+
+        return nullptr;
+    }
+
+    return nullptr;
 }
 
 // DWORD alignment
@@ -874,7 +1124,11 @@ void ProcessModules::reset()
     CSLock lck( _modGuard );
 
     _modules.clear(); 
+    _ranges.clear();
+    _ldrState[0] = LdrListState();
+    _ldrState[1] = LdrListState();
     _ldrPatched = false;
+    _generation++;
 }
 
 }
\ No newline at end of file
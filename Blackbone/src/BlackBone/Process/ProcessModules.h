@@ -3,12 +3,16 @@
 #include "../Config.h"
 #include "../Include/Winheaders.h"
 #include "../PE/PEImage.h"
+#include "../Subsystem/NativeSubsystem.h"
 #include "../Misc/Utils.h"
 
 #include <string>
+#include <vector>
 #include <map>
 #include <unordered_map>
 #include <algorithm>
+#include <memory>
+#include <cstring>
 
 namespace std
 {
@@ -39,6 +43,68 @@ struct exportData
     bool forwardByOrd = false;      // Forward is done by ordinal
 };
 
+/// <summary>
+/// Local copy of module export directory with name and ordinal lookup tables
+/// </summary>
+struct ExportIndex
+{
+    ptr_t base = 0;                     // Module base address index was built for
+    uint32_t dirRva = 0;                // Export directory RVA
+    uint32_t dirSize = 0;               // Export directory size
+    uint32_t ordBase = 0;               // Ordinal base
+    eModType type = mt_unknown;         // Module type
+
+    std::vector<uint8_t> dir;           // Export directory copy, zero terminated
+    std::vector<uint32_t> functions;    // Function RVAs, indexed by ordinal - ordBase
+    std::vector<std::pair<uint32_t, uint16_t>> names;   // Name offset in dir -> function index, sorted by name
+
+    /// <summary>
+    /// Find function by name
+    /// </summary>
+    /// <param name="name">Function name</param>
+    /// <returns>Function RVA, 0 if not found</returns>
+    uint32_t Find( const char* name ) const
+    {
+        auto iter = std::lower_bound( names.begin(), names.end(), name,
+            [this]( const std::pair<uint32_t, uint16_t>& val, const char* key ) { return strcmp( str( val.first ), key ) < 0; } );
+
+        if (iter == names.end() || strcmp( str( iter->first ), name ) != 0 || iter->second >= functions.size())
+            return 0;
+
+        return functions[iter->second];
+    }
+
+    /// <summary>
+    /// Find function by ordinal
+    /// </summary>
+    /// <param name="ordinal">Function ordinal</param>
+    /// <returns>Function RVA, 0 if not found</returns>
+    uint32_t Find( uint16_t ordinal ) const
+    {
+        if (ordinal < ordBase || ordinal - ordBase >= functions.size())
+            return 0;
+
+        return functions[ordinal - ordBase];
+    }
+
+    /// <summary>
+    /// Check if function RVA points to forwarder string
+    /// </summary>
+    /// <param name="rva">Function RVA</param>
+    /// <returns>true if export is forwarded</returns>
+    inline bool forwarded( uint32_t rva ) const { return rva >= dirRva && rva < dirRva + dirSize; }
+
+    /// <summary>
+    /// Get string inside export directory
+    /// </summary>
+    /// <param name="offset">Offset from directory start</param>
+    /// <returns>String, empty if offset is invalid</returns>
+    inline const char* str( uint32_t offset ) const
+    {
+        return offset < dir.size() ? reinterpret_cast<const char*>(dir.data() + offset) : "";
+    }
+};
+
 class ProcessModules
 {
 public:
@@ -118,6 +184,20 @@ public:
     /// <returns>Export info. If failed procAddress field is 0</returns>
     BLACKBONE_API exportData GetExport( const ModuleData* hMod, const char* name_ord, const wchar_t* baseModule = L"" );
 
+    /// <summary>
+    /// Get addresses of several exports in one pass over module export directory.
+    /// Forwarded exports are grouped by target module and resolved if forward module is present
+    /// </summary>
+    /// <param name="hMod">Module to search in</param>
+    /// <param name="names">Function names or ordinals</param>
+    /// <param name="baseModule">Import module name. Only used to resolve ApiSchema during manual map.</param>
+    /// <returns>Export info for every name, in the same order. If failed procAddress field is 0</returns>
+    BLACKBONE_API std::vector<exportData> GetExports(
+        const ModuleData* hMod,
+        const std::vector<const char*>& names,
+        const wchar_t* baseModule = L""
+        );
+
     /// <summary>
     /// Inject image into target process
     /// </summary>
@@ -188,12 +268,62 @@ public:
     /// <returns>true on success</returns>
     BLACKBONE_API bool ValidateModule( module_t base );
 
+    /// <summary>
+    /// Get module list generation. Changes every time a module is removed or replaced in local cache
+    /// </summary>
+    /// <returns>Generation counter</returns>
+    BLACKBONE_API inline uint32_t generation() const { return _generation; }
+
     /// <summary>
     /// Reset local data
     /// </summary>
     BLACKBONE_API void reset();
 
 private:
+    /// <summary>
+    /// Get export index of a module. Index is built once and kept on module data
+    /// </summary>
+    /// <param name="hMod">Module</param>
+    /// <returns>Export index, nullptr if module has no exports</returns>
+    std::shared_ptr<ExportIndex> GetExportIndex( const ModuleData* hMod );
+
+    /// <summary>
+    /// Find export in module index. Forwarded exports are not followed
+    /// </summary>
+    /// <param name="index">Module export index</param>
+    /// <param name="name_ord">Function name or ordinal</param>
+    /// <returns>Export info. If failed procAddress field is 0</returns>
+    exportData LookupExport( const ExportIndex& index, const char* name_ord );
+
+    /// <summary>
+    /// Add module to local cache and address index
+    /// </summary>
+    /// <param name="mod">Module data</param>
+    /// <returns>Cached module. Existing entry is kept if module is already present</returns>
+    const ModuleData* CacheModule( const ModuleData& mod );
+
+    /// <summary>
+    /// Remove module from local cache and address index
+    /// </summary>
+    /// <param name="iter">Module to remove</param>
+    /// <returns>Iterator to the next module</returns>
+    mapModules::iterator UncacheModule( mapModules::iterator iter );
+
+    /// <summary>
+    /// Find cached module containing address
+    /// </summary>
+    /// <param name="address">Address to look for</param>
+    /// <param name="strict">If true address must exactly match module base address</param>
+    /// <param name="type">Module type. Modules of unknown type match any type</param>
+    /// <returns>Module data. nullptr if not found</returns>
+    const ModuleData* FindCached( ptr_t address, bool strict, eModType type ) const;
+
+    /// <summary>
+    /// Apply loader list changes to local cache
+    /// </summary>
+    /// <param name="type">Module type. 32 bit or 64 bit</param>
+    void RefreshLdrModules( eModType type );
+
     ProcessModules( const ProcessModules& ) = delete;
     ProcessModules operator =(const ProcessModules&) = delete;
 
@@ -203,8 +333,11 @@ private:
     class ProcessCore&   _core;
 
     mapModules _modules;            // Fast lookup cache
+    std::map<std::pair<ptr_t, eModType>, const ModuleData*> _ranges;   // Cached modules sorted by base address and type
+    LdrListState _ldrState[2];      // Last seen 32 and 64 bit loader lists
     CriticalSection _modGuard;      // Module guard        
     bool _ldrPatched;               // Win7 loader patch flag
+    uint32_t _generation;           // Module list generation
 };
 
 };
@@ -0,0 +1,345 @@
+#pragma once
+
+//
+// Shared-memory command ring used by the resident RPC agent.
+// This header is intentionally free of any Windows dependency, so the protocol
+// can be exercised by a plain two-thread producer/consumer on any platform.
+//
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+namespace blackbone
+{
+
+#define RING_MAGIC          0x474E5242  // 'BRNG'
+#define RING_MAX_ARGS       8           // Stack arguments per call
+#define RING_MAX_REG_ARGS   2           // x86 ecx/edx arguments (thiscall/fastcall)
+#define RING_CACHE_LINE     64
+
+#ifdef _MSC_VER
+#pragma warning(push)
+#pragma warning(disable : 4324)     // structure was padded due to alignment specifier
+#endif
+
+static_assert(sizeof( std::atomic<uint32_t> ) == sizeof( uint32_t ), "Ring atomics must have plain layout");
+
+/// <summary>
+/// Ring header. Every field has a fixed size, so layout is identical for x86 and x64 sides
+/// </summary>
+struct RingHeader
+{
+    uint32_t magic;                                     // RING_MAGIC
+    uint32_t capacity;                                  // Number of call slots, power of 2
+    uint32_t mask;                                      // capacity - 1
+    uint32_t slotDataSize;                              // Size of per-slot argument data area
+    uint64_t slotsOffset;                               // Offset of first RingCall from header
+    uint64_t dataOffset;                                // Offset of first slot data area from header
+    uint64_t doorbell;                                  // Consumer wake event handle, valid in consumer process
+
+    alignas(RING_CACHE_LINE) std::atomic<uint32_t> head;     // Next sequence to publish. Written by producer only
+    uint32_t retired;                                        // Oldest slot not yet released. Producer private
+
+    alignas(RING_CACHE_LINE) std::atomic<uint32_t> tail;     // Next sequence to execute. Written by consumer only
+    std::atomic<uint32_t> sleeping;                          // Consumer is about to wait on doorbell
+    std::atomic<uint32_t> stop;                              // Consumer must exit
+};
+
+/// <summary>
+/// Single call descriptor
+/// </summary>
+struct alignas(RING_CACHE_LINE) RingCall
+{
+    uint64_t function;                                  // Function address
+    uint64_t args[RING_MAX_ARGS];                       // Stack arguments (register arguments on x64)
+    uint64_t regArgs[RING_MAX_REG_ARGS];                // ecx/edx arguments, x86 only
+    uint64_t result;                                    // rax or edx:eax after call
+    uint32_t sequence;                                  // Call sequence, written by producer
+    std::atomic<uint32_t> completed;                    // Set to sequence by consumer once result is stored
+    uint32_t released;                                  // Set to sequence by producer once result is collected
+    uint32_t reserved;
+};
+
+static_assert(sizeof( RingCall ) == 2 * RING_CACHE_LINE, "Unexpected RingCall layout");
+
+/// <summary>
+/// Lock-free single producer / single consumer view over ring memory.
+/// Both sides work on the same memory block, each through its own CommandRing instance
+/// </summary>
+class CommandRing
+{
+public:
+    CommandRing()
+        : _hdr( nullptr ) { }
+
+    /// <summary>
+    /// Attach to already initialized ring memory
+    /// </summary>
+    /// <param name="base">Ring base address</param>
+    CommandRing( void* base )
+        : _hdr( static_cast<RingHeader*>(base) ) { }
+
+    /// <summary>
+    /// Get memory size required for ring with given parameters
+    /// </summary>
+    /// <param name="capacity">Slot count, power of 2</param>
+    /// <param name="slotDataSize">Per-slot data size</param>
+    /// <returns>Size in bytes</returns>
+    static size_t RequiredSize( uint32_t capacity, uint32_t slotDataSize )
+    {
+        return SlotsOffset() + capacity * (sizeof( RingCall ) + static_cast<size_t>(slotDataSize));
+    }
+
+    /// <summary>
+    /// Initialize ring memory
+    /// </summary>
+    /// <param name="base">Ring base address. Must be at least RequiredSize() bytes</param>
+    /// <param name="capacity">Slot count, power of 2</param>
+    /// <param name="slotDataSize">Per-slot data size</param>
+    /// <returns>true on success</returns>
+    bool Init( void* base, uint32_t capacity, uint32_t slotDataSize )
+    {
+        if (base == nullptr || capacity == 0 || (capacity & (capacity - 1)) != 0)
+            return false;
+
+        memset( base, 0, RequiredSize( capacity, slotDataSize ) );
+
+        _hdr = static_cast<RingHeader*>(base);
+        _hdr->magic = RING_MAGIC;
+        _hdr->capacity = capacity;
+        _hdr->mask = capacity - 1;
+        _hdr->slotDataSize = slotDataSize;
+        _hdr->slotsOffset = SlotsOffset();
+        _hdr->dataOffset = SlotsOffset() + capacity * sizeof( RingCall );
+
+        return true;
+    }
+
+    /// <summary>
+    /// Check if ring memory is initialized
+    /// </summary>
+    /// <returns>true if valid</returns>
+    inline bool valid() const { return _hdr != nullptr && _hdr->magic == RING_MAGIC; }
+
+    inline RingHeader* header() const { return _hdr; }
+    inline uint32_t capacity() const { return _hdr->capacity; }
+    inline uint32_t slotDataSize() const { return _hdr->slotDataSize; }
+
+    /// <summary>
+    /// Get slot for sequence number
+    /// </summary>
+    /// <param name="seq">Call sequence</param>
+    /// <returns>Call descriptor</returns>
+    inline RingCall* slot( uint32_t seq ) const
+    {
+        return reinterpret_cast<RingCall*>(base() + _hdr->slotsOffset) + ((seq - 1) & _hdr->mask);
+    }
+
+    /// <summary>
+    /// Get argument data area of a slot
+    /// </summary>
+    /// <param name="seq">Call sequence</param>
+    /// <returns>Data area</returns>
+    inline uint8_t* slotData( uint32_t seq ) const
+    {
+        return base() + _hdr->dataOffset + ((seq - 1) & _hdr->mask) * static_cast<size_t>(_hdr->slotDataSize);
+    }
+
+    /// <summary>
+    /// Get offset of slot data area from ring base. Used to translate data pointers into consumer address space
+    /// </summary>
+    /// <param name="seq">Call sequence</param>
+    /// <returns>Offset</returns>
+    inline uint64_t slotDataOffset( uint32_t seq ) const
+    {
+        return static_cast<uint64_t>(slotData( seq ) - base());
+    }
+
+    //
+    // Producer side
+    //
+
+    /// <summary>
+    /// Reserve next free slot. Slot contents may be filled until Publish is called
+    /// </summary>
+    /// <param name="seq">Reserved call sequence</param>
+    /// <returns>Call descriptor, nullptr if ring is full</returns>
+    RingCall* Reserve( uint32_t& seq )
+    {
+        Reclaim();
+
+        uint32_t head = _hdr->head.load( std::memory_order_relaxed );
+        if (head - _hdr->retired >= _hdr->capacity)
+            return nullptr;
+
+        seq = head + 1;
+
+        // Any value except seq marks slot as not completed
+        RingCall* call = slot( seq );
+        call->completed.store( seq - 1, std::memory_order_relaxed );
+        call->released = seq - 1;
+        call->sequence = seq;
+
+        return call;
+    }
+
+    /// <summary>
+    /// Make reserved slot visible to consumer
+    /// </summary>
+    /// <returns>true if consumer is asleep and doorbell must be signaled</returns>
+    bool Publish()
+    {
+        uint32_t head = _hdr->head.load( std::memory_order_relaxed );
+        _hdr->head.store( head + 1, std::memory_order_release );
+
+        // Pairs with the fence in PrepareSleep. Either consumer sees new head, or we see sleeping flag
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        return _hdr->sleeping.load( std::memory_order_relaxed ) != 0;
+    }
+
+    /// <summary>
+    /// Check if call has completed
+    /// </summary>
+    /// <param name="seq">Call sequence</param>
+    /// <returns>true if result is available</returns>
+    inline bool Completed( uint32_t seq ) const
+    {
+        return slot( seq )->completed.load( std::memory_order_acquire ) == seq;
+    }
+
+    /// <summary>
+    /// Release completed slot. Slot may be reused by following Reserve calls
+    /// </summary>
+    /// <param name="seq">Call sequence</param>
+    void Release( uint32_t seq )
+    {
+        slot( seq )->released = seq;
+        Reclaim();
+    }
+
+    /// <summary>
+    /// Number of calls published but not yet released
+    /// </summary>
+    /// <returns>Call count</returns>
+    inline uint32_t pending() const { return _hdr->head.load( std::memory_order_relaxed ) - _hdr->retired; }
+
+    /// <summary>
+    /// Ask consumer to exit
+    /// </summary>
+    /// <returns>true if consumer is asleep and doorbell must be signaled</returns>
+    bool RequestStop()
+    {
+        _hdr->stop.store( 1, std::memory_order_release );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+        return _hdr->sleeping.load( std::memory_order_relaxed ) != 0;
+    }
+
+    //
+    // Consumer side
+    //
+
+    /// <summary>
+    /// Get next call to execute
+    /// </summary>
+    /// <returns>Call descriptor, nullptr if ring is empty</returns>
+    RingCall* Peek() const
+    {
+        uint32_t tail = _hdr->tail.load( std::memory_order_relaxed );
+        if (tail == _hdr->head.load( std::memory_order_acquire ))
+            return nullptr;
+
+        return slot( tail + 1 );
+    }
+
+    /// <summary>
+    /// Store call result and move to next slot
+    /// </summary>
+    /// <param name="call">Call returned by Peek</param>
+    /// <param name="result">Call result</param>
+    void Complete( RingCall* call, uint64_t result )
+    {
+        call->result = result;
+        call->completed.store( call->sequence, std::memory_order_release );
+        _hdr->tail.store( _hdr->tail.load( std::memory_order_relaxed ) + 1, std::memory_order_release );
+    }
+
+    /// <summary>
+    /// Execute next call. Same as one iteration of the generated dispatcher loop
+    /// </summary>
+    /// <param name="invoke">Invoker, takes RingCall& and returns call result</param>
+    /// <returns>true if call was executed, false if ring is empty</returns>
+    template<typename Fn>
+    bool ExecuteNext( Fn&& invoke )
+    {
+        RingCall* call = Peek();
+        if (call == nullptr)
+            return false;
+
+        Complete( call, invoke( *call ) );
+        return true;
+    }
+
+    /// <summary>
+    /// Announce that consumer is going to wait on doorbell
+    /// </summary>
+    /// <returns>true if it is safe to wait, false if new work arrived meanwhile</returns>
+    bool PrepareSleep()
+    {
+        _hdr->sleeping.store( 1, std::memory_order_relaxed );
+        std::atomic_thread_fence( std::memory_order_seq_cst );
+
+        if (Peek() != nullptr || stopRequested())
+        {
+            _hdr->sleeping.store( 0, std::memory_order_relaxed );
+            return false;
+        }
+
+        return true;
+    }
+
+    /// <summary>
+    /// Clear sleeping flag after wakeup
+    /// </summary>
+    inline void EndSleep() { _hdr->sleeping.store( 0, std::memory_order_relaxed ); }
+
+    /// <summary>
+    /// Check if producer has requested exit
+    /// </summary>
+    /// <returns>true if consumer must exit</returns>
+    inline bool stopRequested() const { return _hdr->stop.load( std::memory_order_acquire ) != 0; }
+
+private:
+    static inline size_t SlotsOffset()
+    {
+        return (sizeof( RingHeader ) + RING_CACHE_LINE - 1) & ~static_cast<size_t>(RING_CACHE_LINE - 1);
+    }
+
+    inline uint8_t* base() const { return reinterpret_cast<uint8_t*>(_hdr); }
+
+    /// <summary>
+    /// Advance retired index over released slots
+    /// </summary>
+    void Reclaim()
+    {
+        uint32_t head = _hdr->head.load( std::memory_order_relaxed );
+        while (_hdr->retired != head)
+        {
+            RingCall* call = slot( _hdr->retired + 1 );
+            if (call->released != call->sequence || call->completed.load( std::memory_order_acquire ) != call->sequence)
+                break;
+
+            _hdr->retired++;
+        }
+    }
+
+private:
+    RingHeader* _hdr;       // Shared ring memory
+};
+
+#ifdef _MSC_VER
+#pragma warning(pop)
+#endif
+
+}
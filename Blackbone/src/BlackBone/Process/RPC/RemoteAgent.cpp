@@ -0,0 +1,533 @@
+#include "RemoteAgent.h"
+#include "../Process.h"
+#include "../../Misc/DynImport.h"
+
+namespace blackbone
+{
+
+RemoteAgent::RemoteAgent( Process& proc )
+    : _proc( proc )
+    , _hSection( NULL )
+    , _hDoorbell( NULL )
+    , _hRemoteDoorbell( NULL )
+    , _remoteView( 0 )
+    , _viewSize( 0 )
+    , _thread( (DWORD)0, &proc.core() )
+{
+}
+
+RemoteAgent::~RemoteAgent()
+{
+    Stop();
+}
+
+/// <summary>
+/// Map command ring into target process and start dispatcher thread.
+/// Only supported when both processes have the same bitness
+/// </summary>
+/// <param name="capacity">Number of call slots, power of 2</param>
+/// <param name="slotDataSize">Size of per-call area for copied strings and structures</param>
+/// <param name="spinCount">Number of idle polls before dispatcher falls asleep</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteAgent::Start( uint32_t capacity /*= 64*/, uint32_t slotDataSize /*= 0x400*/, uint32_t spinCount /*= 20000*/ )
+{
+    NTSTATUS status = STATUS_SUCCESS;
+
+    if (running())
+        return STATUS_SUCCESS;
+
+    // Ring memory is accessed directly from both sides, so pointer size must match
+    auto barrier = _proc.core().native()->GetWow64Barrier().type;
+    if (barrier != wow_32_32 && barrier != wow_64_64)
+        return LastNtStatus( STATUS_NOT_SUPPORTED );
+
+    if (capacity == 0 || (capacity & (capacity - 1)) != 0)
+        return LastNtStatus( STATUS_INVALID_PARAMETER_1 );
+
+    // Clean up after dead dispatcher
+    Stop();
+
+    //
+    // Create section and map it into both processes
+    //
+    _viewSize = Align( CommandRing::RequiredSize( capacity, slotDataSize ), 0x1000 );
+    _hSection = CreateFileMappingW( INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, static_cast<DWORD>(_viewSize), NULL );
+    if (_hSection == NULL)
+        return LastNtStatus();
+
+    auto pLocalView = MapViewOfFile( _hSection, FILE_MAP_ALL_ACCESS, 0, 0, _viewSize );
+    if (pLocalView == nullptr)
+    {
+        status = LastNtStatus();
+        Stop();
+        return LastNtStatus( status );
+    }
+
+    _ring.Init( pLocalView, capacity, slotDataSize );
+
+    PVOID pRemoteView = nullptr;
+    SIZE_T viewSize = _viewSize;
+    status = SAFE_NATIVE_CALL( NtMapViewOfSection, _hSection, _proc.core().handle(), &pRemoteView, 0, 0, nullptr, &viewSize, 2 /*ViewUnmap*/, 0, PAGE_READWRITE );
+    if (!NT_SUCCESS( status ))
+    {
+        Stop();
+        return LastNtStatus( status );
+    }
+
+    _remoteView = reinterpret_cast<ptr_t>(pRemoteView);
+
+    //
+    // Doorbell event used to wake sleeping dispatcher
+    //
+    _hDoorbell = CreateEventW( NULL, FALSE, FALSE, NULL );
+    if (_hDoorbell == NULL ||
+         !DuplicateHandle( GetCurrentProcess(), _hDoorbell, _proc.core().handle(), &_hRemoteDoorbell, SYNCHRONIZE, FALSE, 0 ))
+    {
+        status = LastNtStatus();
+        Stop();
+        return LastNtStatus( status );
+    }
+
+    _ring.header()->doorbell = reinterpret_cast<uintptr_t>(_hRemoteDoorbell);
+
+    auto pWait = _proc.remote().helpers().NtWaitForSingleObject;
+    if (pWait == 0)
+    {
+        Stop();
+        return LastNtStatus( STATUS_NOT_FOUND );
+    }
+
+    //
+    // Upload dispatcher and start it
+    //
+    AsmJitHelper a;
+    GenerateDispatcher( a, static_cast<uintptr_t>(pWait), spinCount );
+
+    _code = _proc.memory().Allocate( a->getCodeSize() );
+    if (!_code.valid() || _code.Write( 0, a->getCodeSize(), a->make() ) != STATUS_SUCCESS)
+    {
+        status = LastNtStatus();
+        Stop();
+        return LastNtStatus( status );
+    }
+
+    _thread = _proc.threads().CreateNew( _code.ptr<ptr_t>(), _remoteView );
+    if (!_thread.valid())
+    {
+        status = LastNtStatus();
+        Stop();
+        return LastNtStatus( status );
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Stop dispatcher thread and unmap command ring
+/// </summary>
+void RemoteAgent::Stop()
+{
+    CSLock lck( _lock );
+
+    // Let dispatcher leave its loop, kill it if it doesn't
+    if (_thread.valid())
+    {
+        if (_ring.valid() && _ring.RequestStop())
+            Wake();
+
+        if (!_thread.Join( 1000 ))
+        {
+            _thread.Terminate();
+            _thread.Join();
+        }
+    }
+
+    _thread.Close();
+    _code.Free();
+
+    if (_remoteView != 0)
+    {
+        SAFE_NATIVE_CALL( NtUnmapViewOfSection, _proc.core().handle(), reinterpret_cast<PVOID>(_remoteView) );
+        _remoteView = 0;
+    }
+
+    if (_hRemoteDoorbell != NULL)
+    {
+        DuplicateHandle( _proc.core().handle(), _hRemoteDoorbell, NULL, NULL, 0, FALSE, DUPLICATE_CLOSE_SOURCE );
+        _hRemoteDoorbell = NULL;
+    }
+
+    if (_hDoorbell != NULL)
+    {
+        CloseHandle( _hDoorbell );
+        _hDoorbell = NULL;
+    }
+
+    if (_ring.header() != nullptr)
+    {
+        UnmapViewOfFile( _ring.header() );
+        _ring = CommandRing();
+    }
+
+    if (_hSection != NULL)
+    {
+        CloseHandle( _hSection );
+        _hSection = NULL;
+    }
+
+    _viewSize = 0;
+}
+
+/// <summary>
+/// Call remote function through the agent and wait for result
+/// </summary>
+/// <param name="pfn">Remote function pointer</param>
+/// <param name="args">Function arguments</param>
+/// <param name="cc">Calling convention</param>
+/// <param name="result">Function return value, rax or edx:eax</param>
+/// <param name="timeout">Wait timeout in milliseconds</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteAgent::Call(
+    ptr_t pfn,
+    std::vector<AsmVariant>& args,
+    eCalligConvention cc,
+    uint64_t& result,
+    DWORD timeout /*= INFINITE*/
+    )
+{
+    uint32_t seq = 0;
+    NTSTATUS status = Submit( pfn, args, cc, seq );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    return Wait( seq, result, timeout );
+}
+
+/// <summary>
+/// Queue remote function call without waiting for it
+/// </summary>
+/// <param name="pfn">Remote function pointer</param>
+/// <param name="args">Function arguments. Data pointers are redirected into ring memory</param>
+/// <param name="cc">Calling convention</param>
+/// <param name="seq">Call sequence used to collect result</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteAgent::Submit( ptr_t pfn, std::vector<AsmVariant>& args, eCalligConvention cc, uint32_t& seq )
+{
+    CSLock lck( _lock );
+
+    if (!running())
+        return LastNtStatus( STATUS_INVALID_HANDLE );
+
+    // Invalid calling convention
+    if (cc < cc_cdecl || cc > cc_fastcall)
+        return LastNtStatus( STATUS_INVALID_PARAMETER_3 );
+
+    // Leading arguments passed in ecx/edx
+    size_t regCount = 0;
+#ifdef USE32
+    if (cc == cc_thiscall)
+        regCount = 1;
+    else if (cc == cc_fastcall)
+        regCount = 2;
+#endif
+
+    if (args.size() > RING_MAX_ARGS + regCount)
+        return LastNtStatus( STATUS_INVALID_PARAMETER_2 );
+
+    // Slot is only handed to dispatcher on Publish, so bailing out below leaves ring untouched
+    RingCall* call = _ring.Reserve( seq );
+    if (call == nullptr)
+        return LastNtStatus( STATUS_DEVICE_BUSY );
+
+    uint8_t* pData = _ring.slotData( seq );
+    ptr_t remoteData = _remoteView + _ring.slotDataOffset( seq );
+    size_t data_offset = 0;
+
+    memset( call->args, 0, sizeof( call->args ) );
+    memset( call->regArgs, 0, sizeof( call->regArgs ) );
+
+    for (size_t i = 0; i < args.size(); i++)
+    {
+        auto& arg = args[i];
+        uint64_t value = 0;
+
+        switch (arg.type)
+        {
+            case AsmVariant::imm:
+                value = arg.imm_val;
+                break;
+
+            // Copy strings and pointed data into slot area
+            case AsmVariant::dataPtr:
+                if (data_offset + arg.size > _ring.slotDataSize())
+                    return LastNtStatus( STATUS_BUFFER_TOO_SMALL );
+
+                memcpy( pData + data_offset, reinterpret_cast<const void*>(arg.imm_val), arg.size );
+                arg.new_imm_val = static_cast<uintptr_t>(remoteData + data_offset);
+                value = arg.new_imm_val;
+
+                data_offset = Align( data_offset + arg.size, 0x10 );
+                break;
+
+            // Structures by value, FPU values and assembler operands require generated code
+            default:
+                return LastNtStatus( STATUS_NOT_SUPPORTED );
+        }
+
+        if (i < regCount)
+            call->regArgs[i] = value;
+        else
+            call->args[i - regCount] = value;
+    }
+
+    call->function = pfn;
+    call->result = 0;
+
+    if (_ring.Publish())
+        Wake();
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Wait for queued call and release its slot.
+/// Cached pages and region map are dropped, call could have changed target memory
+/// </summary>
+/// <param name="seq">Call sequence returned by Submit</param>
+/// <param name="result">Function return value</param>
+/// <param name="timeout">Wait timeout in milliseconds</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteAgent::Wait( uint32_t seq, uint64_t& result, DWORD timeout /*= INFINITE*/ )
+{
+    if (!_ring.valid())
+        return LastNtStatus( STATUS_INVALID_HANDLE );
+
+    // Dispatcher usually answers within microseconds, so spin before yielding
+    ULONGLONG start = GetTickCount64();
+    for (uint32_t i = 0; !_ring.Completed( seq ); i++)
+    {
+        if (i < 1000)
+        {
+            YieldProcessor();
+            continue;
+        }
+
+        if ((i & 0xFF) == 0)
+        {
+            if (!_thread.valid())
+                return LastNtStatus( STATUS_THREAD_IS_TERMINATING );
+
+            if (timeout != INFINITE && GetTickCount64() - start >= timeout)
+                return LastNtStatus( STATUS_IO_TIMEOUT );
+        }
+
+        SwitchToThread();
+    }
+
+    {
+        CSLock lck( _lock );
+
+        result = _ring.slot( seq )->result;
+        _ring.Release( seq );
+    }
+
+    // Remote code may have changed anything
+    _proc.memory().Invalidate();
+    _proc.memory().regions().Invalidate();
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Generate dispatcher loop
+/// </summary>
+/// <param name="a">Target assembly helper</param>
+/// <param name="pWait">NtWaitForSingleObject address</param>
+/// <param name="spinCount">Number of idle polls before waiting on doorbell</param>
+void RemoteAgent::GenerateDispatcher( AsmHelperBase& a, uintptr_t pWait, uint32_t spinCount )
+{
+    using namespace asmjit::host;
+
+    const int32_t headOfs     = offsetof( RingHeader, head );
+    const int32_t tailOfs     = offsetof( RingHeader, tail );
+    const int32_t sleepOfs    = offsetof( RingHeader, sleeping );
+    const int32_t stopOfs     = offsetof( RingHeader, stop );
+    const int32_t bellOfs     = offsetof( RingHeader, doorbell );
+    const int32_t fnOfs       = offsetof( RingCall, function );
+    const int32_t argsOfs     = offsetof( RingCall, args );
+    const int32_t resultOfs   = offsetof( RingCall, result );
+    const int32_t seqOfs      = offsetof( RingCall, sequence );
+    const int32_t doneOfs     = offsetof( RingCall, completed );
+    const int32_t regArgsOfs  = offsetof( RingCall, regArgs );
+    const int32_t slotsOfs    = static_cast<int32_t>(_ring.header()->slotsOffset);
+
+    asmjit::Label l_loop  = a->newLabel();
+    asmjit::Label l_spin  = a->newLabel();
+    asmjit::Label l_awake = a->newLabel();
+    asmjit::Label l_work  = a->newLabel();
+    asmjit::Label l_exit  = a->newLabel();
+
+    /*
+        for (;;)
+        {
+            for (spin = spinCount; ring.tail == ring.head; spin--)
+            {
+                if (ring.stop)
+                    return 0;
+
+                if (spin == 0)
+                {
+                    ring.sleeping = 1;
+                    if (ring.tail == ring.head && !ring.stop)
+                        NtWaitForSingleObject( ring.doorbell, FALSE, NULL );
+
+                    ring.sleeping = 0;
+                }
+            }
+
+            call = &slots[ring.tail & mask];
+            call->result = call->function( call->args... );
+            call->completed = call->sequence;
+            ring.tail++;
+        }
+    */
+#ifdef USE64
+    const asmjit::GpReg ring = rbx;
+    const asmjit::GpReg spin = r12d;
+    const asmjit::GpReg call = r13;
+
+    a->push( rbx );
+    a->push( r12 );
+    a->push( r13 );
+    a->push( r14 );                 // Keep stack aligned on 16 bytes
+    a->sub( rsp, 0x48 );            // Shadow space + 4 stack arguments
+    a->mov( ring, rcx );
+#else
+    const asmjit::GpReg ring = ebx;
+    const asmjit::GpReg spin = esi;
+    const asmjit::GpReg call = edi;
+
+    a->push( ebx );
+    a->push( esi );
+    a->push( edi );
+    a->push( ebp );
+    a->mov( ring, dword_ptr( esp, 5 * WordSize ) );
+#endif
+
+    a->bind( l_loop );
+    a->mov( spin, spinCount );
+
+    // Poll for new calls
+    a->bind( l_spin );
+    a->mov( eax, dword_ptr( ring, tailOfs ) );
+    a->cmp( eax, dword_ptr( ring, headOfs ) );
+    a->jne( l_work );
+    a->cmp( dword_ptr( ring, stopOfs ), 0 );
+    a->jne( l_exit );
+    a->pause();
+    a->dec( spin );
+    a->jnz( l_spin );
+
+    // Announce sleep, then recheck ring so a concurrent Publish can't be missed
+    a->mov( dword_ptr( ring, sleepOfs ), 1 );
+    a->mfence();
+    a->mov( eax, dword_ptr( ring, tailOfs ) );
+    a->cmp( eax, dword_ptr( ring, headOfs ) );
+    a->jne( l_awake );
+    a->cmp( dword_ptr( ring, stopOfs ), 0 );
+    a->jne( l_awake );
+
+#ifdef USE64
+    a->mov( rcx, qword_ptr( ring, bellOfs ) );
+    a->xor_( edx, edx );
+    a->xor_( r8d, r8d );
+    a->mov( rax, pWait );
+    a->call( rax );
+#else
+    a->push( 0 );
+    a->push( 0 );
+    a->push( dword_ptr( ring, bellOfs ) );
+    a->mov( eax, pWait );
+    a->call( eax );
+#endif
+
+    a->bind( l_awake );
+    a->mov( dword_ptr( ring, sleepOfs ), 0 );
+    a->jmp( l_loop );
+
+    // Execute call at ring tail
+    a->bind( l_work );
+    a->and_( eax, _ring.header()->mask );
+    a->imul( eax, eax, static_cast<int32_t>(sizeof( RingCall )) );
+    a->lea( call, a->intptr_ptr( ring, a->zax, 0, slotsOfs ) );
+
+#ifdef USE64
+    for (int32_t i = 4; i < RING_MAX_ARGS; i++)
+    {
+        a->mov( rax, qword_ptr( call, argsOfs + i * 8 ) );
+        a->mov( qword_ptr( rsp, i * 8 ), rax );
+    }
+
+    a->mov( rcx, qword_ptr( call, argsOfs ) );
+    a->mov( rdx, qword_ptr( call, argsOfs + 8 ) );
+    a->mov( r8,  qword_ptr( call, argsOfs + 16 ) );
+    a->mov( r9,  qword_ptr( call, argsOfs + 24 ) );
+    a->call( qword_ptr( call, fnOfs ) );
+    a->mov( qword_ptr( call, resultOfs ), rax );
+#else
+    // Restoring esp from ebp handles both caller and callee cleanup
+    a->mov( ebp, esp );
+    for (int32_t i = RING_MAX_ARGS - 1; i >= 0; i--)
+        a->push( dword_ptr( call, argsOfs + i * 8 ) );
+
+    a->mov( ecx, dword_ptr( call, regArgsOfs ) );
+    a->mov( edx, dword_ptr( call, regArgsOfs + 8 ) );
+    a->call( dword_ptr( call, fnOfs ) );
+    a->mov( esp, ebp );
+    a->mov( dword_ptr( call, resultOfs ), eax );
+    a->mov( dword_ptr( call, resultOfs + 4 ), edx );
+#endif
+
+    // Publish result before moving tail. x86 stores are not reordered with older stores
+    a->mov( eax, dword_ptr( call, seqOfs ) );
+    a->mov( dword_ptr( call, doneOfs ), eax );
+    a->inc( dword_ptr( ring, tailOfs ) );
+    a->jmp( l_loop );
+
+    a->bind( l_exit );
+#ifdef USE64
+    a->add( rsp, 0x48 );
+    a->pop( r14 );
+    a->pop( r13 );
+    a->pop( r12 );
+    a->pop( rbx );
+    a->xor_( eax, eax );
+    a->ret();
+#else
+    a->pop( ebp );
+    a->pop( edi );
+    a->pop( esi );
+    a->pop( ebx );
+    a->xor_( eax, eax );
+    a->ret( WordSize );
+#endif
+}
+
+/// <summary>
+/// Signal dispatcher doorbell
+/// </summary>
+void RemoteAgent::Wake()
+{
+    if (_hDoorbell != NULL)
+        SetEvent( _hDoorbell );
+}
+
+/// <summary>
+/// Reset instance
+/// </summary>
+void RemoteAgent::reset()
+{
+    Stop();
+}
+
+}
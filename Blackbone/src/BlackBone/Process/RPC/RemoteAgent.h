@@ -0,0 +1,125 @@
+#pragma once
+
+#include "../../Include/Winheaders.h"
+#include "../../Asm/AsmHelper.h"
+#include "../../Misc/Utils.h"
+#include "../Threads/Thread.h"
+#include "../MemBlock.h"
+#include "CommandRing.h"
+
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Resident RPC agent.
+/// Dispatcher thread lives in the target and executes call descriptors from a command ring
+/// placed in a section mapped into both processes. No code is generated or copied per call.
+/// </summary>
+class RemoteAgent
+{
+public:
+    BLACKBONE_API RemoteAgent( class Process& proc );
+    BLACKBONE_API ~RemoteAgent();
+
+    /// <summary>
+    /// Map command ring into target process and start dispatcher thread.
+    /// Only supported when both processes have the same bitness
+    /// </summary>
+    /// <param name="capacity">Number of call slots, power of 2</param>
+    /// <param name="slotDataSize">Size of per-call area for copied strings and structures</param>
+    /// <param name="spinCount">Number of idle polls before dispatcher falls asleep</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Start( uint32_t capacity = 64, uint32_t slotDataSize = 0x400, uint32_t spinCount = 20000 );
+
+    /// <summary>
+    /// Stop dispatcher thread and unmap command ring
+    /// </summary>
+    BLACKBONE_API void Stop();
+
+    /// <summary>
+    /// Call remote function through the agent and wait for result
+    /// </summary>
+    /// <param name="pfn">Remote function pointer</param>
+    /// <param name="args">Function arguments</param>
+    /// <param name="cc">Calling convention</param>
+    /// <param name="result">Function return value, rax or edx:eax</param>
+    /// <param name="timeout">Wait timeout in milliseconds</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Call(
+        ptr_t pfn,
+        std::vector<AsmVariant>& args,
+        eCalligConvention cc,
+        uint64_t& result,
+        DWORD timeout = INFINITE
+        );
+
+    /// <summary>
+    /// Queue remote function call without waiting for it
+    /// </summary>
+    /// <param name="pfn">Remote function pointer</param>
+    /// <param name="args">Function arguments. Data pointers are redirected into ring memory</param>
+    /// <param name="cc">Calling convention</param>
+    /// <param name="seq">Call sequence used to collect result</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Submit( ptr_t pfn, std::vector<AsmVariant>& args, eCalligConvention cc, uint32_t& seq );
+
+    /// <summary>
+    /// Wait for queued call and release its slot.
+    /// Cached pages and region map are dropped, call could have changed target memory
+    /// </summary>
+    /// <param name="seq">Call sequence returned by Submit</param>
+    /// <param name="result">Function return value</param>
+    /// <param name="timeout">Wait timeout in milliseconds</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Wait( uint32_t seq, uint64_t& result, DWORD timeout = INFINITE );
+
+    /// <summary>
+    /// Check if dispatcher thread is running
+    /// </summary>
+    /// <returns>true if running</returns>
+    BLACKBONE_API inline bool running() const { return _ring.valid() && _thread.valid(); }
+
+    /// <summary>
+    /// Get dispatcher thread
+    /// </summary>
+    /// <returns>Dispatcher thread</returns>
+    BLACKBONE_API inline Thread* thread() { return &_thread; }
+
+    /// <summary>
+    /// Reset instance
+    /// </summary>
+    BLACKBONE_API void reset();
+
+private:
+    /// <summary>
+    /// Generate dispatcher loop
+    /// </summary>
+    /// <param name="a">Target assembly helper</param>
+    /// <param name="pWait">NtWaitForSingleObject address</param>
+    /// <param name="spinCount">Number of idle polls before waiting on doorbell</param>
+    void GenerateDispatcher( AsmHelperBase& a, uintptr_t pWait, uint32_t spinCount );
+
+    /// <summary>
+    /// Signal dispatcher doorbell
+    /// </summary>
+    void Wake();
+
+    RemoteAgent( const RemoteAgent& ) = delete;
+    RemoteAgent& operator =(const RemoteAgent&) = delete;
+
+private:
+    class Process&  _proc;
+    CommandRing     _ring;              // Local view of the command ring
+    HANDLE          _hSection;          // Ring section
+    HANDLE          _hDoorbell;         // Dispatcher wake event
+    HANDLE          _hRemoteDoorbell;   // Wake event handle value in target process
+    ptr_t           _remoteView;        // Ring base address in target process
+    size_t          _viewSize;          // Ring size
+    MemBlock        _code;              // Dispatcher code
+    Thread          _thread;            // Dispatcher thread
+    CriticalSection _lock;              // Serializes producers, ring is single-producer
+};
+
+}
@@ -6,6 +6,7 @@
 #include <sddl.h>
 #include <AccCtrl.h>
 #include <Aclapi.h>
+#include <algorithm>
 
 namespace blackbone
 {
@@ -18,11 +19,20 @@ RemoteExec::RemoteExec( Process& proc )
     , _hWorkThd( (DWORD)0, &_memory.core() )
     , _hWaitEvent( NULL )
     , _apcPatched( false )
+    , _agent( proc )
+    , _frameHdrSize( 0 )
+    , _stubUsed( 0 )
 {
+    for (int i = 0; i < 2; i++)
+    {
+        _helpersGen[i] = 0;
+        _helpersValid[i] = false;
+    }
 }
 
 RemoteExec::~RemoteExec()
 {
+    _agent.Stop();
     TerminateWorker();
 }
 
@@ -35,7 +45,6 @@ RemoteExec::~RemoteExec()
 /// <returns>Status</returns>
 NTSTATUS RemoteExec::ExecInNewThread( PVOID pCode, size_t size, uint64_t& callResult )
 {
-    AsmJitHelper a;
     NTSTATUS dwResult = STATUS_SUCCESS;
 
     // Write code
@@ -43,10 +52,37 @@ NTSTATUS RemoteExec::ExecInNewThread( PVOID pCode, size_t size, uint64_t& callRe
     if (dwResult != STATUS_SUCCESS)
         return dwResult;
 
+    return RunInNewThread( _userCode.ptr<ptr_t>(), size, callResult );
+}
+
+/// <summary>
+/// Create new thread and execute code already present in target process. Wait until execution ends
+/// </summary>
+/// <param name="pCode">Remote code address</param>
+/// <param name="callResult">Code return value</param>
+/// <returns>Status</returns>
+NTSTATUS RemoteExec::ExecInNewThread( ptr_t pCode, uint64_t& callResult )
+{
+    // Allocate environment blocks only
+    CreateRPCEnvironment( false, false );
+
+    return RunInNewThread( pCode, 0, callResult );
+}
+
+/// <summary>
+/// Create new thread and execute remote code in it
+/// </summary>
+/// <param name="pCode">Remote code address</param>
+/// <param name="wrapperOffset">Offset in _userCode where thread wrapper is written</param>
+/// <param name="callResult">Code return value</param>
+/// <returns>Status</returns>
+NTSTATUS RemoteExec::RunInNewThread( ptr_t pCode, size_t wrapperOffset, uint64_t& callResult )
+{
+    AsmJitHelper a;
+    NTSTATUS dwResult = STATUS_SUCCESS;
+
     bool switchMode = (_proc.core().native()->GetWow64Barrier().type == wow_64_32);
-    auto pExitThread = _mods.GetExport( _mods.GetModule(
-        L"ntdll.dll", LdrList, switchMode ? mt_mod64 : mt_default ),
-        "NtTerminateThread" ).procAddress;
+    auto pExitThread = helpers( switchMode ? mt_mod64 : mt_default ).NtTerminateThread;
 
     if (pExitThread == 0)
         return LastNtStatus( STATUS_NOT_FOUND );
@@ -57,8 +93,7 @@ NTSTATUS RemoteExec::ExecInNewThread( PVOID pCode, size_t size, uint64_t& callRe
     if(switchMode)
     {
         // Allocate new x64 activation stack
-        auto createActStack = _mods.GetExport( _mods.GetModule( L"ntdll.dll", LdrList, mt_mod64 ),
-                                               "RtlAllocateActivationContextStack" ).procAddress;
+        auto createActStack = helpers( mt_mod64 ).RtlAllocateActivationContextStack;
         if (createActStack)
         {
             a.GenCall( static_cast<uintptr_t>(createActStack), { _userData.ptr<uintptr_t>() + 0x3100 } );
@@ -70,16 +105,20 @@ NTSTATUS RemoteExec::ExecInNewThread( PVOID pCode, size_t size, uint64_t& callRe
         }
     }
 
-    a.GenCall( _userCode.ptr<uintptr_t>(), { } );
+    a.GenCall( static_cast<uintptr_t>(pCode), { } );
     a.ExitThreadWithStatus( (uintptr_t)pExitThread, _userData.ptr<uintptr_t>() + INTRET_OFFSET );
     
     // Execute code in newly created thread
-    if (_userCode.Write( size, a->getCodeSize(), a->make() ) == STATUS_SUCCESS)
+    if (_userCode.Write( wrapperOffset, a->getCodeSize(), a->make() ) == STATUS_SUCCESS)
     {
-        auto thread = _threads.CreateNew( _userCode.ptr<ptr_t>() + size, _userData.ptr<ptr_t>()/*, HideFromDebug*/ );
+        auto thread = _threads.CreateNew( _userCode.ptr<ptr_t>() + wrapperOffset, _userData.ptr<ptr_t>()/*, HideFromDebug*/ );
         thread.Resume();
 
         dwResult = thread.Join();
+
+        // Remote code may have changed anything
+        _memory.Invalidate();
+        _memory.regions().Invalidate();
         callResult = _userData.Read<uint64_t>( INTRET_OFFSET, 0 );
     }
     else
@@ -107,39 +146,54 @@ NTSTATUS RemoteExec::ExecInWorkerThread( PVOID pCode, size_t size, uint64_t& cal
     if (dwResult != STATUS_SUCCESS)
         return dwResult;
 
-    if (_hWaitEvent)
-        ResetEvent( _hWaitEvent );
+    return RunInWorkerThread( _userCode.ptr<ptr_t>(), callResult );
+}
 
-    // Patch KiUserApcDispatcher 
-#ifdef USE64
-    if (!_apcPatched && IsWindows7OrGreater() && !IsWindows8OrGreater())
-    {
-        if (_proc.core().native()->GetWow64Barrier().type == wow_64_32)
-        {
-            auto patchBase = _proc.nativeLdr().APC64PatchAddress();
+/// <summary>
+/// Execute code already present in target process in context of our worker thread
+/// </summary>
+/// <param name="pCode">Remote code address</param>
+/// <param name="callResult">Execution result</param>
+/// <returns>Status</returns>
+NTSTATUS RemoteExec::ExecInWorkerThread( ptr_t pCode, uint64_t& callResult )
+{
+    // Create thread if needed
+    CreateRPCEnvironment();
 
-            if (patchBase != 0)
-            {
-                DWORD flOld = 0;
-                _memory.Protect(patchBase, 6, PAGE_EXECUTE_READWRITE, &flOld);
-                _memory.Write(patchBase + 0x2, (uint8_t)0x0C);
-                _memory.Write( patchBase + 0x4, (uint8_t)0x90 );
-                _memory.Protect( patchBase, 6, flOld, nullptr );
-            }
+    NTSTATUS status = RunInWorkerThread( pCode, callResult );
 
-            _apcPatched = true;
-        }
-        else
-            _apcPatched = true;
-    }
-#endif
+    // Call stub could still be running
+    if (status == WAIT_TIMEOUT && _stubCode.valid() && pCode >= _stubCode.ptr() && pCode < _stubCode.ptr() + _stubCode.size())
+        RetireCallStubs();
+
+    return status;
+}
+
+/// <summary>
+/// Queue remote code as worker thread APC and wait for it
+/// </summary>
+/// <param name="pCode">Remote code address</param>
+/// <param name="callResult">Execution result</param>
+/// <returns>Status</returns>
+NTSTATUS RemoteExec::RunInWorkerThread( ptr_t pCode, uint64_t& callResult )
+{
+    NTSTATUS dwResult = STATUS_SUCCESS;
+
+    if (_hWaitEvent)
+        ResetEvent( _hWaitEvent );
+
+    PatchApcDispatcher();
 
     // Execute code in thread context
     // TODO: Find out why am I passing pRemoteCode as an argument???
-    auto pRemoteCode = _userCode.ptr<PVOID>();
+    auto pRemoteCode = reinterpret_cast<PVOID>(static_cast<uintptr_t>(pCode));
     if (NT_SUCCESS( SAFE_NATIVE_CALL( NtQueueApcThread, _hWorkThd.handle(), pRemoteCode, pRemoteCode, nullptr, nullptr ) ))
     {
         dwResult = WaitForSingleObject( _hWaitEvent, 30 * 1000 /*wait 30s*/ );
+
+        // Remote code may have changed anything
+        _memory.Invalidate();
+        _memory.regions().Invalidate();
         callResult = _userData.Read<uint64_t>( RET_OFFSET, 0 );
     }
     else
@@ -162,7 +216,6 @@ NTSTATUS RemoteExec::ExecInWorkerThread( PVOID pCode, size_t size, uint64_t& cal
 NTSTATUS RemoteExec::ExecInAnyThread( PVOID pCode, size_t size, uint64_t& callResult, Thread& thd )
 {
     NTSTATUS dwResult = STATUS_SUCCESS;
-    CONTEXT_T ctx;
 
     // Prepare for remote exec
     CreateRPCEnvironment( false, true );
@@ -172,6 +225,37 @@ NTSTATUS RemoteExec::ExecInAnyThread( PVOID pCode, size_t size, uint64_t& callRe
     if (dwResult != STATUS_SUCCESS)
         return dwResult;
 
+    return RunInAnyThread( _userCode.ptr<ptr_t>(), size, callResult, thd );
+}
+
+/// <summary>
+/// Execute code already present in target process in context of any existing thread
+/// </summary>
+/// <param name="pCode">Remote code address</param>
+/// <param name="callResult">Execution result</param>
+/// <param name="thd">Target thread</param>
+/// <returns>Status</returns>
+NTSTATUS RemoteExec::ExecInAnyThread( ptr_t pCode, uint64_t& callResult, Thread& thd )
+{
+    // Prepare for remote exec
+    CreateRPCEnvironment( false, true );
+
+    return RunInAnyThread( pCode, 0, callResult, thd );
+}
+
+/// <summary>
+/// Hijack thread to execute remote code
+/// </summary>
+/// <param name="pCode">Remote code address</param>
+/// <param name="wrapperOffset">Offset in _userCode where context switch wrapper is written</param>
+/// <param name="callResult">Execution result</param>
+/// <param name="thd">Target thread</param>
+/// <returns>Status</returns>
+NTSTATUS RemoteExec::RunInAnyThread( ptr_t pCode, size_t wrapperOffset, uint64_t& callResult, Thread& thd )
+{
+    NTSTATUS dwResult = STATUS_SUCCESS;
+    CONTEXT_T ctx;
+
     if (_hWaitEvent)
         ResetEvent( _hWaitEvent );
 
@@ -202,7 +286,7 @@ NTSTATUS RemoteExec::ExecInAnyThread( PVOID pCode, size_t size, uint64_t& callRe
         for (int i = 0; i < count; i++)
             a->mov( asmjit::Mem( asmjit::host::rsp, i * WordSize ), regs[i] );
 
-        a.GenCall( _userCode.ptr<uintptr_t>(), { _userData.ptr<uintptr_t>() } );
+        a.GenCall( static_cast<uintptr_t>(pCode), { _userData.ptr<uintptr_t>() } );
         AddReturnWithEvent( a, mt_default, rt_int32, INTRET_OFFSET );
 
         // Restore registers
@@ -219,7 +303,7 @@ NTSTATUS RemoteExec::ExecInAnyThread( PVOID pCode, size_t size, uint64_t& callRe
         a->pusha();
         a->pushf();
 
-        a.GenCall( _userCode.ptr<uintptr_t>(), { _userData.ptr<uintptr_t>() } );
+        a.GenCall( static_cast<uintptr_t>(pCode), { _userData.ptr<uintptr_t>() } );
         AddReturnWithEvent( a, mt_default, rt_int32, INTRET_OFFSET );
 
         a->popf();
@@ -229,9 +313,9 @@ NTSTATUS RemoteExec::ExecInAnyThread( PVOID pCode, size_t size, uint64_t& callRe
         a->ret();
     #endif
 
-        if (_userCode.Write( size, a->getCodeSize(), a->make() ) == STATUS_SUCCESS)
+        if (_userCode.Write( wrapperOffset, a->getCodeSize(), a->make() ) == STATUS_SUCCESS)
         {
-            ctx.NIP = _userCode.ptr<uintptr_t>() + size;
+            ctx.NIP = _userCode.ptr<uintptr_t>() + wrapperOffset;
 
             if (!thd.SetContext( ctx, true ))
                 dwResult = LastNtStatus();
@@ -247,6 +331,10 @@ NTSTATUS RemoteExec::ExecInAnyThread( PVOID pCode, size_t size, uint64_t& callRe
     if (dwResult == STATUS_SUCCESS)
     {
         WaitForSingleObject( _hWaitEvent, INFINITE );
+
+        // Remote code may have changed anything
+        _memory.Invalidate();
+        _memory.regions().Invalidate();
         callResult = _userData.Read<uintptr_t>( INTRET_OFFSET, 0 );
     }
 
@@ -254,6 +342,303 @@ NTSTATUS RemoteExec::ExecInAnyThread( PVOID pCode, size_t size, uint64_t& callRe
 }
 
 
+/// <summary>
+/// Create call frames for pipelined remote calls.
+/// Each frame owns its argument area, result cells and completion flag, so several calls
+/// can be queued back-to-back and collected in any order.
+///
+/// Frame data layout (x86/x64):
+/// -------------------------------------------------------------------------------------------
+/// | Completion flags, 4 bytes each | Frame 0 | Frame 1 | ... | Frame N - 1 |
+/// -------------------------------------------------------------------------------------------
+/// Single frame:
+/// -------------------------------------------------------------------------------------------
+/// | Return value |  Last Status code  |  Space for copied arguments and strings  |
+/// -------------------------------------------------------------------------------------------
+/// |   8/8 bytes  |      8/8 bytes     |                                          |
+/// -------------------------------------------------------------------------------------------
+/// </summary>
+/// <param name="frameCount">Number of call frames</param>
+/// <param name="workerCount">Number of worker threads frames are distributed between</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteExec::CreateCallFrames( uint32_t frameCount /*= 16*/, uint32_t workerCount /*= 1*/ )
+{
+    CSLock lck( _frameLock );
+
+    if (frameCount == 0 || workerCount == 0)
+        return LastNtStatus( STATUS_INVALID_PARAMETER );
+
+    // Already created
+    if (_frameData.valid())
+        return STATUS_SUCCESS;
+
+    // Frames are executed as worker thread APCs
+    NTSTATUS status = CreateRPCEnvironment( true, false );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    _frameHdrSize = Align( frameCount * sizeof( uint32_t ), 0x40 );
+    _frameData = _memory.Allocate( _frameHdrSize + frameCount * FRAME_DATA_SIZE, PAGE_READWRITE );
+    _frameCode = _memory.Allocate( frameCount * 2 * FRAME_CODE_SIZE );
+    if (!_frameData.valid() || !_frameCode.valid())
+    {
+        status = LastNtStatus();
+        FreeCallFrames();
+        return status;
+    }
+
+    // WOW64 worker passes its x64 activation stack through single _userData cell, so it can't be shared
+    if (_memory.core().native()->GetWow64Barrier().type == wow_64_32)
+        workerCount = 1;
+
+    // Additional workers run the same wait loop as _hWorkThd
+    for (uint32_t i = 1; i < workerCount; i++)
+    {
+        auto thread = _threads.CreateNew( _workerCode.ptr<uintptr_t>() + sizeof(LARGE_INTEGER), _userData.ptr<size_t>() );
+        if (!thread.valid())
+            break;
+
+        _frameWorkers.emplace_back( thread );
+    }
+
+    _frameUse.assign( frameCount, 0 );
+    _freeFrames.clear();
+    for (int i = static_cast<int>(frameCount) - 1; i >= 0; i--)
+        _freeFrames.emplace_back( i );
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Queue remote function call into free call frame. Does not wait for call to complete
+/// </summary>
+/// <param name="pfn">Remote function pointer</param>
+/// <param name="args">Function arguments</param>
+/// <param name="cc">Calling convention</param>
+/// <param name="retType">Return type</param>
+/// <param name="frame">Frame used by call</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteExec::QueueCall(
+    ptr_t pfn,
+    std::vector<AsmVariant>& args,
+    eCalligConvention cc,
+    eReturnType retType,
+    int& frame
+    )
+{
+    AsmJitHelper a;
+    NTSTATUS status = STATUS_SUCCESS;
+
+    if (!_frameData.valid() && !NT_SUCCESS( status = CreateCallFrames() ))
+        return status;
+
+    CSLock lck( _frameLock );
+
+    if (_freeFrames.empty())
+        ReclaimFrames();
+
+    if (_freeFrames.empty())
+        return LastNtStatus( STATUS_NO_MORE_ENTRIES );
+
+    frame = _freeFrames.back();
+
+    if (!PrepareCallAssembly( a, reinterpret_cast<const void*>(static_cast<uintptr_t>(pfn)), args, cc, retType, frame ))
+        return LastNtStatus();
+
+    if (a->getCodeSize() > FRAME_CODE_SIZE)
+        return LastNtStatus( STATUS_BUFFER_TOO_SMALL );
+
+    // Code halves are alternated, so epilogue of previous call in this frame is never overwritten.
+    // Frame is always executed by the same worker, so the call before that one has returned already
+    uintptr_t codeOffset = (frame * 2 + (_frameUse[frame] & 1)) * FRAME_CODE_SIZE;
+
+    status = _frameCode.Write( codeOffset, a->getCodeSize(), a->make() );
+    if (!NT_SUCCESS( status ))
+        return LastNtStatus( status );
+
+    status = _frameData.Write( frame * sizeof( uint32_t ), 0u );
+    if (!NT_SUCCESS( status ))
+        return LastNtStatus( status );
+
+    PatchApcDispatcher();
+
+    auto pRemoteCode = reinterpret_cast<PVOID>(_frameCode.ptr<uintptr_t>() + codeOffset);
+    status = SAFE_NATIVE_CALL( NtQueueApcThread, FrameWorker( frame ).handle(), pRemoteCode, pRemoteCode, nullptr, nullptr );
+    if (!NT_SUCCESS( status ))
+        return LastNtStatus( status );
+
+    _freeFrames.pop_back();
+    _frameUse[frame]++;
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Check if call in frame has completed
+/// </summary>
+/// <param name="frame">Call frame</param>
+/// <returns>true if completed</returns>
+bool RemoteExec::FrameCompleted( int frame )
+{
+    return _frameData.Read<uint32_t>( frame * sizeof( uint32_t ), 0 ) != 0;
+}
+
+/// <summary>
+/// Wait for queued calls. All completion flags are polled with a single read
+/// </summary>
+/// <param name="frames">Frames to wait for</param>
+/// <param name="waitAll">If true - wait for all frames, otherwise for any of them</param>
+/// <param name="timeout">Wait timeout in milliseconds</param>
+/// <param name="signaled">Index of completed frame in 'frames'. Set only when waiting for any frame</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteExec::WaitFrames(
+    const std::vector<int>& frames,
+    bool waitAll /*= true*/,
+    DWORD timeout /*= INFINITE*/,
+    int* signaled /*= nullptr*/
+    )
+{
+    std::vector<uint32_t> flags( _frameUse.size() );
+    DWORD start = GetTickCount();
+
+    if (!_frameData.valid())
+        return LastNtStatus( STATUS_INVALID_PARAMETER );
+
+    for (auto frame : frames)
+        if (frame < 0 || frame >= static_cast<int>(flags.size()))
+            return LastNtStatus( STATUS_INVALID_PARAMETER_1 );
+
+    for (uint32_t spin = 0;; spin++)
+    {
+        // Flags and results are written by remote code
+        _memory.Invalidate();
+
+        NTSTATUS status = _frameData.Read( 0, flags.size() * sizeof( uint32_t ), flags.data() );
+        if (!NT_SUCCESS( status ))
+            return LastNtStatus( status );
+
+        size_t completed = 0;
+        for (size_t i = 0; i < frames.size(); i++)
+        {
+            if (flags[frames[i]] == 0)
+                continue;
+
+            if (!waitAll)
+            {
+                if (signaled)
+                    *signaled = static_cast<int>(i);
+
+                return STATUS_SUCCESS;
+            }
+
+            completed++;
+        }
+
+        if (completed == frames.size())
+            return STATUS_SUCCESS;
+
+        if (timeout != INFINITE && GetTickCount() - start >= timeout)
+            return LastNtStatus( STATUS_IO_TIMEOUT );
+
+        // Spin briefly, then give up time slice
+        if (spin < 64)
+            YieldProcessor();
+        else if (spin < 1024)
+            SwitchToThread();
+        else
+            Sleep( 1 );
+    }
+}
+
+/// <summary>
+/// Return frame to the pool. Frame with a call still running is parked
+/// until the call completes, so late remote writes can't corrupt the next call
+/// </summary>
+/// <param name="frame">Call frame</param>
+/// <returns>STATUS_SUCCESS if frame was released, STATUS_PENDING if release was deferred</returns>
+NTSTATUS RemoteExec::ReleaseFrame( int frame )
+{
+    CSLock lck( _frameLock );
+
+    if (frame < 0 || frame >= static_cast<int>(_frameUse.size()))
+        return LastNtStatus( STATUS_INVALID_PARAMETER_1 );
+
+    if (std::find( _freeFrames.begin(), _freeFrames.end(), frame ) != _freeFrames.end() ||
+        std::find( _parkedFrames.begin(), _parkedFrames.end(), frame ) != _parkedFrames.end())
+        return STATUS_SUCCESS;
+
+    _memory.Invalidate( _frameData.ptr<ptr_t>() + frame * sizeof( uint32_t ), sizeof( uint32_t ) );
+    if (!FrameCompleted( frame ))
+    {
+        _parkedFrames.emplace_back( frame );
+        return STATUS_PENDING;
+    }
+
+    _freeFrames.emplace_back( frame );
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Move parked frames whose calls have completed back to the pool
+/// </summary>
+void RemoteExec::ReclaimFrames()
+{
+    if (_parkedFrames.empty())
+        return;
+
+    std::vector<uint32_t> flags( _frameUse.size() );
+
+    _memory.Invalidate( _frameData.ptr<ptr_t>(), flags.size() * sizeof( uint32_t ) );
+    if (!NT_SUCCESS( _frameData.Read( 0, flags.size() * sizeof( uint32_t ), flags.data() ) ))
+        return;
+
+    for (auto iter = _parkedFrames.begin(); iter != _parkedFrames.end();)
+    {
+        if (flags[*iter] != 0)
+        {
+            _freeFrames.emplace_back( *iter );
+            iter = _parkedFrames.erase( iter );
+        }
+        else
+            iter++;
+    }
+}
+
+/// <summary>
+/// Terminate frame worker threads and free frame memory
+/// </summary>
+void RemoteExec::FreeCallFrames()
+{
+    CSLock lck( _frameLock );
+
+    for (auto& thread : _frameWorkers)
+    {
+        thread.Terminate();
+        thread.Join();
+        thread.Close();
+    }
+
+    _frameWorkers.clear();
+    _freeFrames.clear();
+    _parkedFrames.clear();
+    _frameUse.clear();
+
+    _frameData.Free();
+    _frameCode.Free();
+    _frameHdrSize = 0;
+}
+
+/// <summary>
+/// Get worker thread frame is bound to
+/// </summary>
+/// <param name="frame">Call frame</param>
+/// <returns>Worker thread</returns>
+Thread& RemoteExec::FrameWorker( int frame )
+{
+    size_t idx = frame % (_frameWorkers.size() + 1);
+    return idx == 0 ? _hWorkThd : _frameWorkers[idx - 1];
+}
+
 /// <summary>
 /// Create new thread with specified entry point and argument
 /// </summary>
@@ -265,6 +650,9 @@ DWORD RemoteExec::ExecDirect( ptr_t pCode, ptr_t arg )
     auto thread = _threads.CreateNew( pCode, arg/*, HideFromDebug*/ );
 
     thread.Join();
+    _memory.Invalidate();
+    _memory.regions().Invalidate();
+
     return thread.ExitCode();
 }
 
@@ -286,6 +674,11 @@ NTSTATUS RemoteExec::CreateRPCEnvironment( bool bThread /*= true*/, bool bEvent
     DWORD thdID = GetTickCount();       // randomize thread id
     NTSTATUS status = STATUS_SUCCESS;
 
+    // Resolve helper routines before first call
+    helpers();
+    if (_proc.core().native()->GetWow64Barrier().type == wow_64_32)
+        helpers( mt_mod64 );
+
     //
     // Allocate environment codecave
     //
@@ -345,8 +738,7 @@ DWORD RemoteExec::CreateWorkerThread()
             a->and_( a->zsp, -16 );
 
             // Allocate new x64 activation stack
-            auto createActStack = _mods.GetExport( _mods.GetModule( L"ntdll.dll", LdrList, mt ),
-                                                   "RtlAllocateActivationContextStack" ).procAddress;
+            auto createActStack = helpers( mt ).RtlAllocateActivationContextStack;
             if(createActStack)
             {
                 a.GenCall( static_cast<uintptr_t>(createActStack), { _userData.ptr<uintptr_t>() + 0x3000 } );
@@ -358,9 +750,8 @@ DWORD RemoteExec::CreateWorkerThread()
             }
         }          
 
-        auto ntdll = _mods.GetModule( L"ntdll.dll", Sections, mt );
-        auto proc = _mods.GetExport( ntdll, "NtDelayExecution" ).procAddress;
-        auto pExitThread = _mods.GetExport( ntdll, "NtTerminateThread" ).procAddress;
+        auto proc = helpers( mt ).NtDelayExecution;
+        auto pExitThread = helpers( mt ).NtTerminateThread;
         if (proc == 0 || pExitThread == 0)
             return 0;
 
@@ -430,7 +821,7 @@ NTSTATUS RemoteExec::CreateAPCEvent( DWORD threadID )
         obAttr.Length = sizeof(obAttr);
         obAttr.SecurityDescriptor = pDescriptor;
 
-        auto pOpenEvent = _mods.GetExport( _mods.GetModule( L"ntdll.dll", Sections, mt ), "NtOpenEvent" ).procAddress;
+        auto pOpenEvent = helpers( mt ).NtOpenEvent;
         if (pOpenEvent == 0)
             return false;
 
@@ -468,6 +859,53 @@ NTSTATUS RemoteExec::CreateAPCEvent( DWORD threadID )
     return LastNtStatus( status );
 }
 
+/// <summary>
+/// Copy structures and strings into call data block, insert hidden argument for struct return
+/// </summary>
+/// <param name="args">Function arguments</param>
+/// <param name="retType">Return type</param>
+/// <param name="frame">Call frame. If -1 - legacy _userData block is used</param>
+/// <returns>true on success</returns>
+bool RemoteExec::PrepareCallArguments( std::vector<AsmVariant>& args, eReturnType retType, int frame /*= -1*/ )
+{
+    // Select data block
+    MemBlock& data = frame < 0 ? _userData : _frameData;
+    uintptr_t base = frame < 0 ? 0 : FrameOffset( frame );
+    uintptr_t args_offset = base + (frame < 0 ? ARGS_OFFSET : FRAME_ARGS_OFFSET);
+    uintptr_t data_end = frame < 0 ? data.size() : base + FRAME_DATA_SIZE;
+    uintptr_t data_offset = args_offset;
+
+    // Copy structures and strings
+    for (auto& arg : args)
+    {
+        if (arg.type == AsmVariant::dataStruct || arg.type == AsmVariant::dataPtr)
+        {
+            if (data_offset + arg.size > data_end)
+            {
+                LastNtStatus( STATUS_BUFFER_TOO_SMALL );
+                return false;
+            }
+
+            data.Write( data_offset, arg.size, reinterpret_cast<const void*>(arg.imm_val) );
+            arg.new_imm_val = data.ptr<uintptr_t>() + data_offset;
+
+            // Add some padding after data
+            data_offset += arg.size + 0x10;
+        }
+    }
+
+    // Insert hidden variable if return type is struct.
+    // This variable contains address of buffer in which return value is copied
+    if (retType == rt_struct)
+    {
+        args.emplace( args.begin(), AsmVariant( data.ptr<uintptr_t>() + args_offset ) );
+        args.front().new_imm_val = args.front().imm_val;
+        args.front().type = AsmVariant::structRet;
+    }
+
+    return true;
+}
+
 /// <summary>
 /// Generate assembly code for remote call.
 /// </summary>
@@ -476,17 +914,17 @@ NTSTATUS RemoteExec::CreateAPCEvent( DWORD threadID )
 /// <param name="args">Function arguments</param>
 /// <param name="cc">Calling convention</param>
 /// <param name="retType">Return type</param>
+/// <param name="frame">Call frame. If -1 - legacy _userData block is used and completion is signaled with event</param>
 /// <returns>true on success</returns>
 bool RemoteExec::PrepareCallAssembly( 
     AsmHelperBase& a, 
     const void* pfn,
     std::vector<AsmVariant>& args,
     eCalligConvention cc,
-    eReturnType retType
+    eReturnType retType,
+    int frame /*= -1*/
     )
 {
-    uintptr_t data_offset = ARGS_OFFSET;
-
     // Invalid calling convention
     if (cc < cc_cdecl || cc > cc_fastcall)
     {
@@ -494,35 +932,218 @@ bool RemoteExec::PrepareCallAssembly(
         return false;
     }
 
-    // Copy structures and strings
+    if (!PrepareCallArguments( args, retType, frame ))
+        return false;
+
+    a.GenPrologue();
+    a.GenCall( pfn, args, cc );
+    AddCallReturn( a, retType, frame );
+    a.GenEpilogue();
+
+    return true;
+}
+
+/// <summary>
+/// Prepare resident call stub for remote call.
+/// Stub reads its arguments from memory cells, so it is generated and copied into target only once
+/// per function and signature. Following calls only rewrite argument cells
+/// </summary>
+/// <param name="pfn">Remote function pointer</param>
+/// <param name="args">Function arguments</param>
+/// <param name="cc">Calling convention</param>
+/// <param name="retType">Return type</param>
+/// <param name="stub">Stub address</param>
+/// <returns>Status code. STATUS_NOT_SUPPORTED if call signature can't be served by a stub. Arguments are left untouched on any failure</returns>
+NTSTATUS RemoteExec::PrepareCallStub(
+    const void* pfn,
+    std::vector<AsmVariant>& args,
+    eCalligConvention cc,
+    eReturnType retType,
+    ptr_t& stub
+    )
+{
+    // Invalid calling convention
+    if (cc < cc_cdecl || cc > cc_fastcall)
+        return LastNtStatus( STATUS_INVALID_PARAMETER_3 );
+
+#ifndef USE64
+    // Every cell passes as register argument, so hidden struct return pointer would be loaded into ecx/edx instead of stack
+    bool regArgs = (cc == cc_thiscall || cc == cc_fastcall);
+    if (regArgs && retType == rt_struct)
+        return STATUS_NOT_SUPPORTED;
+#endif
+
+    // Only word-sized arguments can be loaded from cells.
+    // On x86 structures are copied onto stack and floating point values take two pushes
     for (auto& arg : args)
     {
-        if (arg.type == AsmVariant::dataStruct || arg.type == AsmVariant::dataPtr)
+        switch (arg.type)
         {
-            _userData.Write( data_offset, arg.size, reinterpret_cast<const void*>(arg.imm_val) );
-            arg.new_imm_val = _userData.ptr<uintptr_t>() + data_offset;
+        case AsmVariant::imm:
+        case AsmVariant::structRet:
+        case AsmVariant::dataPtr:
+#ifdef USE64
+        case AsmVariant::dataStruct:
+#endif
+            break;
 
-            // Add some padding after data
-            data_offset += arg.size + 0x10;
+        default:
+            return STATUS_NOT_SUPPORTED;
         }
+
+#ifndef USE64
+        if (regArgs && !arg.reg86Compatible())
+            return STATUS_NOT_SUPPORTED;
+#endif
     }
 
-    // Insert hidden variable if return type is struct.
-    // This variable contains address of buffer in which return value is copied
-    if (retType == rt_struct)
+    // Caller falls back to generated call code on failure, so original arguments are kept until stub is ready
+    std::vector<AsmVariant> stubArgs( args );
+    if (!PrepareCallArguments( stubArgs, retType ))
+        return LastNtStatus();
+
+    CallStubKey key;
+    std::get<0>( key ) = reinterpret_cast<uintptr_t>(pfn);
+    std::get<2>( key ) = cc;
+    std::get<3>( key ) = retType;
+
+    std::vector<uint64_t> cells;
+    for (auto& arg : stubArgs)
     {
-        args.emplace( args.begin(), AsmVariant( _userData.ptr<uintptr_t>() + ARGS_OFFSET ) );
-        args.front().new_imm_val = args.front().imm_val;
-        args.front().type = AsmVariant::structRet;
+        cells.emplace_back( arg.type == AsmVariant::dataPtr || arg.type == AsmVariant::dataStruct ? arg.new_imm_val : arg.imm_val );
+        std::get<1>( key ).emplace_back( arg.type );
+    }
+
+    auto iter = _stubs.find( key );
+    if (iter == _stubs.end())
+    {
+        CallStub newStub;
+        if (!GenerateCallStub( pfn, stubArgs, cc, retType, newStub ))
+            return LastNtStatus();
+
+        iter = _stubs.emplace( key, newStub ).first;
+    }
+
+    // Rewrite argument cells
+    if (!cells.empty())
+    {
+        NTSTATUS status = _stubCode.Write( iter->second.cellsOffset, cells.size() * sizeof( uint64_t ), cells.data() );
+        if (!NT_SUCCESS( status ))
+            return LastNtStatus( status );
     }
-        
+
+    args = std::move( stubArgs );
+    stub = _stubCode.ptr<ptr_t>() + iter->second.codeOffset;
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Generate resident call stub and copy it into target.
+/// Once stub block is full all cached stubs are evicted and block is reused from the start
+/// </summary>
+/// <param name="pfn">Remote function pointer</param>
+/// <param name="args">Function arguments</param>
+/// <param name="cc">Calling convention</param>
+/// <param name="retType">Return type</param>
+/// <param name="stub">Generated stub</param>
+/// <returns>true on success</returns>
+bool RemoteExec::GenerateCallStub(
+    const void* pfn,
+    const std::vector<AsmVariant>& args,
+    eCalligConvention cc,
+    eReturnType retType,
+    CallStub& stub
+    )
+{
+    AsmJitHelper a;
+
+    if (!_stubCode.valid())
+    {
+        _stubCode = _memory.Allocate( STUB_BLOCK_SIZE );
+        _stubUsed = 0;
+
+        if (!_stubCode.valid())
+            return false;
+    }
+
+    // Cells are placed before stub code
+    stub.cellsOffset = _stubUsed;
+    uintptr_t cells = _stubCode.ptr<uintptr_t>() + stub.cellsOffset;
+
+    std::vector<AsmVariant> cellArgs;
+    for (size_t i = 0; i < args.size(); i++)
+    {
+#ifdef USE64
+        cellArgs.emplace_back( asmjit::Mem( asmjit::host::qword_ptr( asmjit::host::r11, static_cast<int32_t>(i * sizeof( uint64_t )) ) ) );
+#else
+        cellArgs.emplace_back( asmjit::Mem( asmjit::host::dword_ptr_abs( cells + i * sizeof( uint64_t ) ) ) );
+#endif
+    }
+
     a.GenPrologue();
-    a.GenCall( pfn, args, cc );
+
+    // r11 is volatile and never used for argument passing
+#ifdef USE64
+    a->mov( asmjit::host::r11, cells );
+#endif
+
+    a.GenCall( pfn, cellArgs, cc );
+    AddCallReturn( a, retType );
+    a.GenEpilogue();
+
+    stub.codeOffset = Align( stub.cellsOffset + args.size() * sizeof( uint64_t ), 0x10 );
+    uintptr_t end = Align( stub.codeOffset + a->getCodeSize(), 0x10 );
+    if (end > _stubCode.size())
+    {
+        // Stubs are run by synchronous calls only, so none of evicted ones is executing.
+        // Block of a call that timed out is retired instead of reused, see RetireCallStubs.
+        // Cell addresses are embedded into code, stub has to be generated again
+        if (stub.cellsOffset != 0)
+        {
+            _stubs.clear();
+            _stubUsed = 0;
+            return GenerateCallStub( pfn, args, cc, retType, stub );
+        }
+
+        LastNtStatus( STATUS_NO_MEMORY );
+        return false;
+    }
+
+    if (!NT_SUCCESS( _stubCode.Write( stub.codeOffset, a->getCodeSize(), a->make() ) ))
+        return false;
+
+    _stubUsed = end;
+    return true;
+}
+
+/// <summary>
+/// Drop stub block after a stub call timed out. Stub may still be executing in target,
+/// so block memory is left allocated and never written again, new stubs go into a new block
+/// </summary>
+void RemoteExec::RetireCallStubs()
+{
+    _stubCode.Release();
+    _stubCode = MemBlock();
+    _stubs.clear();
+    _stubUsed = 0;
+}
+
+/// <summary>
+/// Generate return value capture and completion signaling
+/// </summary>
+/// <param name="a">Target assembly helper</param>
+/// <param name="retType">Function return type</param>
+/// <param name="frame">Call frame. If -1 - legacy _userData block is used and completion is signaled with event</param>
+void RemoteExec::AddCallReturn( AsmHelperBase& a, eReturnType retType, int frame /*= -1*/ )
+{
+    MemBlock& data = frame < 0 ? _userData : _frameData;
+    uintptr_t base = frame < 0 ? 0 : FrameOffset( frame );
+    uintptr_t ret_offset = base + (frame < 0 ? RET_OFFSET : FRAME_RET_OFFSET);
 
     // Retrieve result from XMM0 or ST0
     if (retType == rt_float || retType == rt_double)
     {
-        a->mov( a->zax, _userData.ptr<size_t>() + RET_OFFSET );
+        a->mov( a->zax, data.ptr<size_t>() + ret_offset );
 
 #ifdef USE64
         if (retType == rt_double)
@@ -534,10 +1155,15 @@ bool RemoteExec::PrepareCallAssembly(
 #endif
     }
 
-    AddReturnWithEvent( a, mt_default, retType );
-    a.GenEpilogue();
-
-    return true;
+    if (frame < 0)
+    {
+        AddReturnWithEvent( a, mt_default, retType );
+    }
+    else
+    {
+        uintptr_t ptr = data.ptr<uintptr_t>();
+        a.SaveRetValAndSetFlag( ptr + ret_offset, ptr + frame * sizeof( uint32_t ), ptr + base + FRAME_ERR_OFFSET, retType );
+    }
 }
 
 /// <summary>
@@ -562,6 +1188,35 @@ NTSTATUS RemoteExec::CopyCode( PVOID pCode, size_t size )
     return STATUS_SUCCESS;
 }
 
+/// <summary>
+/// Patch KiUserApcDispatcher for x64 code executed by WOW64 thread APC under Win7
+/// </summary>
+void RemoteExec::PatchApcDispatcher()
+{
+#ifdef USE64
+    if (!_apcPatched && IsWindows7OrGreater() && !IsWindows8OrGreater())
+    {
+        if (_proc.core().native()->GetWow64Barrier().type == wow_64_32)
+        {
+            auto patchBase = _proc.nativeLdr().APC64PatchAddress();
+
+            if (patchBase != 0)
+            {
+                DWORD flOld = 0;
+                _memory.Protect(patchBase, 6, PAGE_EXECUTE_READWRITE, &flOld);
+                _memory.Write(patchBase + 0x2, (uint8_t)0x0C);
+                _memory.Write( patchBase + 0x4, (uint8_t)0x90 );
+                _memory.Protect( patchBase, 6, flOld, nullptr );
+            }
+
+            _apcPatched = true;
+        }
+        else
+            _apcPatched = true;
+    }
+#endif
+}
+
 /// <summary>
 /// Generate return from function with event synchronization
 /// </summary>
@@ -581,8 +1236,59 @@ void RemoteExec::AddReturnWithEvent(
         _userData = _memory.Allocate( 0x4000, PAGE_READWRITE );
 
     uintptr_t ptr = _userData.ptr<size_t>();
-    auto pSetEvent = _proc.modules().GetExport( _proc.modules().GetModule( L"ntdll.dll", LdrList, mt ), "NtSetEvent" );
-    a.SaveRetValAndSignalEvent( (uintptr_t)pSetEvent.procAddress, ptr + retOffset, ptr + EVENT_OFFSET, ptr + ERR_OFFSET, retType );
+    auto pSetEvent = helpers( mt ).NtSetEvent;
+    a.SaveRetValAndSignalEvent( (uintptr_t)pSetEvent, ptr + retOffset, ptr + EVENT_OFFSET, ptr + ERR_OFFSET, retType );
+}
+
+/// <summary>
+/// Get ntdll routines used by generated RPC code.
+/// Table is filled on first use and rebuilt only when module list changes
+/// </summary>
+/// <param name="mt">ntdll type, 32 or 64 bit</param>
+/// <returns>Resolved routines. Unresolved ones are 0</returns>
+const RpcHelpers& RemoteExec::helpers( eModType mt /*= mt_default*/ )
+{
+    // Detect module type
+    if (mt == mt_default)
+        mt = _proc.core().native()->GetWow64Barrier().targetWow64 ? mt_mod32 : mt_mod64;
+
+    int idx = (mt == mt_mod64) ? 1 : 0;
+    if (!_helpersValid[idx] || _helpersGen[idx] != _mods.generation())
+    {
+        _helpersValid[idx] = ResolveHelpers( mt, _helpers[idx] );
+        _helpersGen[idx] = _mods.generation();
+    }
+
+    return _helpers[idx];
+}
+
+/// <summary>
+/// Resolve ntdll routines used by generated RPC code
+/// </summary>
+/// <param name="mt">ntdll type, 32 or 64 bit</param>
+/// <param name="table">Resolved routines</param>
+/// <returns>true if every routine was found</returns>
+bool RemoteExec::ResolveHelpers( eModType mt, RpcHelpers& table )
+{
+    table = RpcHelpers();
+
+    // Loader list is not yet initialized in newly created process
+    auto ntdll = _mods.GetModule( L"ntdll.dll", LdrList, mt );
+    if (ntdll == nullptr)
+        ntdll = _mods.GetModule( L"ntdll.dll", Sections, mt );
+
+    if (ntdll == nullptr)
+        return false;
+
+    table.NtSetEvent = _mods.GetExport( ntdll, "NtSetEvent" ).procAddress;
+    table.NtOpenEvent = _mods.GetExport( ntdll, "NtOpenEvent" ).procAddress;
+    table.NtTerminateThread = _mods.GetExport( ntdll, "NtTerminateThread" ).procAddress;
+    table.NtDelayExecution = _mods.GetExport( ntdll, "NtDelayExecution" ).procAddress;
+    table.NtWaitForSingleObject = _mods.GetExport( ntdll, "NtWaitForSingleObject" ).procAddress;
+    table.RtlAllocateActivationContextStack = _mods.GetExport( ntdll, "RtlAllocateActivationContextStack" ).procAddress;
+
+    return table.NtSetEvent != 0 && table.NtOpenEvent != 0 && table.NtTerminateThread != 0 && table.NtDelayExecution != 0
+        && table.NtWaitForSingleObject != 0 && table.RtlAllocateActivationContextStack != 0;
 }
 
 
@@ -591,6 +1297,9 @@ void RemoteExec::AddReturnWithEvent(
 /// </summary>
 void RemoteExec::TerminateWorker()
 {
+    // Frames can't be executed without worker
+    FreeCallFrames();
+
     // Close event
     if(_hWaitEvent)
     {
@@ -613,11 +1322,23 @@ void RemoteExec::TerminateWorker()
 /// </summary>
 void RemoteExec::reset()
 {
+    _agent.reset();
     TerminateWorker();
 
     _userCode.Reset();
     _userData.Reset();
     _workerCode.Reset();
+    _frameData.Reset();
+    _frameCode.Reset();
+    _stubCode.Reset();
+    _stubs.clear();
+    _stubUsed = 0;
+
+    for (int i = 0; i < 2; i++)
+    {
+        _helpers[i] = RpcHelpers();
+        _helpersValid[i] = false;
+    }
 
     _apcPatched = false;
 }
@@ -4,6 +4,11 @@
 #include "../../Asm/AsmHelper.h"
 #include "../Threads/Threads.h"
 #include "../MemBlock.h"
+#include "RemoteAgent.h"
+
+#include <vector>
+#include <map>
+#include <tuple>
 
 
 // User data offsets
@@ -13,10 +18,33 @@
 #define EVENT_OFFSET    0x18
 #define ARGS_OFFSET     0x20
 
+// Call frame offsets
+#define FRAME_RET_OFFSET    0x00
+#define FRAME_ERR_OFFSET    0x08
+#define FRAME_ARGS_OFFSET   0x10
+#define FRAME_DATA_SIZE     0x800   // Frame data area size
+#define FRAME_CODE_SIZE     0x200   // Size of one frame code half
+#define FRAME_ABANDON_WAIT  100     // Time abandoned call is waited for before its frame is parked, ms
+
+#define STUB_BLOCK_SIZE     0x10000 // Resident call stub memory
+
 
 namespace blackbone
 {
 
+/// <summary>
+/// ntdll routines used by generated RPC code
+/// </summary>
+struct RpcHelpers
+{
+    ptr_t NtSetEvent = 0;
+    ptr_t NtOpenEvent = 0;
+    ptr_t NtTerminateThread = 0;
+    ptr_t NtDelayExecution = 0;
+    ptr_t NtWaitForSingleObject = 0;
+    ptr_t RtlAllocateActivationContextStack = 0;
+};
+
 class RemoteExec
 {
     template<typename Fn>
@@ -24,6 +52,16 @@ class RemoteExec
 
     typedef std::vector<AsmVariant> vecArgs;
 
+    // Resident call stub
+    struct CallStub
+    {
+        uintptr_t cellsOffset = 0;  // Argument cells offset in stub block, one qword per argument
+        uintptr_t codeOffset = 0;   // Stub code offset in stub block
+    };
+
+    // Function pointer, argument types, calling convention, return type
+    typedef std::tuple<ptr_t, std::vector<int>, int, int> CallStubKey;
+
 public:
     BLACKBONE_API RemoteExec( class Process& proc );
     BLACKBONE_API ~RemoteExec();
@@ -52,6 +90,14 @@ public:
     /// <returns>Status</returns>
     BLACKBONE_API NTSTATUS ExecInNewThread( PVOID pCode, size_t size, uint64_t& callResult );
 
+    /// <summary>
+    /// Create new thread and execute code already present in target process. Wait until execution ends
+    /// </summary>
+    /// <param name="pCode">Remote code address</param>
+    /// <param name="callResult">Code return value</param>
+    /// <returns>Status</returns>
+    BLACKBONE_API NTSTATUS ExecInNewThread( ptr_t pCode, uint64_t& callResult );
+
     /// <summary>
     /// Execute code in context of our worker thread
     /// </summary>
@@ -61,6 +107,14 @@ public:
     /// <returns>Status</returns>
     BLACKBONE_API NTSTATUS ExecInWorkerThread( PVOID pCode, size_t size, uint64_t& callResult );
 
+    /// <summary>
+    /// Execute code already present in target process in context of our worker thread
+    /// </summary>
+    /// <param name="pCode">Remote code address</param>
+    /// <param name="callResult">Execution result</param>
+    /// <returns>Status</returns>
+    BLACKBONE_API NTSTATUS ExecInWorkerThread( ptr_t pCode, uint64_t& callResult );
+
     /// <summary>
     /// Execute code in context of any existing thread
     /// </summary>
@@ -71,6 +125,15 @@ public:
     /// <returns>Status</returns>
     BLACKBONE_API NTSTATUS ExecInAnyThread( PVOID pCode, size_t size, uint64_t& callResult, Thread& thread );
 
+    /// <summary>
+    /// Execute code already present in target process in context of any existing thread
+    /// </summary>
+    /// <param name="pCode">Remote code address</param>
+    /// <param name="callResult">Execution result</param>
+    /// <param name="thd">Target thread</param>
+    /// <returns>Status</returns>
+    BLACKBONE_API NTSTATUS ExecInAnyThread( ptr_t pCode, uint64_t& callResult, Thread& thread );
+
     /// <summary>
     /// Create new thread with specified entry point and argument
     /// </summary>
@@ -93,6 +156,128 @@ public:
         uint32_t retOffset = RET_OFFSET 
         );
 
+    /// <summary>
+    /// Create call frames for pipelined remote calls.
+    /// Each frame owns its argument area, result cells and completion flag, so several calls
+    /// can be queued back-to-back and collected in any order.
+    ///
+    /// Frame data layout (x86/x64):
+    /// -------------------------------------------------------------------------------------------
+    /// | Completion flags, 4 bytes each | Frame 0 | Frame 1 | ... | Frame N - 1 |
+    /// -------------------------------------------------------------------------------------------
+    /// Single frame:
+    /// -------------------------------------------------------------------------------------------
+    /// | Return value |  Last Status code  |  Space for copied arguments and strings  |
+    /// -------------------------------------------------------------------------------------------
+    /// |   8/8 bytes  |      8/8 bytes     |                                          |
+    /// -------------------------------------------------------------------------------------------
+    /// </summary>
+    /// <param name="frameCount">Number of call frames</param>
+    /// <param name="workerCount">Number of worker threads frames are distributed between</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS CreateCallFrames( uint32_t frameCount = 16, uint32_t workerCount = 1 );
+
+    /// <summary>
+    /// Queue remote function call into free call frame. Does not wait for call to complete
+    /// </summary>
+    /// <param name="pfn">Remote function pointer</param>
+    /// <param name="args">Function arguments</param>
+    /// <param name="cc">Calling convention</param>
+    /// <param name="retType">Return type</param>
+    /// <param name="frame">Frame used by call</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS QueueCall(
+        ptr_t pfn,
+        std::vector<AsmVariant>& args,
+        eCalligConvention cc,
+        eReturnType retType,
+        int& frame
+        );
+
+    /// <summary>
+    /// Check if call in frame has completed
+    /// </summary>
+    /// <param name="frame">Call frame</param>
+    /// <returns>true if completed</returns>
+    BLACKBONE_API bool FrameCompleted( int frame );
+
+    /// <summary>
+    /// Wait for queued calls. All completion flags are polled with a single read
+    /// </summary>
+    /// <param name="frames">Frames to wait for</param>
+    /// <param name="waitAll">If true - wait for all frames, otherwise for any of them</param>
+    /// <param name="timeout">Wait timeout in milliseconds</param>
+    /// <param name="signaled">Index of completed frame in 'frames'. Set only when waiting for any frame</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS WaitFrames(
+        const std::vector<int>& frames,
+        bool waitAll = true,
+        DWORD timeout = INFINITE,
+        int* signaled = nullptr
+        );
+
+    /// <summary>
+    /// Retrieve last NTSTATUS code of completed frame
+    /// </summary>
+    /// <param name="frame">Call frame</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API inline NTSTATUS GetFrameStatus( int frame )
+    {
+        return _frameData.Read<NTSTATUS>( FrameOffset( frame ) + FRAME_ERR_OFFSET, STATUS_NOT_FOUND );
+    }
+
+    /// <summary>
+    /// Return frame to the pool. Frame with a call still running is parked
+    /// until the call completes, so late remote writes can't corrupt the next call
+    /// </summary>
+    /// <param name="frame">Call frame</param>
+    /// <returns>STATUS_SUCCESS if frame was released, STATUS_PENDING if release was deferred</returns>
+    BLACKBONE_API NTSTATUS ReleaseFrame( int frame );
+
+    /// <summary>
+    /// Terminate frame worker threads and free frame memory
+    /// </summary>
+    BLACKBONE_API void FreeCallFrames();
+
+#pragma warning(disable : 4127)
+
+    /// <summary>
+    /// Retrieve call result from completed frame
+    /// </summary>
+    /// <param name="frame">Call frame</param>
+    /// <param name="result">Retrieved result</param>
+    /// <returns>true on success</returns>
+    template<typename T>
+    inline bool GetFrameResult( int frame, T& result )
+    {
+        uintptr_t base = FrameOffset( frame );
+
+        if (sizeof(T) > sizeof(uint64_t))
+        {
+            if (std::is_reference<T>::value)
+                return _frameData.Read( _frameData.Read<uintptr_t>( base + FRAME_RET_OFFSET, 0 ), sizeof(T), (PVOID)&result ) == STATUS_SUCCESS;
+            else
+                return _frameData.Read( base + FRAME_ARGS_OFFSET, sizeof(T), (PVOID)&result ) == STATUS_SUCCESS;
+        }
+        else
+            return _frameData.Read( base + FRAME_RET_OFFSET, sizeof(T), (PVOID)&result ) == STATUS_SUCCESS;
+    }
+#pragma warning(default : 4127)
+
+    /// <summary>
+    /// Get number of call frames
+    /// </summary>
+    /// <returns>Frame count</returns>
+    BLACKBONE_API inline uint32_t frameCount() const { return static_cast<uint32_t>(_frameUse.size()); }
+
+    /// <summary>
+    /// Get ntdll routines used by generated RPC code.
+    /// Table is filled on first use and rebuilt only when module list changes
+    /// </summary>
+    /// <param name="mt">ntdll type, 32 or 64 bit</param>
+    /// <returns>Resolved routines. Unresolved ones are 0</returns>
+    BLACKBONE_API const RpcHelpers& helpers( eModType mt = mt_default );
+
     /// <summary>
     /// Retrieve last NTSTATUS code
     /// </summary>
@@ -113,6 +298,12 @@ public:
     /// <returns></returns>
     BLACKBONE_API inline Thread* getWorker() { return &_hWorkThd; }
 
+    /// <summary>
+    /// Get resident RPC agent. Calls made with agent thread as context thread are dispatched through its command ring
+    /// </summary>
+    /// <returns>Agent instance</returns>
+    BLACKBONE_API inline RemoteAgent& agent() { return _agent; }
+
     /// <summary>
     /// Ge memory routines
     /// </summary>
@@ -147,6 +338,68 @@ private:
     /// <returns>Status</returns>
     NTSTATUS CopyCode( PVOID pCode, size_t size );
 
+    /// <summary>
+    /// Resolve ntdll routines used by generated RPC code
+    /// </summary>
+    /// <param name="mt">ntdll type, 32 or 64 bit</param>
+    /// <param name="table">Resolved routines</param>
+    /// <returns>true if every routine was found</returns>
+    bool ResolveHelpers( eModType mt, RpcHelpers& table );
+
+    /// <summary>
+    /// Create new thread and execute remote code in it
+    /// </summary>
+    /// <param name="pCode">Remote code address</param>
+    /// <param name="wrapperOffset">Offset in _userCode where thread wrapper is written</param>
+    /// <param name="callResult">Code return value</param>
+    /// <returns>Status</returns>
+    NTSTATUS RunInNewThread( ptr_t pCode, size_t wrapperOffset, uint64_t& callResult );
+
+    /// <summary>
+    /// Queue remote code as worker thread APC and wait for it
+    /// </summary>
+    /// <param name="pCode">Remote code address</param>
+    /// <param name="callResult">Execution result</param>
+    /// <returns>Status</returns>
+    NTSTATUS RunInWorkerThread( ptr_t pCode, uint64_t& callResult );
+
+    /// <summary>
+    /// Hijack thread to execute remote code
+    /// </summary>
+    /// <param name="pCode">Remote code address</param>
+    /// <param name="wrapperOffset">Offset in _userCode where context switch wrapper is written</param>
+    /// <param name="callResult">Execution result</param>
+    /// <param name="thd">Target thread</param>
+    /// <returns>Status</returns>
+    NTSTATUS RunInAnyThread( ptr_t pCode, size_t wrapperOffset, uint64_t& callResult, Thread& thd );
+
+    /// <summary>
+    /// Patch KiUserApcDispatcher for x64 code executed by WOW64 thread APC under Win7
+    /// </summary>
+    void PatchApcDispatcher();
+
+    /// <summary>
+    /// Get offset of frame area inside frame data block
+    /// </summary>
+    /// <param name="frame">Call frame</param>
+    /// <returns>Offset</returns>
+    inline uintptr_t FrameOffset( int frame ) const
+    {
+        return _frameHdrSize + static_cast<uintptr_t>(frame) * FRAME_DATA_SIZE;
+    }
+
+    /// <summary>
+    /// Get worker thread frame is bound to
+    /// </summary>
+    /// <param name="frame">Call frame</param>
+    /// <returns>Worker thread</returns>
+    Thread& FrameWorker( int frame );
+
+    /// <summary>
+    /// Move parked frames whose calls have completed back to the pool
+    /// </summary>
+    void ReclaimFrames();
+
     /// <summary>
     /// Generate assembly code for remote call.
     /// </summary>
@@ -155,15 +408,77 @@ private:
     /// <param name="args">Function arguments</param>
     /// <param name="cc">Calling convention</param>
     /// <param name="retType">Return type</param>
+    /// <param name="frame">Call frame. If -1 - legacy _userData block is used and completion is signaled with event</param>
     /// <returns>true on success</returns>
     BLACKBONE_API bool PrepareCallAssembly(
         AsmHelperBase& a, 
         const void* pfn,
         std::vector<blackbone::AsmVariant>& args,
         eCalligConvention cc,
-        eReturnType retType
+        eReturnType retType,
+        int frame = -1
         );
 
+    /// <summary>
+    /// Prepare resident call stub for remote call.
+    /// Stub reads its arguments from memory cells, so it is generated and copied into target only once
+    /// per function and signature. Following calls only rewrite argument cells
+    /// </summary>
+    /// <param name="pfn">Remote function pointer</param>
+    /// <param name="args">Function arguments</param>
+    /// <param name="cc">Calling convention</param>
+    /// <param name="retType">Return type</param>
+    /// <param name="stub">Stub address</param>
+    /// <returns>Status code. STATUS_NOT_SUPPORTED if call signature can't be served by a stub. Arguments are left untouched on any failure</returns>
+    BLACKBONE_API NTSTATUS PrepareCallStub(
+        const void* pfn,
+        std::vector<blackbone::AsmVariant>& args,
+        eCalligConvention cc,
+        eReturnType retType,
+        ptr_t& stub
+        );
+
+    /// <summary>
+    /// Copy structures and strings into call data block, insert hidden argument for struct return
+    /// </summary>
+    /// <param name="args">Function arguments</param>
+    /// <param name="retType">Return type</param>
+    /// <param name="frame">Call frame. If -1 - legacy _userData block is used</param>
+    /// <returns>true on success</returns>
+    bool PrepareCallArguments( std::vector<AsmVariant>& args, eReturnType retType, int frame = -1 );
+
+    /// <summary>
+    /// Generate resident call stub and copy it into target.
+    /// Once stub block is full all cached stubs are evicted and block is reused from the start
+    /// </summary>
+    /// <param name="pfn">Remote function pointer</param>
+    /// <param name="args">Function arguments</param>
+    /// <param name="cc">Calling convention</param>
+    /// <param name="retType">Return type</param>
+    /// <param name="stub">Generated stub</param>
+    /// <returns>true on success</returns>
+    bool GenerateCallStub(
+        const void* pfn,
+        const std::vector<AsmVariant>& args,
+        eCalligConvention cc,
+        eReturnType retType,
+        CallStub& stub
+        );
+
+    /// <summary>
+    /// Drop stub block after a stub call timed out. Stub may still be executing in target,
+    /// so block memory is left allocated and never written again, new stubs go into a new block
+    /// </summary>
+    void RetireCallStubs();
+
+    /// <summary>
+    /// Generate return value capture and completion signaling
+    /// </summary>
+    /// <param name="a">Target assembly helper</param>
+    /// <param name="retType">Function return type</param>
+    /// <param name="frame">Call frame. If -1 - legacy _userData block is used and completion is signaled with event</param>
+    void AddCallReturn( AsmHelperBase& a, eReturnType retType, int frame = -1 );
+
 #pragma warning(disable : 4127)
 
     /// <summary>
@@ -202,6 +517,24 @@ private:
     MemBlock _userCode;         // Codecave for code execution
     MemBlock _userData;         // Region to store copied structures and strings
     bool     _apcPatched;       // KiUserApcDispatcher was patched
+    RemoteAgent _agent;         // Resident command ring dispatcher
+
+    MemBlock _frameData;                    // Call frames: completion flags followed by frame areas
+    MemBlock _frameCode;                    // Call frame code, two halves per frame
+    uintptr_t _frameHdrSize;                // Size of completion flag array
+    std::vector<Thread>   _frameWorkers;    // Additional worker threads, _hWorkThd is always the first one
+    std::vector<int>      _freeFrames;      // Unused frames
+    std::vector<int>      _parkedFrames;    // Released frames whose calls haven't completed yet
+    std::vector<uint32_t> _frameUse;        // Per-frame use counter, selects code half
+    CriticalSection       _frameLock;       // Frame pool guard
+
+    MemBlock _stubCode;                         // Resident call stubs and their argument cells
+    uintptr_t _stubUsed;                        // Used stub memory
+    std::map<CallStubKey, CallStub> _stubs;     // Call stub cache
+
+    RpcHelpers _helpers[2];                     // Resolved helper routines for 32 and 64 bit ntdll
+    uint32_t   _helpersGen[2];                  // Module list generation helpers were resolved at
+    bool       _helpersValid[2];                // All helpers were resolved
 };
 
 
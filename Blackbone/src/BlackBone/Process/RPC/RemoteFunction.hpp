@@ -3,12 +3,262 @@
 #include "../../Asm/AsmHelperBase.h"
 #include "../Process.h"
 
+#include <map>
+#include <initializer_list>
+
 // TODO: Find more elegant way to deduce calling convention
 //       than defining each one manually
 
 namespace blackbone
 {
-    
+
+/// <summary>
+/// Pending remote call executed in RemoteExec call frame
+/// </summary>
+class RemoteCallHandle
+{
+public:
+    RemoteCallHandle()
+        : _remote( nullptr )
+        , _frame( -1 ) { }
+
+    RemoteCallHandle( RemoteExec& remote, int frame, std::vector<AsmVariant>&& args )
+        : _remote( &remote )
+        , _frame( frame )
+        , _args( std::move( args ) ) { }
+
+    RemoteCallHandle( RemoteCallHandle&& other )
+        : _remote( other._remote )
+        , _frame( other._frame )
+        , _args( std::move( other._args ) )
+        , _argData( std::move( other._argData ) )
+    {
+        other._remote = nullptr;
+        other._frame = -1;
+    }
+
+    /// <summary>
+    /// Frame of a call that is still running is parked until it completes
+    /// </summary>
+    ~RemoteCallHandle()
+    {
+        Abandon();
+    }
+
+    RemoteCallHandle& operator =(RemoteCallHandle&& other)
+    {
+        if (this != &other)
+        {
+            Abandon();
+
+            _remote = other._remote;
+            _frame = other._frame;
+            _args = std::move( other._args );
+            _argData = std::move( other._argData );
+
+            other._remote = nullptr;
+            other._frame = -1;
+        }
+
+        return *this;
+    }
+
+    /// <summary>
+    /// Check if handle refers to pending call
+    /// </summary>
+    /// <returns>true if valid</returns>
+    inline bool valid() const { return _remote != nullptr && _frame >= 0; }
+
+    /// <summary>
+    /// Check if call has completed
+    /// </summary>
+    /// <returns>true if result is available</returns>
+    inline bool ready() const { return valid() && _remote->FrameCompleted( _frame ); }
+
+    /// <summary>
+    /// Wait for call to complete
+    /// </summary>
+    /// <param name="timeout">Wait timeout in milliseconds</param>
+    /// <returns>Status code</returns>
+    NTSTATUS wait( DWORD timeout = INFINITE )
+    {
+        if (!valid())
+            return LastNtStatus( STATUS_INVALID_HANDLE );
+
+        return _remote->WaitFrames( { _frame }, true, timeout );
+    }
+
+    /// <summary>
+    /// Get argument passed by pointer as updated by the call.
+    /// Caller's own buffers may be gone by the time call completes, so they are never written
+    /// </summary>
+    /// <param name="index">Argument index</param>
+    /// <returns>Argument data, empty if call isn't finished or argument isn't passed by pointer</returns>
+    inline const std::vector<uint8_t>& argData( size_t index ) const
+    {
+        static const std::vector<uint8_t> empty;
+        return index < _argData.size() ? _argData[index] : empty;
+    }
+
+    inline int frame() const { return _frame; }
+    inline RemoteExec* remote() const { return _remote; }
+
+protected:
+    /// <summary>
+    /// Copy arguments passed by pointer into handle and release call frame
+    /// </summary>
+    void Finish()
+    {
+        _argData.clear();
+        for (auto& arg : _args)
+        {
+            // Hidden struct return pointer isn't a user argument
+            if (arg.type == AsmVariant::structRet)
+                continue;
+
+            _argData.emplace_back();
+            if (arg.type == AsmVariant::dataPtr)
+            {
+                _argData.back().resize( arg.size );
+                _remote->memory().Read( arg.new_imm_val, arg.size, _argData.back().data() );
+            }
+        }
+
+        _remote->ReleaseFrame( _frame );
+        _remote = nullptr;
+        _frame = -1;
+        _args.clear();
+    }
+
+    /// <summary>
+    /// Drop call result. Hung call doesn't block the caller, its frame is parked
+    /// by RemoteExec and returns to the pool once the call completes
+    /// </summary>
+    void Abandon()
+    {
+        if (valid())
+        {
+            wait( FRAME_ABANDON_WAIT );
+            _remote->ReleaseFrame( _frame );
+        }
+
+        _remote = nullptr;
+        _frame = -1;
+        _args.clear();
+    }
+
+private:
+    RemoteCallHandle( const RemoteCallHandle& ) = delete;
+    RemoteCallHandle& operator =(const RemoteCallHandle&) = delete;
+
+protected:
+    RemoteExec* _remote;                // Frame owner
+    int _frame;                         // Call frame
+    std::vector<AsmVariant> _args;      // Call arguments, relocated into frame
+    std::vector<std::vector<uint8_t>> _argData; // Arguments passed by pointer, copied out of frame by Finish
+};
+
+/// <summary>
+/// Pending remote call with typed result
+/// </summary>
+template<typename T>
+class RemoteFuture : public RemoteCallHandle
+{
+public:
+    RemoteFuture() { }
+
+    RemoteFuture( RemoteExec& remote, int frame, std::vector<AsmVariant>&& args )
+        : RemoteCallHandle( remote, frame, std::move( args ) ) { }
+
+    RemoteFuture( RemoteFuture&& other )
+        : RemoteCallHandle( std::move( other ) ) { }
+
+    RemoteFuture& operator =(RemoteFuture&& other)
+    {
+        RemoteCallHandle::operator =( std::move( other ) );
+        return *this;
+    }
+
+    /// <summary>
+    /// Wait for call to complete and retrieve its result. Handle becomes invalid afterwards,
+    /// arguments passed by pointer remain available through argData
+    /// </summary>
+    /// <param name="result">Function return value</param>
+    /// <param name="timeout">Wait timeout in milliseconds</param>
+    /// <returns>Status code</returns>
+    NTSTATUS get( T& result, DWORD timeout = INFINITE )
+    {
+        NTSTATUS status = wait( timeout );
+        if (!NT_SUCCESS( status ))
+            return status;
+
+        if (!_remote->GetFrameResult( _frame, result ))
+            status = LastNtStatus();
+
+        Finish();
+        return status;
+    }
+};
+
+/// <summary>
+/// Wait for all pending calls. Calls queued into the same process are polled together
+/// </summary>
+/// <param name="handles">Pending calls</param>
+/// <param name="timeout">Wait timeout in milliseconds</param>
+/// <returns>Status code</returns>
+inline NTSTATUS when_all( const std::vector<RemoteCallHandle*>& handles, DWORD timeout = INFINITE )
+{
+    std::map<RemoteExec*, std::vector<int>> frames;
+    DWORD start = GetTickCount();
+
+    for (auto handle : handles)
+        if (handle != nullptr && handle->valid())
+            frames[handle->remote()].emplace_back( handle->frame() );
+
+    for (auto& group : frames)
+    {
+        DWORD left = timeout;
+        if (timeout != INFINITE)
+        {
+            DWORD elapsed = GetTickCount() - start;
+            left = elapsed < timeout ? timeout - elapsed : 0;
+        }
+
+        NTSTATUS status = group.first->WaitFrames( group.second, true, left );
+        if (!NT_SUCCESS( status ))
+            return status;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Wait for all pending calls
+/// </summary>
+/// <param name="handles">Pending calls</param>
+/// <param name="timeout">Wait timeout in milliseconds</param>
+/// <returns>Status code</returns>
+inline NTSTATUS when_all( std::initializer_list<RemoteCallHandle*> handles, DWORD timeout = INFINITE )
+{
+    return when_all( std::vector<RemoteCallHandle*>( handles ), timeout );
+}
+
+/// <summary>
+/// Wait for all pending calls
+/// </summary>
+/// <param name="futures">Pending calls</param>
+/// <param name="timeout">Wait timeout in milliseconds</param>
+/// <returns>Status code</returns>
+template<typename T>
+inline NTSTATUS when_all( std::vector<RemoteFuture<T>>& futures, DWORD timeout = INFINITE )
+{
+    std::vector<RemoteCallHandle*> handles;
+    for (auto& future : futures)
+        handles.emplace_back( &future );
+
+    return when_all( handles, timeout );
+}
+
 /// <summary>
 /// Base class for remote function pointer
 /// </summary>
@@ -46,10 +296,88 @@ protected:
         uint64_t result2 = 0;
         AsmJitHelper a;
 
+        eReturnType retType = DeduceReturnType<T>();
+
+        auto pfnNew = brutal_cast<const void*>(_pfn);
+
+        // Resident agent executes call without generating any code
+        auto& agent = _process.remote().agent();
+        if (contextThread != nullptr && agent.running() && *contextThread == *agent.thread())
+        {
+            if ((retType != rt_int32 && retType != rt_int64) || sizeof(T) > sizeof(uint64_t))
+                return LastNtStatus( STATUS_NOT_SUPPORTED );
+
+            NTSTATUS status = agent.Call( reinterpret_cast<uintptr_t>(pfnNew), args, _callConv, result2 );
+            if (NT_SUCCESS( status ))
+                memcpy( &result, &result2, sizeof(T) );
+
+            return status;
+        }
+
         // Ensure RPC environment exists
         if (!NT_SUCCESS( _process.remote().CreateRPCEnvironment( contextThread == _process.remote().getWorker(), contextThread != nullptr ) ))
             return LastNtStatus();
 
+        // Resident stub only needs its argument cells rewritten.
+        // Any stub failure falls back to one-off call code, arguments are untouched in that case
+        ptr_t stub = 0;
+        if (NT_SUCCESS( _process.remote().PrepareCallStub( pfnNew, args, _callConv, retType, stub ) ))
+        {
+            // Choose execution thread
+            if (contextThread == nullptr)
+                _process.remote().ExecInNewThread( stub, result2 );
+            else if (*contextThread == _process.remote()._hWorkThd)
+                _process.remote().ExecInWorkerThread( stub, result2 );
+            else
+                _process.remote().ExecInAnyThread( stub, result2, *contextThread );
+        }
+        else
+        {
+            _process.remote().PrepareCallAssembly( a, pfnNew, args, _callConv, retType );
+
+            // Choose execution thread
+            if (contextThread == nullptr)
+                _process.remote().ExecInNewThread( a->make(), a->getCodeSize(), result2 );
+            else if (*contextThread == _process.remote()._hWorkThd)
+                _process.remote().ExecInWorkerThread( a->make(), a->getCodeSize(), result2 );
+            else
+                _process.remote().ExecInAnyThread( a->make(), a->getCodeSize(), result2, *contextThread );
+        }
+
+        // Get function return value
+        _process.remote().GetCallResult( result );
+
+        return STATUS_SUCCESS;
+    }
+
+    /// <summary>
+    /// Queue remote function call into RemoteExec call frame and return immediately
+    /// </summary>
+    /// <param name="future">Pending call</param>
+    /// <param name="args">Function arguments. Copied, so function object can be reused before call completes</param>
+    /// <returns>Call status</returns>
+    template<typename T>
+    NTSTATUS CallAsync( RemoteFuture<T>& future, const std::vector<AsmVariant>& args )
+    {
+        int frame = -1;
+        std::vector<AsmVariant> frameArgs( args );
+
+        auto pfnNew = brutal_cast<const void*>(_pfn);
+        NTSTATUS status = _process.remote().QueueCall( reinterpret_cast<uintptr_t>(pfnNew), frameArgs, _callConv, DeduceReturnType<T>(), frame );
+        if (!NT_SUCCESS( status ))
+            return status;
+
+        future = RemoteFuture<T>( _process.remote(), frame, std::move( frameArgs ) );
+        return STATUS_SUCCESS;
+    }
+
+    /// <summary>
+    /// Get return type for function result
+    /// </summary>
+    /// <returns>Return type</returns>
+    template<typename T>
+    static eReturnType DeduceReturnType()
+    {
         // FPU check
         bool isFloat  = std::is_same<T, float>::value;
         bool isDouble = std::is_same<T, double>::value || std::is_same<T, long double>::value;
@@ -66,22 +394,7 @@ protected:
         else if (!std::is_reference<T>::value && sizeof(T) > sizeof(uint64_t))
             retType = rt_struct;
 
-        auto pfnNew = brutal_cast<const void*>(_pfn);
-
-        _process.remote().PrepareCallAssembly( a, pfnNew, args, _callConv, retType );
-
-        // Choose execution thread
-        if (contextThread == nullptr)
-            _process.remote().ExecInNewThread( a->make(), a->getCodeSize(), result2 );
-        else if (*contextThread == _process.remote()._hWorkThd)
-            _process.remote().ExecInWorkerThread( a->make(), a->getCodeSize(), result2 );
-        else
-            _process.remote().ExecInAnyThread( a->make(), a->getCodeSize(), result2, *contextThread );
-
-        // Get function return value
-        _process.remote().GetCallResult( result );
-
-        return STATUS_SUCCESS;
+        return retType;
     }
 
 #pragma warning(default : 4127)
@@ -178,6 +491,11 @@ public: \
         FuncArguments<Args...>::updateArgs( ); \
         return status; \
     } \
+    \
+    inline NTSTATUS CallAsync( RemoteFuture<ReturnType>& future ) \
+    { \
+        return RemoteFuncBase<R( CALL_OPT* )(Args...)>::CallAsync( future, FuncArguments<Args...>::getArgsRaw() ); \
+    } \
 }
 
 //
@@ -215,6 +533,11 @@ public:
         FuncArguments<C*, Args...>::updateArgs();
         return status;
     } 
+
+    inline NTSTATUS CallAsync( RemoteFuture<R>& future )
+    {
+        return RemoteFuncBase<R( C::* )(C*, Args...)>::CallAsync( future, getArgsRaw() );
+    }
 };
 
 }
\ No newline at end of file
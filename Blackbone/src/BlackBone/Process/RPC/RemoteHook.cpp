@@ -2,6 +2,7 @@
 #include "../Process.h"
 
 #include <algorithm>
+#include <array>
 
 namespace blackbone
 {
@@ -639,40 +640,73 @@ DWORD RemoteHook::StackBacktrace( ptr_t ip, ptr_t sp, Thread& thd, std::vector<s
     // Store exception address
     results.emplace_back( std::make_pair( 0, ip ) );
 
-    // Walk stack
-    for (ptr_t stackPtr = sp; stackPtr < stack_base && i < depth; stackPtr += _wordSize)
+    // Walk stack one page at a time
+    for (ptr_t pagePtr = sp; pagePtr < stack_base && i < depth;)
     {
-        ptr_t stack_val = 0;
-        _memory.Read( stackPtr, _wordSize, &stack_val );
-        MEMORY_BASIC_INFORMATION64 meminfo = { 0 };
+        uint8_t stackPage[0x1000] = { 0 };
+        ptr_t pageEnd = std::min<ptr_t>( (pagePtr & ~0xFFFull) + sizeof( stackPage ), stack_base );
 
-        ptr_t original = stack_val & 0x7FFFFFFFFFFFFFFF;
+        _memory.Read( pagePtr, static_cast<size_t>(pageEnd - pagePtr), stackPage );
 
-        // Invalid value
-        if (stack_val < _core.native()->minAddr() || original > _core.native()->maxAddr())
-            continue;
+        for (ptr_t stackPtr = pagePtr; stackPtr + _wordSize <= pageEnd && i < depth;)
+        {
+            // Values that look like return addresses into executable memory,
+            // no more than frames still needed
+            std::vector<std::pair<ptr_t, ptr_t>> candidates;
+            for (; stackPtr + _wordSize <= pageEnd && candidates.size() < static_cast<size_t>(depth - i); stackPtr += _wordSize)
+            {
+                ptr_t stack_val = 0;
+                memcpy( &stack_val, stackPage + (stackPtr - pagePtr), _wordSize );
+                MEMORY_BASIC_INFORMATION64 meminfo = { 0 };
 
-        // Check if memory is executable
-        if (_core.native()->VirtualQueryExT( original, &meminfo ) != STATUS_SUCCESS)
-            continue;
+                ptr_t original = stack_val & 0x7FFFFFFFFFFFFFFF;
 
-        if ( meminfo.AllocationProtect != PAGE_EXECUTE_READ &&
-             meminfo.AllocationProtect != PAGE_EXECUTE_WRITECOPY &&
-             meminfo.AllocationProtect != PAGE_EXECUTE_READWRITE)
-        {
-            continue;
-        }
+                // Invalid value
+                if (stack_val < _core.native()->minAddr() || original > _core.native()->maxAddr())
+                    continue;
 
-        uint8_t codeChunk[6] = {0};
-        _memory.Read( original - 6, sizeof(codeChunk), codeChunk );
+                // Check if memory is executable
+                if (_core.native()->VirtualQueryExT( original, &meminfo ) != STATUS_SUCCESS)
+                    continue;
 
-        // Detect 'call' instruction
-        // TODO: Implement more reliable way to detect 'call'
-        if (codeChunk[0] == 0xFF || codeChunk[1] == 0xE8 || codeChunk[4] == 0xFF)
-        {
-            results.emplace_back( std::make_pair( stackPtr, stack_val ) );
-            i++;
+                if ( meminfo.AllocationProtect != PAGE_EXECUTE_READ &&
+                     meminfo.AllocationProtect != PAGE_EXECUTE_WRITECOPY &&
+                     meminfo.AllocationProtect != PAGE_EXECUTE_READWRITE)
+                {
+                    continue;
+                }
+
+                candidates.emplace_back( std::make_pair( stackPtr, stack_val ) );
+            }
+
+            // Fetch code before every candidate in one batch
+            std::vector<std::array<uint8_t, 6>> codeChunks( candidates.size() );
+            std::vector<ReadRequest> requests;
+            requests.reserve( candidates.size() );
+
+            for (size_t k = 0; k < candidates.size(); k++)
+            {
+                codeChunks[k].fill( 0 );
+                requests.emplace_back( (candidates[k].second & 0x7FFFFFFFFFFFFFFF) - 6, codeChunks[k].size(), codeChunks[k].data() );
+            }
+
+            _memory.ReadBatch( requests );
+
+            for (auto k = 0u; k < candidates.size(); k++)
+            {
+                auto& codeChunk = codeChunks[k];
+
+                // Detect 'call' instruction
+                // TODO: Implement more reliable way to detect 'call'
+                if (codeChunk[0] == 0xFF || codeChunk[1] == 0xE8 || codeChunk[4] == 0xFF)
+                {
+                    results.emplace_back( candidates[k] );
+                    i++;
+                }
+            }
         }
+
+        pagePtr = pageEnd;
     }
 
     return i;
@@ -0,0 +1,286 @@
+#include "RegionMap.h"
+#include "ProcessMemory.h"
+#include "ProcessCore.h"
+#include "../Subsystem/NativeSubsystem.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+RegionMap::RegionMap( ProcessMemory& memory )
+    : _memory( memory )
+{
+}
+
+RegionMap::~RegionMap()
+{
+}
+
+/// <summary>
+/// Rebuild whole map
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS RegionMap::Refresh()
+{
+    CSLock lck( _lock );
+
+    auto& backend = _memory.backend();
+    vecRegions regions;
+
+    // Running past user space is expected
+    NTSTATUS status = QueryRange( backend.minAddr(), backend.maxAddr(), regions );
+    if (status == STATUS_INVALID_PARAMETER)
+        status = STATUS_SUCCESS;
+
+    _regions.swap( regions );
+    _valid = !_regions.empty();
+    _builtAt = GetTickCount64();
+
+    if (!_valid && NT_SUCCESS( status ))
+        status = STATUS_NOT_FOUND;
+
+    return LastNtStatus( status );
+}
+
+/// <summary>
+/// Re-query regions overlapping memory range. Does nothing if map wasn't built yet
+/// </summary>
+/// <param name="address">Range start</param>
+/// <param name="size">Range size</param>
+void RegionMap::Update( ptr_t address, size_t size )
+{
+    CSLock lck( _lock );
+
+    if (!_valid)
+        return;
+
+    auto& backend = _memory.backend();
+    ptr_t pageSize = backend.pageSize();
+    ptr_t start = std::max<ptr_t>( address & ~(pageSize - 1), backend.minAddr() );
+    ptr_t end = std::min<ptr_t>( address + (size != 0 ? size : 1), backend.maxAddr() );
+
+    if (start >= end)
+        return;
+
+    vecRegions fresh;
+    QueryRange( start, end, fresh );
+    Splice( std::move( fresh ) );
+}
+
+/// <summary>
+/// Replace map regions with re-queried ones. Lock must be held
+/// </summary>
+/// <param name="fresh">Consecutive re-queried regions</param>
+void RegionMap::Splice( vecRegions fresh )
+{
+    if (fresh.empty())
+        return;
+
+    ptr_t newStart = fresh.front().BaseAddress;
+    ptr_t newEnd = fresh.back().BaseAddress + fresh.back().RegionSize;
+
+    // Old regions overlapping [newStart, newEnd)
+    size_t first = LowerBound( newStart );
+    size_t last = first;
+    while (last < _regions.size() && _regions[last].BaseAddress < newEnd)
+        last++;
+
+    // Keep parts of old regions outside of re-queried range
+    if (first < last && _regions[first].BaseAddress < newStart)
+    {
+        MEMORY_BASIC_INFORMATION64 head = _regions[first];
+        head.RegionSize = newStart - head.BaseAddress;
+        fresh.insert( fresh.begin(), head );
+    }
+
+    if (first < last && _regions[last - 1].BaseAddress + _regions[last - 1].RegionSize > newEnd)
+    {
+        MEMORY_BASIC_INFORMATION64 tail = _regions[last - 1];
+        tail.RegionSize = tail.BaseAddress + tail.RegionSize - newEnd;
+        tail.BaseAddress = newEnd;
+        fresh.emplace_back( tail );
+    }
+
+    _regions.erase( _regions.begin() + first, _regions.begin() + last );
+    _regions.insert( _regions.begin() + first, fresh.begin(), fresh.end() );
+
+    Merge( first != 0 ? first - 1 : 0, first + fresh.size() );
+}
+
+/// <summary>
+/// Drop map. It will be rebuilt on next access
+/// </summary>
+void RegionMap::Invalidate()
+{
+    CSLock lck( _lock );
+
+    _regions.clear();
+    _valid = false;
+}
+
+/// <summary>
+/// Find region containing address. Address is queried directly if map isn't built
+/// </summary>
+/// <param name="address">Memory address</param>
+/// <param name="mbi">Found region</param>
+/// <returns>true if found</returns>
+bool RegionMap::Find( ptr_t address, MEMORY_BASIC_INFORMATION64& mbi )
+{
+    CSLock lck( _lock );
+
+    if (!_valid)
+        return _memory.Query( address, &mbi ) == STATUS_SUCCESS && mbi.RegionSize != 0;
+
+    size_t idx = LowerBound( address );
+    if (idx >= _regions.size() || _regions[idx].BaseAddress > address)
+        return false;
+
+    mbi = _regions[idx];
+    return true;
+}
+
+/// <summary>
+/// Get regions overlapping memory range.
+/// Whole address space request rebuilds map if it isn't built or is older than max age,
+/// other ranges are queried directly if map isn't built
+/// </summary>
+/// <param name="start">Range start</param>
+/// <param name="end">Range end</param>
+/// <param name="results">Found regions, sorted by address</param>
+/// <param name="includeFree">If true - non-allocated regions will be included in list</param>
+/// <returns>Number of regions found</returns>
+size_t RegionMap::Get( ptr_t start, ptr_t end, vecRegions& results, bool includeFree /*= false*/ )
+{
+    CSLock lck( _lock );
+
+    results.clear();
+
+    auto& backend = _memory.backend();
+    if (start <= backend.minAddr() && end >= backend.maxAddr())
+    {
+        // Target allocations aren't tracked, map this old could miss them
+        if (!_valid || GetTickCount64() - _builtAt > _maxAge)
+            Refresh();
+    }
+    else if (!_valid)
+    {
+        // Building whole map for a single range costs more than querying the range
+        vecRegions fresh;
+        ptr_t pageSize = backend.pageSize();
+        QueryRange( std::max<ptr_t>( start & ~(pageSize - 1), backend.minAddr() ), std::min<ptr_t>( end, backend.maxAddr() ), fresh );
+
+        for (auto& mbi : fresh)
+            if (mbi.BaseAddress + mbi.RegionSize > start && mbi.BaseAddress < end && (includeFree || mbi.State & (MEM_COMMIT | MEM_RESERVE)))
+                results.emplace_back( mbi );
+
+        return results.size();
+    }
+
+    for (size_t idx = LowerBound( start ); idx < _regions.size() && _regions[idx].BaseAddress < end; idx++)
+        if (includeFree || _regions[idx].State & (MEM_COMMIT | MEM_RESERVE))
+            results.emplace_back( _regions[idx] );
+
+    return results.size();
+}
+
+/// <summary>
+/// Get size of allocation starting at address, as seen by the map
+/// </summary>
+/// <param name="base">Allocation base</param>
+/// <returns>Allocation size, 0 if unknown</returns>
+size_t RegionMap::AllocationSize( ptr_t base )
+{
+    CSLock lck( _lock );
+
+    if (!_valid)
+        return 0;
+
+    size_t size = 0;
+    for (size_t idx = LowerBound( base ); idx < _regions.size(); idx++)
+    {
+        auto& mbi = _regions[idx];
+        if (mbi.State == MEM_FREE || mbi.AllocationBase != base || mbi.BaseAddress != base + size)
+            break;
+
+        size += static_cast<size_t>(mbi.RegionSize);
+    }
+
+    return size;
+}
+
+/// <summary>
+/// Query consecutive regions covering memory range
+/// </summary>
+/// <param name="start">Page aligned range start</param>
+/// <param name="end">Range end</param>
+/// <param name="results">Found regions</param>
+/// <returns>Status code of the last query</returns>
+NTSTATUS RegionMap::QueryRange( ptr_t start, ptr_t end, vecRegions& results )
+{
+    MEMORY_BASIC_INFORMATION64 mbi = { 0 };
+    ptr_t pageSize = _memory.backend().pageSize();
+    NTSTATUS status = STATUS_SUCCESS;
+
+    for (ptr_t memptr = start; memptr < end;)
+    {
+        status = _memory.Query( memptr, &mbi );
+
+        if (status == STATUS_INVALID_PARAMETER || status == STATUS_ACCESS_DENIED)
+            break;
+
+        // Skip unqueryable page
+        if (status != STATUS_SUCCESS || mbi.RegionSize == 0)
+        {
+            memptr += pageSize;
+            continue;
+        }
+
+        results.emplace_back( mbi );
+        memptr = mbi.BaseAddress + mbi.RegionSize;
+    }
+
+    return status;
+}
+
+/// <summary>
+/// Join adjacent regions with same attributes
+/// </summary>
+/// <param name="first">First region index to check</param>
+/// <param name="last">Last region index to check</param>
+void RegionMap::Merge( size_t first, size_t last )
+{
+    last = std::min<size_t>( last, _regions.size() - 1 );
+
+    for (size_t idx = last; idx > first; idx--)
+    {
+        auto& prev = _regions[idx - 1];
+        auto& cur = _regions[idx];
+
+        if (prev.BaseAddress + prev.RegionSize == cur.BaseAddress &&
+            prev.State == cur.State &&
+            prev.Protect == cur.Protect &&
+            prev.Type == cur.Type &&
+            prev.AllocationBase == cur.AllocationBase &&
+            prev.AllocationProtect == cur.AllocationProtect)
+        {
+            prev.RegionSize += cur.RegionSize;
+            _regions.erase( _regions.begin() + idx );
+        }
+    }
+}
+
+/// <summary>
+/// Get index of the first region ending after address
+/// </summary>
+/// <param name="address">Memory address</param>
+/// <returns>Region index</returns>
+size_t RegionMap::LowerBound( ptr_t address ) const
+{
+    auto iter = std::upper_bound( _regions.begin(), _regions.end(), address,
+        []( ptr_t addr, const MEMORY_BASIC_INFORMATION64& mbi ) { return addr < mbi.BaseAddress + mbi.RegionSize; } );
+
+    return static_cast<size_t>(iter - _regions.begin());
+}
+
+}
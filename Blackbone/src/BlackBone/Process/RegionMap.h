@@ -0,0 +1,128 @@
+#pragma once
+
+#include "../Config.h"
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+#include "../Misc/Utils.h"
+
+#include <vector>
+
+namespace blackbone
+{
+
+typedef std::vector<MEMORY_BASIC_INFORMATION64> vecRegions;
+
+#define REGION_MAP_MAX_AGE  1000    // Default max map age for whole address space lookups, ms
+
+/// <summary>
+/// Sorted map of target address space regions, free regions included.
+/// Map is built by whole address space lookups and then updated only around ranges changed through owning ProcessMemory.
+/// Changes made by the target itself are not tracked, so whole address space lookups rebuild map once it's older than max age.
+/// Range lookups use map as is, while it isn't built they query only the requested range
+/// </summary>
+class RegionMap
+{
+public:
+    BLACKBONE_API RegionMap( class ProcessMemory& memory );
+    BLACKBONE_API ~RegionMap();
+
+    /// <summary>
+    /// Rebuild whole map
+    /// </summary>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Refresh();
+
+    /// <summary>
+    /// Re-query regions overlapping memory range. Does nothing if map wasn't built yet
+    /// </summary>
+    /// <param name="address">Range start</param>
+    /// <param name="size">Range size</param>
+    BLACKBONE_API void Update( ptr_t address, size_t size );
+
+    /// <summary>
+    /// Drop map. It will be rebuilt on next access
+    /// </summary>
+    BLACKBONE_API void Invalidate();
+
+    /// <summary>
+    /// Find region containing address. Address is queried directly if map isn't built
+    /// </summary>
+    /// <param name="address">Memory address</param>
+    /// <param name="mbi">Found region</param>
+    /// <returns>true if found</returns>
+    BLACKBONE_API bool Find( ptr_t address, MEMORY_BASIC_INFORMATION64& mbi );
+
+    /// <summary>
+    /// Get regions overlapping memory range.
+    /// Whole address space request rebuilds map if it isn't built or is older than max age,
+    /// other ranges are queried directly if map isn't built
+    /// </summary>
+    /// <param name="start">Range start</param>
+    /// <param name="end">Range end</param>
+    /// <param name="results">Found regions, sorted by address</param>
+    /// <param name="includeFree">If true - non-allocated regions will be included in list</param>
+    /// <returns>Number of regions found</returns>
+    BLACKBONE_API size_t Get( ptr_t start, ptr_t end, vecRegions& results, bool includeFree = false );
+
+    /// <summary>
+    /// Get size of allocation starting at address, as seen by the map
+    /// </summary>
+    /// <param name="base">Allocation base</param>
+    /// <returns>Allocation size, 0 if unknown</returns>
+    BLACKBONE_API size_t AllocationSize( ptr_t base );
+
+    /// <summary>
+    /// Check if map is built
+    /// </summary>
+    /// <returns>true if map is built</returns>
+    BLACKBONE_API inline bool valid() const { return _valid; }
+
+    /// <summary>
+    /// Set max map age for whole address space lookups
+    /// </summary>
+    /// <param name="ms">Max age in milliseconds, 0 rebuilds map on every whole address space lookup</param>
+    BLACKBONE_API inline void setMaxAge( uint32_t ms ) { _maxAge = ms; }
+
+private:
+    /// <summary>
+    /// Query consecutive regions covering memory range
+    /// </summary>
+    /// <param name="start">Page aligned range start</param>
+    /// <param name="end">Range end</param>
+    /// <param name="results">Found regions</param>
+    /// <returns>Status code of the last query</returns>
+    NTSTATUS QueryRange( ptr_t start, ptr_t end, vecRegions& results );
+
+    /// <summary>
+    /// Replace map regions with re-queried ones. Lock must be held
+    /// </summary>
+    /// <param name="fresh">Consecutive re-queried regions</param>
+    void Splice( vecRegions fresh );
+
+    /// <summary>
+    /// Join adjacent regions with same attributes
+    /// </summary>
+    /// <param name="first">First region index to check</param>
+    /// <param name="last">Last region index to check</param>
+    void Merge( size_t first, size_t last );
+
+    /// <summary>
+    /// Get index of the first region ending after address
+    /// </summary>
+    /// <param name="address">Memory address</param>
+    /// <returns>Region index</returns>
+    size_t LowerBound( ptr_t address ) const;
+
+    RegionMap( const RegionMap& ) = delete;
+    RegionMap& operator =( const RegionMap& ) = delete;
+
+private:
+    class ProcessMemory& _memory;   // Owning process memory
+    vecRegions _regions;            // Regions sorted by base address
+    bool _valid = false;            // Map is built
+    ULONGLONG _builtAt = 0;         // Tick count of last rebuild
+    uint32_t _maxAge = REGION_MAP_MAX_AGE;  // Max map age for whole address space lookups, ms
+    CriticalSection _lock;          // Map guard
+};
+
+}
@@ -0,0 +1,267 @@
+#include "RegionStream.h"
+#include "ProcessMemory.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+RegionStream::RegionStream( ProcessMemory& memory, size_t chunkSize /*= STREAM_CHUNK_SIZE*/, size_t overlap /*= 0*/, size_t buffers /*= STREAM_BUFFERS*/ )
+    : _memory( memory )
+    , _chunkSize( chunkSize != 0 ? chunkSize : STREAM_CHUNK_SIZE )
+    , _overlap( overlap )
+{
+    // Carried bytes are copied from the previous buffer, so at least two are required
+    _buffers.resize( std::max<size_t>( buffers, 2 ) );
+    for (auto& buf : _buffers)
+        buf.resize( _chunkSize + _overlap );
+}
+
+RegionStream::~RegionStream()
+{
+    Stop();
+}
+
+/// <summary>
+/// Start streaming committed readable regions overlapping memory range
+/// </summary>
+/// <param name="start">Range start</param>
+/// <param name="end">Range end</param>
+/// <returns>Status code</returns>
+NTSTATUS RegionStream::Start( ptr_t start, ptr_t end )
+{
+    vecRegions ranges;
+    Readable( _memory, start, end, ranges );
+
+    return Start( ranges );
+}
+
+/// <summary>
+/// Get committed readable parts of memory range. Whole address space scan rebuilds region map once it's older than max age
+/// </summary>
+/// <param name="memory">Target process memory</param>
+/// <param name="start">Range start</param>
+/// <param name="end">Range end</param>
+/// <param name="ranges">Found ranges, sorted by address</param>
+void RegionStream::Readable( ProcessMemory& memory, ptr_t start, ptr_t end, vecRegions& ranges )
+{
+    vecRegions found;
+    memory.regions().Get( start, end, found );
+
+    for (auto& mbi : found)
+    {
+        if (mbi.State != MEM_COMMIT || mbi.Protect == 0 || (mbi.Protect & (PAGE_NOACCESS | PAGE_GUARD)) != 0)
+            continue;
+
+        ptr_t rstart = std::max<ptr_t>( mbi.BaseAddress, start );
+        ptr_t rend = std::min<ptr_t>( mbi.BaseAddress + mbi.RegionSize, end );
+        if (rstart >= rend)
+            continue;
+
+        mbi.BaseAddress = rstart;
+        mbi.RegionSize = rend - rstart;
+        ranges.emplace_back( mbi );
+    }
+}
+
+/// <summary>
+/// Start streaming arbitrary ranges. Only BaseAddress and RegionSize are used
+/// </summary>
+/// <param name="ranges">Ranges to read, sorted by address</param>
+/// <returns>Status code</returns>
+NTSTATUS RegionStream::Start( const vecRegions& ranges )
+{
+    Stop();
+
+    _ranges = ranges;
+    _stats = StreamStats();
+    _stop = false;
+    _finished = false;
+
+    LONG count = static_cast<LONG>(_buffers.size());
+
+    // End of stream marker is queued without a buffer
+    _hFree = CreateSemaphoreW( NULL, count, count, NULL );
+    _hReady = CreateSemaphoreW( NULL, 0, count + 1, NULL );
+    if (_hFree == NULL || _hReady == NULL)
+    {
+        NTSTATUS status = LastNtStatus();
+        Stop();
+        return status;
+    }
+
+    _hThread = CreateThread( NULL, 0, &RegionStream::ReadThreadWrap, this, 0, NULL );
+    if (_hThread == NULL)
+    {
+        NTSTATUS status = LastNtStatus();
+        Stop();
+        return status;
+    }
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Get next chunk. Previously returned chunk is released
+/// </summary>
+/// <param name="chunk">Chunk</param>
+/// <returns>false if there are no more chunks</returns>
+bool RegionStream::Next( StreamChunk& chunk )
+{
+    if (_hThread == NULL || _finished)
+        return false;
+
+    if (_holding)
+    {
+        _holding = false;
+        ReleaseSemaphore( _hFree, 1, NULL );
+    }
+
+    {
+        CSLock lck( _lock );
+        if (_ready.empty())
+            _stats.stalls++;
+    }
+
+    WaitForSingleObject( _hReady, INFINITE );
+
+    {
+        CSLock lck( _lock );
+        chunk = _ready.front();
+        _ready.pop_front();
+    }
+
+    if (chunk.data == nullptr)
+    {
+        _finished = true;
+        return false;
+    }
+
+    _holding = true;
+    _stats.chunks++;
+    _stats.bytes += chunk.size - chunk.overlap;
+
+    return true;
+}
+
+/// <summary>
+/// Stop reading thread and release pending chunks
+/// </summary>
+void RegionStream::Stop()
+{
+    if (_hThread != NULL)
+    {
+        // Wake thread if it waits for a free buffer
+        _stop = true;
+        ReleaseSemaphore( _hFree, 1, NULL );
+
+        WaitForSingleObject( _hThread, INFINITE );
+        CloseHandle( _hThread );
+        _hThread = NULL;
+    }
+
+    if (_hFree != NULL)
+    {
+        CloseHandle( _hFree );
+        _hFree = NULL;
+    }
+
+    if (_hReady != NULL)
+    {
+        CloseHandle( _hReady );
+        _hReady = NULL;
+    }
+
+    _ready.clear();
+    _holding = false;
+    _finished = true;
+}
+
+/// <summary>
+/// Read thread wrapper
+/// </summary>
+/// <param name="lpParam">RegionStream instance</param>
+/// <returns>0</returns>
+DWORD CALLBACK RegionStream::ReadThreadWrap( LPVOID lpParam )
+{
+    ((RegionStream*)lpParam)->ReadThread();
+    return 0;
+}
+
+/// <summary>
+/// Fill free buffers with chunks of requested ranges
+/// </summary>
+void RegionStream::ReadThread()
+{
+    const uint8_t* prev = nullptr;  // Previous chunk data, still owned by stream or consumer
+    size_t prevSize = 0;            // Previous chunk size
+    ptr_t prevEnd = 0;              // End of the previously requested chunk
+    size_t index = 0;               // Next buffer in ring
+
+    for (auto& range : _ranges)
+    {
+        ptr_t end = range.BaseAddress + range.RegionSize;
+
+        for (ptr_t ptr = range.BaseAddress; ptr < end && !_stop;)
+        {
+            size_t size = static_cast<size_t>(std::min<ptr_t>( end - ptr, _chunkSize ));
+
+            WaitForSingleObject( _hFree, INFINITE );
+            if (_stop)
+                break;
+
+            // Ring order guarantees the previous buffer isn't the one being filled
+            auto& buf = _buffers[index];
+            size_t carry = (prev != nullptr && prevEnd == ptr) ? std::min( _overlap, prevSize ) : 0;
+
+            if (NT_SUCCESS( _memory.Read( ptr, size, buf.data() + carry ) ))
+            {
+                if (carry != 0)
+                    memcpy( buf.data(), prev + prevSize - carry, carry );
+
+                StreamChunk chunk;
+                chunk.address = ptr - carry;
+                chunk.data = buf.data();
+                chunk.size = size + carry;
+                chunk.overlap = carry;
+
+                Publish( chunk );
+
+                prev = buf.data();
+                prevSize = chunk.size;
+                index = (index + 1) % _buffers.size();
+            }
+            else
+            {
+                // Buffer wasn't used, return it
+                _stats.failed++;
+                prev = nullptr;
+                ReleaseSemaphore( _hFree, 1, NULL );
+            }
+
+            ptr += size;
+            prevEnd = ptr;
+        }
+
+        if (_stop)
+            break;
+    }
+
+    Publish( StreamChunk() );
+}
+
+/// <summary>
+/// Queue ready chunk and wake consumer
+/// </summary>
+/// <param name="chunk">Ready chunk, data == nullptr marks end of stream</param>
+void RegionStream::Publish( const StreamChunk& chunk )
+{
+    {
+        CSLock lck( _lock );
+        _ready.emplace_back( chunk );
+    }
+
+    ReleaseSemaphore( _hReady, 1, NULL );
+}
+
+}
@@ -0,0 +1,137 @@
+#pragma once
+
+#include "../Config.h"
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+#include "../Misc/Utils.h"
+#include "RegionMap.h"
+
+#include <vector>
+#include <deque>
+#include <atomic>
+
+namespace blackbone
+{
+
+#define STREAM_CHUNK_SIZE   0x100000    // Default chunk size, 1 MB
+#define STREAM_BUFFERS      2           // Default number of chunk buffers
+
+/// <summary>
+/// Chunk of target memory returned by stream
+/// </summary>
+struct StreamChunk
+{
+    ptr_t address = 0;              // Target address of data[0], carried bytes included
+    const uint8_t* data = nullptr;  // Chunk data, valid until next call to RegionStream::Next
+    size_t size = 0;                // Data size, carried bytes included
+    size_t overlap = 0;             // Number of leading bytes carried from the previous chunk
+};
+
+/// <summary>
+/// Stream statistics
+/// </summary>
+struct StreamStats
+{
+    size_t chunks = 0;              // Chunks returned
+    size_t bytes = 0;               // Bytes read from target, carried bytes excluded
+    size_t failed = 0;              // Chunks skipped due to read failure
+    size_t stalls = 0;              // Times consumer had to wait for a read to complete
+};
+
+/// <summary>
+/// Streaming reader of target memory regions.
+/// Regions are split into fixed-size chunks, next chunks are read on a background thread
+/// while the consumer processes current one. If chunk directly continues previous one,
+/// last 'overlap' bytes of the previous chunk are carried in front of it,
+/// so data crossing chunk boundary is seen whole.
+/// Use pattern size - 1 as overlap: match that fits entirely into carried bytes can't exist,
+/// so every match is reported exactly once
+/// </summary>
+class RegionStream
+{
+public:
+    BLACKBONE_API RegionStream( class ProcessMemory& memory, size_t chunkSize = STREAM_CHUNK_SIZE, size_t overlap = 0, size_t buffers = STREAM_BUFFERS );
+    BLACKBONE_API ~RegionStream();
+
+    /// <summary>
+    /// Start streaming committed readable regions overlapping memory range
+    /// </summary>
+    /// <param name="start">Range start</param>
+    /// <param name="end">Range end</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Start( ptr_t start, ptr_t end );
+
+    /// <summary>
+    /// Start streaming arbitrary ranges. Only BaseAddress and RegionSize are used
+    /// </summary>
+    /// <param name="ranges">Ranges to read, sorted by address</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Start( const vecRegions& ranges );
+
+    /// <summary>
+    /// Get next chunk. Previously returned chunk is released
+    /// </summary>
+    /// <param name="chunk">Chunk</param>
+    /// <returns>false if there are no more chunks</returns>
+    BLACKBONE_API bool Next( StreamChunk& chunk );
+
+    /// <summary>
+    /// Stop reading thread and release pending chunks
+    /// </summary>
+    BLACKBONE_API void Stop();
+
+    /// <summary>
+    /// Statistics of the last stream. Reliable only after all chunks were consumed
+    /// </summary>
+    BLACKBONE_API inline const StreamStats& stats() const { return _stats; }
+
+    /// <summary>
+    /// Get committed readable parts of memory range. Whole address space scan rebuilds region map once it's older than max age
+    /// </summary>
+    /// <param name="memory">Target process memory</param>
+    /// <param name="start">Range start</param>
+    /// <param name="end">Range end</param>
+    /// <param name="ranges">Found ranges, sorted by address</param>
+    BLACKBONE_API static void Readable( class ProcessMemory& memory, ptr_t start, ptr_t end, vecRegions& ranges );
+
+private:
+    /// <summary>
+    /// Read thread wrapper
+    /// </summary>
+    /// <param name="lpParam">RegionStream instance</param>
+    /// <returns>0</returns>
+    static DWORD CALLBACK ReadThreadWrap( LPVOID lpParam );
+
+    /// <summary>
+    /// Fill free buffers with chunks of requested ranges
+    /// </summary>
+    void ReadThread();
+
+    /// <summary>
+    /// Queue ready chunk and wake consumer
+    /// </summary>
+    /// <param name="chunk">Ready chunk, data == nullptr marks end of stream</param>
+    void Publish( const StreamChunk& chunk );
+
+    RegionStream( const RegionStream& ) = delete;
+    RegionStream& operator =( const RegionStream& ) = delete;
+
+private:
+    class ProcessMemory& _memory;               // Target process memory
+    size_t _chunkSize;                          // Bytes read from target per chunk
+    size_t _overlap;                            // Bytes carried from previous chunk
+    std::vector<std::vector<uint8_t>> _buffers; // Chunk buffers, used in ring order
+    vecRegions _ranges;                         // Ranges being streamed
+
+    HANDLE _hThread = NULL;                     // Read thread
+    HANDLE _hFree = NULL;                       // Semaphore, number of free buffers
+    HANDLE _hReady = NULL;                      // Semaphore, number of queued chunks
+    CriticalSection _lock;                      // Queue guard
+    std::deque<StreamChunk> _ready;             // Chunks ready for consumer
+    std::atomic<bool> _stop{ false };           // Read thread stop flag
+    bool _holding = false;                      // Consumer holds a buffer
+    bool _finished = false;                     // End of stream reached
+    StreamStats _stats;                         // Statistics
+};
+
+}
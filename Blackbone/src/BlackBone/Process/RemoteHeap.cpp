@@ -0,0 +1,226 @@
+#include "RemoteHeap.h"
+#include "ProcessMemory.h"
+#include "ProcessCore.h"
+
+#include <algorithm>
+
+namespace blackbone
+{
+
+RemoteHeap::RemoteHeap( ProcessMemory& memory )
+    : _memory( memory )
+{
+    _arenas[0].protection = PAGE_READWRITE;
+    _arenas[1].protection = PAGE_EXECUTE_READWRITE;
+}
+
+RemoteHeap::~RemoteHeap()
+{
+}
+
+/// <summary>
+/// Allocate memory block. Block is zero-filled.
+/// Executable blocks are served from read-write-execute arena, other ones from read-write arena.
+/// Blocks bigger than HEAP_MAX_BLOCK are allocated directly
+/// </summary>
+/// <param name="size">Block size</param>
+/// <param name="protection">Memory protection</param>
+/// <param name="own">false if caller will be responsible for block deallocation</param>
+/// <returns>Memory block. If failed - returned block will be invalid</returns>
+MemBlock RemoteHeap::Allocate( size_t size, DWORD protection /*= PAGE_EXECUTE_READWRITE*/, bool own /*= true*/ )
+{
+    static const uint8_t zeroes[HEAP_MAX_BLOCK] = { 0 };
+
+    const DWORD execMask = PAGE_EXECUTE | PAGE_EXECUTE_READ | PAGE_EXECUTE_READWRITE | PAGE_EXECUTE_WRITECOPY;
+    const DWORD dataMask = PAGE_READONLY | PAGE_READWRITE | PAGE_WRITECOPY;
+
+    // Not a pooled block
+    if (size == 0 || size > HEAP_MAX_BLOCK || (protection & (execMask | dataMask)) == 0 || (protection & ~(execMask | dataMask)) != 0)
+    {
+        _stats.fallbacks++;
+        return _memory.Allocate( size, protection, 0, own );
+    }
+
+    uint8_t arenaIdx = (protection & execMask) ? 1 : 0;
+    uint8_t sizeClass = 0;
+    while (static_cast<size_t>(HEAP_MIN_BLOCK) << sizeClass < size)
+        sizeClass++;
+
+    size_t blockSize = static_cast<size_t>(HEAP_MIN_BLOCK) << sizeClass;
+
+    CSLock lck( _lock );
+
+    auto& arena = _arenas[arenaIdx];
+    auto& list = arena.free[sizeClass];
+
+    if (list.released.empty() && list.fresh.empty() && !Carve( arena, sizeClass ))
+        return MemBlock();
+
+    ptr_t ptr = 0;
+    if (!list.released.empty())
+    {
+        ptr = list.released.back();
+
+        // Previous contents must not leak into new block
+        if (!NT_SUCCESS( _memory.Write( ptr, blockSize, zeroes ) ))
+            return MemBlock();
+
+        list.released.pop_back();
+        _stats.reuses++;
+    }
+    else
+    {
+        ptr = list.fresh.back();
+        list.fresh.pop_back();
+    }
+
+    FindChunk( arena, ptr )->live++;
+    _live.emplace( ptr, std::make_pair( arenaIdx, sizeClass ) );
+
+    _stats.allocations++;
+    _stats.blocks++;
+    _stats.used += blockSize;
+
+    return MemBlock( &_memory, ptr, blockSize, arena.protection, own, false, this );
+}
+
+/// <summary>
+/// Return block into its arena
+/// </summary>
+/// <param name="ptr">Block address</param>
+/// <returns>Status code</returns>
+NTSTATUS RemoteHeap::Release( ptr_t ptr )
+{
+    CSLock lck( _lock );
+
+    auto iter = _live.find( ptr );
+    if (iter == _live.end())
+        return LastNtStatus( STATUS_INVALID_ADDRESS );
+
+    auto& arena = _arenas[iter->second.first];
+    uint8_t sizeClass = iter->second.second;
+
+    FindChunk( arena, ptr )->live--;
+    arena.free[sizeClass].released.emplace_back( ptr );
+    _live.erase( iter );
+
+    _stats.blocks--;
+    _stats.used -= static_cast<size_t>(HEAP_MIN_BLOCK) << sizeClass;
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Free chunks without blocks in use
+/// </summary>
+/// <returns>Number of freed chunks</returns>
+size_t RemoteHeap::Trim()
+{
+    CSLock lck( _lock );
+
+    size_t freed = 0;
+
+    for (auto& arena : _arenas)
+    {
+        for (auto iter = arena.chunks.begin(); iter != arena.chunks.end();)
+        {
+            if (iter->second.live != 0 || !NT_SUCCESS( _memory.Free( iter->first ) ))
+            {
+                ++iter;
+                continue;
+            }
+
+            // Drop free blocks of released chunk
+            ptr_t base = iter->first;
+            auto inChunk = [base]( ptr_t ptr ) { return ptr >= base && ptr < base + HEAP_CHUNK_SIZE; };
+
+            for (auto& list : arena.free)
+            {
+                list.fresh.erase( std::remove_if( list.fresh.begin(), list.fresh.end(), inChunk ), list.fresh.end() );
+                list.released.erase( std::remove_if( list.released.begin(), list.released.end(), inChunk ), list.released.end() );
+            }
+
+            iter = arena.chunks.erase( iter );
+            _stats.chunks--;
+            freed++;
+        }
+    }
+
+    return freed;
+}
+
+/// <summary>
+/// Free unused chunks and forget the rest. Blocks still in use stay in target process
+/// </summary>
+void RemoteHeap::reset()
+{
+    if (_memory.core().handle() != NULL)
+        Trim();
+
+    CSLock lck( _lock );
+
+    for (auto& arena : _arenas)
+    {
+        arena.chunks.clear();
+        for (auto& list : arena.free)
+        {
+            list.fresh.clear();
+            list.released.clear();
+        }
+    }
+
+    _live.clear();
+    _stats = HeapStats();
+}
+
+/// <summary>
+/// Give new slab to size class
+/// </summary>
+/// <param name="arena">Arena</param>
+/// <param name="sizeClass">Size class index</param>
+/// <returns>true on success</returns>
+bool RemoteHeap::Carve( Arena& arena, uint8_t sizeClass )
+{
+    auto iter = std::find_if( arena.chunks.begin(), arena.chunks.end(),
+        []( const std::pair<const ptr_t, Chunk>& chunk ) { return chunk.second.carved + HEAP_SLAB_SIZE <= HEAP_CHUNK_SIZE; } );
+
+    // Reserve new chunk
+    if (iter == arena.chunks.end())
+    {
+        auto block = _memory.Allocate( HEAP_CHUNK_SIZE, arena.protection, 0, false );
+        if (!block.valid())
+            return false;
+
+        iter = arena.chunks.emplace( block.ptr(), Chunk() ).first;
+        _stats.chunks++;
+    }
+
+    ptr_t slab = iter->first + iter->second.carved;
+    size_t blockSize = static_cast<size_t>(HEAP_MIN_BLOCK) << sizeClass;
+    auto& fresh = arena.free[sizeClass].fresh;
+
+    // Lower addresses are handed out first
+    for (size_t offset = HEAP_SLAB_SIZE; offset >= blockSize; offset -= blockSize)
+        fresh.emplace_back( slab + offset - blockSize );
+
+    iter->second.carved += HEAP_SLAB_SIZE;
+    return true;
+}
+
+/// <summary>
+/// Find chunk containing address
+/// </summary>
+/// <param name="arena">Arena</param>
+/// <param name="ptr">Block address</param>
+/// <returns>Chunk, nullptr if not found</returns>
+RemoteHeap::Chunk* RemoteHeap::FindChunk( Arena& arena, ptr_t ptr )
+{
+    auto iter = arena.chunks.upper_bound( ptr );
+    if (iter == arena.chunks.begin())
+        return nullptr;
+
+    --iter;
+    return ptr < iter->first + HEAP_CHUNK_SIZE ? &iter->second : nullptr;
+}
+
+}
@@ -0,0 +1,136 @@
+#pragma once
+
+#include "../Include/Winheaders.h"
+#include "../Include/Types.h"
+#include "../Misc/Utils.h"
+#include "MemBlock.h"
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+
+namespace blackbone
+{
+
+#define HEAP_CHUNK_SIZE     0x10000     // Memory reserved at once for an arena
+#define HEAP_SLAB_SIZE      0x1000      // Memory carved from chunk at once for a size class
+#define HEAP_MIN_BLOCK      0x10        // Smallest size class
+#define HEAP_MAX_BLOCK      0x800       // Largest size class. Bigger blocks are allocated directly
+#define HEAP_CLASS_COUNT    8           // Number of size classes between HEAP_MIN_BLOCK and HEAP_MAX_BLOCK
+
+/// <summary>
+/// Remote heap usage
+/// </summary>
+struct HeapStats
+{
+    size_t chunks = 0;          // Reserved chunks
+    size_t blocks = 0;          // Blocks in use
+    size_t used = 0;            // Bytes in use, rounded to size class
+    uint64_t allocations = 0;   // Blocks served from arenas
+    uint64_t reuses = 0;        // Blocks served from released ones
+    uint64_t fallbacks = 0;     // Blocks allocated directly
+};
+
+/// <summary>
+/// Remote sub-allocator.
+/// Small blocks are carved from large chunks reserved once, data and code blocks live in separate arenas.
+/// Returned MemBlock handles release memory back into the arena instead of freeing it
+/// </summary>
+class RemoteHeap
+{
+public:
+    BLACKBONE_API RemoteHeap( class ProcessMemory& memory );
+    BLACKBONE_API ~RemoteHeap();
+
+    /// <summary>
+    /// Allocate memory block. Block is zero-filled.
+    /// Executable blocks are served from read-write-execute arena, other ones from read-write arena.
+    /// Blocks bigger than HEAP_MAX_BLOCK are allocated directly
+    /// </summary>
+    /// <param name="size">Block size</param>
+    /// <param name="protection">Memory protection</param>
+    /// <param name="own">false if caller will be responsible for block deallocation</param>
+    /// <returns>Memory block. If failed - returned block will be invalid</returns>
+    BLACKBONE_API MemBlock Allocate( size_t size, DWORD protection = PAGE_EXECUTE_READWRITE, bool own = true );
+
+    /// <summary>
+    /// Return block into its arena
+    /// </summary>
+    /// <param name="ptr">Block address</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Release( ptr_t ptr );
+
+    /// <summary>
+    /// Free chunks without blocks in use
+    /// </summary>
+    /// <returns>Number of freed chunks</returns>
+    BLACKBONE_API size_t Trim();
+
+    /// <summary>
+    /// Get heap usage
+    /// </summary>
+    /// <returns>Heap usage</returns>
+    BLACKBONE_API inline const HeapStats& stats() const { return _stats; }
+
+    /// <summary>
+    /// Free unused chunks and forget the rest. Blocks still in use stay in target process
+    /// </summary>
+    BLACKBONE_API void reset();
+
+private:
+    /// <summary>
+    /// Reserved memory chunk
+    /// </summary>
+    struct Chunk
+    {
+        size_t carved = 0;      // Bytes given to size classes
+        size_t live = 0;        // Blocks in use
+    };
+
+    /// <summary>
+    /// Free blocks of one size class
+    /// </summary>
+    struct FreeList
+    {
+        std::vector<ptr_t> fresh;       // Never used blocks, zero-filled
+        std::vector<ptr_t> released;    // Released blocks, must be cleared before reuse
+    };
+
+    /// <summary>
+    /// Chunks with same memory protection
+    /// </summary>
+    struct Arena
+    {
+        DWORD protection = 0;
+        std::map<ptr_t, Chunk> chunks;
+        FreeList free[HEAP_CLASS_COUNT];
+    };
+
+    /// <summary>
+    /// Give new slab to size class
+    /// </summary>
+    /// <param name="arena">Arena</param>
+    /// <param name="sizeClass">Size class index</param>
+    /// <returns>true on success</returns>
+    bool Carve( Arena& arena, uint8_t sizeClass );
+
+    /// <summary>
+    /// Find chunk containing address
+    /// </summary>
+    /// <param name="arena">Arena</param>
+    /// <param name="ptr">Block address</param>
+    /// <returns>Chunk, nullptr if not found</returns>
+    Chunk* FindChunk( Arena& arena, ptr_t ptr );
+
+    RemoteHeap( const RemoteHeap& ) = delete;
+    RemoteHeap& operator =( const RemoteHeap& ) = delete;
+
+private:
+    class ProcessMemory& _memory;                               // Target process memory
+    Arena _arenas[2];                                           // Read-write and read-write-execute arenas
+    std::unordered_map<ptr_t, std::pair<uint8_t, uint8_t>> _live;   // Block address -> arena and size class
+    HeapStats _stats;                                           // Heap usage
+    CriticalSection _lock;                                      // Heap guard
+};
+
+}
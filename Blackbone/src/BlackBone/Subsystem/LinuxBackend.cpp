@@ -0,0 +1,310 @@
+#include "LinuxBackend.h"
+
+#ifdef OS_LINUX
+
+#include <sys/uio.h>
+#include <unistd.h>
+#include <errno.h>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+
+namespace blackbone
+{
+
+LinuxBackend::LinuxBackend( pid_t pid )
+    : _pid( pid )
+    , _pageSize( static_cast<uint32_t>(sysconf( _SC_PAGESIZE )) )
+    , _ptrSize( sizeof( ptr_t ) )
+{
+    // ELF class of target executable
+    std::ifstream exe( "/proc/" + std::to_string( pid ) + "/exe", std::ios::binary );
+    char ident[5] = { 0 };
+
+    if (exe.read( ident, sizeof( ident ) ) && memcmp( ident, "\x7F" "ELF", 4 ) == 0)
+        _ptrSize = ident[4] == 1 ? sizeof( uint32_t ) : sizeof( uint64_t );
+}
+
+LinuxBackend::~LinuxBackend()
+{
+}
+
+NTSTATUS LinuxBackend::Allocate( ptr_t& /*address*/, size_t /*size*/, DWORD /*allocationType*/, DWORD /*protection*/ )
+{
+    return LastNtStatus( STATUS_NOT_SUPPORTED );
+}
+
+NTSTATUS LinuxBackend::Free( ptr_t /*address*/, size_t /*size*/, DWORD /*freeType*/ )
+{
+    return LastNtStatus( STATUS_NOT_SUPPORTED );
+}
+
+NTSTATUS LinuxBackend::Protect( ptr_t /*address*/, size_t /*size*/, DWORD /*protection*/, DWORD* /*pOld*/ )
+{
+    return LastNtStatus( STATUS_NOT_SUPPORTED );
+}
+
+/// <summary>
+/// Read virtual memory
+/// </summary>
+/// <param name="address">Memory address</param>
+/// <param name="buffer">Output buffer</param>
+/// <param name="size">Number of bytes to read</param>
+/// <returns>Status code</returns>
+NTSTATUS LinuxBackend::Read( ptr_t address, void* buffer, size_t size )
+{
+    iovec local = { buffer, size };
+    iovec remote = { reinterpret_cast<void*>(address), size };
+
+    ssize_t res = process_vm_readv( _pid, &local, 1, &remote, 1, 0 );
+    if (res < 0)
+        return LastNtStatus( ErrnoToStatus( errno ) );
+
+    return LastNtStatus( static_cast<size_t>(res) == size ? STATUS_SUCCESS : STATUS_PARTIAL_COPY );
+}
+
+/// <summary>
+/// Read several memory ranges. Up to LINUX_IOV_BATCH ranges are read with a single call,
+/// transfer stops at the first unreadable range, so call is restarted right after it
+/// </summary>
+/// <param name="requests">Ranges to read. Status of every request is updated</param>
+/// <param name="gap">Unused, ranges are never merged</param>
+/// <param name="calls">Number of reads issued</param>
+/// <returns>STATUS_SUCCESS if all ranges were read, STATUS_PARTIAL_COPY if only some of them</returns>
+NTSTATUS LinuxBackend::ReadBatch( std::vector<ReadRequest>& requests, size_t /*gap*/, size_t* calls )
+{
+    size_t junk = 0;
+    if (calls == nullptr)
+        calls = &junk;
+
+    *calls = 0;
+
+    std::vector<size_t> order;
+    order.reserve( requests.size() );
+
+    for (size_t i = 0; i < requests.size(); i++)
+    {
+        requests[i].status = STATUS_SUCCESS;
+        if (requests[i].size != 0)
+            order.emplace_back( i );
+    }
+
+    std::vector<iovec> local, remote;
+    size_t failed = 0;
+
+    for (size_t first = 0; first < order.size();)
+    {
+        size_t count = std::min<size_t>( order.size() - first, LINUX_IOV_BATCH );
+        size_t last = first + count;
+
+        local.clear();
+        remote.clear();
+
+        for (size_t k = first; k < last; k++)
+        {
+            auto& req = requests[order[k]];
+            local.push_back( { req.buffer, req.size } );
+            remote.push_back( { reinterpret_cast<void*>(req.address), req.size } );
+        }
+
+        ssize_t res = process_vm_readv( _pid, local.data(), count, remote.data(), count, 0 );
+        (*calls)++;
+
+        // Nothing was read. For bad address only the first range is at fault
+        if (res < 0 && errno != EFAULT)
+        {
+            NTSTATUS status = ErrnoToStatus( errno );
+            for (size_t k = first; k < order.size(); k++)
+                requests[order[k]].status = status;
+
+            failed += order.size() - first;
+            break;
+        }
+
+        // Skip completely read ranges
+        size_t done = res > 0 ? static_cast<size_t>(res) : 0;
+        for (; first < last && done >= requests[order[first]].size; first++)
+            done -= requests[order[first]].size;
+
+        // Range transfer stopped at
+        if (first < last)
+        {
+            requests[order[first]].status = done != 0 ? STATUS_PARTIAL_COPY : STATUS_ACCESS_VIOLATION;
+            failed++;
+            first++;
+        }
+    }
+
+    if (failed == 0)
+        return LastNtStatus( STATUS_SUCCESS );
+
+    return LastNtStatus( failed == order.size() ? STATUS_UNSUCCESSFUL : STATUS_PARTIAL_COPY );
+}
+
+/// <summary>
+/// Write virtual memory. Unlike WriteProcessMemory, read-only pages can't be written
+/// </summary>
+/// <param name="address">Memory address</param>
+/// <param name="buffer">Data to write</param>
+/// <param name="size">Number of bytes to write</param>
+/// <returns>Status code</returns>
+NTSTATUS LinuxBackend::Write( ptr_t address, const void* buffer, size_t size )
+{
+    iovec local = { const_cast<void*>(buffer), size };
+    iovec remote = { reinterpret_cast<void*>(address), size };
+
+    ssize_t res = process_vm_writev( _pid, &local, 1, &remote, 1, 0 );
+    if (res < 0)
+        return LastNtStatus( ErrnoToStatus( errno ) );
+
+    return LastNtStatus( static_cast<size_t>(res) == size ? STATUS_SUCCESS : STATUS_PARTIAL_COPY );
+}
+
+/// <summary>
+/// Query virtual memory
+/// </summary>
+/// <param name="address">Address to query</param>
+/// <param name="info">Retrieved memory info</param>
+/// <returns>Status code, STATUS_INVALID_PARAMETER past the end of address space</returns>
+NTSTATUS LinuxBackend::Query( ptr_t address, PMEMORY_BASIC_INFORMATION64 info )
+{
+    if (address > maxAddr())
+        return LastNtStatus( STATUS_INVALID_PARAMETER );
+
+    std::lock_guard<std::mutex> lck( _lock );
+
+    // New region walk, maps may be outdated
+    if (!_valid || address <= _lastQuery)
+    {
+        NTSTATUS status = ParseMaps();
+        if (!NT_SUCCESS( status ))
+            return status;
+    }
+
+    _lastQuery = address;
+
+    ptr_t page = address & ~static_cast<ptr_t>(_pageSize - 1);
+    auto iter = std::upper_bound( _maps.begin(), _maps.end(), page, []( ptr_t addr, const Mapping& map ) { return addr < map.end; } );
+
+    memset( info, 0, sizeof( *info ) );
+    info->BaseAddress = page;
+
+    if (iter == _maps.end() || iter->start > page)
+    {
+        info->RegionSize = (iter != _maps.end() ? iter->start : maxAddr() + 1) - page;
+        info->State = MEM_FREE;
+        info->Protect = PAGE_NOACCESS;
+    }
+    else
+    {
+        info->AllocationBase = iter->allocBase;
+        info->AllocationProtect = iter->protect;
+        info->RegionSize = iter->end - page;
+        info->State = iter->protect != 0 ? MEM_COMMIT : MEM_RESERVE;
+        info->Protect = iter->protect;
+        info->Type = iter->type;
+    }
+
+    return LastNtStatus( STATUS_SUCCESS );
+}
+
+/// <summary>
+/// Re-read /proc/pid/maps
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS LinuxBackend::Refresh()
+{
+    std::lock_guard<std::mutex> lck( _lock );
+    return ParseMaps();
+}
+
+/// <summary>
+/// Read /proc/pid/maps. Maps lock must be held
+/// </summary>
+/// <returns>Status code</returns>
+NTSTATUS LinuxBackend::ParseMaps()
+{
+    static const DWORD protections[8] =
+    {
+        0,                          // ---
+        PAGE_READONLY,              // r--
+        PAGE_READWRITE,             // -w-
+        PAGE_READWRITE,             // rw-
+        PAGE_EXECUTE,               // --x
+        PAGE_EXECUTE_READ,          // r-x
+        PAGE_EXECUTE_READWRITE,     // -wx
+        PAGE_EXECUTE_READWRITE,     // rwx
+    };
+
+    std::ifstream maps( "/proc/" + std::to_string( _pid ) + "/maps" );
+    if (!maps)
+        return LastNtStatus( STATUS_INVALID_CID );
+
+    std::vector<Mapping> parsed;
+    std::string line, prevPath;
+
+    while (std::getline( maps, line ))
+    {
+        unsigned long long start = 0, end = 0, offset = 0, inode = 0;
+        char perms[5] = { 0 };
+        int pathPos = 0;
+
+        if (sscanf( line.c_str(), "%llx-%llx %4s %llx %*x:%*x %llu %n", &start, &end, perms, &offset, &inode, &pathPos ) < 5)
+            continue;
+
+        Mapping map;
+        map.start = start;
+        map.end = end;
+        map.allocBase = start;
+        map.protect = protections[(perms[0] == 'r' ? 1 : 0) | (perms[1] == 'w' ? 2 : 0) | (perms[2] == 'x' ? 4 : 0)];
+
+        std::string path = pathPos > 0 ? line.substr( pathPos ) : std::string();
+        if (inode != 0)
+        {
+            map.type = perms[3] == 's' ? MEM_MAPPED : MEM_IMAGE;
+
+            // Segments of the same file form one allocation, like image sections
+            if (!parsed.empty() && path == prevPath && parsed.back().end == start)
+                map.allocBase = parsed.back().allocBase;
+        }
+
+        prevPath = inode != 0 ? path : std::string();
+        parsed.emplace_back( map );
+    }
+
+    _maps.swap( parsed );
+    _valid = true;
+
+    return LastNtStatus( STATUS_SUCCESS );
+}
+
+/// <summary>
+/// Translate errno of failed transfer
+/// </summary>
+/// <param name="err">errno value</param>
+/// <returns>Status code</returns>
+NTSTATUS LinuxBackend::ErrnoToStatus( int err )
+{
+    switch (err)
+    {
+        case EFAULT:
+            return STATUS_ACCESS_VIOLATION;
+
+        case EPERM:
+            return STATUS_ACCESS_DENIED;
+
+        case ESRCH:
+            return STATUS_INVALID_CID;
+
+        case ENOMEM:
+            return STATUS_NO_MEMORY;
+
+        default:
+            return STATUS_UNSUCCESSFUL;
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "../Config.h"
+
+#ifdef OS_LINUX
+
+#include "MemoryBackend.h"
+
+#include <sys/types.h>
+#include <vector>
+#include <string>
+#include <mutex>
+
+namespace blackbone
+{
+
+#define LINUX_IOV_BATCH 1024    // Max ranges per process_vm_readv call, IOV_MAX
+
+/// <summary>
+/// Linux process backend. Memory is accessed with process_vm_readv/process_vm_writev,
+/// regions are taken from /proc/pid/maps and reported in Windows terms:
+/// PROT_NONE mappings are reserved, file mappings are MEM_IMAGE (private) or MEM_MAPPED (shared).
+/// Allocation and protection changes require code execution in target and aren't supported
+/// </summary>
+class LinuxBackend : public MemoryBackend
+{
+public:
+    BLACKBONE_API LinuxBackend( pid_t pid );
+    BLACKBONE_API ~LinuxBackend();
+
+    virtual NTSTATUS Allocate( ptr_t& address, size_t size, DWORD allocationType, DWORD protection );
+    virtual NTSTATUS Free( ptr_t address, size_t size, DWORD freeType );
+    virtual NTSTATUS Protect( ptr_t address, size_t size, DWORD protection, DWORD* pOld );
+    virtual NTSTATUS Read( ptr_t address, void* buffer, size_t size );
+    virtual NTSTATUS ReadBatch( std::vector<ReadRequest>& requests, size_t gap, size_t* calls );
+    virtual NTSTATUS Write( ptr_t address, const void* buffer, size_t size );
+    virtual NTSTATUS Query( ptr_t address, PMEMORY_BASIC_INFORMATION64 info );
+
+    virtual ptr_t minAddr() const { return 0x10000; }
+    virtual ptr_t maxAddr() const { return _ptrSize == sizeof( uint32_t ) ? 0xFFFFEFFF : 0x7FFFFFFFEFFF; }
+    virtual uint32_t pageSize() const { return _pageSize; }
+    virtual uint32_t ptrSize() const { return _ptrSize; }
+
+    /// <summary>
+    /// Re-read /proc/pid/maps
+    /// </summary>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Refresh();
+
+    BLACKBONE_API inline pid_t pid() const { return _pid; }
+
+private:
+    /// <summary>
+    /// Read /proc/pid/maps. Maps lock must be held
+    /// </summary>
+    /// <returns>Status code</returns>
+    NTSTATUS ParseMaps();
+
+    /// <summary>
+    /// Single /proc/pid/maps entry
+    /// </summary>
+    struct Mapping
+    {
+        ptr_t start = 0;            // Mapping start
+        ptr_t end = 0;              // Mapping end
+        ptr_t allocBase = 0;        // First mapping of the same file, or start
+        DWORD protect = 0;          // Protection, 0 for PROT_NONE
+        DWORD type = MEM_PRIVATE;   // Region type
+    };
+
+    /// <summary>
+    /// Translate errno of failed transfer
+    /// </summary>
+    /// <param name="err">errno value</param>
+    /// <returns>Status code</returns>
+    static NTSTATUS ErrnoToStatus( int err );
+
+    LinuxBackend( const LinuxBackend& ) = delete;
+    LinuxBackend& operator =( const LinuxBackend& ) = delete;
+
+private:
+    pid_t _pid;                     // Target process
+    uint32_t _pageSize;             // Page size
+    uint32_t _ptrSize;              // Pointer size, taken from target ELF class
+    std::vector<Mapping> _maps;     // Parsed mappings, sorted by address
+    ptr_t _lastQuery = 0;           // Last queried address. Maps are re-read when query doesn't continue ascending walk
+    bool _valid = false;            // Maps were read
+    std::mutex _lock;               // Maps guard
+};
+
+}
+
+#endif
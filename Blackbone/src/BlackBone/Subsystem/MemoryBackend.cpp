@@ -0,0 +1,42 @@
+#include "MemoryBackend.h"
+
+namespace blackbone
+{
+
+/// <summary>
+/// Read several memory ranges. Default implementation reads every range separately
+/// </summary>
+/// <param name="requests">Ranges to read. Status of every request is updated</param>
+/// <param name="gap">Max distance between ranges that may be merged into one read</param>
+/// <param name="calls">Number of reads issued</param>
+/// <returns>STATUS_SUCCESS if all ranges were read, STATUS_PARTIAL_COPY if only some of them</returns>
+NTSTATUS MemoryBackend::ReadBatch( std::vector<ReadRequest>& requests, size_t /*gap*/, size_t* calls )
+{
+    size_t junk = 0;
+    if (calls == nullptr)
+        calls = &junk;
+
+    *calls = 0;
+
+    size_t total = 0, failed = 0;
+    for (auto& req : requests)
+    {
+        req.status = STATUS_SUCCESS;
+        if (req.size == 0)
+            continue;
+
+        req.status = Read( req.address, req.buffer, req.size );
+        (*calls)++;
+        total++;
+
+        if (!NT_SUCCESS( req.status ))
+            failed++;
+    }
+
+    if (failed == 0)
+        return LastNtStatus( STATUS_SUCCESS );
+
+    return LastNtStatus( failed == total ? STATUS_UNSUCCESSFUL : STATUS_PARTIAL_COPY );
+}
+
+}
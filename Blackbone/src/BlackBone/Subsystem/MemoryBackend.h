@@ -0,0 +1,109 @@
+#pragma once
+
+#include "../Include/BackendTypes.h"
+
+#include <vector>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Address space access used by ProcessMemory.
+/// Default backend forwards to process subsystem, others allow to run memory routines
+/// against synthetic or non-Windows address spaces
+/// </summary>
+class MemoryBackend
+{
+public:
+    BLACKBONE_API virtual ~MemoryBackend() { }
+
+    /// <summary>
+    /// Allocate virtual memory
+    /// </summary>
+    /// <param name="address">Desired allocation address. Updated with actual address</param>
+    /// <param name="size">Region size</param>
+    /// <param name="allocationType">Allocation type</param>
+    /// <param name="protection">Memory protection</param>
+    /// <returns>Status code</returns>
+    virtual NTSTATUS Allocate( ptr_t& address, size_t size, DWORD allocationType, DWORD protection ) = 0;
+
+    /// <summary>
+    /// Free virtual memory
+    /// </summary>
+    /// <param name="address">Memory address</param>
+    /// <param name="size">Region size</param>
+    /// <param name="freeType">Release/decommit</param>
+    /// <returns>Status code</returns>
+    virtual NTSTATUS Free( ptr_t address, size_t size, DWORD freeType ) = 0;
+
+    /// <summary>
+    /// Change memory protection
+    /// </summary>
+    /// <param name="address">Memory address</param>
+    /// <param name="size">Region size</param>
+    /// <param name="protection">New protection</param>
+    /// <param name="pOld">Old protection</param>
+    /// <returns>Status code</returns>
+    virtual NTSTATUS Protect( ptr_t address, size_t size, DWORD protection, DWORD* pOld ) = 0;
+
+    /// <summary>
+    /// Read virtual memory
+    /// </summary>
+    /// <param name="address">Memory address</param>
+    /// <param name="buffer">Output buffer</param>
+    /// <param name="size">Number of bytes to read</param>
+    /// <returns>Status code</returns>
+    virtual NTSTATUS Read( ptr_t address, void* buffer, size_t size ) = 0;
+
+    /// <summary>
+    /// Read several memory ranges. Default implementation reads every range separately
+    /// </summary>
+    /// <param name="requests">Ranges to read. Status of every request is updated</param>
+    /// <param name="gap">Max distance between ranges that may be merged into one read</param>
+    /// <param name="calls">Number of reads issued</param>
+    /// <returns>STATUS_SUCCESS if all ranges were read, STATUS_PARTIAL_COPY if only some of them</returns>
+    virtual NTSTATUS ReadBatch( std::vector<ReadRequest>& requests, size_t gap, size_t* calls );
+
+    /// <summary>
+    /// Write virtual memory
+    /// </summary>
+    /// <param name="address">Memory address</param>
+    /// <param name="buffer">Data to write</param>
+    /// <param name="size">Number of bytes to write</param>
+    /// <returns>Status code</returns>
+    virtual NTSTATUS Write( ptr_t address, const void* buffer, size_t size ) = 0;
+
+    /// <summary>
+    /// Query virtual memory
+    /// </summary>
+    /// <param name="address">Address to query</param>
+    /// <param name="info">Retrieved memory info</param>
+    /// <returns>Status code, STATUS_INVALID_PARAMETER past the end of address space</returns>
+    virtual NTSTATUS Query( ptr_t address, PMEMORY_BASIC_INFORMATION64 info ) = 0;
+
+    /// <summary>
+    /// Lowest user-mode address
+    /// </summary>
+    /// <returns>Address</returns>
+    virtual ptr_t minAddr() const = 0;
+
+    /// <summary>
+    /// Highest user-mode address
+    /// </summary>
+    /// <returns>Address</returns>
+    virtual ptr_t maxAddr() const = 0;
+
+    /// <summary>
+    /// Page size
+    /// </summary>
+    /// <returns>Page size</returns>
+    virtual uint32_t pageSize() const = 0;
+
+    /// <summary>
+    /// Size of pointer in target address space
+    /// </summary>
+    /// <returns>Pointer size</returns>
+    virtual uint32_t ptrSize() const = 0;
+};
+
+}
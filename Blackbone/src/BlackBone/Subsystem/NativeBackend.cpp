@@ -0,0 +1,71 @@
+#include "NativeBackend.h"
+#include "../Process/ProcessCore.h"
+
+namespace blackbone
+{
+
+NativeBackend::NativeBackend( ProcessCore& core )
+    : _core( core )
+{
+}
+
+NativeBackend::~NativeBackend()
+{
+}
+
+NTSTATUS NativeBackend::Allocate( ptr_t& address, size_t size, DWORD allocationType, DWORD protection )
+{
+    return _core.native()->VirtualAllocExT( address, size, allocationType, protection );
+}
+
+NTSTATUS NativeBackend::Free( ptr_t address, size_t size, DWORD freeType )
+{
+    return _core.native()->VirtualFreeExT( address, size, freeType );
+}
+
+NTSTATUS NativeBackend::Protect( ptr_t address, size_t size, DWORD protection, DWORD* pOld )
+{
+    return _core.native()->VirtualProtectExT( address, size, protection, pOld );
+}
+
+NTSTATUS NativeBackend::Read( ptr_t address, void* buffer, size_t size )
+{
+    return _core.native()->ReadProcessMemoryT( address, buffer, size );
+}
+
+NTSTATUS NativeBackend::ReadBatch( std::vector<ReadRequest>& requests, size_t gap, size_t* calls )
+{
+    return _core.native()->ReadBatchT( requests, gap, calls );
+}
+
+NTSTATUS NativeBackend::Write( ptr_t address, const void* buffer, size_t size )
+{
+    return _core.native()->WriteProcessMemoryT( address, buffer, size );
+}
+
+NTSTATUS NativeBackend::Query( ptr_t address, PMEMORY_BASIC_INFORMATION64 info )
+{
+    return _core.native()->VirtualQueryExT( address, info );
+}
+
+ptr_t NativeBackend::minAddr() const
+{
+    return _core.native()->minAddr();
+}
+
+ptr_t NativeBackend::maxAddr() const
+{
+    return _core.native()->maxAddr();
+}
+
+uint32_t NativeBackend::pageSize() const
+{
+    return _core.native()->pageSize();
+}
+
+uint32_t NativeBackend::ptrSize() const
+{
+    return _core.native()->GetWow64Barrier().targetWow64 ? sizeof( uint32_t ) : sizeof( ptr_t );
+}
+
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include "MemoryBackend.h"
+
+namespace blackbone
+{
+
+/// <summary>
+/// Process subsystem backend. Forwards to Native of the process core,
+/// so backend stays valid when process is re-attached
+/// </summary>
+class NativeBackend : public MemoryBackend
+{
+public:
+    BLACKBONE_API NativeBackend( class ProcessCore& core );
+    BLACKBONE_API ~NativeBackend();
+
+    virtual NTSTATUS Allocate( ptr_t& address, size_t size, DWORD allocationType, DWORD protection );
+    virtual NTSTATUS Free( ptr_t address, size_t size, DWORD freeType );
+    virtual NTSTATUS Protect( ptr_t address, size_t size, DWORD protection, DWORD* pOld );
+    virtual NTSTATUS Read( ptr_t address, void* buffer, size_t size );
+    virtual NTSTATUS ReadBatch( std::vector<ReadRequest>& requests, size_t gap, size_t* calls );
+    virtual NTSTATUS Write( ptr_t address, const void* buffer, size_t size );
+    virtual NTSTATUS Query( ptr_t address, PMEMORY_BASIC_INFORMATION64 info );
+
+    virtual ptr_t minAddr() const;
+    virtual ptr_t maxAddr() const;
+    virtual uint32_t pageSize() const;
+    virtual uint32_t ptrSize() const;
+
+private:
+    NativeBackend( const NativeBackend& ) = delete;
+    NativeBackend& operator =( const NativeBackend& ) = delete;
+
+private:
+    class ProcessCore& _core;   // Process core
+};
+
+}
@@ -4,6 +4,7 @@
 #include "../Include/Macro.h"
 
 #include <type_traits>
+#include <algorithm>
 #include <Psapi.h>
 
 namespace blackbone
@@ -154,6 +155,96 @@ NTSTATUS Native::ReadProcessMemoryT( ptr_t lpBaseAddress, LPVOID lpBuffer, size_
     return LastNtStatus();
 }
 
+/// <summary>
+/// Read several memory ranges. Ranges closer than gap bytes are merged into single read.
+/// Reads go through ReadProcessMemoryT, so every subsystem gets batching for free
+/// </summary>
+/// <param name="requests">Ranges to read. Status of every request is updated</param>
+/// <param name="gap">Max distance between ranges that are still merged</param>
+/// <param name="calls">Number of native reads issued</param>
+/// <returns>STATUS_SUCCESS if all ranges were read, STATUS_PARTIAL_COPY if only some of them</returns>
+NTSTATUS Native::ReadBatchT( std::vector<ReadRequest>& requests, size_t gap /*= 0x1000*/, size_t* calls /*= nullptr*/ )
+{
+    size_t junk = 0;
+    if (calls == nullptr)
+        calls = &junk;
+
+    *calls = 0;
+
+    std::vector<size_t> order;
+    order.reserve( requests.size() );
+
+    for (size_t i = 0; i < requests.size(); i++)
+    {
+        requests[i].status = STATUS_SUCCESS;
+        if (requests[i].size != 0)
+            order.emplace_back( i );
+    }
+
+    std::sort( order.begin(), order.end(), [&requests]( size_t l, size_t r ) { return requests[l].address < requests[r].address; } );
+
+    std::vector<uint8_t> buf;
+    size_t failed = 0;
+
+    for (size_t first = 0; first < order.size();)
+    {
+        ptr_t start = requests[order[first]].address;
+        ptr_t end = start + requests[order[first]].size;
+        size_t last = first + 1;
+
+        // Grow group while next range is close enough
+        for (; last < order.size(); last++)
+        {
+            auto& req = requests[order[last]];
+            ptr_t reqEnd = std::max<ptr_t>( end, req.address + req.size );
+
+            if (req.address > end + gap || reqEnd - start > READ_BATCH_MAX_SPAN)
+                break;
+
+            end = reqEnd;
+        }
+
+        // Single range goes straight into caller buffer
+        if (last - first == 1)
+        {
+            auto& req = requests[order[first]];
+            req.status = ReadProcessMemoryT( req.address, req.buffer, req.size );
+            (*calls)++;
+        }
+        else
+        {
+            buf.resize( static_cast<size_t>(end - start) );
+            NTSTATUS status = ReadProcessMemoryT( start, buf.data(), buf.size() );
+            (*calls)++;
+
+            for (size_t k = first; k < last; k++)
+            {
+                auto& req = requests[order[k]];
+
+                // Gap between ranges may be unreadable, retry separately
+                if (NT_SUCCESS( status ))
+                    memcpy( req.buffer, buf.data() + (req.address - start), req.size );
+                else
+                {
+                    req.status = ReadProcessMemoryT( req.address, req.buffer, req.size );
+                    (*calls)++;
+                }
+            }
+        }
+
+        for (size_t k = first; k < last; k++)
+            if (!NT_SUCCESS( requests[order[k]].status ))
+                failed++;
+
+        first = last;
+    }
+
+    if (failed == 0)
+        return LastNtStatus( STATUS_SUCCESS );
+
+    return LastNtStatus( failed == order.size() ? STATUS_UNSUCCESSFUL : STATUS_PARTIAL_COPY );
+}
+
 /// <summary>
 /// Write virtual memory
 /// </summary>
@@ -416,6 +507,65 @@ size_t Native::EnumRegions( std::list<MEMORY_BASIC_INFORMATION64>& results, bool
     return results.size();
 }
 
+/// <summary>
+/// Read memory through page cache. Missing pages are read in bulk,
+/// unreadable ones are skipped in favor of a direct read
+/// </summary>
+/// <param name="cache">Page cache</param>
+/// <param name="address">Memory address</param>
+/// <param name="buffer">Output buffer</param>
+/// <param name="size">Number of bytes to read</param>
+/// <returns>Status code</returns>
+NTSTATUS Native::ReadCached( PageCache& cache, ptr_t address, void* buffer, size_t size )
+{
+    uint8_t* out = reinterpret_cast<uint8_t*>(buffer);
+
+    while (size > 0)
+    {
+        ptr_t page = address & ~static_cast<ptr_t>(_pageSize - 1);
+        auto iter = cache.pages.find( page );
+
+        // Fetch several pages at once, heap entries are usually close to each other
+        if (iter == cache.pages.end())
+        {
+            std::vector<uint8_t> bulk( LDR_PREFETCH_PAGES * static_cast<size_t>(_pageSize) );
+            if (NT_SUCCESS( ReadProcessMemoryT( page, bulk.data(), bulk.size(), 0 ) ))
+            {
+                for (size_t i = 0; i < LDR_PREFETCH_PAGES; i++)
+                {
+                    auto start = bulk.begin() + i * _pageSize;
+                    cache.pages.emplace( page + i * _pageSize, std::vector<uint8_t>( start, start + _pageSize ) );
+                }
+            }
+            else
+            {
+                // Bulk read crossed into an invalid page, read just this one
+                std::vector<uint8_t> single( _pageSize );
+                if (!NT_SUCCESS( ReadProcessMemoryT( page, single.data(), single.size(), 0 ) ))
+                    single.clear();
+
+                cache.pages.emplace( page, std::move( single ) );
+            }
+
+            iter = cache.pages.find( page );
+        }
+
+        // Unreadable page, let direct read sort it out
+        if (iter->second.empty())
+            return ReadProcessMemoryT( address, out, size, 0 );
+
+        size_t offset = static_cast<size_t>(address - page);
+        size_t chunk = std::min<size_t>( size, _pageSize - offset );
+        memcpy( out, iter->second.data() + offset, chunk );
+
+        out += chunk;
+        address += chunk;
+        size -= chunk;
+    }
+
+    return STATUS_SUCCESS;
+}
+
 /// <summary>
 /// Enumerate process modules
 /// </summary>
@@ -431,31 +581,140 @@ size_t Native::EnumModulesT( Native::listModules& result )
 
     if (getPEB( &peb ) != 0 && ReadProcessMemoryT( peb.Ldr, &ldr, sizeof(ldr), 0 ) == STATUS_SUCCESS)
     {
-        for (T head = ldr.InLoadOrderModuleList.Flink;
-              head != (peb.Ldr + FIELD_OFFSET( _PEB_LDR_DATA2<T>, InLoadOrderModuleList ));
-              ReadProcessMemoryT( static_cast<ptr_t>(head), &head, sizeof(head), 0 ))
+        // Loader entries and their names share a few heap pages
+        PageCache cache;
+        T listHead = static_cast<T>(peb.Ldr + FIELD_OFFSET( _PEB_LDR_DATA2<T>, InLoadOrderModuleList ));
+
+        for (T head = ldr.InLoadOrderModuleList.Flink; head != listHead && head != 0;)
         {
-            ModuleData data;
-            wchar_t localPath[512] = { 0 };
             _LDR_DATA_TABLE_ENTRY_BASE<T> localdata = { { 0 } };
+            if (!NT_SUCCESS( ReadCached( cache, head, &localdata, sizeof( localdata ) ) ))
+                break;
 
-            ReadProcessMemoryT( head, &localdata, sizeof(localdata), 0 );
-            ReadProcessMemoryT( localdata.FullDllName.Buffer, localPath, localdata.FullDllName.Length, 0 );
+            result.emplace_back();
+            ReadLdrModule( cache, head, localdata, result.back() );
 
-            data.baseAddress = localdata.DllBase;
-            data.size = localdata.SizeOfImage;
-            data.fullPath = Utils::ToLower( localPath );
-            data.name = Utils::StripPath( data.fullPath );
-            data.manual = false;
-            data.type = std::is_same<T, DWORD>::value ? mt_mod32 : mt_mod64;
+            // Loop guard
+            if (result.size() > 0x10000)
+                break;
 
-            result.emplace_back( data );
+            head = localdata.InLoadOrderLinks.Flink;
         }
     }
 
     return result.size();
 }
 
+/// <summary>
+/// Update loader list state
+/// </summary>
+/// <param name="state">Loader list state from previous call</param>
+/// <param name="added">Modules loaded since previous call</param>
+/// <param name="removed">Modules unloaded since previous call</param>
+/// <returns>Status code</returns>
+template<typename T>
+NTSTATUS Native::RefreshModulesT( LdrListState& state, listModules& added, listModules& removed )
+{
+    typename _PEB_T2<T>::type peb = { { { 0 } } };
+    _PEB_LDR_DATA2<T> ldr = { 0 };
+
+    added.clear();
+    removed.clear();
+
+    if (getPEB( &peb ) == 0)
+        return STATUS_NOT_FOUND;
+
+    NTSTATUS status = ReadProcessMemoryT( peb.Ldr, &ldr, sizeof( ldr ), 0 );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    T listHead = static_cast<T>(peb.Ldr + FIELD_OFFSET( _PEB_LDR_DATA2<T>, InLoadOrderModuleList ));
+
+    // Unload from the middle of the list leaves head links and tail entry intact, so list is always walked.
+    // Entries share a few heap pages, walk costs a handful of reads
+    PageCache cache;
+    std::map<ptr_t, ModuleData> entries;
+
+    for (T head = ldr.InLoadOrderModuleList.Flink; head != listHead && head != 0;)
+    {
+        _LDR_DATA_TABLE_ENTRY_BASE<T> localdata = { { 0 } };
+        if (!NT_SUCCESS( ReadCached( cache, head, &localdata, sizeof( localdata ) ) ))
+            break;
+
+        // Known entry, name is already decoded
+        auto iter = state.entries.find( head );
+        if (iter != state.entries.end() &&
+             iter->second.baseAddress == localdata.DllBase &&
+             iter->second.size == localdata.SizeOfImage)
+        {
+            entries.emplace( std::move( *iter ) );
+            state.entries.erase( iter );
+        }
+        else
+        {
+            ModuleData data;
+            ReadLdrModule( cache, head, localdata, data );
+
+            added.emplace_back( data );
+            entries.emplace( head, std::move( data ) );
+        }
+
+        // Loop guard
+        if (entries.size() > 0x10000)
+            break;
+
+        head = localdata.InLoadOrderLinks.Flink;
+    }
+
+    // Whatever wasn't visited is gone
+    for (auto& entry : state.entries)
+        removed.emplace_back( std::move( entry.second ) );
+
+    state.entries = std::move( entries );
+    state.valid = true;
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Fill module data from loader entry
+/// </summary>
+/// <param name="cache">Page cache</param>
+/// <param name="entry">Loader entry address</param>
+/// <param name="localdata">Loader entry</param>
+/// <param name="data">Module data</param>
+template<typename T>
+void Native::ReadLdrModule( PageCache& cache, T entry, const _LDR_DATA_TABLE_ENTRY_BASE<T>& localdata, ModuleData& data )
+{
+    // Decode path in place, same result as ToLower + StripPath
+    size_t length = std::min<size_t>( localdata.FullDllName.Length / sizeof( wchar_t ), 511 );
+    cache.arena.assign( length + 1, 0 );
+
+    if (!NT_SUCCESS( ReadCached( cache, localdata.FullDllName.Buffer, cache.arena.data(), length * sizeof( wchar_t ) ) ))
+        length = 0;
+
+    wchar_t* path = cache.arena.data();
+    length = std::find( path, path + length, L'\0' ) - path;
+    std::transform( path, path + length, path, ::tolower );
+
+    size_t nameStart = 0;
+    for (size_t i = length; i > 0 && nameStart == 0; i--)
+        if (path[i - 1] == L'\\')
+            nameStart = i;
+
+    for (size_t i = length; i > 0 && nameStart == 0; i--)
+        if (path[i - 1] == L'/')
+            nameStart = i;
+
+    data.baseAddress = localdata.DllBase;
+    data.size = localdata.SizeOfImage;
+    data.fullPath.assign( path, length );
+    data.name.assign( path + nameStart, length - nameStart );
+    data.manual = false;
+    data.type = std::is_same<T, DWORD>::value ? mt_mod32 : mt_mod64;
+    data.ldrEntry = entry;
+}
+
 /// <summary>
 /// Enum process section objects
 /// </summary>
@@ -672,5 +931,62 @@ size_t Native::EnumModules( listModules& result, eModSeachType search/*= LdrList
     return 0;
 }
 
+/// <summary>
+/// Update loader list state. List is walked through a page cache,
+/// and full entry data is read only for new entries
+/// </summary>
+/// <param name="state">Loader list state from previous call</param>
+/// <param name="added">Modules loaded since previous call</param>
+/// <param name="removed">Modules unloaded since previous call</param>
+/// <param name="mtype">Module type: x86 or x64</param>
+/// <returns>Status code</returns>
+NTSTATUS Native::RefreshModules( LdrListState& state, listModules& added, listModules& removed, eModType mtype /*= mt_default*/ )
+{
+    // Detect module type
+    if (mtype == mt_default)
+        mtype = _wowBarrier.targetWow64 ? mt_mod32 : mt_mod64;
+
+    return (mtype == mt_mod32) ? RefreshModulesT<DWORD>( state, added, removed ) : RefreshModulesT<DWORD64>( state, added, removed );
+}
+
+/// <summary>
+/// Check if module loader entry is still linked and describes same image
+/// </summary>
+/// <param name="mod">Module enumerated from loader list</param>
+/// <returns>true if entry is unchanged</returns>
+bool Native::ValidateLdrEntry( const ModuleData& mod )
+{
+    if (mod.ldrEntry == 0)
+        return false;
+
+    return (mod.type == mt_mod32) ? ValidateLdrEntryT<DWORD>( mod ) : ValidateLdrEntryT<DWORD64>( mod );
+}
+
+/// <summary>
+/// Check if module loader entry is still linked and describes same image
+/// </summary>
+/// <param name="mod">Module enumerated from loader list</param>
+/// <returns>true if entry is unchanged</returns>
+template<typename T>
+bool Native::ValidateLdrEntryT( const ModuleData& mod )
+{
+    _LDR_DATA_TABLE_ENTRY_BASE<T> localdata = { { 0 } };
+    T entry = static_cast<T>(mod.ldrEntry);
+    T flinkBlink = 0, blinkFlink = 0;
+
+    if (!NT_SUCCESS( ReadProcessMemoryT( entry, &localdata, sizeof( localdata ), 0 ) ))
+        return false;
+
+    if (localdata.DllBase != mod.baseAddress || localdata.SizeOfImage != mod.size)
+        return false;
+
+    // Unlinked entry keeps pointing to its former neighbours, but they don't point back.
+    // Freed entry may still hold old values, so neighbour links are checked too
+    if (!NT_SUCCESS( ReadProcessMemoryT( localdata.InLoadOrderLinks.Flink + FIELD_OFFSET( _LIST_ENTRY_T<T>, Blink ), &flinkBlink, sizeof( flinkBlink ), 0 ) ) ||
+        !NT_SUCCESS( ReadProcessMemoryT( localdata.InLoadOrderLinks.Blink + FIELD_OFFSET( _LIST_ENTRY_T<T>, Flink ), &blinkFlink, sizeof( blinkFlink ), 0 ) ))
+        return false;
+
+    return flinkBlink == entry && blinkFlink == entry;
+}
 
 }
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include <string>
 #include <list>
 #include <vector>
+#include <map>
 #include <unordered_set>
 #include <cassert>
 
@@ -24,6 +25,18 @@ enum CreateThreadFlags
 
 ENUM_OPS(CreateThreadFlags)
 
+/// <summary>
+/// Loader list state for incremental module enumeration
+/// </summary>
+struct LdrListState
+{
+    bool valid = false;                     // State was filled at least once
+    std::map<ptr_t, ModuleData> entries;    // Loader entry address -> module
+};
+
+#define LDR_PREFETCH_PAGES  4           // Pages read at once during loader list walk
+#define READ_BATCH_MAX_SPAN 0x100000    // Largest merged range in batched read
+
 class Native
 {
 public:
@@ -74,6 +87,16 @@ public:
     /// <returns>Status code</returns>
     virtual NTSTATUS ReadProcessMemoryT( ptr_t lpBaseAddress, LPVOID lpBuffer, size_t nSize, DWORD64 *lpBytes = nullptr );
 
+    /// <summary>
+    /// Read several memory ranges. Ranges closer than gap bytes are merged into single read.
+    /// Reads go through ReadProcessMemoryT, so every subsystem gets batching for free
+    /// </summary>
+    /// <param name="requests">Ranges to read. Status of every request is updated</param>
+    /// <param name="gap">Max distance between ranges that are still merged</param>
+    /// <param name="calls">Number of native reads issued</param>
+    /// <returns>STATUS_SUCCESS if all ranges were read, STATUS_PARTIAL_COPY if only some of them</returns>
+    virtual NTSTATUS ReadBatchT( std::vector<ReadRequest>& requests, size_t gap = 0x1000, size_t* calls = nullptr );
+
     /// <summary>
     /// Write virtual memory
     /// </summary>
@@ -205,6 +228,24 @@ public:
     /// <returns>Module count</returns>
     BLACKBONE_API size_t EnumModules( listModules& result, eModSeachType search = LdrList, eModType mtype = mt_default );
 
+    /// <summary>
+    /// Update loader list state. List is walked through a page cache,
+    /// and full entry data is read only for new entries
+    /// </summary>
+    /// <param name="state">Loader list state from previous call</param>
+    /// <param name="added">Modules loaded since previous call</param>
+    /// <param name="removed">Modules unloaded since previous call</param>
+    /// <param name="mtype">Module type: x86 or x64</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS RefreshModules( LdrListState& state, listModules& added, listModules& removed, eModType mtype = mt_default );
+
+    /// <summary>
+    /// Check if module loader entry is still present and describes same image
+    /// </summary>
+    /// <param name="mod">Module enumerated from loader list</param>
+    /// <returns>true if entry is unchanged</returns>
+    BLACKBONE_API bool ValidateLdrEntry( const ModuleData& mod );
+
     /// <summary>
     /// Get lowest possible valid address value
     /// </summary>
@@ -223,6 +264,25 @@ public:
     /// <returns>Address value</returns>
     BLACKBONE_API inline uint32_t pageSize() const { return _pageSize; }
 private:
+    /// <summary>
+    /// Local copy of remote pages touched during loader list walk
+    /// </summary>
+    struct PageCache
+    {
+        std::map<ptr_t, std::vector<uint8_t>> pages;    // Page base -> contents, empty if page is unreadable
+        std::vector<wchar_t> arena;                     // Module path decode buffer
+    };
+
+    /// <summary>
+    /// Read memory through page cache. Missing pages are read in bulk,
+    /// unreadable ones are skipped in favor of a direct read
+    /// </summary>
+    /// <param name="cache">Page cache</param>
+    /// <param name="address">Memory address</param>
+    /// <param name="buffer">Output buffer</param>
+    /// <param name="size">Number of bytes to read</param>
+    /// <returns>Status code</returns>
+    NTSTATUS ReadCached( PageCache& cache, ptr_t address, void* buffer, size_t size );
 
     /// <summary>
     /// Enumerate process modules
@@ -232,6 +292,34 @@ private:
     template<typename T>
     size_t EnumModulesT( Native::listModules& result );
 
+    /// <summary>
+    /// Update loader list state
+    /// </summary>
+    /// <param name="state">Loader list state from previous call</param>
+    /// <param name="added">Modules loaded since previous call</param>
+    /// <param name="removed">Modules unloaded since previous call</param>
+    /// <returns>Status code</returns>
+    template<typename T>
+    NTSTATUS RefreshModulesT( LdrListState& state, listModules& added, listModules& removed );
+
+    /// <summary>
+    /// Fill module data from loader entry
+    /// </summary>
+    /// <param name="cache">Page cache</param>
+    /// <param name="entry">Loader entry address</param>
+    /// <param name="localdata">Loader entry</param>
+    /// <param name="data">Module data</param>
+    template<typename T>
+    void ReadLdrModule( PageCache& cache, T entry, const _LDR_DATA_TABLE_ENTRY_BASE<T>& localdata, ModuleData& data );
+
+    /// <summary>
+    /// Check if module loader entry is still linked and describes same image
+    /// </summary>
+    /// <param name="mod">Module enumerated from loader list</param>
+    /// <returns>true if entry is unchanged</returns>
+    template<typename T>
+    bool ValidateLdrEntryT( const ModuleData& mod );
+
     /// <summary>
     /// Enum process section objects
     /// </summary>
@@ -0,0 +1,460 @@
+#include "SyntheticBackend.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace blackbone
+{
+
+/// <summary>
+/// Create empty address space
+/// </summary>
+/// <param name="ptrSize">Pointer size of emulated target</param>
+/// <param name="pageSize">Page size</param>
+SyntheticBackend::SyntheticBackend( uint32_t ptrSize /*= sizeof( ptr_t )*/, uint32_t pageSize /*= 0x1000*/ )
+    : _ptrSize( ptrSize )
+    , _pageSize( pageSize )
+{
+}
+
+SyntheticBackend::~SyntheticBackend()
+{
+}
+
+/// <summary>
+/// Allocate virtual memory. Committing pages inside existing allocation is supported
+/// </summary>
+/// <param name="address">Desired allocation address. Updated with actual address</param>
+/// <param name="size">Region size</param>
+/// <param name="allocationType">MEM_RESERVE and/or MEM_COMMIT</param>
+/// <param name="protection">Memory protection</param>
+/// <returns>Status code</returns>
+NTSTATUS SyntheticBackend::Allocate( ptr_t& address, size_t size, DWORD allocationType, DWORD protection )
+{
+    if (size == 0)
+        return LastNtStatus( STATUS_INVALID_PARAMETER );
+
+    std::lock_guard<std::recursive_mutex> lck( _lock );
+
+    ptr_t pageMask = _pageSize - 1;
+    bool commit = (allocationType & MEM_COMMIT) != 0;
+
+    // Commit pages of existing allocation
+    if (address != 0 && Find( address ) != _regions.end())
+    {
+        if (!commit)
+            return LastNtStatus( STATUS_CONFLICTING_ADDRESSES );
+
+        ptr_t start = address & ~pageMask;
+        ptr_t end = (address + size + pageMask) & ~pageMask;
+        mapRegions::iterator first, last;
+
+        NTSTATUS status = Isolate( start, static_cast<size_t>(end - start), first, last );
+        if (!NT_SUCCESS( status ))
+            return LastNtStatus( status );
+
+        for (; first != last; ++first)
+        {
+            auto& reg = first->second;
+            if (reg.state != MEM_COMMIT)
+            {
+                reg.state = MEM_COMMIT;
+                reg.data.assign( reg.size, 0 );
+            }
+
+            reg.protect = protection;
+        }
+
+        address = start;
+        return LastNtStatus( STATUS_SUCCESS );
+    }
+
+    ptr_t base = address & ~static_cast<ptr_t>(SYNTHETIC_GRANULARITY - 1);
+    ptr_t end = (address + size + pageMask) & ~pageMask;
+
+    if (address != 0)
+    {
+        auto next = _regions.lower_bound( base );
+        if (Find( base ) != _regions.end() || (next != _regions.end() && next->first < end))
+            return LastNtStatus( STATUS_CONFLICTING_ADDRESSES );
+
+        if (base < minAddr() || end > maxAddr() + 1)
+            return LastNtStatus( STATUS_INVALID_PARAMETER );
+    }
+    else
+    {
+        base = FindFree( static_cast<size_t>(end) );
+        end += base;
+
+        if (base == 0)
+            return LastNtStatus( STATUS_NO_MEMORY );
+    }
+
+    Region reg;
+    reg.size = static_cast<size_t>(end - base);
+    reg.allocBase = base;
+    reg.allocProtect = protection;
+
+    if (commit)
+    {
+        reg.state = MEM_COMMIT;
+        reg.protect = protection;
+        reg.data.assign( reg.size, 0 );
+    }
+
+    _regions.emplace( base, std::move( reg ) );
+    address = base;
+
+    return LastNtStatus( STATUS_SUCCESS );
+}
+
+/// <summary>
+/// Free virtual memory
+/// </summary>
+/// <param name="address">Memory address</param>
+/// <param name="size">Region size. Ignored for MEM_RELEASE, 0 decommits rest of allocation</param>
+/// <param name="freeType">Release/decommit</param>
+/// <returns>Status code</returns>
+NTSTATUS SyntheticBackend::Free( ptr_t address, size_t size, DWORD freeType )
+{
+    std::lock_guard<std::recursive_mutex> lck( _lock );
+
+    auto iter = Find( address );
+    if (iter == _regions.end())
+        return LastNtStatus( STATUS_MEMORY_NOT_ALLOCATED );
+
+    ptr_t base = iter->second.allocBase;
+
+    if (freeType & MEM_RELEASE)
+    {
+        if (address != base)
+            return LastNtStatus( STATUS_FREE_VM_NOT_AT_BASE );
+
+        for (iter = _regions.find( base ); iter != _regions.end() && iter->second.allocBase == base;)
+            iter = _regions.erase( iter );
+
+        return LastNtStatus( STATUS_SUCCESS );
+    }
+
+    if (!(freeType & MEM_DECOMMIT))
+        return LastNtStatus( STATUS_INVALID_PARAMETER );
+
+    ptr_t pageMask = _pageSize - 1;
+    ptr_t start = address & ~pageMask;
+    ptr_t end = (address + size + pageMask) & ~pageMask;
+
+    // Rest of allocation
+    if (size == 0)
+    {
+        for (end = iter->first; iter != _regions.end() && iter->first == end && iter->second.allocBase == base; ++iter)
+            end += iter->second.size;
+    }
+
+    mapRegions::iterator first, last;
+    NTSTATUS status = Isolate( start, static_cast<size_t>(end - start), first, last );
+    if (!NT_SUCCESS( status ))
+        return LastNtStatus( status );
+
+    for (; first != last; ++first)
+    {
+        first->second.state = MEM_RESERVE;
+        first->second.protect = 0;
+        std::vector<uint8_t>().swap( first->second.data );
+    }
+
+    return LastNtStatus( STATUS_SUCCESS );
+}
+
+/// <summary>
+/// Change memory protection
+/// </summary>
+/// <param name="address">Memory address</param>
+/// <param name="size">Region size</param>
+/// <param name="protection">New protection</param>
+/// <param name="pOld">Old protection of first page</param>
+/// <returns>Status code</returns>
+NTSTATUS SyntheticBackend::Protect( ptr_t address, size_t size, DWORD protection, DWORD* pOld )
+{
+    std::lock_guard<std::recursive_mutex> lck( _lock );
+
+    ptr_t pageMask = _pageSize - 1;
+    ptr_t start = address & ~pageMask;
+    ptr_t end = (address + (size != 0 ? size : 1) + pageMask) & ~pageMask;
+    mapRegions::iterator first, last;
+
+    NTSTATUS status = Isolate( start, static_cast<size_t>(end - start), first, last );
+    if (!NT_SUCCESS( status ))
+        return LastNtStatus( status );
+
+    for (auto iter = first; iter != last; ++iter)
+        if (iter->second.state != MEM_COMMIT)
+            return LastNtStatus( STATUS_NOT_COMMITTED );
+
+    if (pOld != nullptr)
+        *pOld = first->second.protect;
+
+    for (; first != last; ++first)
+        first->second.protect = protection;
+
+    return LastNtStatus( STATUS_SUCCESS );
+}
+
+/// <summary>
+/// Read virtual memory
+/// </summary>
+/// <param name="address">Memory address</param>
+/// <param name="buffer">Output buffer</param>
+/// <param name="size">Number of bytes to read</param>
+/// <returns>Status code</returns>
+NTSTATUS SyntheticBackend::Read( ptr_t address, void* buffer, size_t size )
+{
+    std::lock_guard<std::recursive_mutex> lck( _lock );
+    return LastNtStatus( Transfer( address, reinterpret_cast<uint8_t*>(buffer), size, false ) );
+}
+
+/// <summary>
+/// Write virtual memory. Like WriteProcessMemory, read-only pages are writable
+/// </summary>
+/// <param name="address">Memory address</param>
+/// <param name="buffer">Data to write</param>
+/// <param name="size">Number of bytes to write</param>
+/// <returns>Status code</returns>
+NTSTATUS SyntheticBackend::Write( ptr_t address, const void* buffer, size_t size )
+{
+    std::lock_guard<std::recursive_mutex> lck( _lock );
+    return LastNtStatus( Transfer( address, reinterpret_cast<uint8_t*>(const_cast<void*>(buffer)), size, true ) );
+}
+
+/// <summary>
+/// Query virtual memory
+/// </summary>
+/// <param name="address">Address to query</param>
+/// <param name="info">Retrieved memory info</param>
+/// <returns>Status code, STATUS_INVALID_PARAMETER past the end of address space</returns>
+NTSTATUS SyntheticBackend::Query( ptr_t address, PMEMORY_BASIC_INFORMATION64 info )
+{
+    if (address > maxAddr())
+        return LastNtStatus( STATUS_INVALID_PARAMETER );
+
+    std::lock_guard<std::recursive_mutex> lck( _lock );
+
+    ptr_t page = address & ~static_cast<ptr_t>(_pageSize - 1);
+    auto iter = Find( page );
+
+    memset( info, 0, sizeof( *info ) );
+    info->BaseAddress = page;
+
+    // Free range up to next allocation
+    if (iter == _regions.end())
+    {
+        auto next = _regions.upper_bound( page );
+        info->RegionSize = (next != _regions.end() ? next->first : maxAddr() + 1) - page;
+        info->State = MEM_FREE;
+        info->Protect = PAGE_NOACCESS;
+
+        return LastNtStatus( STATUS_SUCCESS );
+    }
+
+    auto& reg = iter->second;
+    ptr_t end = iter->first + reg.size;
+
+    // Following pages with same attributes belong to the same region
+    for (auto next = std::next( iter ); next != _regions.end() && next->first == end; ++next)
+    {
+        auto& nreg = next->second;
+        if (nreg.allocBase != reg.allocBase || nreg.state != reg.state || nreg.protect != reg.protect || nreg.type != reg.type)
+            break;
+
+        end += nreg.size;
+    }
+
+    info->AllocationBase = reg.allocBase;
+    info->AllocationProtect = reg.allocProtect;
+    info->RegionSize = end - page;
+    info->State = reg.state;
+    info->Protect = reg.protect;
+    info->Type = reg.type;
+
+    return LastNtStatus( STATUS_SUCCESS );
+}
+
+/// <summary>
+/// Allocate committed memory at fixed address and fill it with data
+/// </summary>
+/// <param name="address">Allocation address</param>
+/// <param name="data">Region contents, can be null</param>
+/// <param name="size">Region size</param>
+/// <param name="protection">Memory protection</param>
+/// <param name="type">Region type reported by Query: MEM_PRIVATE, MEM_MAPPED or MEM_IMAGE</param>
+/// <returns>Status code</returns>
+NTSTATUS SyntheticBackend::Map( ptr_t address, const void* data, size_t size, DWORD protection /*= PAGE_READWRITE*/, DWORD type /*= MEM_PRIVATE*/ )
+{
+    std::lock_guard<std::recursive_mutex> lck( _lock );
+
+    ptr_t base = address;
+    NTSTATUS status = Allocate( base, size, MEM_RESERVE | MEM_COMMIT, protection );
+    if (!NT_SUCCESS( status ))
+        return status;
+
+    for (auto iter = Find( base ); iter != _regions.end() && iter->first < address + size; ++iter)
+        iter->second.type = type;
+
+    if (data != nullptr)
+        status = Transfer( address, reinterpret_cast<uint8_t*>(const_cast<void*>(data)), size, true );
+
+    return LastNtStatus( status );
+}
+
+/// <summary>
+/// Release all memory
+/// </summary>
+void SyntheticBackend::Clear()
+{
+    std::lock_guard<std::recursive_mutex> lck( _lock );
+    _regions.clear();
+}
+
+/// <summary>
+/// Find region containing address
+/// </summary>
+/// <param name="address">Address</param>
+/// <returns>Region iterator, end() if address is free</returns>
+SyntheticBackend::mapRegions::iterator SyntheticBackend::Find( ptr_t address )
+{
+    auto iter = _regions.upper_bound( address );
+    if (iter == _regions.begin())
+        return _regions.end();
+
+    --iter;
+    return address < iter->first + iter->second.size ? iter : _regions.end();
+}
+
+/// <summary>
+/// Make region boundary at address
+/// </summary>
+/// <param name="address">Page aligned address</param>
+void SyntheticBackend::Split( ptr_t address )
+{
+    auto iter = Find( address );
+    if (iter == _regions.end() || iter->first == address)
+        return;
+
+    auto& head = iter->second;
+    size_t headSize = static_cast<size_t>(address - iter->first);
+
+    Region tail;
+    tail.size = head.size - headSize;
+    tail.allocBase = head.allocBase;
+    tail.allocProtect = head.allocProtect;
+    tail.protect = head.protect;
+    tail.state = head.state;
+    tail.type = head.type;
+
+    if (!head.data.empty())
+    {
+        tail.data.assign( head.data.begin() + headSize, head.data.end() );
+        head.data.resize( headSize );
+    }
+
+    head.size = headSize;
+    _regions.emplace( address, std::move( tail ) );
+}
+
+/// <summary>
+/// Split range out of single allocation
+/// </summary>
+/// <param name="address">Page aligned range start</param>
+/// <param name="size">Page aligned range size</param>
+/// <param name="first">First region of range</param>
+/// <param name="last">Region after range</param>
+/// <returns>Status code</returns>
+NTSTATUS SyntheticBackend::Isolate( ptr_t address, size_t size, mapRegions::iterator& first, mapRegions::iterator& last )
+{
+    auto iter = Find( address );
+    if (iter == _regions.end())
+        return STATUS_MEMORY_NOT_ALLOCATED;
+
+    ptr_t base = iter->second.allocBase;
+    ptr_t end = address + size;
+
+    // Range must be fully allocated by single allocation
+    for (ptr_t ptr = iter->first; ptr < end; ++iter)
+    {
+        if (iter == _regions.end() || iter->first != ptr || iter->second.allocBase != base)
+            return STATUS_CONFLICTING_ADDRESSES;
+
+        ptr += iter->second.size;
+    }
+
+    Split( address );
+    Split( end );
+
+    first = _regions.find( address );
+    last = _regions.lower_bound( end );
+
+    return STATUS_SUCCESS;
+}
+
+/// <summary>
+/// Find free range for new allocation
+/// </summary>
+/// <param name="size">Allocation size</param>
+/// <returns>Allocation address, 0 if address space is full</returns>
+ptr_t SyntheticBackend::FindFree( size_t size ) const
+{
+    const ptr_t granMask = SYNTHETIC_GRANULARITY - 1;
+    ptr_t start = (minAddr() + granMask) & ~granMask;
+
+    for (auto& reg : _regions)
+    {
+        if (reg.first >= start + size)
+            break;
+
+        ptr_t regEnd = reg.first + reg.second.size;
+        if (regEnd > start)
+            start = (regEnd + granMask) & ~granMask;
+    }
+
+    return start + size <= maxAddr() + 1 ? start : 0;
+}
+
+/// <summary>
+/// Copy data from or into committed pages
+/// </summary>
+/// <param name="address">Range start</param>
+/// <param name="buffer">Local buffer</param>
+/// <param name="size">Range size</param>
+/// <param name="write">Copy direction</param>
+/// <returns>Status code</returns>
+NTSTATUS SyntheticBackend::Transfer( ptr_t address, uint8_t* buffer, size_t size, bool write )
+{
+    size_t done = 0;
+
+    while (done < size)
+    {
+        auto iter = Find( address + done );
+        if (iter == _regions.end())
+            break;
+
+        auto& reg = iter->second;
+        if (reg.state != MEM_COMMIT || (reg.protect & (PAGE_NOACCESS | PAGE_GUARD)) != 0)
+            break;
+
+        size_t offset = static_cast<size_t>(address + done - iter->first);
+        size_t chunk = std::min<size_t>( reg.size - offset, size - done );
+
+        if (write)
+            memcpy( reg.data.data() + offset, buffer + done, chunk );
+        else
+            memcpy( buffer + done, reg.data.data() + offset, chunk );
+
+        done += chunk;
+    }
+
+    if (done == size)
+        return STATUS_SUCCESS;
+
+    return done != 0 ? STATUS_PARTIAL_COPY : STATUS_ACCESS_VIOLATION;
+}
+
+}
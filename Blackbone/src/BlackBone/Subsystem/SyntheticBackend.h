@@ -0,0 +1,125 @@
+#pragma once
+
+#include "MemoryBackend.h"
+
+#include <map>
+#include <vector>
+#include <mutex>
+
+namespace blackbone
+{
+
+#define SYNTHETIC_GRANULARITY   0x10000     // Allocation granularity of synthetic address space
+
+/// <summary>
+/// In-memory address space.
+/// Follows Windows virtual memory rules closely enough for region queries, hole-aware reads and allocations,
+/// so memory routines can be benchmarked without a live target
+/// </summary>
+class SyntheticBackend : public MemoryBackend
+{
+public:
+    /// <summary>
+    /// Create empty address space
+    /// </summary>
+    /// <param name="ptrSize">Pointer size of emulated target</param>
+    /// <param name="pageSize">Page size</param>
+    BLACKBONE_API SyntheticBackend( uint32_t ptrSize = sizeof( ptr_t ), uint32_t pageSize = 0x1000 );
+    BLACKBONE_API ~SyntheticBackend();
+
+    virtual NTSTATUS Allocate( ptr_t& address, size_t size, DWORD allocationType, DWORD protection );
+    virtual NTSTATUS Free( ptr_t address, size_t size, DWORD freeType );
+    virtual NTSTATUS Protect( ptr_t address, size_t size, DWORD protection, DWORD* pOld );
+    virtual NTSTATUS Read( ptr_t address, void* buffer, size_t size );
+    virtual NTSTATUS Write( ptr_t address, const void* buffer, size_t size );
+    virtual NTSTATUS Query( ptr_t address, PMEMORY_BASIC_INFORMATION64 info );
+
+    virtual ptr_t minAddr() const { return 0x10000; }
+    virtual ptr_t maxAddr() const { return _ptrSize == sizeof( uint32_t ) ? 0x7FFEFFFF : 0x7FFFFFFEFFFF; }
+    virtual uint32_t pageSize() const { return _pageSize; }
+    virtual uint32_t ptrSize() const { return _ptrSize; }
+
+    /// <summary>
+    /// Allocate committed memory at fixed address and fill it with data
+    /// </summary>
+    /// <param name="address">Allocation address</param>
+    /// <param name="data">Region contents, can be null</param>
+    /// <param name="size">Region size</param>
+    /// <param name="protection">Memory protection</param>
+    /// <param name="type">Region type reported by Query: MEM_PRIVATE, MEM_MAPPED or MEM_IMAGE</param>
+    /// <returns>Status code</returns>
+    BLACKBONE_API NTSTATUS Map( ptr_t address, const void* data, size_t size, DWORD protection = PAGE_READWRITE, DWORD type = MEM_PRIVATE );
+
+    /// <summary>
+    /// Release all memory
+    /// </summary>
+    BLACKBONE_API void Clear();
+
+private:
+    /// <summary>
+    /// Run of pages with same attributes
+    /// </summary>
+    struct Region
+    {
+        size_t size = 0;                // Region size
+        ptr_t allocBase = 0;            // Allocation base
+        DWORD allocProtect = 0;         // Allocation protection
+        DWORD protect = 0;              // Current protection, 0 for reserved pages
+        DWORD state = MEM_RESERVE;      // MEM_RESERVE or MEM_COMMIT
+        DWORD type = MEM_PRIVATE;       // Region type
+        std::vector<uint8_t> data;      // Contents of committed pages
+    };
+
+    typedef std::map<ptr_t, Region> mapRegions;
+
+    /// <summary>
+    /// Find region containing address
+    /// </summary>
+    /// <param name="address">Address</param>
+    /// <returns>Region iterator, end() if address is free</returns>
+    mapRegions::iterator Find( ptr_t address );
+
+    /// <summary>
+    /// Make region boundary at address
+    /// </summary>
+    /// <param name="address">Page aligned address</param>
+    void Split( ptr_t address );
+
+    /// <summary>
+    /// Split range out of single allocation
+    /// </summary>
+    /// <param name="address">Page aligned range start</param>
+    /// <param name="size">Page aligned range size</param>
+    /// <param name="first">First region of range</param>
+    /// <param name="last">Region after range</param>
+    /// <returns>Status code</returns>
+    NTSTATUS Isolate( ptr_t address, size_t size, mapRegions::iterator& first, mapRegions::iterator& last );
+
+    /// <summary>
+    /// Find free range for new allocation
+    /// </summary>
+    /// <param name="size">Allocation size</param>
+    /// <returns>Allocation address, 0 if address space is full</returns>
+    ptr_t FindFree( size_t size ) const;
+
+    /// <summary>
+    /// Copy data from or into committed pages
+    /// </summary>
+    /// <param name="address">Range start</param>
+    /// <param name="buffer">Local buffer</param>
+    /// <param name="size">Range size</param>
+    /// <param name="write">Copy direction</param>
+    /// <returns>Status code</returns>
+    NTSTATUS Transfer( ptr_t address, uint8_t* buffer, size_t size, bool write );
+
+    SyntheticBackend( const SyntheticBackend& ) = delete;
+    SyntheticBackend& operator =( const SyntheticBackend& ) = delete;
+
+private:
+    mapRegions _regions;            // Region start -> region
+    uint32_t _ptrSize;              // Emulated pointer size
+    uint32_t _pageSize;             // Page size
+    std::recursive_mutex _lock;     // Address space guard, Map allocates under it
+};
+
+}
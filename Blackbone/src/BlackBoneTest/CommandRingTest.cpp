@@ -0,0 +1,236 @@
+//
+// Two-thread producer/consumer check of the RPC command ring.
+// Consumer thread plays the role of the remote dispatcher, doorbell is emulated with a condition variable
+//
+
+#include "../BlackBone/Process/RPC/CommandRing.h"
+
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace blackbone;
+
+#define CHECK( expr ) \
+    if (!(expr)) { printf( "%s(%d): check failed: %s\n", __FILE__, __LINE__, #expr ); return false; }
+
+/// <summary>
+/// Auto-reset event used as consumer doorbell
+/// </summary>
+class Doorbell
+{
+public:
+    void Signal()
+    {
+        std::lock_guard<std::mutex> lck( _lock );
+        _signaled = true;
+        _cv.notify_one();
+    }
+
+    void Wait()
+    {
+        std::unique_lock<std::mutex> lck( _lock );
+        _cv.wait( lck, [this] { return _signaled; } );
+        _signaled = false;
+    }
+
+private:
+    std::mutex _lock;
+    std::condition_variable _cv;
+    bool _signaled = false;
+};
+
+static uint64_t Invoke( const RingCall& call )
+{
+    return call.function + call.args[0] * 3;
+}
+
+/// <summary>
+/// Single thread full/empty transitions and out of order release
+/// </summary>
+static bool TestTransitions()
+{
+    const uint32_t capacity = 4;
+    std::vector<uint8_t> memory( CommandRing::RequiredSize( capacity, 16 ) + RING_CACHE_LINE );
+    void* base = reinterpret_cast<void*>((reinterpret_cast<uintptr_t>(memory.data()) + RING_CACHE_LINE - 1) & ~static_cast<uintptr_t>(RING_CACHE_LINE - 1));
+
+    CommandRing producer, bad;
+    CHECK( !bad.Init( base, 3, 16 ) );
+    CHECK( producer.Init( base, capacity, 16 ) );
+    CHECK( producer.valid() );
+
+    CommandRing consumer( base );
+    CHECK( consumer.Peek() == nullptr );
+
+    // Fill the ring
+    uint32_t seqs[capacity] = { 0 };
+    for (uint32_t i = 0; i < capacity; i++)
+    {
+        RingCall* call = producer.Reserve( seqs[i] );
+        CHECK( call != nullptr );
+        call->function = 0;
+        call->args[0] = i;
+        producer.Publish();
+    }
+
+    uint32_t seq = 0;
+    CHECK( producer.Reserve( seq ) == nullptr );
+    CHECK( producer.pending() == capacity );
+
+    // Drain it
+    for (uint32_t i = 0; i < capacity; i++)
+        CHECK( consumer.ExecuteNext( Invoke ) );
+
+    CHECK( consumer.Peek() == nullptr );
+    CHECK( !consumer.ExecuteNext( Invoke ) );
+
+    // Completed but not released slots still occupy the ring
+    CHECK( producer.Reserve( seq ) == nullptr );
+
+    // Release of the second slot alone frees nothing
+    CHECK( producer.Completed( seqs[1] ) );
+    producer.Release( seqs[1] );
+    CHECK( producer.Reserve( seq ) == nullptr );
+
+    // First release retires both
+    producer.Release( seqs[0] );
+    CHECK( producer.pending() == capacity - 2 );
+    CHECK( producer.slot( seqs[3] )->result == 9 );
+
+    CHECK( producer.Reserve( seq ) != nullptr );
+    CHECK( seq == seqs[3] + 1 );
+    CHECK( !producer.Completed( seq ) );
+
+    return true;
+}
+
+/// <summary>
+/// Producer and consumer threads, sequence counter wraps around 2^32 during the run
+/// </summary>
+/// <param name="capacity">Ring capacity</param>
+/// <param name="calls">Number of calls to run</param>
+/// <param name="sleepy">Consumer waits on doorbell whenever ring is empty</param>
+static bool TestThreads( uint32_t capacity, uint32_t calls, bool sleepy )
+{
+    const uint32_t dataSize = 32;
+    std::vector<uint8_t> memory( CommandRing::RequiredSize( capacity, dataSize ) + RING_CACHE_LINE );
+    void* base = reinterpret_cast<void*>((reinterpret_cast<uintptr_t>(memory.data()) + RING_CACHE_LINE - 1) & ~static_cast<uintptr_t>(RING_CACHE_LINE - 1));
+
+    CommandRing producer;
+    CHECK( producer.Init( base, capacity, dataSize ) );
+
+    // Start close to counter overflow
+    const uint32_t start = 0xFFFFFFFF - calls / 2;
+    producer.header()->head = start;
+    producer.header()->tail = start;
+    producer.header()->retired = start;
+
+    Doorbell doorbell;
+    uint64_t empty = 0, sleeps = 0;
+    bool dataOk = true;
+
+    std::thread consumerThread( [&]()
+    {
+        CommandRing consumer( base );
+        while (!consumer.stopRequested())
+        {
+            RingCall* call = consumer.Peek();
+            if (call == nullptr)
+            {
+                empty++;
+                if (sleepy && consumer.PrepareSleep())
+                {
+                    sleeps++;
+                    doorbell.Wait();
+                    consumer.EndSleep();
+                }
+                else
+                    std::this_thread::yield();
+
+                continue;
+            }
+
+            uint64_t value = 0;
+            memcpy( &value, consumer.slotData( call->sequence ), sizeof( value ) );
+            dataOk &= value == call->args[0];
+
+            consumer.Complete( call, Invoke( *call ) );
+        }
+    } );
+
+    std::vector<uint32_t> inflight;
+    uint64_t full = 0;
+    uint32_t issued = 0, collected = 0;
+    bool resultsOk = true;
+
+    auto collect = [&]()
+    {
+        uint32_t seq = inflight.front();
+        while (!producer.Completed( seq ))
+            std::this_thread::yield();
+
+        resultsOk &= producer.slot( seq )->result == 7 + static_cast<uint64_t>(collected) * 3;
+        producer.Release( seq );
+        inflight.erase( inflight.begin() );
+        collected++;
+    };
+
+    while (issued < calls)
+    {
+        uint32_t seq = 0;
+        RingCall* call = producer.Reserve( seq );
+        if (call == nullptr)
+        {
+            full++;
+            collect();
+            continue;
+        }
+
+        uint64_t value = issued;
+        call->function = 7;
+        call->args[0] = value;
+        memcpy( producer.slotData( seq ), &value, sizeof( value ) );
+
+        if (producer.Publish())
+            doorbell.Signal();
+
+        inflight.push_back( seq );
+        issued++;
+    }
+
+    while (!inflight.empty())
+        collect();
+
+    if (producer.RequestStop())
+        doorbell.Signal();
+
+    // Consumer may have checked stop flag right before it was set and be asleep without the flag seen
+    doorbell.Signal();
+    consumerThread.join();
+
+    printf( "capacity %u, %u calls%s: %llu full, %llu empty, %llu sleeps\n", capacity, calls, sleepy ? ", doorbell" : "",
+        static_cast<unsigned long long>(full), static_cast<unsigned long long>(empty), static_cast<unsigned long long>(sleeps) );
+
+    CHECK( resultsOk );
+    CHECK( dataOk );
+    CHECK( collected == calls );
+    CHECK( producer.pending() == 0 );
+    CHECK( producer.header()->head.load() == start + calls );
+    CHECK( full > 0 );
+    CHECK( empty > 0 );
+
+    return true;
+}
+
+int main()
+{
+    bool ok = TestTransitions()
+        && TestThreads( 1, 20000, false )
+        && TestThreads( 8, 200000, false )
+        && TestThreads( 64, 200000, true );
+
+    printf( ok ? "CommandRing: OK\n" : "CommandRing: FAILED\n" );
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,91 @@
+//
+// Linux backend checks against own process: /proc/self/maps translation, process_vm_readv/writev transfers
+//
+
+#include "../BlackBone/Subsystem/LinuxBackend.h"
+
+#include <sys/mman.h>
+#include <unistd.h>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace blackbone;
+
+#define CHECK( expr ) \
+    if (!(expr)) { printf( "%s(%d): check failed: %s\n", __FILE__, __LINE__, #expr ); return false; }
+
+static bool TestSelf()
+{
+    LinuxBackend mem( getpid() );
+    size_t page = mem.pageSize();
+
+    CHECK( page == static_cast<size_t>(sysconf( _SC_PAGESIZE )) );
+    CHECK( mem.ptrSize() == sizeof( void* ) );
+
+    // Three pages, middle one is inaccessible
+    auto block = reinterpret_cast<uint8_t*>(mmap( nullptr, page * 3, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 ));
+    CHECK( block != MAP_FAILED );
+    CHECK( mprotect( block + page, page, PROT_NONE ) == 0 );
+
+    for (size_t i = 0; i < page * 3; i += page)
+        if (i != page)
+            memset( block + i, static_cast<int>(0x11 * (i / page + 1)), page );
+
+    ptr_t base = reinterpret_cast<uintptr_t>(block);
+
+    // Reported in Windows terms
+    MEMORY_BASIC_INFORMATION64 mbi = {};
+    CHECK( NT_SUCCESS( mem.Query( base, &mbi ) ) );
+    CHECK( mbi.BaseAddress == base && mbi.State == MEM_COMMIT && mbi.Protect == PAGE_READWRITE && mbi.Type == MEM_PRIVATE );
+    CHECK( mbi.BaseAddress + mbi.RegionSize >= base + page );
+
+    CHECK( NT_SUCCESS( mem.Query( base + page, &mbi ) ) );
+    CHECK( mbi.BaseAddress == base + page && mbi.RegionSize == page && mbi.State == MEM_RESERVE && mbi.Protect == 0 );
+
+    CHECK( mem.Query( mem.maxAddr() + 1, &mbi ) == STATUS_INVALID_PARAMETER );
+
+    // Plain transfers
+    uint32_t value = 0;
+    CHECK( NT_SUCCESS( mem.Read( base + 8, &value, sizeof( value ) ) ) );
+    CHECK( value == 0x11111111 );
+
+    value = 0xCAFEBABE;
+    CHECK( NT_SUCCESS( mem.Write( base + page * 2, &value, sizeof( value ) ) ) );
+    CHECK( memcmp( block + page * 2, &value, sizeof( value ) ) == 0 );
+
+    std::vector<uint8_t> buf( page * 2 );
+    CHECK( mem.Read( base + page, buf.data(), 16 ) == STATUS_ACCESS_VIOLATION );
+    CHECK( mem.Read( base + page - 16, buf.data(), 32 ) == STATUS_PARTIAL_COPY );
+
+    // Batch resumes after unreadable range
+    uint8_t a[16] = { 0 }, b[16] = { 0 }, c[16] = { 0 };
+    std::vector<ReadRequest> requests;
+    requests.emplace_back( base, sizeof( a ), a );
+    requests.emplace_back( base + page + 32, sizeof( b ), b );
+    requests.emplace_back( base + page * 2 + 64, sizeof( c ), c );
+
+    size_t calls = 0;
+    CHECK( mem.ReadBatch( requests, 0, &calls ) == STATUS_PARTIAL_COPY );
+    CHECK( calls == 2 );
+    CHECK( NT_SUCCESS( requests[0].status ) && a[0] == 0x11 );
+    CHECK( requests[1].status == STATUS_ACCESS_VIOLATION );
+    CHECK( NT_SUCCESS( requests[2].status ) && c[0] == 0x33 );
+
+    munmap( block, page * 3 );
+
+    // Gone process
+    LinuxBackend dead( 0x7FFFFFF0 );
+    CHECK( dead.Read( base, &value, sizeof( value ) ) == STATUS_INVALID_CID );
+    CHECK( dead.Refresh() == STATUS_INVALID_CID );
+
+    return true;
+}
+
+int main()
+{
+    bool ok = TestSelf();
+
+    printf( ok ? "LinuxBackend: OK\n" : "LinuxBackend: FAILED\n" );
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,168 @@
+//
+// Synthetic address space checks: allocation, region queries, protection changes and hole-aware reads
+//
+
+#include "../BlackBone/Subsystem/SyntheticBackend.h"
+
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace blackbone;
+
+#define CHECK( expr ) \
+    if (!(expr)) { printf( "%s(%d): check failed: %s\n", __FILE__, __LINE__, #expr ); return false; }
+
+/// <summary>
+/// Query address and compare region attributes
+/// </summary>
+static bool Expect( SyntheticBackend& mem, ptr_t address, ptr_t base, ptr_t size, DWORD state, DWORD protect )
+{
+    MEMORY_BASIC_INFORMATION64 mbi = {};
+    CHECK( NT_SUCCESS( mem.Query( address, &mbi ) ) );
+    CHECK( mbi.BaseAddress == base );
+    CHECK( mbi.RegionSize == size );
+    CHECK( mbi.State == state );
+    CHECK( mbi.Protect == protect );
+
+    return true;
+}
+
+/// <summary>
+/// Reserve, commit, protect, decommit and release
+/// </summary>
+static bool TestAllocation()
+{
+    SyntheticBackend mem;
+
+    // Reserve 16 pages at fixed address, commit 4 in the middle
+    ptr_t base = 0x100000;
+    CHECK( NT_SUCCESS( mem.Allocate( base, 0x10000, MEM_RESERVE, PAGE_READWRITE ) ) );
+    CHECK( base == 0x100000 );
+
+    ptr_t commit = 0x104000;
+    CHECK( NT_SUCCESS( mem.Allocate( commit, 0x4000, MEM_COMMIT, PAGE_READWRITE ) ) );
+
+    CHECK( Expect( mem, 0x100000, 0x100000, 0x4000, MEM_RESERVE, 0 ) );
+    CHECK( Expect( mem, 0x105123, 0x105000, 0x3000, MEM_COMMIT, PAGE_READWRITE ) );
+    CHECK( Expect( mem, 0x108000, 0x108000, 0x8000, MEM_RESERVE, 0 ) );
+    CHECK( Expect( mem, 0x110000, 0x110000, mem.maxAddr() + 1 - 0x110000, MEM_FREE, PAGE_NOACCESS ) );
+
+    // Overlapping allocation
+    ptr_t overlap = 0x100000;
+    CHECK( mem.Allocate( overlap, 0x1000, MEM_RESERVE, PAGE_READWRITE ) == STATUS_CONFLICTING_ADDRESSES );
+
+    // Protection change splits committed run, old protection is reported
+    DWORD old = 0;
+    CHECK( NT_SUCCESS( mem.Protect( 0x105000, 0x1000, PAGE_READONLY, &old ) ) );
+    CHECK( old == PAGE_READWRITE );
+    CHECK( Expect( mem, 0x104000, 0x104000, 0x1000, MEM_COMMIT, PAGE_READWRITE ) );
+    CHECK( Expect( mem, 0x105000, 0x105000, 0x1000, MEM_COMMIT, PAGE_READONLY ) );
+
+    // Restored protection coalesces regions again
+    CHECK( NT_SUCCESS( mem.Protect( 0x105000, 0x1000, PAGE_READWRITE, &old ) ) );
+    CHECK( Expect( mem, 0x104000, 0x104000, 0x4000, MEM_COMMIT, PAGE_READWRITE ) );
+
+    // Reserved pages can't be protected
+    CHECK( mem.Protect( 0x100000, 0x1000, PAGE_READONLY, nullptr ) == STATUS_NOT_COMMITTED );
+
+    // Decommit drops contents
+    uint32_t value = 0xDEADBEEF;
+    CHECK( NT_SUCCESS( mem.Write( 0x106000, &value, sizeof( value ) ) ) );
+    CHECK( NT_SUCCESS( mem.Free( 0x106000, 0x1000, MEM_DECOMMIT ) ) );
+    CHECK( Expect( mem, 0x106000, 0x106000, 0x1000, MEM_RESERVE, 0 ) );
+    CHECK( mem.Read( 0x106000, &value, sizeof( value ) ) == STATUS_ACCESS_VIOLATION );
+
+    ptr_t recommit = 0x106000;
+    CHECK( NT_SUCCESS( mem.Allocate( recommit, 0x1000, MEM_COMMIT, PAGE_READWRITE ) ) );
+    CHECK( NT_SUCCESS( mem.Read( 0x106000, &value, sizeof( value ) ) ) );
+    CHECK( value == 0 );
+
+    // Release only from allocation base
+    CHECK( mem.Free( 0x104000, 0, MEM_RELEASE ) == STATUS_FREE_VM_NOT_AT_BASE );
+    CHECK( NT_SUCCESS( mem.Free( 0x100000, 0, MEM_RELEASE ) ) );
+    CHECK( Expect( mem, 0x100000, 0x100000, mem.maxAddr() + 1 - 0x100000, MEM_FREE, PAGE_NOACCESS ) );
+    CHECK( mem.Free( 0x100000, 0, MEM_RELEASE ) == STATUS_MEMORY_NOT_ALLOCATED );
+
+    // Allocations without address are granularity aligned and don't overlap
+    ptr_t a = 0, b = 0;
+    CHECK( NT_SUCCESS( mem.Allocate( a, 0x1800, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE ) ) );
+    CHECK( NT_SUCCESS( mem.Allocate( b, 0x1000, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE ) ) );
+    CHECK( a % SYNTHETIC_GRANULARITY == 0 && b % SYNTHETIC_GRANULARITY == 0 );
+    CHECK( a >= mem.minAddr() && b >= a + 0x2000 );
+    CHECK( Expect( mem, a, a, 0x2000, MEM_COMMIT, PAGE_READWRITE ) );
+
+    return true;
+}
+
+/// <summary>
+/// Reads across region boundaries and holes, batched reads
+/// </summary>
+static bool TestTransfer()
+{
+    SyntheticBackend mem( sizeof( uint32_t ) );
+    CHECK( mem.ptrSize() == sizeof( uint32_t ) );
+    CHECK( mem.maxAddr() == 0x7FFEFFFF );
+
+    std::vector<uint8_t> image( 0x3000 );
+    for (size_t i = 0; i < image.size(); i++)
+        image[i] = static_cast<uint8_t>(i * 7);
+
+    CHECK( NT_SUCCESS( mem.Map( 0x400000, image.data(), image.size(), PAGE_EXECUTE_READ, MEM_IMAGE ) ) );
+
+    MEMORY_BASIC_INFORMATION64 mbi = {};
+    CHECK( NT_SUCCESS( mem.Query( 0x401000, &mbi ) ) );
+    CHECK( mbi.Type == MEM_IMAGE );
+    CHECK( mbi.AllocationBase == 0x400000 );
+
+    // Read spanning two differently protected regions
+    DWORD old = 0;
+    CHECK( NT_SUCCESS( mem.Protect( 0x401000, 0x1000, PAGE_READWRITE, &old ) ) );
+
+    std::vector<uint8_t> buf( 0x2000 );
+    CHECK( NT_SUCCESS( mem.Read( 0x400800, buf.data(), buf.size() ) ) );
+    CHECK( memcmp( buf.data(), image.data() + 0x800, buf.size() ) == 0 );
+
+    // Read-only pages are still writable, like with WriteProcessMemory
+    uint32_t value = 0x12345678;
+    CHECK( NT_SUCCESS( mem.Write( 0x400010, &value, sizeof( value ) ) ) );
+    value = 0;
+    CHECK( NT_SUCCESS( mem.Read( 0x400010, &value, sizeof( value ) ) ) );
+    CHECK( value == 0x12345678 );
+
+    // Guard page stops transfer
+    CHECK( NT_SUCCESS( mem.Protect( 0x402000, 0x1000, PAGE_READWRITE | PAGE_GUARD, &old ) ) );
+    CHECK( mem.Read( 0x401F00, buf.data(), 0x200 ) == STATUS_PARTIAL_COPY );
+    CHECK( mem.Read( 0x402000, buf.data(), 0x10 ) == STATUS_ACCESS_VIOLATION );
+    CHECK( LastNtStatus() == STATUS_ACCESS_VIOLATION );
+
+    // Default batched read reads ranges one by one
+    uint8_t a[0x10] = { 0 }, b[0x10] = { 0 }, c[0x10] = { 0 };
+    std::vector<ReadRequest> requests;
+    requests.emplace_back( 0x400100, sizeof( a ), a );
+    requests.emplace_back( 0x500000, sizeof( b ), b );
+    requests.emplace_back( 0x401100, sizeof( c ), c );
+    requests.emplace_back( 0x401200, 0, nullptr );
+
+    size_t calls = 0;
+    CHECK( mem.ReadBatch( requests, 0x1000, &calls ) == STATUS_PARTIAL_COPY );
+    CHECK( calls == 3 );
+    CHECK( NT_SUCCESS( requests[0].status ) && memcmp( a, image.data() + 0x100, sizeof( a ) ) == 0 );
+    CHECK( requests[1].status == STATUS_ACCESS_VIOLATION );
+    CHECK( NT_SUCCESS( requests[2].status ) && memcmp( c, image.data() + 0x1100, sizeof( c ) ) == 0 );
+    CHECK( requests[3].status == STATUS_SUCCESS );
+
+    // Empty address space
+    mem.Clear();
+    CHECK( mem.Read( 0x400000, buf.data(), 1 ) == STATUS_ACCESS_VIOLATION );
+
+    return true;
+}
+
+int main()
+{
+    bool ok = TestAllocation() && TestTransfer();
+
+    printf( ok ? "SyntheticBackend: OK\n" : "SyntheticBackend: FAILED\n" );
+    return ok ? 0 : 1;
+}
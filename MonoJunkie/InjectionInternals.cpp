@@ -6,6 +6,7 @@
 #include "../Blackbone/src/BlackBone/Process/RPC/RemoteFunction.hpp"
 #include "../Blackbone/src/BlackBone/Process/Threads/Thread.h"
 #include "../Blackbone/src/BlackBone/Asm/AsmVariant.hpp"
+#include "../Blackbone/src/BlackBone/Asm/AsmHelper.h"
 
 MonoInternals::MonoInternals(blackbone::Process& targetProcess, const std::wstring& targetDLLFilename) {
 
@@ -38,11 +39,20 @@ MonoInternals::MonoInternals(blackbone::Process& targetProcess, const std::wstri
 		//blackbone pointers to procedures, which we will cast and use below
 		std::vector<blackbone::ptr_t> procs;
 
+		//names passed to the bulk export lookup, pointers stay valid as long as TARGET_PROCS does
+		std::vector<const char*> procNames;
+		for (const std::string& procName : TARGET_PROCS) {
+			procNames.push_back(procName.c_str());
+		}
+
+		//resolve all target procs with a single read of mono.dll's export directory
+		std::vector<blackbone::exportData> targetExports = targetProcess.modules().GetExports(module, procNames);
+
 		//iterate over all target procs we are remotely getting
 		for (std::vector<std::string>::size_type k = 0; k < TARGET_PROCS.size(); k++) {
 
 			//get the current target function exported from mono.dll in the remote process
-			blackbone::exportData targetExport = targetProcess.modules().GetExport(module, TARGET_PROCS[k].c_str());
+			const blackbone::exportData& targetExport = targetExports[k];
 
 			//check if the remote function was found (NOTE: The invalid/uninitialized value of blackbone::ptr_t is 0!)
 			if (targetExport.procAddress != 0) {
@@ -381,6 +391,222 @@ MonoObject* MonoInternals::mono_runtime_invoke(MonoMethod* method, void* object,
 	return result;
 }
 
+//Runs the entire injection chain inside the target process with a single generated stub (one round trip instead of six)
+MonoObject* MonoInternals::mono_inject_fused(const std::string& fileName, const std::string& nameSpace, const std::string& className, const std::string& methodName, FusedInjectionResult& results) {
+
+	//reset the results so a stale block is never mistaken for a successful run
+	results = FusedInjectionResult();
+
+	//lay out the remote data block: result block first, then each null-terminated string right after it
+	const size_t resultOffset = 0;
+	const size_t fileNameOffset = sizeof(FusedInjectionResult);
+	const size_t nameSpaceOffset = fileNameOffset + fileName.size() + 1;
+	const size_t classNameOffset = nameSpaceOffset + nameSpace.size() + 1;
+	const size_t methodNameOffset = classNameOffset + className.size() + 1;
+	const size_t dataSize = methodNameOffset + methodName.size() + 1;
+
+	//allocate the remote data block, which is freed automatically when the MemBlock goes out of scope
+	blackbone::MemBlock data = getProcess().memory().Allocate(dataSize, PAGE_READWRITE);
+
+	//check if the remote allocation worked
+	if (!data.valid()) {
+
+		//unable to allocate memory in the target, tell the user why
+		throw MonoInternalsException(_T("Unable to allocate fused injection data: ") + GetNTErrorString(LastNtStatus()));
+
+	}
+
+	//write the zeroed result block followed by the strings the stub passes into mono
+	NTSTATUS error = data.Write(resultOffset, results);
+	error = NT_SUCCESS(error) ? data.Write(fileNameOffset, fileName.size() + 1, fileName.c_str()) : error;
+	error = NT_SUCCESS(error) ? data.Write(nameSpaceOffset, nameSpace.size() + 1, nameSpace.c_str()) : error;
+	error = NT_SUCCESS(error) ? data.Write(classNameOffset, className.size() + 1, className.c_str()) : error;
+	error = NT_SUCCESS(error) ? data.Write(methodNameOffset, methodName.size() + 1, methodName.c_str()) : error;
+
+	//check if everything was written to the target
+	if (!NT_SUCCESS(error)) {
+
+		//unable to write the stub's data, tell the user why
+		throw MonoInternalsException(_T("Unable to write fused injection data: ") + GetNTErrorString(error));
+
+	}
+
+	//remote addresses of every cell and string used by the stub
+	const uintptr_t base = data.ptr<uintptr_t>();
+	const uintptr_t stageCell = base + offsetof(FusedInjectionResult, stage);
+
+	//generate the stub. Each call's return value is stored in its result cell, and the stub bails out as soon as one of them returns null
+	blackbone::AsmJitHelper a;
+	asmjit::Label bail = a->newLabel();
+
+	//records the stage the stub is about to run, so we know where it bailed out
+	auto setStage = [&](int32_t stage) {
+
+		a->mov(a->zcx, stageCell);
+		a->mov(asmjit::host::dword_ptr(a->zcx), stage);
+
+	};
+
+	//stores the last return value into the given result cell, optionally bailing out if it is null
+	//NOTE: Only the low pointer-sized half of the cell is written, the high half stays zeroed for 32-bit targets
+	auto storeResult = [&](size_t cellOffset, bool bailOnNull) {
+
+		a->mov(a->zcx, base + cellOffset);
+		a->mov(a->intptr_ptr(a->zcx), a->zax);
+
+		if (bailOnNull) {
+
+			a->test(a->zax, a->zax);
+			a->jz(bail);
+
+		}
+
+	};
+
+	a.GenPrologue();
+
+	//MonoDomain* domain = mono_get_root_domain()
+	setStage(FUSED_STAGE_ROOT_DOMAIN);
+	a.GenCall(reinterpret_cast<uintptr_t>(remote_mono_get_root_domain), {}, blackbone::cc_cdecl);
+	storeResult(offsetof(FusedInjectionResult, domain), true);
+
+	//MonoAssembly* assembly = mono_assembly_open(fileName, &openStatus)
+	setStage(FUSED_STAGE_ASSEMBLY_OPEN);
+	a.GenCall(reinterpret_cast<uintptr_t>(remote_mono_assembly_open), { base + fileNameOffset, base + offsetof(FusedInjectionResult, openStatus) }, blackbone::cc_cdecl);
+	storeResult(offsetof(FusedInjectionResult, assembly), true);
+
+	//mono_assembly_open can return something even when the image failed to open, so the status has to be checked as well
+	a->mov(a->zcx, base + offsetof(FusedInjectionResult, openStatus));
+	a->cmp(asmjit::host::dword_ptr(a->zcx), MONO_IMAGE_OK);
+	a->jne(bail);
+
+	//MonoImage* image = mono_assembly_get_image(assembly)
+	setStage(FUSED_STAGE_GET_IMAGE);
+	a.GenCall(reinterpret_cast<uintptr_t>(remote_mono_assembly_get_image), { a->zax }, blackbone::cc_cdecl);
+	storeResult(offsetof(FusedInjectionResult, image), true);
+
+	//MonoClass* targetClass = mono_class_from_name(image, nameSpace, className)
+	setStage(FUSED_STAGE_CLASS_FROM_NAME);
+	a.GenCall(reinterpret_cast<uintptr_t>(remote_mono_class_from_name), { a->zax, base + nameSpaceOffset, base + classNameOffset }, blackbone::cc_cdecl);
+	storeResult(offsetof(FusedInjectionResult, targetClass), true);
+
+	//MonoMethod* targetMethod = mono_class_get_method_from_name(targetClass, methodName, 0)
+	setStage(FUSED_STAGE_METHOD_FROM_NAME);
+	a.GenCall(reinterpret_cast<uintptr_t>(remote_mono_class_get_method_from_name), { a->zax, base + methodNameOffset, 0 }, blackbone::cc_cdecl);
+	storeResult(offsetof(FusedInjectionResult, targetMethod), true);
+
+	//MonoObject* result = mono_runtime_invoke(targetMethod, nullptr, nullptr, &exception) (NOTE: A null result is valid for void methods)
+	setStage(FUSED_STAGE_RUNTIME_INVOKE);
+	a.GenCall(reinterpret_cast<uintptr_t>(remote_mono_runtime_invoke), { a->zax, 0, 0, base + offsetof(FusedInjectionResult, exception) }, blackbone::cc_cdecl);
+	storeResult(offsetof(FusedInjectionResult, result), false);
+
+	//every call was made
+	setStage(FUSED_STAGE_COMPLETE);
+
+	//early exits land here with the stage of the call that failed still recorded
+	a->bind(bail);
+
+	//signal completion back to us the same way a regular RemoteFunction call does
+	getProcess().remote().AddReturnWithEvent(a, blackbone::mt_default, blackbone::rt_int32);
+	a.GenEpilogue();
+
+	//run the stub in the main thread, this is the only round trip into the target for the whole injection
+	uint64_t callResult = 0;
+	error = getProcess().remote().ExecInAnyThread(a->make(), a->getCodeSize(), callResult, *getMainThread());
+
+	//check if the stub was executed
+	if (!NT_SUCCESS(error)) {
+
+		//unable to run the stub, tell the user why
+		throw MonoInternalsException(_T("Unable to execute fused injection stub: ") + GetNTErrorString(error));
+
+	}
+
+	//pull every intermediate pointer and status back out of the target
+	error = data.Read(resultOffset, sizeof(results), &results);
+
+	//check if the results could be read
+	if (!NT_SUCCESS(error)) {
+
+		//unable to read the result block, tell the user why
+		throw MonoInternalsException(_T("Unable to read fused injection results: ") + GetNTErrorString(error));
+
+	}
+
+	//the root domain never changes, so cache it for any later single calls
+	if (results.domain != 0) {
+
+		this->cachedDomain = reinterpret_cast<MonoDomain*>(results.domain);
+
+	}
+
+	//check if the stub bailed out part way through the chain
+	if (results.stage != FUSED_STAGE_COMPLETE || results.openStatus != MONO_IMAGE_OK) {
+
+		//report the same error the single call for that stage would have
+		throwFusedError(results, nameSpace, className, methodName);
+
+	}
+
+	//the method ran, but threw an exception that mono caught for us
+	if (results.exception != 0) {
+
+		//unhandled managed exception, tell the user where the exception object lives
+		throw MonoInternalsException(_T("Invoked method threw an exception: MonoObject at ") + ToHex(results.exception) + _T("."));
+
+	}
+
+	return reinterpret_cast<MonoObject*>(results.result);
+
+}
+
+//throws the same error the matching single-call wrapper would throw, for a fused stub that bailed out early
+void MonoInternals::throwFusedError(const FusedInjectionResult& results, const std::string& nameSpace, const std::string& className, const std::string& methodName) {
+
+	//mono_assembly_open can fail with a status even if it returned something
+	if (results.openStatus != MONO_IMAGE_OK) {
+
+		//assembly failed to be loaded, convert the error code to a string and throw it up
+		throw MonoInternalsException(_T("Unable to retrieve assembly: " + toString(results.openStatus)));
+
+	}
+
+	switch (results.stage) {
+
+		//mono_get_root_domain returned null
+		case FUSED_STAGE_ROOT_DOMAIN: {
+			throw MonoInternalsException(_T("Unable to acquire root mono domain: Returned domain is null."));
+		}
+
+		//mono_assembly_open returned null with MONO_IMAGE_OK
+		case FUSED_STAGE_ASSEMBLY_OPEN: {
+			throw MonoInternalsException(_T("Unable to retrieve assembly: " + toString(results.openStatus)));
+		}
+
+		//mono_assembly_get_image returned null
+		case FUSED_STAGE_GET_IMAGE: {
+			throw MonoInternalsException(_T("Unable to generate image from assembly: Returned image is null."));
+		}
+
+		//mono_class_from_name returned null
+		case FUSED_STAGE_CLASS_FROM_NAME: {
+			throw MonoInternalsException("Unable to retrieve class \"" + nameSpace + "." + className + "\": Class could not be found.");
+		}
+
+		//mono_class_get_method_from_name returned null
+		case FUSED_STAGE_METHOD_FROM_NAME: {
+			throw MonoInternalsException("Unable to retrieve the method \"" + methodName + "\": Method could not be found.");
+		}
+
+		//the stub never started, or crashed part way through mono_runtime_invoke
+		default: {
+			throw MonoInternalsException("Fused injection stub stopped unexpectedly at stage " + std::to_string(results.stage) + ".");
+		}
+
+	}
+
+}
+
 std::wstring MonoInternals::toString(MonoImageOpenStatus code) {
 
 	std::wstring s = _T("Unknown");
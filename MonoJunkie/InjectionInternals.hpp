@@ -52,6 +52,38 @@ typedef MonoMethod* (MONO_FUNCTION *mono_class_get_method_from_name_t)(MonoClass
 //MonoObject* mono_runtime_invoke (MonoMethod* method, void* obj, void** params, MonoObject** exc)
 typedef MonoObject* (MONO_FUNCTION *mono_runtime_invoke_t)(MonoMethod*, void*, void**, MonoObject**);
 
+//stages of the fused bootstrap stub, written into FusedInjectionResult::stage before each call is made
+#define FUSED_STAGE_NONE 0
+#define FUSED_STAGE_ROOT_DOMAIN 1
+#define FUSED_STAGE_ASSEMBLY_OPEN 2
+#define FUSED_STAGE_GET_IMAGE 3
+#define FUSED_STAGE_CLASS_FROM_NAME 4
+#define FUSED_STAGE_METHOD_FROM_NAME 5
+#define FUSED_STAGE_RUNTIME_INVOKE 6
+#define FUSED_STAGE_COMPLETE 7
+
+//Result block filled in by the fused bootstrap stub inside the target process. Every pointer is stored as 64-bit, so the layout is the same for 32-bit and 64-bit targets.
+struct FusedInjectionResult {
+
+	//intermediate pointers returned by each mono call
+	uint64_t domain = 0;
+	uint64_t assembly = 0;
+	uint64_t image = 0;
+	uint64_t targetClass = 0;
+	uint64_t targetMethod = 0;
+
+	//object returned by mono_runtime_invoke, and the exception it caught (if any)
+	uint64_t result = 0;
+	uint64_t exception = 0;
+
+	//status passed out by mono_assembly_open
+	MonoImageOpenStatus openStatus = MONO_IMAGE_OK;
+
+	//last stage the stub reached (FUSED_STAGE_*). Anything but FUSED_STAGE_COMPLETE means the chain bailed out at that call.
+	int32_t stage = FUSED_STAGE_NONE;
+
+};
+
 //Class that wraps all the low level details of any RPC calls.
 class MonoInternals {
 
@@ -82,6 +114,9 @@ private:
 	//converts a MonoImageOpenStatus to a string
 	std::wstring toString(MonoImageOpenStatus);
 
+	//throws the same error the matching single-call wrapper would throw, for a fused stub that bailed out early
+	void throwFusedError(const FusedInjectionResult&, const std::string&, const std::string&, const std::string&);
+
 public:
 
 	//Initialize and cleanup RPCs for the given process.
@@ -107,4 +142,9 @@ public:
 	//If any exception is thrown, the resulting MonoObject will be null.
 	MonoObject* mono_runtime_invoke(MonoMethod*, void*, void**, MonoObject**);
 
+	//Runs mono_get_root_domain, mono_assembly_open, mono_assembly_get_image, mono_class_from_name, mono_class_get_method_from_name and mono_runtime_invoke
+	//back to back inside the target from a single generated stub, so the whole injection costs one round trip instead of six.
+	//Every intermediate pointer and status is passed out in the given FusedInjectionResult. Throws if the invoked method threw a managed exception.
+	MonoObject* mono_inject_fused(const std::string&, const std::string&, const std::string&, const std::string&, FusedInjectionResult&);
+
 };
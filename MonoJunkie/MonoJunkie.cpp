@@ -16,6 +16,7 @@ void InjectAssembly(Configuration& configuration) {
 	//output injection configuration
 	std::wcout << _T("Attempting to inject ") << configuration.assemblyFileName << _T(" into ") << configuration.targetProcessEXE << _T("...") << std::endl;
 	std::wcout << _T("Mono DLL: ") << configuration.monoDLLFileName << std::endl;
+	std::wcout << _T("Mode: ") << (configuration.fusedMode ? _T("fused") : _T("standard")) << std::endl;
 
 	//vector of found process IDs matching the given exeName
 	std::vector<DWORD> foundPIDs;
@@ -50,6 +51,29 @@ void InjectAssembly(Configuration& configuration) {
 				//Create mono internals class which handles acquiring all RPCs
 				MonoInternals internals(targetProcess, configuration.monoDLLFileName);
 
+				//check if the whole chain should run inside the target in a single round trip
+				if (configuration.fusedMode) {
+
+					//every intermediate pointer and status is passed back out in here
+					FusedInjectionResult results;
+
+					//load the assembly and call the target method from one stub
+					internals.mono_inject_fused(configuration.assemblyPath, configuration.targetNamespace, configuration.targetClass, configuration.targetMethod, results);
+
+					//output addresses for debugging purposes
+					__LOG_ADDRESS(_T("Mono Domain"), reinterpret_cast<MonoDomain*>(results.domain));
+					__LOG_ADDRESS(_T("Assembly"), reinterpret_cast<MonoAssembly*>(results.assembly));
+					__LOG_ADDRESS(_T("Image"), reinterpret_cast<MonoImage*>(results.image));
+					__LOG_ADDRESS(_T("Class"), reinterpret_cast<MonoClass*>(results.targetClass));
+					__LOG_ADDRESS(_T("Method"), reinterpret_cast<MonoMethod*>(results.targetMethod));
+
+					//Done! output injection success
+					std::wcout << _T("Injection complete. Called ") << configuration.targetNamespace << _T("::") << configuration.targetClass << _T(".") << configuration.targetMethod << _T("().") << std::endl;
+
+					return;
+
+				}
+
 				//Retrieve root app domain
 				MonoDomain* domain = internals.mono_get_root_domain();
 
@@ -256,6 +280,26 @@ Configuration ParseCommandLine(int argc, wchar_t** argv) {
 
 					}
 
+				} else if (optionName == _T("mode")) {
+
+					//check which injection mode the user asked for
+					if (argument == _T("fused")) {
+
+						//run the whole injection chain from a single stub
+						parsedConfiguration.fusedMode = true;
+
+					} else if (argument == _T("standard")) {
+
+						//one remote call per mono function
+						parsedConfiguration.fusedMode = false;
+
+					} else {
+
+						//unknown mode, flag an error
+						parsedConfiguration.onError(_T("Unknown injection mode \"") + argument + _T("\". Expected \"standard\" or \"fused\"."));
+
+					}
+
 				} else {
 
 					//invalid option, flag an error
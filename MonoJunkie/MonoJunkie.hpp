@@ -6,7 +6,7 @@
 #include <tchar.h>
 #include "Exceptions.hpp"
 
-#define COMMAND_LINE_USAGE _T("MonoJunkie -dll <dll name> -namespace <namespace name> -class <class name> -method <method name> -exe <exe name> [-mdll <mono dll name>]")
+#define COMMAND_LINE_USAGE _T("MonoJunkie -dll <dll name> -namespace <namespace name> -class <class name> -method <method name> -exe <exe name> [-mdll <mono dll name>] [-mode <standard|fused>]")
 
 //We wrap all strings in this class for two reasons:
 //First, Mono expects UTF-8 narrow character strings (UTF-8 const char*).
@@ -124,6 +124,9 @@ struct Configuration {
 	//path/filename of the Mono DLL in the target process
 	ConfigurationString monoDLLFileName;
 
+	//if true, the whole injection chain runs inside the target from a single stub instead of one remote call per mono function
+	bool fusedMode = false;
+
 	//set optional configuration parameters
 	Configuration() {
 